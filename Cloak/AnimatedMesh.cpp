@@ -1,9 +1,18 @@
 #include "AnimatedMesh.h"
 
+#include "PoseCache.h"
+#include "SkinningKeyframeCache.h"
+
 #define DEFAULT_TEXTURE_PATH "../data/textures/"
 
-AnimatedMesh::AnimatedMesh() : DrawableObject(kDrawableTypeAnimatedMesh)
+AnimatedMesh::AnimatedMesh() : DrawableObject(kDrawableTypeAnimatedMesh), m_drawDescriptorSet(VK_NULL_HANDLE), m_cullIndex(0), m_firstDrawCommand(0),
+	mPaletteFormat(kPaletteFormatMatrix4x4), mMaxWeightsPerVertex(0),
+	mAnimation(nullptr), mSkinningKeyframes(nullptr), mAnimationTime(0.f), mBakedAnimation(nullptr), mAnimationTimeOffset(0.f), mSharedPose(nullptr),
+	mPaletteChanged(false), mComputeSkinning(false), mLodPolicy(nullptr), mLodLevel(0), mLodFrozen(false), mLodForceUpdate(true), mLodFrameCounter(0),
+	mLodPendingMillis(0), mLodHistoryValid(false)
 {
+	static U32 sLodPhase = 0;
+	mLodPhase = sLodPhase++;
 }
 
 
@@ -15,6 +24,8 @@ bool AnimatedMesh::loadModel(const std::string &filename)
 {
 	mSubMeshes.clear();
 	mBones.clear();
+	mModelName = filename;
+	mMaxWeightsPerVertex = 0;
 
 	U32 boneCount = 0;
 	U32 meshCount = 0;
@@ -53,41 +64,377 @@ bool AnimatedMesh::loadModel(const std::string &filename)
 	}
 	assert(boneCount == mBones.size());
 	assert(meshCount == mSubMeshes.size());
+
+	//bones nobody else is parented to can be dropped at low animation LODs
+	mLodBoneMask.assign(mBones.size(), 0);
+	for (const Bone &bone : mBones)
+	{
+		if (bone.parentId >= 0)
+		{
+			mLodBoneMask[bone.parentId] = 1;
+		}
+	}
+	packPalette();
 	return true;
 }
 
-void AnimatedMesh::setAnimation(Animation *animation)
+void AnimatedMesh::setAnimation(Animation *animation, SkinningKeyframeCache *keyframeCache)
 {
 	assert(animation->getBoneCount() == mBones.size());
 	mAnimation = animation;
+	mAnimationTime = 0.f;
+	onTransformChanged(); //the bounding box comes from the clip
+	mSkinningKeyframes = keyframeCache->acquireKeyframes(this);
+}
+
+void AnimatedMesh::setBakedAnimation(const BakedAnimation *bakedAnimation, float timeOffset)
+{
+	assert(bakedAnimation == nullptr || bakedAnimation->boneCount == mBones.size());
+	mBakedAnimation = bakedAnimation;
+	mAnimationTimeOffset = timeOffset;
 }
 
 
+void AnimatedMesh::setSharedPose(SharedPose *sharedPose)
+{
+	mSharedPose = sharedPose;
+}
+
+void AnimatedMesh::setAnimationLodPolicy(const AnimationLodPolicy *lodPolicy)
+{
+	mLodPolicy = lodPolicy;
+	mLodLevel = 0;
+	mLodForceUpdate = true;
+	mLodHistoryValid = false;
+}
+
+void AnimatedMesh::updateLod(bool isVisible, float screenRadius)
+{
+	if (!mLodPolicy)
+	{
+		return;
+	}
+
+	bool frozen = !isVisible && mLodPolicy->getFreezeOffscreen();
+	if (mLodFrozen && !frozen)
+	{
+		//coming back on screen, catch up right away
+		mLodForceUpdate = true;
+	}
+	mLodFrozen = frozen;
+
+	U32 lodLevel = mLodPolicy->selectLevel(screenRadius);
+	if (lodLevel != mLodLevel)
+	{
+		mLodLevel = lodLevel;
+		mLodHistoryValid = false;
+	}
+}
+
 void AnimatedMesh::update(U32 elapsedMillis)
 {
+	mPaletteChanged = false;
+	mLodStats.reset();
+
+	//baked animations are evaluated entirely in the vertex shader, shared poses by the PoseCache
+	if (!mAnimation || mBakedAnimation || mSharedPose)
+	{
+		return;
+	}
+
+	const U32 boneCount = (U32)mBones.size();
+	mLodStats.instanceCount = 1;
+	if (!mLodPolicy)
+	{
+		evaluatePose(elapsedMillis, nullptr);
+		mLodStats.evaluatedInstances = 1;
+		mLodStats.bonesEvaluated = boneCount;
+		return;
+	}
+
+	//keep the clock running while skipped so the pose is right when we evaluate again
+	mLodPendingMillis += elapsedMillis;
+	if (mLodFrozen)
+	{
+		mLodStats.frozenInstances = 1;
+		mLodStats.bonesSkipped = boneCount;
+		return;
+	}
+
+	const AnimationLodLevel &level = mLodPolicy->getLevel(mLodLevel);
+	U32 lodFrame = (mLodFrameCounter++ + mLodPhase) % level.updateInterval;
+	if (lodFrame == 0 || mLodForceUpdate)
+	{
+		const std::vector<U8> *boneMask = level.skipLeafBones ? &mLodBoneMask : nullptr;
+		evaluatePose(mLodPendingMillis, boneMask);
+		mLodPendingMillis = 0;
+		mLodForceUpdate = false;
+
+		if (level.extrapolate)
+		{
+			mLodPrevPalette.swap(mLodLastPalette);
+			mLodLastPalette = mPalette;
+			mLodHistoryValid = mLodPrevPalette.size() == mPalette.size();
+		}
+
+		U32 bonesEvaluated = boneCount;
+		if (boneMask)
+		{
+			bonesEvaluated = (U32)std::count(boneMask->begin(), boneMask->end(), 1);
+		}
+		mLodStats.evaluatedInstances = 1;
+		mLodStats.bonesEvaluated = bonesEvaluated;
+		mLodStats.bonesSkipped = boneCount - bonesEvaluated;
+	}
+	else if (level.extrapolate && mLodHistoryValid)
+	{
+		//continue along the last update's motion instead of evaluating the skeleton
+		float t = lodFrame / (float)level.updateInterval;
+		SkinningPalette::extrapolate(mPaletteFormat, mLodLastPalette.data(), mLodPrevPalette.data(), t, boneCount, mPalette.data());
+		mPaletteChanged = true;
+		mLodStats.extrapolatedInstances = 1;
+		mLodStats.bonesSkipped = boneCount;
+	}
+	else
+	{
+		mLodStats.heldInstances = 1;
+		mLodStats.bonesSkipped = boneCount;
+	}
+}
+
+void AnimatedMesh::evaluatePose(U32 elapsedMillis, const std::vector<U8> *boneMask)
+{
+	mAnimationTime = mAnimation->wrapTime(mAnimationTime + elapsedMillis / 1000.f);
+	sampleSkinningKeyframes(mAnimationTime, mPaletteFormat, mPalette.data(), boneMask);
+	mPaletteChanged = true;
+}
+
+void AnimatedMesh::setPaletteFormat(PaletteFormat paletteFormat)
+{
+	mPaletteFormat = paletteFormat;
+	mLodHistoryValid = false;
+	packPalette();
+}
+
+void AnimatedMesh::packPalette()
+{
+	const U32 boneCount = (U32)mBones.size();
+	mPalette.resize(SkinningPalette::getStride(mPaletteFormat) * boneCount);
+	if (mSkinningKeyframes)
+	{
+		sampleSkinningKeyframes(mAnimationTime, mPaletteFormat, mPalette.data());
+		return;
+	}
+
+	//bind pose until a clip is bound
+	const U32 stride = SkinningPalette::getStride(mPaletteFormat);
+	for (U32 i = 0; i < boneCount; i++)
+	{
+		SkinningPalette::packDualQuaternion(mPaletteFormat, glm::vec4(0.f, 0.f, 0.f, 1.f), glm::vec4(0.f), &mPalette[i * stride]);
+	}
+}
+
+void AnimatedMesh::getWorldBoundingSphere(glm::vec3 &centerOut, float &radiusOut)
+{
+	Animation::AABoundingBox bounds = { glm::vec3(0.f), glm::vec3(0.f) };
+	if (mAnimation)
+	{
+		bounds = mAnimation->getMaxBounds();
+	}
+	glm::vec3 localCenter = (bounds.min + bounds.max) * 0.5f;
+	float localRadius = glm::length(bounds.max - bounds.min) * 0.5f;
+
+	centerOut = glm::vec3(buildModelMatrix() * glm::vec4(localCenter, 1.f));
+	radiusOut = localRadius * glm::max(mScale.x, glm::max(mScale.y, mScale.z));
+}
+
+void AnimatedMesh::getWorldBounds(glm::vec3 &minOut, glm::vec3 &maxOut)
+{
+	Animation::AABoundingBox bounds = { glm::vec3(0.f), glm::vec3(0.f) };
+	if (mSharedPose)
+	{
+		bounds = mAnimation->getBounds(mSharedPose->animationTime);
+	}
+	else if (mBakedAnimation)
+	{
+		//the playback position only exists on the GPU
+		bounds = mAnimation->getMaxBounds();
+	}
+	else if (mAnimation)
+	{
+		bounds = mAnimation->getBounds(mAnimationTime);
+	}
+	transformBounds(bounds, minOut, maxOut);
+}
+
+void AnimatedMesh::getBoundingBox(glm::vec3 &minOut, glm::vec3 &maxOut)
+{
+	Animation::AABoundingBox bounds = { glm::vec3(0.f), glm::vec3(0.f) };
 	if (mAnimation)
 	{
-		mAnimation->update(elapsedMillis);
-		const Animation::FrameSkeleton &skeleton = mAnimation->getSkeleton();
-		for (U32 i = 0; i < skeleton.bones.size(); i++)
+		bounds = mAnimation->getMaxBounds();
+	}
+	transformBounds(bounds, minOut, maxOut);
+}
+
+void AnimatedMesh::transformBounds(const Animation::AABoundingBox &bounds, glm::vec3 &minOut, glm::vec3 &maxOut)
+{
+	glm::vec3 localCenter = (bounds.min + bounds.max) * 0.5f;
+	glm::vec3 localExtents = (bounds.max - bounds.min) * 0.5f;
+
+	glm::mat4 modelMatrix = buildModelMatrix();
+	glm::mat3 rotationScale(modelMatrix);
+	glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(localCenter, 1.f));
+	glm::vec3 extents = glm::abs(rotationScale[0]) * localExtents.x + glm::abs(rotationScale[1]) * localExtents.y
+		+ glm::abs(rotationScale[2]) * localExtents.z;
+	minOut = center - extents;
+	maxOut = center + extents;
+}
+
+void AnimatedMesh::bakeSkinningPalettes(std::vector<glm::mat4> &palettesOut) const
+{
+	assert(mAnimation);
+	const U32 frameCount = mAnimation->getFrameCount();
+	const U32 boneCount = (U32)mBones.size();
+	palettesOut.resize(frameCount * boneCount);
+	for (U32 frame = 0; frame < frameCount; frame++)
+	{
+		buildBoneMatrices(mAnimation->getFrameSkeleton(frame), &palettesOut[frame * boneCount]);
+	}
+}
+
+void AnimatedMesh::sampleSkinningKeyframes(float animationTime, PaletteFormat format, glm::vec4 *pPaletteOut, const std::vector<U8> *boneMask) const
+{
+	assert(mSkinningKeyframes);
+	int frame0, frame1;
+	float blendWeight;
+	mAnimation->getFrameBlend(animationTime, frame0, frame1, blendWeight);
+
+	const U32 boneCount = mSkinningKeyframes->boneCount;
+	const glm::vec4 *keyframe0 = &mSkinningKeyframes->dualQuaternions[frame0 * boneCount * 2];
+	const glm::vec4 *keyframe1 = &mSkinningKeyframes->dualQuaternions[frame1 * boneCount * 2];
+	const U32 stride = SkinningPalette::getStride(format);
+	for (U32 i = 0; i < boneCount; i++)
+	{
+		glm::vec4 *pBoneOut = &pPaletteOut[i * stride];
+		if (boneMask && !(*boneMask)[i])
 		{
-			const Animation::SkeletonBone &bone = skeleton.bones[i];
-		
-			glm::mat4 boneTranslation = glm::translate(glm::mat4(), bone.position);
-			glm::mat4 boneRotation = glm::mat4_cast(bone.orientation);
-			mBoneMatrices[i] = (boneTranslation * boneRotation) * mBones[i].inverseBindMatrix;
+			int parentId = mBones[i].parentId;
+			if (parentId >= 0)
+			{
+				std::copy(&pPaletteOut[parentId * stride], &pPaletteOut[(parentId + 1) * stride], pBoneOut);
+			}
+			else
+			{
+				SkinningPalette::packDualQuaternion(format, glm::vec4(0.f, 0.f, 0.f, 1.f), glm::vec4(0.f), pBoneOut);
+			}
+			continue;
 		}
+
+		const glm::vec4 &real0 = keyframe0[i * 2];
+		const glm::vec4 &real1 = keyframe1[i * 2];
+		//take the short way around
+		float weight1 = glm::dot(real0, real1) < 0.f ? -blendWeight : blendWeight;
+		glm::vec4 real = real0 * (1.f - blendWeight) + real1 * weight1;
+		glm::vec4 dual = keyframe0[i * 2 + 1] * (1.f - blendWeight) + keyframe1[i * 2 + 1] * weight1;
+
+		float invLength = 1.f / glm::length(real);
+		SkinningPalette::packDualQuaternion(format, real * invLength, dual * invLength, pBoneOut);
 	}
 }
 
-std::vector<AnimatedSubMesh>& AnimatedMesh::getSubMeshes()
+bool AnimatedMesh::skinPositions(std::vector<glm::vec3> &positionsOut) const
 {
-	return mSubMeshes;
+	if (mBakedAnimation)
+	{
+		return false;
+	}
+
+	const PaletteFormat format = mSharedPose ? mSharedPose->paletteFormat : mPaletteFormat;
+	const glm::vec4 *pPalette = mSharedPose ? mSharedPose->palette.data() : mPalette.data();
+	positionsOut.clear();
+	for (const AnimatedSubMesh &subMesh : mSubMeshes)
+	{
+		for (const AnimatedMeshVertex &vertex : subMesh.vertices)
+		{
+			positionsOut.push_back(SkinningPalette::skinPosition(format, pPalette, vertex.position, vertex.bone_weights, vertex.bone_indices));
+		}
+	}
+	return true;
+}
+
+glm::vec4 AnimatedMesh::getAnimationParams() const
+{
+	if (!mBakedAnimation)
+	{
+		return glm::vec4(0.f);
+	}
+	return glm::vec4(mAnimationTimeOffset, (float)mBakedAnimation->frameRate,
+		(float)mBakedAnimation->frameCount, (float)mBakedAnimation->boneCount);
+}
+
+void AnimatedMesh::buildBoneMatrices(const Animation::FrameSkeleton &skeleton, glm::mat4 *pMatricesOut, const std::vector<U8> *boneMask) const
+{
+	for (U32 i = 0; i < skeleton.bones.size(); i++)
+	{
+		if (boneMask && !(*boneMask)[i])
+		{
+			//skipped bones move rigidly with their parent, which always comes first
+			int parentId = mBones[i].parentId;
+			pMatricesOut[i] = parentId >= 0 ? pMatricesOut[parentId] : glm::mat4();
+			continue;
+		}
+		const Animation::SkeletonBone &bone = skeleton.bones[i];
+
+		glm::mat4 boneTranslation = glm::translate(glm::mat4(), bone.position);
+		glm::mat4 boneRotation = glm::mat4_cast(bone.orientation);
+		pMatricesOut[i] = (boneTranslation * boneRotation) * mBones[i].inverseBindMatrix;
+	}
+}
+
+void AnimatedMesh::addTexturesToAtlas(TextureAtlas *atlas) const
+{
+	for (const AnimatedSubMesh &subMesh : mSubMeshes)
+	{
+		glm::vec2 texcoordMin(std::numeric_limits<float>::max());
+		glm::vec2 texcoordMax(-std::numeric_limits<float>::max());
+		for (const AnimatedMeshVertex &vertex : subMesh.vertices)
+		{
+			texcoordMin = glm::min(texcoordMin, vertex.texcoord);
+			texcoordMax = glm::max(texcoordMax, vertex.texcoord);
+		}
+		atlas->addTexture(subMesh.textureName, texcoordMin, texcoordMax);
+	}
+}
+
+void AnimatedMesh::applyTextureAtlas(const TextureAtlas &atlas)
+{
+	AnimatedSubMesh merged;
+	merged.textureName = atlas.getName();
+	for (const AnimatedSubMesh &subMesh : mSubMeshes)
+	{
+		const glm::vec4 transform = atlas.getTexcoordTransform(subMesh.textureName);
+		const U32 baseVertex = (U32)merged.vertices.size();
+		assert(baseVertex + subMesh.vertices.size() <= 0x10000);
+		for (AnimatedMeshVertex vertex : subMesh.vertices)
+		{
+			vertex.texcoord = vertex.texcoord * glm::vec2(transform) + glm::vec2(transform.z, transform.w);
+			merged.vertices.push_back(vertex);
+		}
+		for (U16 index : subMesh.indices)
+		{
+			merged.indices.push_back((U16)(baseVertex + index));
+		}
+	}
+	mSubMeshes.clear();
+	mSubMeshes.push_back(merged);
+	//merged geometry can't share pool ranges with unmerged instances of the same model
+	mModelName += "@" + atlas.getName();
 }
 
-std::vector<glm::mat4>& AnimatedMesh::getBoneMatrices()
+std::vector<AnimatedSubMesh>& AnimatedMesh::getSubMeshes()
 {
-	return mBoneMatrices;
+	return mSubMeshes;
 }
 
 struct BoneWeight
@@ -181,6 +528,7 @@ void AnimatedMesh::readSubMesh(std::ifstream & file, U32 fileLength)
 	for (unsigned int i = 0; i < vertexList.size(); i++) {
 		VertexInfo& vertInfo = vertexList[i];
 		assert(vertInfo.weightCount <= 4);
+		mMaxWeightsPerVertex = std::max(mMaxWeightsPerVertex, (U32)vertInfo.weightCount);
 		AnimatedMeshVertex vertex;
 		vertex.position = glm::vec3(0);
 		vertex.normal = glm::vec3(0);
@@ -258,5 +606,4 @@ void AnimatedMesh::readBone(std::ifstream & file, U32 fileLength)
 	glm::mat4 bindMatrix = boneTranslation * boneRotation;
 	bone.inverseBindMatrix = glm::inverse(bindMatrix);
 	mBones.push_back(bone);
-	mBoneMatrices.push_back(glm::mat4());
 }
\ No newline at end of file
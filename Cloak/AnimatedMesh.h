@@ -3,27 +3,64 @@
 #include "stdafx.h"
 
 #include "Animation.h"
+#include "AnimationLod.h"
 #include "DrawableObject.h"
 #include "geometry.h"
 #include "graphics_resources.h"
+#include "SkinningPalette.h"
+#include "TextureAtlas.h"
 
 struct AnimatedSubMesh {
 	std::vector<AnimatedMeshVertex> vertices;
 	std::vector<U16> indices;
 	std::string textureName;
 
+	//range in GraphicsContext's geometry pool, shared by every instance of the model
+	std::string geometryName;
+	S32 vertexOffset;
+	U32 firstIndex;
+
 	//Vulkan handles
-	GpuBuffer vertexBuffer;
-	GpuBuffer indexBuffer;
+	GpuBuffer vertexBuffer; //compute skinning input only, everything else draws from the pool
 	GpuBuffer constantBuffer;
+	//MeshVertex output of the compute skinning pass, one per frame in flight so skinning the next frame doesn't
+	//have to wait for the last one's draws
+	std::vector<GpuBuffer> skinnedVertexBuffers;
+
+	std::vector<VkDescriptorSet> skinningDescriptorSets; //same order as skinnedVertexBuffers
 
 	GpuImage textureImage;
 	VkImageView textureImageView;
 	VkSampler textureSampler;
 
-	VkDescriptorSet descriptorSet;
+	VkDescriptorSet materialDescriptorSet; //set 1, shared with everything else using the texture
+	U32 textureIndex; //into the bindless array, when that's in use
+};
+
+//Skinning palettes for every frame of a clip, stored frame-major in a storage buffer so the
+//vertex shader can pick and blend two frames on its own. Can be shared by any number of meshes
+//that use the same model and clip.
+struct BakedAnimation {
+	U32 frameCount;
+	U32 boneCount;
+	U32 frameRate;
+
+	GpuBuffer paletteBuffer;
 };
 
+//Final skinning transforms for every keyframe of a clip on one model, stored frame-major as unit
+//dual quaternions (two vec4s per bone). Owned by a SkinningKeyframeCache and shared by every mesh that
+//binds the same clip to the same model, so runtime updates only have to blend two keyframes.
+struct SkinningKeyframes {
+	const Animation *animation;
+	std::string modelName;
+	U32 boneCount;
+	std::vector<glm::vec4> dualQuaternions;
+};
+
+struct SharedPose;
+class SkinningKeyframeCache;
+
 class AnimatedMesh : public DrawableObject
 {
 public:
@@ -31,13 +68,64 @@ public:
 	~AnimatedMesh();
 
 	bool loadModel(const std::string & filename);
-	void setAnimation(Animation *animation);
-
+	//the cache bakes the clip's keyframes for this model if nothing else has yet
+	void setAnimation(Animation *animation, SkinningKeyframeCache *keyframeCache);
+	void setBakedAnimation(const BakedAnimation *bakedAnimation, float timeOffset);
+	void setSharedPose(SharedPose *sharedPose);
+	void setAnimationLodPolicy(const AnimationLodPolicy *lodPolicy);
+	void setPaletteFormat(PaletteFormat paletteFormat);
+	//skin once per frame in a compute pass instead of in every vertex shader that draws the mesh
+	void setComputeSkinning(bool computeSkinning) { mComputeSkinning = computeSkinning; }
+	//registers every submesh's texture and texcoord range with an atlas that has yet to be built
+	void addTexturesToAtlas(TextureAtlas *atlas) const;
+	//remaps every submesh into the built atlas and merges them into one, so the whole model is a single draw.
+	//Has to happen before the mesh is handed to the GraphicsContext.
+	void applyTextureAtlas(const TextureAtlas &atlas);
+
+	//picks the animation LOD for the next update
+	void updateLod(bool isVisible, float screenRadius);
 	void update(U32 elapsedMillis);
+	void buildBoneMatrices(const Animation::FrameSkeleton &skeleton, glm::mat4 *pMatricesOut, const std::vector<U8> *boneMask = nullptr) const;
+	void bakeSkinningPalettes(std::vector<glm::mat4> &palettesOut) const;
+	//blends the cached keyframes of the bound clip straight into a palette of the given format, skipped bones follow their parent
+	void sampleSkinningKeyframes(float animationTime, PaletteFormat format, glm::vec4 *pPaletteOut, const std::vector<U8> *boneMask = nullptr) const;
 	std::vector<AnimatedSubMesh>& getSubMeshes();
-	std::vector<glm::mat4>& getBoneMatrices();
+	//bone matrices packed in the palette format, ready for upload
+	const std::vector<glm::vec4>& getPalette() const { return mPalette; }
+	PaletteFormat getPaletteFormat() const { return mPaletteFormat; }
+	bool usesComputeSkinning() const { return mComputeSkinning; }
+	Animation* getAnimation() { return mAnimation; }
+	const Animation* getAnimation() const { return mAnimation; }
+	const BakedAnimation* getBakedAnimation() const { return mBakedAnimation; }
+	SharedPose* getSharedPose() { return mSharedPose; }
+	const std::string& getModelName() const { return mModelName; }
+	U32 getBoneCount() const { return (U32)mBones.size(); }
+	//Every submesh's vertices one after another, in model space and skinned with the palette that gets drawn.
+	//False with baked animation, its pose only exists on the GPU.
+	bool skinPositions(std::vector<glm::vec3> &positionsOut) const;
+	//most bone influences any vertex has, so shaders can skip blending the empty ones
+	U32 getMaxWeightsPerVertex() const { return mMaxWeightsPerVertex; }
+	bool hasPaletteChanged() const { return mPaletteChanged; }
+	const AnimationLodStats& getLodStats() const { return mLodStats; }
+	//0 for leaf bones, which low animation LODs can skip
+	const std::vector<U8>& getLodBoneMask() const { return mLodBoneMask; }
+	void getWorldBoundingSphere(glm::vec3 &centerOut, float &radiusOut);
+	//world space AABB of the current animation frame
+	void getWorldBounds(glm::vec3 &minOut, glm::vec3 &maxOut);
+	//covers every frame of the clip, so the spatial index doesn't churn as the pose changes
+	void getBoundingBox(glm::vec3 &minOut, glm::vec3 &maxOut) override;
+	glm::vec4 getAnimationParams() const;
 
 	GpuBuffer m_animationConstantBuffer;
+	VkDescriptorSet m_drawDescriptorSet; //set 2, object constants and palette for every submesh
+	//Draw secondaries by frame in flight. Compute skinned meshes get one per frame, since each draws that frame's
+	//skinned vertices, everything else shares a single one.
+	std::vector<VkCommandBuffer> m_commandBuffers;
+	//GPU occlusion culling: the late pass draws whatever the early pass missed, laid out like m_commandBuffers
+	std::vector<VkCommandBuffer> m_lateCommandBuffers;
+	std::vector<VkCommandBuffer> m_skinningCommandBuffers; //one per frame in flight, each skins into that frame's output
+	U32 m_cullIndex;
+	U32 m_firstDrawCommand;
 
 private:
 
@@ -51,11 +139,41 @@ private:
 
 	void readSubMesh(std::ifstream &file, U32 fileLength);
 	void readBone(std::ifstream &file, U32 fileLength);
+	void evaluatePose(U32 elapsedMillis, const std::vector<U8> *boneMask);
+	void packPalette();
+	void transformBounds(const Animation::AABoundingBox &bounds, glm::vec3 &minOut, glm::vec3 &maxOut);
 
 	std::vector<AnimatedSubMesh> mSubMeshes;
 	std::vector<Bone> mBones;
-	std::vector<glm::mat4> mBoneMatrices;
+	PaletteFormat mPaletteFormat;
+	std::vector<glm::vec4> mPalette;
+
+	std::string mModelName;
+	U32 mMaxWeightsPerVertex;
 
 	Animation *mAnimation;
+	const SkinningKeyframes *mSkinningKeyframes;
+	float mAnimationTime;
+
+	const BakedAnimation *mBakedAnimation;
+	float mAnimationTimeOffset;
+	SharedPose *mSharedPose;
+
+	bool mPaletteChanged;
+	bool mComputeSkinning;
+
+	//Animation LOD
+	const AnimationLodPolicy *mLodPolicy;
+	U32 mLodLevel;
+	bool mLodFrozen;
+	bool mLodForceUpdate;
+	U32 mLodFrameCounter;
+	U32 mLodPhase; //staggers reduced rate updates across instances
+	U32 mLodPendingMillis;
+	bool mLodHistoryValid;
+	std::vector<U8> mLodBoneMask; //0 for leaf bones
+	std::vector<glm::vec4> mLodLastPalette;
+	std::vector<glm::vec4> mLodPrevPalette;
+	AnimationLodStats mLodStats;
 };
 
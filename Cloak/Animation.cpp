@@ -3,6 +3,8 @@
 
 
 Animation::Animation(void)
+    : mFrameCount(0), mBoneCount(0), mFrameRate(0), mComponentCount(0),
+    mAnimationDuration(0.0f), mFrameDuration(0.0f), mAnimationTime(0.0f)
 {
 }
 
@@ -95,6 +97,13 @@ bool Animation::loadAnimation(const std::string& filename) {
         }
 	}
     mAnimatedSkeleton.bones.assign(mBoneCount, SkeletonBone());
+    if(!mBounds.empty()) {
+        mMaxBounds = mBounds[0];
+        for(size_t i = 1; i < mBounds.size(); i++) {
+            mMaxBounds.min = glm::min(mMaxBounds.min, mBounds[i].min);
+            mMaxBounds.max = glm::max(mMaxBounds.max, mBounds[i].max);
+        }
+    }
     mFrameDuration = 1.0f / (float)mFrameRate;
     mAnimationDuration = mFrameDuration * mFrameCount;
     mAnimationTime = 0.0f;
@@ -165,29 +174,83 @@ void Animation::saveAnimation() {
 void Animation::update(unsigned int elapsedTimeInMillis) {
     if(mFrameCount < 1) return;
 
-    mAnimationTime += (elapsedTimeInMillis / 1000.f);
-    while(mAnimationTime > mAnimationDuration) mAnimationTime -= mAnimationDuration;
-    while(mAnimationTime < 0.0f) mAnimationTime += mAnimationDuration;
+    mAnimationTime = wrapTime(mAnimationTime + (elapsedTimeInMillis / 1000.f));
+    evaluate(mAnimationTime, mAnimatedSkeleton);
+}
+
+void Animation::evaluate(float animationTime, FrameSkeleton& result, const std::vector<U8> *boneMask) const {
+    if(mFrameCount < 1) return;
+
+    int frame0, frame1;
+    float interpolate;
+    getFrameBlend(animationTime, frame0, frame1, interpolate);
+
+    if((int)result.bones.size() != mBoneCount) {
+        result.bones.assign(mBoneCount, SkeletonBone());
+    }
+    InterpolateSkeletons(result, mSkeletons[frame0], mSkeletons[frame1], interpolate, boneMask);
+}
 
+void Animation::getFrameBlend(float animationTime, int &frame0, int &frame1, float &blendWeight) const {
     //Figure out which frame we're on
-    float frameNum = mAnimationTime * (float)mFrameRate;
-    int frame0 = (int)floorf(frameNum);
-    int frame1 = (int)ceilf(frameNum);
+    float frameNum = animationTime * (float)mFrameRate;
+    frame0 = (int)floorf(frameNum);
+    frame1 = (int)ceilf(frameNum);
     frame0 = frame0 % mFrameCount;
     frame1 = frame1 % mFrameCount;
 
-    float interpolate = fmodf(mAnimationTime, mFrameDuration) / mFrameDuration;
-    InterpolateSkeletons(mAnimatedSkeleton, mSkeletons[frame0], mSkeletons[frame1], interpolate);
+    blendWeight = fmodf(animationTime, mFrameDuration) / mFrameDuration;
+}
+
+float Animation::wrapTime(float animationTime) const {
+    if(mAnimationDuration <= 0.0f) return 0.0f;
+
+    while(animationTime > mAnimationDuration) animationTime -= mAnimationDuration;
+    while(animationTime < 0.0f) animationTime += mAnimationDuration;
+    return animationTime;
 }
 
 const Animation::FrameSkeleton& Animation::getSkeleton() const {
 	return mAnimatedSkeleton;
 }
 
+const Animation::FrameSkeleton& Animation::getFrameSkeleton(unsigned int frame) const {
+	return mSkeletons[frame];
+}
+
 int Animation::getBoneCount() const {
 	return mBoneCount;
 }
 
+int Animation::getFrameCount() const {
+	return mFrameCount;
+}
+
+int Animation::getFrameRate() const {
+	return mFrameRate;
+}
+
+float Animation::getDuration() const {
+	return mAnimationDuration;
+}
+
+const Animation::AABoundingBox& Animation::getMaxBounds() const {
+	return mMaxBounds;
+}
+
+Animation::AABoundingBox Animation::getBounds(float animationTime) const {
+	if(mBounds.empty()) return mMaxBounds;
+
+	int frame0, frame1;
+	float blendWeight;
+	getFrameBlend(animationTime, frame0, frame1, blendWeight);
+
+	AABoundingBox bounds;
+	bounds.min = glm::min(mBounds[frame0].min, mBounds[frame1].min);
+	bounds.max = glm::max(mBounds[frame0].max, mBounds[frame1].max);
+	return bounds;
+}
+
 const Animation::BoneInfo& Animation::getBoneInfo(unsigned int index) const {
 	return mBoneInfos[index];
 }
@@ -252,8 +315,10 @@ void Animation::BuildFrameSkeleton(FrameSkeletonList& skeletons, const BoneInfoL
     skeletons.push_back(skeleton);
 }
 
-void Animation::InterpolateSkeletons(FrameSkeleton& result, const FrameSkeleton& skeleton0, const FrameSkeleton& skeleton1, float blendWeight) {
+void Animation::InterpolateSkeletons(FrameSkeleton& result, const FrameSkeleton& skeleton0, const FrameSkeleton& skeleton1, float blendWeight, const std::vector<U8> *boneMask) const {
     for(int i = 0; i < mBoneCount; i++) {
+        if(boneMask && !(*boneMask)[i]) continue;
+
         SkeletonBone& resultBone = result.bones[i];
         const SkeletonBone &bone0 = skeleton0.bones[i];
         const SkeletonBone &bone1 = skeleton1.bones[i];
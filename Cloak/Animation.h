@@ -58,13 +58,25 @@ public:
 	bool loadAnimation(const std::string& filename);
     void saveAnimation();
 	void update(unsigned int elapsedTimeInMillis);
+	void evaluate(float animationTime, FrameSkeleton& result, const std::vector<U8> *boneMask = nullptr) const;
+	float wrapTime(float animationTime) const;
+	//the two keyframes to blend between at animationTime and how far towards frame1 we are
+	void getFrameBlend(float animationTime, int &frame0, int &frame1, float &blendWeight) const;
 	const FrameSkeleton& getSkeleton() const;
+	const FrameSkeleton& getFrameSkeleton(unsigned int frame) const;
 	int getBoneCount() const;
+	int getFrameCount() const;
+	int getFrameRate() const;
+	float getDuration() const;
+	const AABoundingBox& getMaxBounds() const;
+	//bounds of both keyframes blended at animationTime
+	AABoundingBox getBounds(float animationTime) const;
 	const BoneInfo& getBoneInfo(unsigned int index) const;
 
 private:
 	BoneInfoList mBoneInfos;
 	BoundsList mBounds;
+	AABoundingBox mMaxBounds; //union of every frame's bounds
 	BaseFrameList mBaseFrames;
 	FrameDataList mFrames;
 	FrameSkeletonList mSkeletons;
@@ -81,6 +93,6 @@ private:
 	float mAnimationTime;
 
 	void BuildFrameSkeleton(FrameSkeletonList& skeletons, const BoneInfoList& boneInfos, const BaseFrameList& baseFrames, const FrameData& frameData);
-	void InterpolateSkeletons(FrameSkeleton& result, const FrameSkeleton& skeleton0, const FrameSkeleton& skeleton1, float blendWeight);
+	void InterpolateSkeletons(FrameSkeleton& result, const FrameSkeleton& skeleton0, const FrameSkeleton& skeleton1, float blendWeight, const std::vector<U8> *boneMask) const;
 };
 
@@ -0,0 +1,99 @@
+#include "AnimationLod.h"
+
+void AnimationLodStats::reset()
+{
+	instanceCount = 0;
+	evaluatedInstances = 0;
+	extrapolatedInstances = 0;
+	heldInstances = 0;
+	frozenInstances = 0;
+	bonesEvaluated = 0;
+	bonesSkipped = 0;
+}
+
+void AnimationLodStats::accumulate(const AnimationLodStats &other)
+{
+	instanceCount += other.instanceCount;
+	evaluatedInstances += other.evaluatedInstances;
+	extrapolatedInstances += other.extrapolatedInstances;
+	heldInstances += other.heldInstances;
+	frozenInstances += other.frozenInstances;
+	bonesEvaluated += other.bonesEvaluated;
+	bonesSkipped += other.bonesSkipped;
+}
+
+void AnimationLodStats::print(std::ostream &out) const
+{
+	U32 totalBones = bonesEvaluated + bonesSkipped;
+	out << "Animation LOD: " << instanceCount << " instances ("
+		<< evaluatedInstances << " evaluated, "
+		<< extrapolatedInstances << " extrapolated, "
+		<< heldInstances << " held, "
+		<< frozenInstances << " frozen), "
+		<< bonesEvaluated << "/" << totalBones << " bones evaluated";
+	if (totalBones > 0)
+	{
+		out << " (" << (100.f * bonesSkipped / totalBones) << "% saved)";
+	}
+	out << std::endl;
+}
+
+AnimationLodPolicy::AnimationLodPolicy() : mFreezeOffscreen(true)
+{
+}
+
+AnimationLodPolicy::~AnimationLodPolicy()
+{
+}
+
+void AnimationLodPolicy::addLevel(const AnimationLodLevel &level)
+{
+	assert(level.updateInterval > 0);
+	assert(mLevels.empty() || level.minScreenRadius < mLevels.back().minScreenRadius);
+	mLevels.push_back(level);
+}
+
+void AnimationLodPolicy::setFreezeOffscreen(bool freezeOffscreen)
+{
+	mFreezeOffscreen = freezeOffscreen;
+}
+
+U32 AnimationLodPolicy::selectLevel(float screenRadius) const
+{
+	assert(!mLevels.empty());
+	for (U32 i = 0; i < mLevels.size(); i++)
+	{
+		if (screenRadius >= mLevels[i].minScreenRadius)
+		{
+			return i;
+		}
+	}
+	return (U32)mLevels.size() - 1;
+}
+
+const AnimationLodLevel& AnimationLodPolicy::getLevel(U32 index) const
+{
+	return mLevels[index];
+}
+
+U32 AnimationLodPolicy::getLevelCount() const
+{
+	return (U32)mLevels.size();
+}
+
+bool AnimationLodPolicy::getFreezeOffscreen() const
+{
+	return mFreezeOffscreen;
+}
+
+AnimationLodPolicy AnimationLodPolicy::createDefault()
+{
+	AnimationLodPolicy policy;
+	AnimationLodLevel full = { 100.f, 1, false, false };
+	AnimationLodLevel medium = { 30.f, 2, true, true };
+	AnimationLodLevel low = { 0.f, 4, false, true };
+	policy.addLevel(full);
+	policy.addLevel(medium);
+	policy.addLevel(low);
+	return policy;
+}
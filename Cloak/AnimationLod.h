@@ -0,0 +1,51 @@
+#pragma once
+
+#include "stdafx.h"
+
+struct AnimationLodLevel
+{
+	float minScreenRadius;	//projected radius in pixels an instance needs to use this level
+	U32 updateInterval;		//evaluate the skeleton every Nth frame
+	bool extrapolate;		//extrapolate the palette on skipped frames instead of holding the last pose
+	bool skipLeafBones;		//leaf bones follow their parent rigidly instead of being evaluated
+};
+
+struct AnimationLodStats
+{
+	AnimationLodStats() { reset(); }
+
+	void reset();
+	void accumulate(const AnimationLodStats &other);
+	void print(std::ostream &out) const;
+
+	U32 instanceCount;
+	U32 evaluatedInstances;
+	U32 extrapolatedInstances;
+	U32 heldInstances;
+	U32 frozenInstances;
+	U32 bonesEvaluated;
+	U32 bonesSkipped;
+};
+
+//Picks how much animation work an instance gets based on how big it is on screen
+class AnimationLodPolicy
+{
+public:
+	AnimationLodPolicy();
+	~AnimationLodPolicy();
+
+	//levels must be added from the largest screen radius to the smallest
+	void addLevel(const AnimationLodLevel &level);
+	void setFreezeOffscreen(bool freezeOffscreen);
+
+	U32 selectLevel(float screenRadius) const;
+	const AnimationLodLevel& getLevel(U32 index) const;
+	U32 getLevelCount() const;
+	bool getFreezeOffscreen() const;
+
+	static AnimationLodPolicy createDefault();
+
+private:
+	std::vector<AnimationLodLevel> mLevels;
+	bool mFreezeOffscreen;
+};
@@ -86,4 +86,71 @@ const glm::mat4 Camera::getProjectionMatrix()
 	//Y-coordinate fixup because this isn't OpenGL
 	projectionMatrix[1][1] *= -1;
 	return projectionMatrix;
+}
+
+Frustum Camera::getFrustum()
+{
+	Frustum frustum;
+	frustum.extract(getProjectionMatrix() * getViewMatrix());
+	return frustum;
+}
+
+float Camera::getProjectedRadius(const glm::vec3 &center, float radius, float viewportHeight) const
+{
+	float distance = glm::length(center - mPosition);
+	if (distance <= radius)
+	{
+		return viewportHeight;
+	}
+	return (radius / (distance * tanf(mFovY * 0.5f))) * (viewportHeight * 0.5f);
+}
+
+void Frustum::extract(const glm::mat4 &viewProjection)
+{
+	//rows of the combined matrix (glm is column major)
+	glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+	glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+	glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+	glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+	planes[kPlaneLeft] = row3 + row0;
+	planes[kPlaneRight] = row3 - row0;
+	planes[kPlaneBottom] = row3 + row1;
+	planes[kPlaneTop] = row3 - row1;
+	planes[kPlaneNear] = row2; //depth is zero to one
+	planes[kPlaneFar] = row3 - row2;
+
+	for (int i = 0; i < kPlaneCount; i++)
+	{
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+bool Frustum::intersectsSphere(const glm::vec3 &center, float radius) const
+{
+	for (int i = 0; i < kPlaneCount; i++)
+	{
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Frustum::intersectsBox(const glm::vec3 &min, const glm::vec3 &max) const
+{
+	const glm::vec3 center = (min + max) * 0.5f;
+	const glm::vec3 extents = (max - min) * 0.5f;
+	for (int i = 0; i < kPlaneCount; i++)
+	{
+		//projected radius of the box onto the plane normal
+		const glm::vec3 normal(planes[i]);
+		float radius = glm::dot(glm::abs(normal), extents);
+		if (glm::dot(normal, center) + planes[i].w < -radius)
+		{
+			return false;
+		}
+	}
+	return true;
 }
\ No newline at end of file
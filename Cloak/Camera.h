@@ -2,6 +2,28 @@
 
 #include "stdafx.h"
 
+struct Frustum
+{
+	enum Plane
+	{
+		kPlaneLeft = 0,
+		kPlaneRight,
+		kPlaneBottom,
+		kPlaneTop,
+		kPlaneNear,
+		kPlaneFar,
+
+		kPlaneCount
+	};
+
+	//plane normals point inward, xyz = normal, w = distance
+	glm::vec4 planes[kPlaneCount];
+
+	void extract(const glm::mat4 &viewProjection);
+	bool intersectsSphere(const glm::vec3 &center, float radius) const;
+	bool intersectsBox(const glm::vec3 &min, const glm::vec3 &max) const;
+};
+
 class Camera
 {
 public:
@@ -29,6 +51,10 @@ public:
 
 	const glm::mat4 getViewMatrix();
 	const glm::mat4 getProjectionMatrix();
+	Frustum getFrustum();
+
+	//approximate radius in pixels of a world space sphere
+	float getProjectedRadius(const glm::vec3 &center, float radius, float viewportHeight) const;
 private:
 	glm::vec3 mPosition;
 	glm::vec3 mDirection;
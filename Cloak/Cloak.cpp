@@ -5,20 +5,161 @@
 
 #include "AnimatedMesh.h"
 #include "Camera.h"
+#include "Culling.h"
 #include "GraphicsContext.h"
+#include "LooseOctree.h"
 #include "Mesh.h"
+#include "PoseCache.h"
+#include "SkinningKeyframeCache.h"
+#include "SoftwareOcclusion.h"
+#include "StaticBatcher.h"
 
 static Mesh *g_pyramidMesh = nullptr;
 #define BOB_ROWS 10
 #define BOB_COLS 10
 #define BOB_COUNT (BOB_ROWS * BOB_COLS)
 static AnimatedMesh *g_bobLampArray[BOB_COUNT];
+static InstanceCuller g_bobCuller;
+
+//Coarse culling of the scene before the per-frame bounds test
+static LooseOctree g_sceneIndex(glm::vec3(0.f), 256.f, 8);
+static std::unordered_map<DrawableObject*, U32> g_bobIndices;
+//declared ahead of everything that samples from it so it is torn down last
+static SkinningKeyframeCache g_skinningKeyframeCache;
+
+//Bake every frame's skinning palette into a GPU buffer up front and let the vertex shader do all of the
+//animation work, so bobs cost nothing on the CPU per frame. Needs animated_baked.vert compiled to animated_baked_vert.spv.
+#define USE_BAKED_ANIMATION 0
+#if USE_BAKED_ANIMATION
+static BakedAnimation g_bakedBobAnimation;
+#endif
+
+//Quantize each bob's playback phase into this many buckets and evaluate one pose per bucket
+//instead of one per bob. 0 gives every bob its own pose.
+#define ANIMATION_PHASE_BUCKETS 16
+#if ANIMATION_PHASE_BUCKETS
+static PoseCache g_poseCache(ANIMATION_PHASE_BUCKETS);
+#endif
+
+//Palette encoding for bobs skinned from a constant buffer. The compact formats need
+//animated_affine.vert / animated_dq.vert compiled to animated_affine_vert.spv / animated_dq_vert.spv.
+#define BOB_PALETTE_FORMAT kPaletteFormatMatrix4x4
+
+//Skin each bob once per frame in a compute pre-pass and draw the result with a static vertex pipeline,
+//so extra passes over the bobs don't pay for skinning again. Needs skin.comp and static.vert compiled to
+//skin_comp.spv and static_vert.spv. Only works with kPaletteFormatMatrix4x4.
+#define USE_COMPUTE_SKINNING 0
+
+//Let the GPU reject bobs hidden behind other geometry using a Hi-Z pyramid of this frame's depth, in two
+//phases so newly revealed bobs never pop in a frame late. Needs hiz_build.comp and occlusion_cull.comp
+//compiled to hiz_build_comp.spv and occlusion_cull_comp.spv.
+#define USE_OCCLUSION_CULLING 0
+#define BOB_SUBMESH_COUNT 6
+
+//CPU fallback for when GPU occlusion culling is off: the bobs nearest the camera are rasterized
+//into a small depth buffer on worker threads and everything behind them is dropped before submission.
+//Occluders are skinned on the CPU with the palette they're drawn with, so they never cover more than the bob does.
+//Bobs with their own pose only update after culling, so theirs is a frame behind; shared poses are current.
+#define USE_SOFTWARE_OCCLUSION 0
+#define SOFTWARE_OCCLUDER_COUNT 8
+
+//Draw every bob from one shared vertex/index buffer with indirect draws that a compute pass culls and
+//writes each frame, so the CPU only uploads transforms and palettes. Needs gpu_cull.comp, gpu_driven.vert
+//and gpu_driven.frag compiled to gpu_cull_comp.spv, gpu_driven_vert.spv and gpu_driven_frag.spv.
+//Only works with kPaletteFormatMatrix4x4 and without baked animation or compute skinning.
+#define USE_GPU_DRIVEN_RENDERING 0
+
+//Bind every texture once through a descriptor-indexed array and select it per draw with a push constant,
+//so draws no longer split on material. Needs bindless.frag compiled to bindless_frag.spv.
+#define USE_BINDLESS_TEXTURES 0
+
+//Pack the bob's textures into one atlas at load and merge its submeshes, so each bob is a single draw
+//with a single material. Falls back to the separate textures if the atlas doesn't fit.
+#define USE_TEXTURE_ATLAS 0
+#define TEXTURE_ATLAS_MAX_SIZE 2048
+#if USE_TEXTURE_ATLAS
+static TextureAtlas g_bobTextureAtlas("boblamp_atlas");
+#endif
+
+//Record the visible bobs' draws on worker threads every frame instead of replaying the command buffers
+//recorded at load, so what gets drawn is free to change from frame to frame.
+#define USE_PARALLEL_RECORDING 0
+
+//Build each bob's pipeline from skinned.vert specialized for its bone count, weights and palette format instead of
+//the hand-written per-format shaders. Needs skinned.vert compiled to skinned_vert.spv and triangle.frag recompiled.
+#define USE_SHADER_VARIANTS 0
+
+//Scatter pyramids around the bobs as static scenery, merged at load into one batch per material and
+//grid cell so they cost a draw per visible cell instead of one each. Needs static.vert compiled to static_vert.spv.
+#define USE_STATIC_SCENERY 0
+#define STATIC_SCENERY_CELL_SIZE 32.f
+#if USE_STATIC_SCENERY
+static InstanceCuller g_staticBatchCuller;
+#endif
+
+//Reduce animation update rate and bone count for bobs that are small on screen and freeze
+//the ones that are off screen. With phase buckets the LOD is picked per bucket, from its most demanding bob.
+#define ANIMATION_LOD 1
+#if ANIMATION_LOD
+static AnimationLodPolicy g_animationLodPolicy = AnimationLodPolicy::createDefault();
+#endif
+
+//MAILBOX or IMMEDIATE to stop benchmarks being capped at the refresh rate and cut input latency, FIFO to wait for
+//vblank. 0 images is one more than the surface's minimum. A frame rate limit of 0 leaves pacing to the present mode.
+#define PRESENT_MODE VK_PRESENT_MODE_FIFO_KHR
+#define SWAPCHAIN_IMAGE_COUNT 0
+#define FRAME_RATE_LIMIT 0
+
+//Bar graph of the last frames' times in the top left corner, red for anything over budget (60Hz, or the frame rate
+//limit when there is one), so hitches show up as they happen instead of being averaged away in the stats.
+#define SHOW_FRAME_TIME_GRAPH 1
 
 void initScene(GraphicsContext *graphicsContext)
 {
 	g_pyramidMesh = new Mesh();
 
-	bool success = g_pyramidMesh->loadFromObj("../data/meshes/pyramid.obj");
+	bool success = g_pyramidMesh->loadFromObj("../data/models/pyramid.obj");
+
+#if USE_STATIC_SCENERY
+	StaticBatcher staticBatcher(STATIC_SCENERY_CELL_SIZE);
+	for (int i = -16; i < 32; i++)
+	{
+		for (int j = -16; j < 32; j++)
+		{
+			glm::mat4 modelMatrix = glm::translate(glm::mat4(1.f), glm::vec3(i * 4.f, -1.f, j * 4.f));
+			modelMatrix = glm::rotate(modelMatrix, glm::radians((float)(rand() % 360)), glm::vec3(0.f, 1.f, 0.f));
+			modelMatrix = glm::scale(modelMatrix, glm::vec3(0.2f + (rand() % 100) / 500.f));
+			staticBatcher.addMesh(g_pyramidMesh, modelMatrix, "../data/textures/chalet.jpg");
+		}
+	}
+	staticBatcher.build();
+	graphicsContext->createStaticBatches(staticBatcher);
+
+	const std::vector<StaticBatch> &staticBatches = staticBatcher.getBatches();
+	g_staticBatchCuller.resize((U32)staticBatches.size());
+	for (U32 i = 0; i < staticBatches.size(); i++)
+	{
+		g_staticBatchCuller.setBounds(i, staticBatches[i].boundsMin, staticBatches[i].boundsMax);
+	}
+	std::cout << "Batched " << staticBatcher.getMeshCount() << " static meshes into " << staticBatches.size() << " draws" << std::endl;
+#endif
+
+	//the clip holds no playback state, so every bob can share it, and its keyframes once baked
+	Animation *animation = new Animation();
+	animation->loadAnimation("../data/animations/boblamp.md5anim");
+
+#if USE_TEXTURE_ATLAS
+	AnimatedMesh atlasSource;
+	atlasSource.loadModel("../data/models/boblamp.md5mesh");
+	atlasSource.addTexturesToAtlas(&g_bobTextureAtlas);
+	const bool useTextureAtlas = g_bobTextureAtlas.build(TEXTURE_ATLAS_MAX_SIZE);
+	if (useTextureAtlas)
+	{
+		graphicsContext->addTextureSurface(g_bobTextureAtlas.getName(), g_bobTextureAtlas.getSurface());
+		std::cout << "Packed " << g_bobTextureAtlas.getTextureCount() << " bob textures into a " << g_bobTextureAtlas.getSurface()->w << "x"
+			<< g_bobTextureAtlas.getSurface()->h << " atlas" << std::endl;
+	}
+#endif
 
 	int count = 0;
 	for (int i = 0; i < BOB_COLS; i++)
@@ -27,17 +168,48 @@ void initScene(GraphicsContext *graphicsContext)
 		{
 			AnimatedMesh *bob = new AnimatedMesh();
 			bob->loadModel("../data/models/boblamp.md5mesh");
-			Animation *animation = new Animation();
-			animation->loadAnimation("../data/animations/boblamp.md5anim");
-			bob->setAnimation(animation);
+#if USE_TEXTURE_ATLAS
+			if (useTextureAtlas)
+			{
+				bob->applyTextureAtlas(g_bobTextureAtlas);
+			}
+#endif
+			bob->setAnimation(animation, &g_skinningKeyframeCache);
+			bob->setPaletteFormat(BOB_PALETTE_FORMAT);
+			bob->setComputeSkinning(USE_COMPUTE_SKINNING != 0);
 			bob->setPosition(glm::vec3(i * 4, 0.f, j * 4));
 			bob->rotateBy(glm::radians(-90.f), glm::vec3(1.f, 0.f, 0.f));
 			bob->setScale(glm::vec3(0.1f, 0.1f, 0.1f));
+#if USE_BAKED_ANIMATION
+			if (count == 0)
+			{
+				graphicsContext->createBakedAnimation(bob, &g_bakedBobAnimation);
+			}
+			bob->setBakedAnimation(&g_bakedBobAnimation, (rand() % 5000) / 1000.f);
+#elif ANIMATION_PHASE_BUCKETS
+			g_poseCache.acquirePose(bob, rand() % 5000);
+#else
 			bob->update(rand() % 5000);
+#endif
+#if ANIMATION_LOD
+			bob->setAnimationLodPolicy(&g_animationLodPolicy);
+#endif
+#if USE_GPU_DRIVEN_RENDERING
+			graphicsContext->addGpuDrivenMesh(bob);
+#else
 			graphicsContext->createCommandBuffer(bob);
+#endif
+			g_sceneIndex.insert(bob);
+			g_bobIndices[bob] = count;
 			g_bobLampArray[count++] = bob;
 		}
 	}
+#if ANIMATION_PHASE_BUCKETS && !USE_BAKED_ANIMATION
+#if ANIMATION_LOD
+	g_poseCache.setAnimationLodPolicy(&g_animationLodPolicy);
+#endif
+	std::cout << "Sharing " << g_poseCache.getPoses().size() << " poses between " << g_poseCache.getInstanceCount() << " bobs" << std::endl;
+#endif
 }
 
 int main()
@@ -45,7 +217,7 @@ int main()
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
 	const int width = 640;
 	const int height = 480;
-	SDL_Window *window = SDL_CreateWindow("MyWindow", 800, 200, width, height, SDL_WINDOW_SHOWN);
+	SDL_Window *window = SDL_CreateWindow("MyWindow", 800, 200, width, height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
 	assert(window != nullptr);
 
 	SDL_SysWMinfo info;
@@ -74,19 +246,49 @@ int main()
 	camera.setPosition(glm::vec3(BOB_COLS * 2.5, 15.f, BOB_ROWS * 5.f));
 
 	GraphicsContext graphicsContext;
+	graphicsContext.setPresentMode(PRESENT_MODE, SWAPCHAIN_IMAGE_COUNT);
 	graphicsContext.init(GetModuleHandle(NULL), info.info.win.window);
+	graphicsContext.setFrameRateLimit(FRAME_RATE_LIMIT);
+#if SHOW_FRAME_TIME_GRAPH
+	graphicsContext.enableFrameTimeGraph();
+#endif
+#if USE_PARALLEL_RECORDING
+	ThreadPool recordingThreadPool;
+	graphicsContext.enableParallelRecording(&recordingThreadPool);
+#endif
+#if USE_BINDLESS_TEXTURES
+	graphicsContext.enableBindlessTextures();
+#endif
+#if USE_SHADER_VARIANTS
+	graphicsContext.enableShaderVariants();
+#endif
+#if USE_OCCLUSION_CULLING
+	graphicsContext.enableOcclusionCulling(BOB_COUNT, BOB_COUNT * BOB_SUBMESH_COUNT);
+#endif
+#if USE_GPU_DRIVEN_RENDERING
+	graphicsContext.enableGpuDrivenRendering(BOB_COUNT, BOB_COUNT * BOB_SUBMESH_COUNT);
+#endif
 
 	initScene(&graphicsContext);
 
+#if USE_SOFTWARE_OCCLUSION && !USE_OCCLUSION_CULLING
+	ThreadPool threadPool;
+	SoftwareOcclusionCuller softwareOcclusion(256, 128, &threadPool);
+#endif
+
 	SceneConstantBuffer perFrameCB = {};
 	perFrameCB.viewMatrix = camera.getViewMatrix();
 	perFrameCB.projectionMatrix = camera.getProjectionMatrix();
 	perFrameCB.lightDirection = glm::normalize(glm::vec4(0.f, -0.5, 0.5, 0.f));
 	perFrameCB.lightColor = glm::vec4(1.f, 1.f, 1.f, 0.25f);
 
-	U32 lastFrameTime = SDL_GetTicks();
+	const U32 startTime = SDL_GetTicks();
+	U32 lastFrameTime = startTime;
+	U32 lastStatsTime = startTime;
 	bool done = false;
 	while (!done) {
+		//start the frame as late as the GPU allows, so the input below is as fresh as possible once it's on screen
+		graphicsContext.waitForNextFrame();
 		U32 currentFrameTime = SDL_GetTicks();
 		U32 elapsedMillis = currentFrameTime - lastFrameTime;
 
@@ -96,24 +298,167 @@ int main()
 			if (event.type == SDL_QUIT) {
 				done = true;
 			}
+			if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED && event.window.data2 > 0) {
+				camera.setPerspective(45.f, event.window.data1 / (float)event.window.data2, 0.1f, 1000.f);
+				perFrameCB.projectionMatrix = camera.getProjectionMatrix();
+				graphicsContext.resize();
+			}
 			std::cout << "FPS: " << (1000.f / elapsedMillis) << "(" << elapsedMillis << "ms)" << std::endl;
 		}
 
 		camera.moveBy(glm::vec3(elapsedMillis / 100.f, 0.f, 0.f));
 		camera.lookAt(glm::vec3(7.5f, 0.f, 5.f));
 		perFrameCB.viewMatrix = camera.getViewMatrix();
+		perFrameCB.time.x = (currentFrameTime - startTime) / 1000.f;
 
 		graphicsContext.updateSceneConstantBuffer(perFrameCB);
 
+#if ANIMATION_PHASE_BUCKETS && !USE_BAKED_ANIMATION
+		g_poseCache.update(elapsedMillis);
+#if !USE_GPU_DRIVEN_RENDERING
+		for (SharedPose *pose : g_poseCache.getPoses())
+		{
+			if (pose->paletteChanged)
+			{
+				graphicsContext.updateConstantBuffer(pose->palette.data(), pose->palette.size() * sizeof(glm::vec4), pose->animationConstantBuffer.buffer);
+			}
+		}
+#endif
+#endif
+
+		//the octree narrows the scene down to candidates, which are then culled against the current frame's animated bounds
+		const Frustum frustum = camera.getFrustum();
+		std::vector<DrawableObject*> candidates;
+		g_sceneIndex.queryFrustum(frustum, candidates);
+
+		g_bobCuller.resize((U32)candidates.size());
+		for (U32 i = 0; i < candidates.size(); i++)
+		{
+			glm::vec3 boundsMin, boundsMax;
+			static_cast<AnimatedMesh*>(candidates[i])->getWorldBounds(boundsMin, boundsMax);
+			g_bobCuller.setBounds(i, boundsMin, boundsMax);
+		}
+		std::vector<U8> candidateVisibility;
+		g_bobCuller.cull(frustum, candidateVisibility);
+
+#if USE_SOFTWARE_OCCLUSION && !USE_OCCLUSION_CULLING
+		{
+			std::vector<std::pair<float, AnimatedMesh*>> occluders;
+			std::vector<glm::vec3> boundsMins(candidates.size());
+			std::vector<glm::vec3> boundsMaxs(candidates.size());
+			for (U32 i = 0; i < candidates.size(); i++)
+			{
+				AnimatedMesh *bob = static_cast<AnimatedMesh*>(candidates[i]);
+				bob->getWorldBounds(boundsMins[i], boundsMaxs[i]);
+				if (candidateVisibility[i])
+				{
+					occluders.push_back(std::make_pair(glm::length(bob->getPosition() - camera.getPosition()), bob));
+				}
+			}
+			std::sort(occluders.begin(), occluders.end());
+			occluders.resize(std::min<size_t>(occluders.size(), SOFTWARE_OCCLUDER_COUNT));
+
+			softwareOcclusion.beginFrame(camera.getProjectionMatrix() * camera.getViewMatrix());
+			std::vector<glm::vec3> occluderPositions;
+			for (auto &occluder : occluders)
+			{
+				if (!occluder.second->skinPositions(occluderPositions))
+				{
+					continue;
+				}
+				const glm::mat4 modelMatrix = occluder.second->buildModelMatrix();
+				U32 firstVertex = 0;
+				for (const AnimatedSubMesh &subMesh : occluder.second->getSubMeshes())
+				{
+					softwareOcclusion.addOccluder(&occluderPositions[firstVertex], sizeof(glm::vec3), subMesh.indices.data(),
+						(U32)subMesh.indices.size(), modelMatrix);
+					firstVertex += (U32)subMesh.vertices.size();
+				}
+			}
+			softwareOcclusion.rasterizeOccluders();
+			softwareOcclusion.cullBoxes(boundsMins, boundsMaxs, candidateVisibility);
+		}
+#endif
+
+		std::vector<U8> bobVisibility(BOB_COUNT, 0);
+		for (U32 i = 0; i < candidates.size(); i++)
+		{
+			bobVisibility[g_bobIndices[candidates[i]]] = candidateVisibility[i];
+		}
+
+		std::vector<AnimatedMesh*> visibleBobs;
+		AnimationLodStats lodStats;
+#if ANIMATION_PHASE_BUCKETS && !USE_BAKED_ANIMATION
+		lodStats.accumulate(g_poseCache.getLodStats());
+#endif
 		for (int i = 0; i < BOB_COUNT; i++)
 		{
 			AnimatedMesh *bob = g_bobLampArray[i];
+			if (bobVisibility[i])
+			{
+				visibleBobs.push_back(bob);
+			}
+#if ANIMATION_LOD
+			glm::vec3 boundsCenter;
+			float boundsRadius;
+			bob->getWorldBoundingSphere(boundsCenter, boundsRadius);
+			const float screenRadius = camera.getProjectedRadius(boundsCenter, boundsRadius, (float)height);
+#if ANIMATION_PHASE_BUCKETS && !USE_BAKED_ANIMATION
+			//picked up by the next g_poseCache.update
+			g_poseCache.requestLod(bob->getSharedPose(), bobVisibility[i] != 0, screenRadius);
+#else
+			bob->updateLod(bobVisibility[i] != 0, screenRadius);
+#endif
+#endif
 			bob->update(elapsedMillis);
-			graphicsContext.updateConstantBuffer((void *)&bob->buildModelMatrix(), sizeof(ObjectConstantBuffer), bob->m_objectConstantBuffer.buffer);
-			graphicsContext.updateConstantBuffer(bob->getBoneMatrices().data(), bob->getBoneMatrices().size() * sizeof(glm::mat4), bob->m_animationConstantBuffer.buffer);
+			lodStats.accumulate(bob->getLodStats());
+
+#if !USE_GPU_DRIVEN_RENDERING
+			ObjectConstantBuffer objectCB = {};
+			objectCB.modelMatrix = bob->buildModelMatrix();
+			objectCB.animationParams = bob->getAnimationParams();
+			graphicsContext.updateConstantBuffer(&objectCB, sizeof(objectCB), bob->m_objectConstantBuffer.buffer);
+			if (bob->hasPaletteChanged())
+			{
+				graphicsContext.updateConstantBuffer(bob->getPalette().data(), bob->getPalette().size() * sizeof(glm::vec4), bob->m_animationConstantBuffer.buffer);
+			}
+#endif
 		}
 
-		graphicsContext.drawFrame();
+#if USE_GPU_DRIVEN_RENDERING
+		//drawFrame picks up transforms and palettes itself and the GPU does its own culling
+		visibleBobs.clear();
+#endif
+
+#if USE_STATIC_SCENERY
+		std::vector<U8> staticBatchVisibility;
+		std::vector<U32> visibleStaticBatches;
+		g_staticBatchCuller.cull(frustum, staticBatchVisibility);
+		for (U32 i = 0; i < staticBatchVisibility.size(); i++)
+		{
+			if (staticBatchVisibility[i])
+			{
+				visibleStaticBatches.push_back(i);
+			}
+		}
+		graphicsContext.drawFrame(visibleBobs, visibleStaticBatches);
+#else
+		graphicsContext.drawFrame(visibleBobs);
+#endif
+
+		if (currentFrameTime - lastStatsTime >= 1000)
+		{
+			const FrameTiming &frameTiming = graphicsContext.getFrameTiming();
+			std::cout << "Frame: " << frameTiming.frameMillis << "ms, waited " << frameTiming.waitMillis << "ms, " <<
+				frameTiming.latencyMillis << "ms to present" << std::endl;
+#if ANIMATION_LOD
+			lodStats.print(std::cout);
+#endif
+#if USE_SOFTWARE_OCCLUSION && !USE_OCCLUSION_CULLING
+			softwareOcclusion.getStats().print(std::cout);
+#endif
+			lastStatsTime = currentFrameTime;
+		}
 
 		lastFrameTime = currentFrameTime;
 		//Sleep(1); //remove this once we actually have some frame time
@@ -5,4 +5,6 @@
 namespace CloakUtils
 {
 	std::vector<char> readFile(const std::string& filename);
+	//every aspect of the format, which is what barriers on it have to cover
+	VkImageAspectFlags getFormatAspects(VkFormat format);
 };
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "Culling.h"
+
+#include <xmmintrin.h>
+
+InstanceCuller::InstanceCuller() : mInstanceCount(0)
+{
+}
+
+InstanceCuller::~InstanceCuller()
+{
+}
+
+void InstanceCuller::resize(U32 instanceCount)
+{
+	mInstanceCount = instanceCount;
+	U32 paddedCount = (instanceCount + 3) & ~3;
+	mCenterX.assign(paddedCount, 0.f);
+	mCenterY.assign(paddedCount, 0.f);
+	mCenterZ.assign(paddedCount, 0.f);
+	mExtentX.assign(paddedCount, 0.f);
+	mExtentY.assign(paddedCount, 0.f);
+	mExtentZ.assign(paddedCount, 0.f);
+}
+
+void InstanceCuller::setBounds(U32 index, const glm::vec3 &min, const glm::vec3 &max)
+{
+	assert(index < mInstanceCount);
+	glm::vec3 center = (min + max) * 0.5f;
+	glm::vec3 extents = (max - min) * 0.5f;
+	mCenterX[index] = center.x;
+	mCenterY[index] = center.y;
+	mCenterZ[index] = center.z;
+	mExtentX[index] = extents.x;
+	mExtentY[index] = extents.y;
+	mExtentZ[index] = extents.z;
+}
+
+U32 InstanceCuller::cull(const Frustum &frustum, std::vector<U8> &visibleOut) const
+{
+	visibleOut.resize(mInstanceCount);
+
+	//splat every plane once up front
+	__m128 planeX[Frustum::kPlaneCount];
+	__m128 planeY[Frustum::kPlaneCount];
+	__m128 planeZ[Frustum::kPlaneCount];
+	__m128 planeW[Frustum::kPlaneCount];
+	__m128 absPlaneX[Frustum::kPlaneCount];
+	__m128 absPlaneY[Frustum::kPlaneCount];
+	__m128 absPlaneZ[Frustum::kPlaneCount];
+	for (U32 p = 0; p < Frustum::kPlaneCount; p++)
+	{
+		const glm::vec4 &plane = frustum.planes[p];
+		planeX[p] = _mm_set1_ps(plane.x);
+		planeY[p] = _mm_set1_ps(plane.y);
+		planeZ[p] = _mm_set1_ps(plane.z);
+		planeW[p] = _mm_set1_ps(plane.w);
+		absPlaneX[p] = _mm_set1_ps(fabsf(plane.x));
+		absPlaneY[p] = _mm_set1_ps(fabsf(plane.y));
+		absPlaneZ[p] = _mm_set1_ps(fabsf(plane.z));
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	U32 visibleCount = 0;
+	for (U32 i = 0; i < mInstanceCount; i += 4)
+	{
+		__m128 centerX = _mm_loadu_ps(&mCenterX[i]);
+		__m128 centerY = _mm_loadu_ps(&mCenterY[i]);
+		__m128 centerZ = _mm_loadu_ps(&mCenterZ[i]);
+		__m128 extentX = _mm_loadu_ps(&mExtentX[i]);
+		__m128 extentY = _mm_loadu_ps(&mExtentY[i]);
+		__m128 extentZ = _mm_loadu_ps(&mExtentZ[i]);
+
+		//a box is outside if it is fully behind any plane: dot(n, c) + w + dot(|n|, e) < 0
+		__m128 outside = zero;
+		for (U32 p = 0; p < Frustum::kPlaneCount; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], centerX), _mm_mul_ps(planeY[p], centerY)),
+				_mm_add_ps(_mm_mul_ps(planeZ[p], centerZ), planeW[p]));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absPlaneX[p], extentX), _mm_mul_ps(absPlaneY[p], extentY)),
+				_mm_mul_ps(absPlaneZ[p], extentZ));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+		}
+
+		int outsideMask = _mm_movemask_ps(outside);
+		U32 laneCount = std::min(4u, mInstanceCount - i);
+		for (U32 lane = 0; lane < laneCount; lane++)
+		{
+			U8 visible = (outsideMask & (1 << lane)) ? 0 : 1;
+			visibleOut[i + lane] = visible;
+			visibleCount += visible;
+		}
+	}
+	return visibleCount;
+}
\ No newline at end of file
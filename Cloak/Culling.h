@@ -0,0 +1,33 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "Camera.h"
+
+//Frustum culls a flat list of world space AABBs four at a time with SSE.
+//Bounds are kept as structure-of-arrays so each plane test is a handful of packed ops.
+class InstanceCuller
+{
+public:
+	InstanceCuller();
+	~InstanceCuller();
+
+	void resize(U32 instanceCount);
+	void setBounds(U32 index, const glm::vec3 &min, const glm::vec3 &max);
+
+	//visibleOut[i] is 1 if instance i intersects the frustum. Returns the visible count.
+	U32 cull(const Frustum &frustum, std::vector<U8> &visibleOut) const;
+
+	U32 getInstanceCount() const { return mInstanceCount; }
+
+private:
+	U32 mInstanceCount;
+
+	//padded to a multiple of 4, padding boxes are empty
+	std::vector<float> mCenterX;
+	std::vector<float> mCenterY;
+	std::vector<float> mCenterZ;
+	std::vector<float> mExtentX;
+	std::vector<float> mExtentY;
+	std::vector<float> mExtentZ;
+};
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "DescriptorAllocator.h"
+
+DescriptorAllocator::DescriptorAllocator() : mDevice(VK_NULL_HANDLE), mMaxSets(0), mCurrentPool(VK_NULL_HANDLE), mSetsLeft(0)
+{
+}
+
+DescriptorAllocator::~DescriptorAllocator()
+{
+}
+
+void DescriptorAllocator::init(VkDevice device, U32 maxSets, const std::vector<VkDescriptorPoolSize> &poolSizes)
+{
+	mDevice = device;
+	mMaxSets = maxSets;
+	mPoolSizes = poolSizes;
+}
+
+void DescriptorAllocator::registerLayout(VkDescriptorSetLayout layout, const VkDescriptorSetLayoutBinding *pBindings, U32 bindingCount)
+{
+	std::vector<U32> &counts = mLayoutCounts[layout];
+	counts.assign(mPoolSizes.size(), 0);
+	for (U32 i = 0; i < bindingCount; i++)
+	{
+		U32 sizeIndex = 0;
+		while (sizeIndex < mPoolSizes.size() && mPoolSizes[sizeIndex].type != pBindings[i].descriptorType)
+		{
+			sizeIndex++;
+		}
+		//a descriptor type the pools don't hold at all could never be allocated
+		assert(sizeIndex < mPoolSizes.size());
+		counts[sizeIndex] += pBindings[i].descriptorCount;
+		//nor could a set that is bigger than a whole pool
+		assert(counts[sizeIndex] <= mPoolSizes[sizeIndex].descriptorCount);
+	}
+}
+
+void DescriptorAllocator::allocate(VkDescriptorSetLayout layout, VkDescriptorSet *pSetOut)
+{
+	auto counts = mLayoutCounts.find(layout);
+	assert(counts != mLayoutCounts.end());
+	const std::vector<U32> &descriptorCounts = counts->second;
+	if (mCurrentPool == VK_NULL_HANDLE || !fitsCurrentPool(descriptorCounts))
+	{
+		mCurrentPool = grabPool();
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = mCurrentPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	//sets are never freed one at a time, so a pool that has room can't be fragmented either
+	VkResult result = vkAllocateDescriptorSets(mDevice, &allocInfo, pSetOut);
+	assert(result == VK_SUCCESS);
+
+	mSetsLeft--;
+	for (U32 i = 0; i < descriptorCounts.size(); i++)
+	{
+		mDescriptorsLeft[i] -= descriptorCounts[i];
+	}
+}
+
+bool DescriptorAllocator::fitsCurrentPool(const std::vector<U32> &descriptorCounts) const
+{
+	if (mSetsLeft == 0)
+	{
+		return false;
+	}
+	for (U32 i = 0; i < descriptorCounts.size(); i++)
+	{
+		if (descriptorCounts[i] > mDescriptorsLeft[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void DescriptorAllocator::reset()
+{
+	for (VkDescriptorPool pool : mUsedPools)
+	{
+		vkResetDescriptorPool(mDevice, pool, 0);
+		mFreePools.push_back(pool);
+	}
+	mUsedPools.clear();
+	mCurrentPool = VK_NULL_HANDLE;
+}
+
+void DescriptorAllocator::destroy()
+{
+	for (VkDescriptorPool pool : mUsedPools)
+	{
+		vkDestroyDescriptorPool(mDevice, pool, nullptr);
+	}
+	for (VkDescriptorPool pool : mFreePools)
+	{
+		vkDestroyDescriptorPool(mDevice, pool, nullptr);
+	}
+	mUsedPools.clear();
+	mFreePools.clear();
+	mCurrentPool = VK_NULL_HANDLE;
+}
+
+VkDescriptorPool DescriptorAllocator::grabPool()
+{
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	if (!mFreePools.empty())
+	{
+		pool = mFreePools.back();
+		mFreePools.pop_back();
+	}
+	else
+	{
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = (U32)mPoolSizes.size();
+		poolInfo.pPoolSizes = mPoolSizes.data();
+		poolInfo.maxSets = mMaxSets;
+
+		VkResult result = vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &pool);
+		assert(result == VK_SUCCESS);
+	}
+	mUsedPools.push_back(pool);
+
+	mSetsLeft = mMaxSets;
+	mDescriptorsLeft.resize(mPoolSizes.size());
+	for (U32 i = 0; i < mPoolSizes.size(); i++)
+	{
+		mDescriptorsLeft[i] = mPoolSizes[i].descriptorCount;
+	}
+	return pool;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "stdafx.h"
+
+//Hands out descriptor sets from a chain of pools, adding another pool whenever the current one
+//runs dry, so the number of sets isn't capped up front. Not thread safe.
+//Vulkan 1.0 doesn't promise VK_ERROR_OUT_OF_POOL_MEMORY_KHR on an exhausted pool, so what each pool
+//has left is counted here and the next pool is chained before a set would no longer fit.
+class DescriptorAllocator
+{
+public:
+	DescriptorAllocator();
+	~DescriptorAllocator();
+
+	//poolSizes and maxSets describe each pool in the chain, not the total
+	void init(VkDevice device, U32 maxSets, const std::vector<VkDescriptorPoolSize> &poolSizes);
+	//Layouts have to be registered before sets are allocated with them, so their descriptors can be counted
+	void registerLayout(VkDescriptorSetLayout layout, const VkDescriptorSetLayoutBinding *pBindings, U32 bindingCount);
+	void allocate(VkDescriptorSetLayout layout, VkDescriptorSet *pSetOut);
+	//Frees every set at once and keeps the pools for reuse. For per-frame allocators, once the frame's fence has signaled.
+	void reset();
+	void destroy();
+
+	U32 getPoolCount() const { return (U32)(mUsedPools.size() + mFreePools.size()); }
+
+private:
+	VkDescriptorPool grabPool();
+	bool fitsCurrentPool(const std::vector<U32> &descriptorCounts) const;
+
+	VkDevice mDevice;
+	U32 mMaxSets;
+	std::vector<VkDescriptorPoolSize> mPoolSizes;
+	VkDescriptorPool mCurrentPool;
+	U32 mSetsLeft;
+	std::vector<U32> mDescriptorsLeft; //per entry of mPoolSizes, for the current pool
+	std::unordered_map<VkDescriptorSetLayout, std::vector<U32>> mLayoutCounts; //descriptors per entry of mPoolSizes
+	std::vector<VkDescriptorPool> mUsedPools; //includes the current pool
+	std::vector<VkDescriptorPool> mFreePools;
+};
\ No newline at end of file
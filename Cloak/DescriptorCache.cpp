@@ -0,0 +1,156 @@
+#include "DescriptorCache.h"
+
+DescriptorResource makeBufferResource(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	DescriptorResource resource;
+	memset(&resource, 0, sizeof(resource));
+	resource.buffer.buffer = buffer;
+	resource.buffer.offset = offset;
+	resource.buffer.range = range;
+	return resource;
+}
+
+DescriptorResource makeImageResource(VkSampler sampler, VkImageView imageView, VkImageLayout imageLayout)
+{
+	DescriptorResource resource;
+	memset(&resource, 0, sizeof(resource));
+	resource.image.sampler = sampler;
+	resource.image.imageView = imageView;
+	resource.image.imageLayout = imageLayout;
+	return resource;
+}
+
+DescriptorCache::DescriptorCache() : mDevice(VK_NULL_HANDLE), mAllocator(nullptr), mCreateUpdateTemplate(nullptr), mUpdateWithTemplate(nullptr)
+{
+}
+
+DescriptorCache::~DescriptorCache()
+{
+}
+
+void DescriptorCache::init(VkDevice device, DescriptorAllocator *pAllocator, bool useUpdateTemplates)
+{
+	mDevice = device;
+	mAllocator = pAllocator;
+	if (useUpdateTemplates)
+	{
+		mCreateUpdateTemplate = (PFN_vkCreateDescriptorUpdateTemplateKHR)vkGetDeviceProcAddr(device, "vkCreateDescriptorUpdateTemplateKHR");
+		mUpdateWithTemplate = (PFN_vkUpdateDescriptorSetWithTemplateKHR)vkGetDeviceProcAddr(device, "vkUpdateDescriptorSetWithTemplateKHR");
+		if (!mCreateUpdateTemplate || !mUpdateWithTemplate)
+		{
+			mCreateUpdateTemplate = nullptr;
+			mUpdateWithTemplate = nullptr;
+		}
+	}
+}
+
+void DescriptorCache::registerLayout(VkDescriptorSetLayout layout, const VkDescriptorSetLayoutBinding *pBindings, U32 bindingCount)
+{
+	mAllocator->registerLayout(layout, pBindings, bindingCount);
+
+	LayoutInfo &layoutInfo = mLayouts[layout];
+	layoutInfo.bindings.assign(pBindings, pBindings + bindingCount);
+	layoutInfo.updateTemplate = VK_NULL_HANDLE;
+
+	if (!mCreateUpdateTemplate)
+	{
+		return;
+	}
+
+	//resource i lands in binding i, so the template just walks the array
+	std::vector<VkDescriptorUpdateTemplateEntryKHR> entries(bindingCount);
+	for (U32 i = 0; i < bindingCount; i++)
+	{
+		assert(pBindings[i].descriptorCount == 1);
+		entries[i].dstBinding = pBindings[i].binding;
+		entries[i].dstArrayElement = 0;
+		entries[i].descriptorCount = 1;
+		entries[i].descriptorType = pBindings[i].descriptorType;
+		entries[i].offset = i * sizeof(DescriptorResource);
+		entries[i].stride = sizeof(DescriptorResource);
+	}
+
+	VkDescriptorUpdateTemplateCreateInfoKHR templateInfo = {};
+	templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR;
+	templateInfo.descriptorUpdateEntryCount = bindingCount;
+	templateInfo.pDescriptorUpdateEntries = entries.data();
+	templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+	templateInfo.descriptorSetLayout = layout;
+
+	VkResult result = mCreateUpdateTemplate(mDevice, &templateInfo, nullptr, &layoutInfo.updateTemplate);
+	assert(result == VK_SUCCESS);
+}
+
+VkDescriptorSet DescriptorCache::getSet(VkDescriptorSetLayout layout, const DescriptorResource *pResources)
+{
+	auto layoutIt = mLayouts.find(layout);
+	assert(layoutIt != mLayouts.end());
+	const LayoutInfo &layoutInfo = layoutIt->second;
+	const size_t resourceBytes = layoutInfo.bindings.size() * sizeof(DescriptorResource);
+
+	//FNV-1a over the layout handle and the raw resources
+	U64 hash = 14695981039346656037ULL;
+	const U8 *pLayoutBytes = (const U8*)&layout;
+	for (size_t i = 0; i < sizeof(layout); i++)
+	{
+		hash = (hash ^ pLayoutBytes[i]) * 1099511628211ULL;
+	}
+	const U8 *pResourceBytes = (const U8*)pResources;
+	for (size_t i = 0; i < resourceBytes; i++)
+	{
+		hash = (hash ^ pResourceBytes[i]) * 1099511628211ULL;
+	}
+
+	auto range = mSets.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second.layout == layout && memcmp(it->second.resources.data(), pResources, resourceBytes) == 0)
+		{
+			return it->second.set;
+		}
+	}
+
+	CachedSet cachedSet;
+	cachedSet.layout = layout;
+	cachedSet.resources.assign(pResources, pResources + layoutInfo.bindings.size());
+	mAllocator->allocate(layout, &cachedSet.set);
+	writeSet(layoutInfo, cachedSet.set, pResources);
+	mSets.insert(std::make_pair(hash, cachedSet));
+	return cachedSet.set;
+}
+
+void DescriptorCache::writeSet(const LayoutInfo &layoutInfo, VkDescriptorSet set, const DescriptorResource *pResources)
+{
+	if (layoutInfo.updateTemplate != VK_NULL_HANDLE)
+	{
+		mUpdateWithTemplate(mDevice, set, layoutInfo.updateTemplate, pResources);
+		return;
+	}
+
+	std::vector<VkWriteDescriptorSet> descriptorWrites(layoutInfo.bindings.size());
+	for (size_t i = 0; i < descriptorWrites.size(); i++)
+	{
+		const VkDescriptorSetLayoutBinding &binding = layoutInfo.bindings[i];
+		VkWriteDescriptorSet &write = descriptorWrites[i];
+		write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = binding.binding;
+		write.descriptorType = binding.descriptorType;
+		write.descriptorCount = 1;
+		switch (binding.descriptorType)
+		{
+		case VK_DESCRIPTOR_TYPE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+		case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+		case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+		case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+			write.pImageInfo = &pResources[i].image;
+			break;
+		default:
+			write.pBufferInfo = &pResources[i].buffer;
+			break;
+		}
+	}
+	vkUpdateDescriptorSets(mDevice, (U32)descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+}
\ No newline at end of file
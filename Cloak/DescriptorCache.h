@@ -0,0 +1,57 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "DescriptorAllocator.h"
+
+//What one binding points at. Arrays of these are handed straight to an update template,
+//so build them with the make functions below, which zero the unused bytes for hashing.
+union DescriptorResource
+{
+	VkDescriptorBufferInfo buffer;
+	VkDescriptorImageInfo image;
+};
+
+DescriptorResource makeBufferResource(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+DescriptorResource makeImageResource(VkSampler sampler, VkImageView imageView, VkImageLayout imageLayout);
+
+//Long-lived descriptor sets keyed by their layout and the resources bound to them. Asking twice for the
+//same combination hands back the same set, and only the first request allocates or writes anything.
+//Writes go through one update template per layout when VK_KHR_descriptor_update_template is available.
+class DescriptorCache
+{
+public:
+	DescriptorCache();
+	~DescriptorCache();
+
+	//Without templates, sets are written with vkUpdateDescriptorSets instead
+	void init(VkDevice device, DescriptorAllocator *pAllocator, bool useUpdateTemplates);
+	//Layouts have to be registered before sets are asked for. Only single-descriptor bindings are supported.
+	void registerLayout(VkDescriptorSetLayout layout, const VkDescriptorSetLayoutBinding *pBindings, U32 bindingCount);
+	//pResources holds one entry per binding, in the order they were registered
+	VkDescriptorSet getSet(VkDescriptorSetLayout layout, const DescriptorResource *pResources);
+
+	U32 getSetCount() const { return (U32)mSets.size(); }
+
+private:
+	struct LayoutInfo
+	{
+		std::vector<VkDescriptorSetLayoutBinding> bindings;
+		VkDescriptorUpdateTemplateKHR updateTemplate;
+	};
+	struct CachedSet
+	{
+		VkDescriptorSetLayout layout;
+		std::vector<DescriptorResource> resources;
+		VkDescriptorSet set;
+	};
+
+	void writeSet(const LayoutInfo &layoutInfo, VkDescriptorSet set, const DescriptorResource *pResources);
+
+	VkDevice mDevice;
+	DescriptorAllocator *mAllocator;
+	PFN_vkCreateDescriptorUpdateTemplateKHR mCreateUpdateTemplate; //null when templates aren't used
+	PFN_vkUpdateDescriptorSetWithTemplateKHR mUpdateWithTemplate;
+	std::unordered_map<VkDescriptorSetLayout, LayoutInfo> mLayouts;
+	std::unordered_multimap<U64, CachedSet> mSets; //keyed by a hash of the layout and resources
+};
\ No newline at end of file
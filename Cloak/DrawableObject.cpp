@@ -1,32 +1,40 @@
 #include "DrawableObject.h"
 
+#include "LooseOctree.h"
+
 
 
 DrawableObject::DrawableObject(DrawableType type)
-	: mType(type), mPosition(0, 0, 0), mOrientation(0, 0, 0, 1)
+	: mType(type), mPosition(0, 0, 0), mOrientation(0, 0, 0, 1), mScale(1, 1, 1), mSpatialIndex(nullptr), mSpatialNode(-1)
 {
-	m_commandBuffer = VK_NULL_HANDLE;
 }
 
 
 DrawableObject::~DrawableObject()
 {
+	if (mSpatialIndex)
+	{
+		mSpatialIndex->remove(this);
+	}
 }
 
 
 void DrawableObject::moveBy(const glm::vec3 & deltaXYZ)
 {
 	mPosition += deltaXYZ;
+	onTransformChanged();
 }
 
 void DrawableObject::rotateBy(float angle, const glm::vec3 & axis)
 {
 	mOrientation = glm::angleAxis(angle, axis) * mOrientation;
+	onTransformChanged();
 }
 
 void DrawableObject::scaleBy(const glm::vec3 &scale)
 {
 	mScale *= scale;
+	onTransformChanged();
 }
 
 glm::mat4 DrawableObject::buildModelMatrix()
@@ -38,3 +46,17 @@ glm::mat4 DrawableObject::buildModelMatrix()
 	modelMatrix = glm::scale(modelMatrix, mScale);
 	return modelMatrix;
 }
+
+void DrawableObject::getBoundingBox(glm::vec3 &minOut, glm::vec3 &maxOut)
+{
+	minOut = mPosition;
+	maxOut = mPosition;
+}
+
+void DrawableObject::onTransformChanged()
+{
+	if (mSpatialIndex)
+	{
+		mSpatialIndex->update(this);
+	}
+}
\ No newline at end of file
@@ -4,9 +4,12 @@
 
 #include "graphics_resources.h"
 
+class LooseOctree;
+
 class DrawableObject
 {
 	friend class GraphicsContext;
+	friend class LooseOctree;
 public:
 	enum DrawableType
 	{
@@ -17,14 +20,14 @@ public:
 	};
 
 	DrawableObject(DrawableType type);
-	~DrawableObject();
+	virtual ~DrawableObject();
 
 	//absolute transforms
-	void setPosition(const glm::vec3 &position) { mPosition = position; }
+	void setPosition(const glm::vec3 &position) { mPosition = position; onTransformChanged(); }
 	const glm::vec3& getPosition() { return mPosition; }
-	void setOrientation(const glm::quat &orientation) { mOrientation = orientation; }
+	void setOrientation(const glm::quat &orientation) { mOrientation = orientation; onTransformChanged(); }
 	const glm::quat& getOrientation() { return mOrientation; }
-	void setScale(const glm::vec3& scale) { mScale = scale; }
+	void setScale(const glm::vec3& scale) { mScale = scale; onTransformChanged(); }
 	const glm::vec3& getScale() { return mScale; }
 
 	//relative transforms
@@ -34,6 +37,9 @@ public:
 
 	glm::mat4 buildModelMatrix();
 
+	//world space box that covers the object no matter what it's doing, used by the spatial index
+	virtual void getBoundingBox(glm::vec3 &minOut, glm::vec3 &maxOut);
+
 	GpuBuffer m_objectConstantBuffer;
 
 protected:
@@ -42,6 +48,12 @@ protected:
 	glm::quat mOrientation;
 	glm::vec3 mScale;
 
-	VkCommandBuffer m_commandBuffer;
+	//keeps the spatial index in sync with the transform
+	void onTransformChanged();
+
+	LooseOctree *mSpatialIndex;
+	int mSpatialNode;
+	glm::vec3 mSpatialMin; //bounds the object was indexed with
+	glm::vec3 mSpatialMax;
 };
 
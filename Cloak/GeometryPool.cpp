@@ -0,0 +1,97 @@
+#include "GeometryPool.h"
+
+GeometryPool::GeometryPool(U32 vertexCapacity, U32 indexCapacity) : mVertexAllocator(vertexCapacity), mIndexAllocator(indexCapacity)
+{
+}
+
+GeometryPool::~GeometryPool()
+{
+}
+
+bool GeometryPool::acquire(const std::string &name, U32 vertexCount, U32 indexCount, GeometryRange *pRangeOut, bool *pCreatedOut)
+{
+	auto existing = mEntries.find(name);
+	if (existing != mEntries.end())
+	{
+		assert(existing->second.range.vertexCount == vertexCount && existing->second.range.indexCount == indexCount);
+		existing->second.refCount++;
+		*pRangeOut = existing->second.range;
+		*pCreatedOut = false;
+		return true;
+	}
+
+	const U32 firstVertex = mVertexAllocator.allocate(vertexCount);
+	if (firstVertex == OffsetAllocator::kInvalidOffset)
+	{
+		return false;
+	}
+	const U32 firstIndex = mIndexAllocator.allocate(indexCount);
+	if (firstIndex == OffsetAllocator::kInvalidOffset)
+	{
+		mVertexAllocator.free(firstVertex);
+		return false;
+	}
+
+	Entry entry;
+	entry.range.firstVertex = firstVertex;
+	entry.range.vertexCount = vertexCount;
+	entry.range.firstIndex = firstIndex;
+	entry.range.indexCount = indexCount;
+	entry.refCount = 1;
+	mEntries[name] = entry;
+
+	*pRangeOut = entry.range;
+	*pCreatedOut = true;
+	return true;
+}
+
+void GeometryPool::release(const std::string &name)
+{
+	auto entry = mEntries.find(name);
+	assert(entry != mEntries.end());
+	if (--entry->second.refCount == 0)
+	{
+		mVertexAllocator.free(entry->second.range.firstVertex);
+		mIndexAllocator.free(entry->second.range.firstIndex);
+		mEntries.erase(entry);
+	}
+}
+
+const GeometryRange& GeometryPool::getRange(const std::string &name) const
+{
+	auto entry = mEntries.find(name);
+	assert(entry != mEntries.end());
+	return entry->second.range;
+}
+
+void GeometryPool::defragment(std::vector<OffsetAllocator::Move> &vertexMovesOut, std::vector<OffsetAllocator::Move> &indexMovesOut)
+{
+	mVertexAllocator.defragment(vertexMovesOut);
+	mIndexAllocator.defragment(indexMovesOut);
+
+	std::unordered_map<U32, U32> vertexRemap;
+	for (const OffsetAllocator::Move &move : vertexMovesOut)
+	{
+		vertexRemap[move.srcOffset] = move.dstOffset;
+	}
+	std::unordered_map<U32, U32> indexRemap;
+	for (const OffsetAllocator::Move &move : indexMovesOut)
+	{
+		indexRemap[move.srcOffset] = move.dstOffset;
+	}
+
+	for (auto &entry : mEntries)
+	{
+		GeometryRange &range = entry.second.range;
+		auto vertexMove = vertexRemap.find(range.firstVertex);
+		if (vertexMove != vertexRemap.end())
+		{
+			range.firstVertex = vertexMove->second;
+		}
+		auto indexMove = indexRemap.find(range.firstIndex);
+		if (indexMove != indexRemap.end())
+		{
+			range.firstIndex = indexMove->second;
+		}
+	}
+}
\ No newline at end of file
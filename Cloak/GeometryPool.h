@@ -0,0 +1,46 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "OffsetAllocator.h"
+
+struct GeometryRange
+{
+	U32 firstVertex;
+	U32 vertexCount;
+	U32 firstIndex;
+	U32 indexCount;
+};
+
+//Bookkeeping for the shared vertex and index buffers every mesh draws from, so draws only differ in
+//vertexOffset/firstIndex and the buffers can stay bound. Ranges are named and reference counted so
+//every instance of a model shares one copy. GraphicsContext owns the buffers and moves the data.
+class GeometryPool
+{
+public:
+	GeometryPool(U32 vertexCapacity, U32 indexCapacity);
+	~GeometryPool();
+
+	//Adds a reference to the named range, allocating it if it doesn't exist yet. pCreatedOut says whether the
+	//caller has to upload the data. Returns false if either buffer has no free range big enough.
+	bool acquire(const std::string &name, U32 vertexCount, U32 indexCount, GeometryRange *pRangeOut, bool *pCreatedOut);
+	void release(const std::string &name);
+	const GeometryRange& getRange(const std::string &name) const;
+
+	//Packs both buffers and updates every range. Moves are in elements, not bytes.
+	void defragment(std::vector<OffsetAllocator::Move> &vertexMovesOut, std::vector<OffsetAllocator::Move> &indexMovesOut);
+
+	const OffsetAllocator& getVertexAllocator() const { return mVertexAllocator; }
+	const OffsetAllocator& getIndexAllocator() const { return mIndexAllocator; }
+
+private:
+	struct Entry
+	{
+		GeometryRange range;
+		U32 refCount;
+	};
+
+	OffsetAllocator mVertexAllocator;
+	OffsetAllocator mIndexAllocator;
+	std::unordered_map<std::string, Entry> mEntries;
+};
\ No newline at end of file
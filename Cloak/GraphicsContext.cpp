@@ -2,6 +2,7 @@
 
 #include "geometry.h"
 #include "CloakUtils.h"
+#include "PoseCache.h"
 
 #define VMA_DEBUG_PRINT 0
 #define VMA_IMPLEMENTATION
@@ -13,6 +14,27 @@
 		std::cerr << "Error in " << __FILE__ << ":" << __LINE__ << "calling " << #func_call << "\n\treturned " << resultToString(result) << '\n'; \
 }
 
+//Size of the shared geometry buffers, in vertices and 16 bit indices
+static const U32 kGeometryPoolVertexCount = 262144;
+static const U32 kGeometryPoolIndexCount = 786432;
+
+//How many frames the CPU can record ahead of the GPU
+static const U32 kFramesInFlight = 2;
+//Room each frame has for staging constant buffer updates
+static const VkDeviceSize kUploadBufferSize = 4 * 1024 * 1024;
+
+//Frame time graph, one bar per frame, in the top left corner
+static const U32 kFrameTimeGraphWidth = 256;
+static const U32 kFrameTimeGraphHeight = 64;
+static const U32 kFrameTimeGraphBarWidth = 2;
+static const U32 kFrameTimeGraphMargin = 8;
+static const float kFrameTimeGraphMaxMillis = 50.f; //what a full height bar stands for
+
+//Pipeline cache kept between runs, next to the executable's working directory
+static const char *kPipelineCacheFilename = "pipeline_cache.bin";
+//Background threads for pipelines that are built on demand
+static const U32 kPipelineCompileThreadCount = 2;
+
 static VkBool32 debugCallback(VkDebugReportFlagsEXT flags,
 	VkDebugReportObjectTypeEXT objType,
 	U64 obj,
@@ -26,8 +48,28 @@ static VkBool32 debugCallback(VkDebugReportFlagsEXT flags,
 	return VK_FALSE;
 }
 
-GraphicsContext::GraphicsContext() : mFrameCount(0)
+GraphicsContext::GraphicsContext() : mFrameCount(0), mBakedPipelineLayout(VK_NULL_HANDLE), mBakedPipeline(VK_NULL_HANDLE),
+	mGeometryPool(kGeometryPoolVertexCount, kGeometryPoolIndexCount),
+	mSkinningDescriptorSetLayout(VK_NULL_HANDLE), mSkinningPipelineLayout(VK_NULL_HANDLE), mSkinningPipeline(VK_NULL_HANDLE),
+	mStaticPipelineLayout(VK_NULL_HANDLE), mStaticPipeline(VK_NULL_HANDLE), mHasAsyncCompute(false),
+	mOcclusionCulling(false), mMaxCullInstances(0), mMaxDrawCommands(0), mCullInstanceCount(0), mDrawCommandCount(0), mFrameCullInstanceCount(0), mHiZMipCount(0),
+	mGpuDriven(false), mMaxGpuInstances(0), mMaxGpuDrawRecords(0),
+	mMaxGpuPaletteMatrices(0), mGpuDrawRecordCount(0), mGpuPaletteMatrixCount(0),
+	mRecordingThreadPool(nullptr), mBindlessTextures(false), mBindlessDescriptorSetLayout(VK_NULL_HANDLE),
+	mBindlessDescriptorPool(VK_NULL_HANDLE), mBindlessDescriptorSet(VK_NULL_HANDLE), mBindlessTextureCount(0),
+	mHasUpdateTemplates(false), mHasPhysicalDeviceProperties2(false), mHasDescriptorIndexing(false), mBakedPipelineRequest(-1),
+	mShaderVariants(false), mLightingPath(kLightingPathDiffuseAmbient), mFrameGraphDirty(true), mDepthResource(kInvalidRenderGraphResource),
+	mSwapchain(VK_NULL_HANDLE), mRequestedPresentMode(VK_PRESENT_MODE_FIFO_KHR), mRequestedImageCount(0), mSwapchainDirty(false),
+	mSwapchainUsage(0), mStaticDrawDescriptorSet(VK_NULL_HANDLE), mFrameRateLimit(0), mFrameStarted(false), mFrameTimeGraph(false),
+	mFrameTimeHistoryIndex(0)
 {
+	mFrameTiming = {};
+	for (U32 i = 0; i < kPaletteFormatCount; i++)
+	{
+		mPalettePipelineLayouts[i] = VK_NULL_HANDLE;
+		mPalettePipelines[i] = VK_NULL_HANDLE;
+		mPalettePipelineRequests[i] = -1;
+	}
 }
 
 GraphicsContext::~GraphicsContext()
@@ -41,19 +83,21 @@ void GraphicsContext::init(HINSTANCE hinstance, HWND hwnd)
 	selectPhysicalDevice();
 	createLogicalDevice();
 	createMemoryAllocator();
+	mPipelineManager.init(mDevice, mPhysicalDeviceProperties, kPipelineCacheFilename, kPipelineCompileThreadCount);
+	mShaderLibrary.init(mDevice);
 	createSurface(hinstance, hwnd);
 	createSwapchain();
 	createImageViews();
-	createDepthResources();
+	selectDepthFormat();
 	createRenderPass();
+	createDescriptorPool();
 	createDescriptorSetLayout();
 	createGraphicsPipeline();
-	createFramebuffers();
 	createTextureSampler();
+	createSemaphores();
 	createUniformBuffer();
-	createDescriptorPool();
+	createGeometryPool();
 	createCommandBuffers();
-	createSemaphores();
 }
 
 void GraphicsContext::createInstance()
@@ -74,7 +118,15 @@ void GraphicsContext::createInstance()
 	instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	
 	const std::vector<const char *> validationLayers = { "VK_LAYER_LUNARG_standard_validation" };
-	const std::vector<const char *> enabledExtensions = { "VK_KHR_surface", "VK_KHR_win32_surface", "VK_EXT_debug_report" };
+	std::vector<const char *> enabledExtensions = { "VK_KHR_surface", "VK_KHR_win32_surface", "VK_EXT_debug_report" };
+	for (VkExtensionProperties &extension : extensions)
+	{
+		if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+		{
+			enabledExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+			mHasPhysicalDeviceProperties2 = true;
+		}
+	}
 	if (gEnableValidationLayers)
 	{
 		assert(checkValidationLayerSupport(validationLayers));
@@ -158,21 +210,112 @@ void GraphicsContext::createLogicalDevice()
 		std::cout << "\t- Sparse Binding" << std::endl;
 	}
 
-	VkDeviceQueueCreateInfo deviceQueueInfo = {};
-	deviceQueueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	deviceQueueInfo.queueFamilyIndex = mQueueFamilyIndex;
-	float queuePriorities[] = { 1.f };
-	deviceQueueInfo.pQueuePriorities = queuePriorities;
-	deviceQueueInfo.queueCount = 1;
+	//Prefer a dedicated compute family for async compute, then a second queue in the graphics family.
+	//With neither, compute work is recorded into the graphics command buffer.
+	mComputeQueueFamilyIndex = mQueueFamilyIndex;
+	U32 computeQueueIndex = 0;
+	for (U32 i = 0; i < queueFamilyCount; i++)
+	{
+		VkQueueFlags flags = queueFamilyProperties[i].queueFlags;
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && queueFamilyProperties[i].queueCount > 0)
+		{
+			mComputeQueueFamilyIndex = i;
+			break;
+		}
+	}
+	if (mComputeQueueFamilyIndex == mQueueFamilyIndex && queueFamilyProperties[mQueueFamilyIndex].queueCount > 1)
+	{
+		computeQueueIndex = 1;
+	}
+	mHasAsyncCompute = mComputeQueueFamilyIndex != mQueueFamilyIndex || computeQueueIndex != 0;
+	std::cout << (mHasAsyncCompute ? "Using async compute on queue family " : "No async compute queue, sharing queue family ")
+		<< mComputeQueueFamilyIndex << std::endl;
+
+	float queuePriorities[] = { 1.f, 1.f };
+	std::array<VkDeviceQueueCreateInfo, 2> deviceQueueInfos = {};
+	deviceQueueInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	deviceQueueInfos[0].queueFamilyIndex = mQueueFamilyIndex;
+	deviceQueueInfos[0].pQueuePriorities = queuePriorities;
+	deviceQueueInfos[0].queueCount = computeQueueIndex + 1;
+	deviceQueueInfos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	deviceQueueInfos[1].queueFamilyIndex = mComputeQueueFamilyIndex;
+	deviceQueueInfos[1].pQueuePriorities = queuePriorities;
+	deviceQueueInfos[1].queueCount = 1;
+
+	//only turn on what we use, and only where it's there
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(mPhysicalDevice, &supportedFeatures);
+	mEnabledFeatures = {};
+	mEnabledFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+	mEnabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	mEnabledFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	mEnabledFeatures.shaderSampledImageArrayDynamicIndexing = supportedFeatures.shaderSampledImageArrayDynamicIndexing;
+
+	U32 extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(mPhysicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(mPhysicalDevice, nullptr, &extensionCount, extensions.data());
+	auto isExtensionAvailable = [&extensions](const char *extensionName)
+	{
+		for (VkExtensionProperties &extension : extensions)
+		{
+			if (strcmp(extension.extensionName, extensionName) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	};
+	std::vector<const char*> enabledExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	if (isExtensionAvailable(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME))
+	{
+		enabledExtensions.push_back(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+		mHasUpdateTemplates = true;
+	}
+	std::cout << (mHasUpdateTemplates ? "Writing descriptor sets with update templates" : "No descriptor update templates, writing sets directly") << std::endl;
+
+	const void *pDeviceInfoNext = nullptr;
+#ifdef VK_EXT_descriptor_indexing
+	//bindless textures only need partially bound arrays they can write to while bound
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+	descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	if (mHasPhysicalDeviceProperties2 && isExtensionAvailable(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)
+		&& isExtensionAvailable(VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+	{
+		auto pfnGetPhysicalDeviceFeatures2KHR = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(mInstance,
+			"vkGetPhysicalDeviceFeatures2KHR");
+		VkPhysicalDeviceFeatures2KHR features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+		features2.pNext = &descriptorIndexingFeatures;
+		pfnGetPhysicalDeviceFeatures2KHR(mPhysicalDevice, &features2);
+		mHasDescriptorIndexing = descriptorIndexingFeatures.descriptorBindingPartiallyBound &&
+			descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind;
+	}
+	if (mHasDescriptorIndexing)
+	{
+		descriptorIndexingFeatures = {};
+		descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+		descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		pDeviceInfoNext = &descriptorIndexingFeatures;
+		enabledExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+	}
+#endif
 
 	VkDeviceCreateInfo deviceInfo = {};
 	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	deviceInfo.queueCreateInfoCount = 1;
-	deviceInfo.pQueueCreateInfos = &deviceQueueInfo;
+	deviceInfo.pNext = pDeviceInfoNext;
+	deviceInfo.queueCreateInfoCount = mComputeQueueFamilyIndex != mQueueFamilyIndex ? 2 : 1;
+	deviceInfo.pQueueCreateInfos = deviceQueueInfos.data();
+	deviceInfo.pEnabledFeatures = &mEnabledFeatures;
+	deviceInfo.enabledExtensionCount = (U32)enabledExtensions.size();
+	deviceInfo.ppEnabledExtensionNames = enabledExtensions.data();
 	result = vkCreateDevice(mPhysicalDevice, &deviceInfo, nullptr, &mDevice);
 	assert(checkResult(result));
 
 	vkGetDeviceQueue(mDevice, mQueueFamilyIndex, 0, &mQueue);
+	vkGetDeviceQueue(mDevice, mComputeQueueFamilyIndex, computeQueueIndex, &mComputeQueue);
 
 	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
 	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -180,6 +323,10 @@ void GraphicsContext::createLogicalDevice()
 	commandPoolCreateInfo.queueFamilyIndex = mQueueFamilyIndex;
 	result = vkCreateCommandPool(mDevice, &commandPoolCreateInfo, nullptr, &mCommandPool);
 	assert(checkResult(result));
+
+	commandPoolCreateInfo.queueFamilyIndex = mComputeQueueFamilyIndex;
+	result = vkCreateCommandPool(mDevice, &commandPoolCreateInfo, nullptr, &mComputeCommandPool);
+	assert(checkResult(result));
 }
 
 void GraphicsContext::createMemoryAllocator()
@@ -229,13 +376,31 @@ void GraphicsContext::createSwapchain()
 	VkSurfaceCapabilitiesKHR surfaceCapabilities;
 	result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(mPhysicalDevice, mSurface, &surfaceCapabilities);
 	assert(checkResult(result));
-	uint32_t desiredImages = surfaceCapabilities.minImageCount + 1;
+	uint32_t desiredImages = mRequestedImageCount > 0 ? mRequestedImageCount : surfaceCapabilities.minImageCount + 1;
+	desiredImages = std::max(desiredImages, surfaceCapabilities.minImageCount);
 	if (surfaceCapabilities.maxImageCount > 0
 		&& desiredImages > surfaceCapabilities.maxImageCount) {
 		desiredImages = surfaceCapabilities.maxImageCount;
 	}
 	mSwapchainExtent = surfaceCapabilities.currentExtent;
 
+	//FIFO is the only mode every surface has to support
+	U32 presentModeCount = 0;
+	result = vkGetPhysicalDeviceSurfacePresentModesKHR(mPhysicalDevice, mSurface, &presentModeCount, nullptr);
+	assert(checkResult(result));
+	std::vector<VkPresentModeKHR> presentModes(presentModeCount);
+	result = vkGetPhysicalDeviceSurfacePresentModesKHR(mPhysicalDevice, mSurface, &presentModeCount, presentModes.data());
+	assert(checkResult(result));
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	if (std::find(presentModes.begin(), presentModes.end(), mRequestedPresentMode) != presentModes.end())
+	{
+		presentMode = mRequestedPresentMode;
+	}
+	else
+	{
+		std::cout << "Present mode " << mRequestedPresentMode << " isn't supported, using FIFO" << std::endl;
+	}
+
 	VkSwapchainCreateInfoKHR swapchainInfo = {};
 	swapchainInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
 	swapchainInfo.surface = mSurface;
@@ -243,17 +408,127 @@ void GraphicsContext::createSwapchain()
 	swapchainInfo.imageFormat = mSurfaceFormat.format;
 	swapchainInfo.imageColorSpace = mSurfaceFormat.colorSpace;
 	swapchainInfo.imageExtent = mSwapchainExtent;
-	swapchainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	//the frame time graph gets copied straight in, where the surface allows it
+	mSwapchainUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+	swapchainInfo.imageUsage = mSwapchainUsage;
 	swapchainInfo.preTransform = surfaceCapabilities.currentTransform;
 	swapchainInfo.imageArrayLayers = 1;
 	swapchainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	swapchainInfo.queueFamilyIndexCount = 0;
 	swapchainInfo.pQueueFamilyIndices = nullptr;
-	swapchainInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	swapchainInfo.presentMode = presentMode;
 	swapchainInfo.clipped = true;
 	swapchainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-	result = vkCreateSwapchainKHR(mDevice, &swapchainInfo, nullptr, &mSwapchain);
+	//lets the driver hand resources straight over from the swapchain being replaced
+	swapchainInfo.oldSwapchain = mSwapchain;
+	VkSwapchainKHR swapchain;
+	result = vkCreateSwapchainKHR(mDevice, &swapchainInfo, nullptr, &swapchain);
+	assert(checkResult(result));
+	if (mSwapchain != VK_NULL_HANDLE)
+	{
+		vkDestroySwapchainKHR(mDevice, mSwapchain, nullptr);
+	}
+	mSwapchain = swapchain;
+}
+
+bool GraphicsContext::recreateSwapchain()
+{
+	VkResult result = VK_SUCCESS;
+
+	VkSurfaceCapabilitiesKHR surfaceCapabilities;
+	result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(mPhysicalDevice, mSurface, &surfaceCapabilities);
 	assert(checkResult(result));
+	if (surfaceCapabilities.currentExtent.width == 0 || surfaceCapabilities.currentExtent.height == 0)
+	{
+		return false;
+	}
+
+	//everything below was recorded against the old images or the old size
+	result = vkDeviceWaitIdle(mDevice);
+	assert(checkResult(result));
+	const VkExtent2D oldExtent = mSwapchainExtent;
+	for (U32 i = 0; i < mSwapchainImages.size(); i++)
+	{
+		mResourceStates.forgetImage(mSwapchainImages[i]);
+		vkDestroyImageView(mDevice, mImageViews[i], nullptr);
+	}
+	createSwapchain();
+	createImageViews();
+	mSwapchainDirty = false;
+	mFrameGraphDirty = true;
+	if (mSwapchainExtent.width == oldExtent.width && mSwapchainExtent.height == oldExtent.height)
+	{
+		return true;
+	}
+
+	//Pipelines take the viewport and scissor as dynamic state so they don't have to be rebuilt, but the
+	//command buffers recorded up front set them and the Hi-Z pyramid matches the depth buffer's size
+	if (mOcclusionCulling)
+	{
+		destroyHiZImage();
+		createHiZImage();
+	}
+	for (AnimatedMesh *animatedMesh : mPooledMeshes)
+	{
+		recordMeshCommands(animatedMesh);
+	}
+	if (!mStaticBatchCommandBuffers.empty())
+	{
+		recordStaticBatchCommands();
+	}
+	if (mGpuDriven)
+	{
+		invalidateGpuDrivenCommands();
+	}
+	return true;
+}
+
+void GraphicsContext::setPresentMode(VkPresentModeKHR presentMode, U32 imageCount)
+{
+	mRequestedPresentMode = presentMode;
+	mRequestedImageCount = imageCount;
+	mSwapchainDirty = mSwapchain != VK_NULL_HANDLE;
+}
+
+void GraphicsContext::resize()
+{
+	mSwapchainDirty = true;
+}
+
+void GraphicsContext::setFrameRateLimit(U32 framesPerSecond)
+{
+	mFrameRateLimit = framesPerSecond;
+	mNextFrameTime = std::chrono::high_resolution_clock::now();
+}
+
+void GraphicsContext::enableFrameTimeGraph()
+{
+	if (!(mSwapchainUsage & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+	{
+		std::cout << "The surface can't be copied to, the frame time graph stays off" << std::endl;
+		return;
+	}
+	mFrameTimeGraph = true;
+	mFrameTimeHistory.assign(kFrameTimeGraphWidth / kFrameTimeGraphBarWidth, 0.f);
+	mFrameTimeHistoryIndex = 0;
+	mFrameGraphDirty = true;
+}
+
+void GraphicsContext::setViewportAndScissor(VkCommandBuffer commandBuffer)
+{
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)mSwapchainExtent.width;
+	viewport.height = (float)mSwapchainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = mSwapchainExtent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 }
 
 void GraphicsContext::createImageViews()
@@ -263,33 +538,44 @@ void GraphicsContext::createImageViews()
 	uint32_t imageCount;
 	result = vkGetSwapchainImagesKHR(mDevice, mSwapchain, &imageCount, nullptr);
 	assert(checkResult(result));
-	std::vector<VkImage> images(imageCount);
+	std::vector<VkImage> &images = mSwapchainImages;
+	images.resize(imageCount);
 	vkGetSwapchainImagesKHR(mDevice, mSwapchain, &imageCount, &images[0]);	
 
 	VkCommandBuffer commandBuffer = beginSingleUseCommandBuffer();
 	mImageViews.resize(imageCount);
 	for (uint32_t imageIndex = 0; imageIndex < imageCount; imageIndex++)
 	{
-		setImageLayout(commandBuffer, images[imageIndex], VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		mResourceStates.trackImage(images[imageIndex], VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_LAYOUT_UNDEFINED);
+		mResourceStates.useImage(images[imageIndex], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
 		createImageView(images[imageIndex], mSurfaceFormat.format, VK_IMAGE_ASPECT_COLOR_BIT, &mImageViews[imageIndex]);
 	}
+	mResourceStates.flush(commandBuffer);
 	endSingleUseCommandBuffer(commandBuffer);
 
 }
 
 void GraphicsContext::createRenderPass()
+{
+	createRenderPass(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		&mRenderPass);
+}
+
+//Same attachments as every graph pass, so pipelines and secondaries built against mRenderPass work in all of them
+void GraphicsContext::createRenderPass(VkAttachmentLoadOp colorLoadOp, VkImageLayout initialColorLayout, VkImageLayout finalColorLayout,
+	VkAttachmentStoreOp depthStoreOp, VkRenderPass *pRenderPassOut)
 {
 	VkResult result = VK_SUCCESS;
 
 	VkAttachmentDescription colorAttachment = {};
 	colorAttachment.format = mSurfaceFormat.format;
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.loadOp = colorLoadOp;
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.initialLayout = initialColorLayout;
+	colorAttachment.finalLayout = finalColorLayout;
 
 	VkAttachmentReference colorAttachmentRef = {};
 	colorAttachmentRef.attachment = 0;
@@ -298,8 +584,8 @@ void GraphicsContext::createRenderPass()
 	VkAttachmentDescription depthAttachment = {};
 	depthAttachment.format = m_depthFormat;
 	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.loadOp = colorLoadOp;
+	depthAttachment.storeOp = depthStoreOp;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
@@ -332,112 +618,162 @@ void GraphicsContext::createRenderPass()
 	renderPassInfo.pSubpasses = &subPass;
 	renderPassInfo.dependencyCount = 1;
 	renderPassInfo.pDependencies = &dependency;
-	result = vkCreateRenderPass(mDevice, &renderPassInfo, nullptr, &mRenderPass);
+	result = vkCreateRenderPass(mDevice, &renderPassInfo, nullptr, pRenderPassOut);
 	assert(checkResult(result));
 }
 
 void GraphicsContext::createDescriptorSetLayout()
+{
+	//Split by how often they change: set 0 once per frame, set 1 per material, set 2 per draw.
+	//Draws only rebind the sets that differ from the previous draw.
+	VkDescriptorSetLayoutBinding frameBinding = {};
+	frameBinding.binding = 0;
+	frameBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	frameBinding.descriptorCount = 1;
+	frameBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	createDescriptorSetLayout(&frameBinding, 1, &mFrameDescriptorSetLayout);
+
+	VkDescriptorSetLayoutBinding samplerBinding = {};
+	samplerBinding.binding = 0;
+	samplerBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	samplerBinding.descriptorCount = 1;
+	samplerBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	createDescriptorSetLayout(&samplerBinding, 1, &mMaterialDescriptorSetLayout);
+
+	std::array<VkDescriptorSetLayoutBinding, 2> drawBindings = {};
+	drawBindings[0].binding = 0;
+	drawBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	drawBindings[0].descriptorCount = 1;
+	drawBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	drawBindings[1].binding = 1;
+	drawBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	drawBindings[1].descriptorCount = 1;
+	drawBindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	createDescriptorSetLayout(drawBindings.data(), (U32)drawBindings.size(), &mDrawDescriptorSetLayout);
+	//baked animations read every frame's palette out of a storage buffer instead of the per-object bone constants
+	drawBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	createDescriptorSetLayout(drawBindings.data(), (U32)drawBindings.size(), &mBakedDrawDescriptorSetLayout);
+}
+
+void GraphicsContext::createDescriptorSetLayout(const VkDescriptorSetLayoutBinding *pBindings, U32 bindingCount, VkDescriptorSetLayout *pLayoutOut)
 {
 	VkResult result = VK_SUCCESS;
 
-	VkDescriptorSetLayoutBinding perFrameLayoutBinding = {};
-	perFrameLayoutBinding.binding = 0;
-	perFrameLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	perFrameLayoutBinding.descriptorCount = 1;
-	perFrameLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	perFrameLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding perObjectLayoutBinding = {};
-	perObjectLayoutBinding.binding = 1;
-	perObjectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	perObjectLayoutBinding.descriptorCount = 1;
-	perObjectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	perObjectLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding animationLayoutBinding = {};
-	animationLayoutBinding.binding = 2;
-	animationLayoutBinding.descriptorCount = 1;
-	animationLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	animationLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	animationLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-	samplerLayoutBinding.binding = 3;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
-
-	std::array<VkDescriptorSetLayoutBinding, 4> bindings = { perFrameLayoutBinding, perObjectLayoutBinding, animationLayoutBinding, samplerLayoutBinding };
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount = bindings.size();
-	layoutInfo.pBindings = bindings.data();
+	layoutInfo.bindingCount = bindingCount;
+	layoutInfo.pBindings = pBindings;
 	
-	result = vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mDescriptorSetLayout);
+	result = vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, pLayoutOut);
 	assert(checkResult(result));
+	mDescriptorCache.registerLayout(*pLayoutOut, pBindings, bindingCount);
 }
 
 void GraphicsContext::createGraphicsPipeline()
 {
-	VkResult result = VK_SUCCESS;
+	createMeshPipeline("../data/shaders/vert.spv", mDrawDescriptorSetLayout, &mPipelineLayout, &mPipeline);
+	mPalettePipelineLayouts[kPaletteFormatMatrix4x4] = mPipelineLayout;
+	mPalettePipelines[kPaletteFormatMatrix4x4] = mPipeline;
+}
+
+void GraphicsContext::createGraphicsPipeline(const std::string &vertShaderFilename, const std::string &fragShaderFilename,
+	const std::vector<VkDescriptorSetLayout> &setLayouts, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut)
+{
+	VkVertexInputBindingDescription bindingDescription = AnimatedMeshVertex::getBindingDescription();
+	auto attributeDescriptions = AnimatedMeshVertex::getAttributeDescriptions();
+	createGraphicsPipeline(vertShaderFilename, fragShaderFilename, bindingDescription, attributeDescriptions.data(), attributeDescriptions.size(),
+		setLayouts, pPipelineLayoutOut, pPipelineOut);
+}
+
+void GraphicsContext::createMeshPipeline(const std::string &vertShaderFilename, VkDescriptorSetLayout drawSetLayout,
+	VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut, const ShaderVariant *pVariant)
+{
+	VkVertexInputBindingDescription bindingDescription = AnimatedMeshVertex::getBindingDescription();
+	auto attributeDescriptions = AnimatedMeshVertex::getAttributeDescriptions();
+	createMeshPipeline(vertShaderFilename, bindingDescription, attributeDescriptions.data(), attributeDescriptions.size(),
+		drawSetLayout, pPipelineLayoutOut, pPipelineOut, pVariant);
+}
+
+void GraphicsContext::createMeshPipeline(const std::string &vertShaderFilename,
+	const VkVertexInputBindingDescription &bindingDescription, const VkVertexInputAttributeDescription *pAttributeDescriptions, U32 attributeCount,
+	VkDescriptorSetLayout drawSetLayout, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut, const ShaderVariant *pVariant)
+{
+	if (!mBindlessTextures)
+	{
+		createGraphicsPipeline(vertShaderFilename, "../data/shaders/frag.spv", bindingDescription, pAttributeDescriptions, attributeCount,
+			{ mFrameDescriptorSetLayout, mMaterialDescriptorSetLayout, drawSetLayout }, pPipelineLayoutOut, pPipelineOut, nullptr, pVariant);
+		return;
+	}
+
+	//the texture index
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(U32);
+	createGraphicsPipeline(vertShaderFilename, "../data/shaders/bindless_frag.spv", bindingDescription, pAttributeDescriptions, attributeCount,
+		{ mFrameDescriptorSetLayout, mBindlessDescriptorSetLayout, drawSetLayout }, pPipelineLayoutOut, pPipelineOut, &pushConstantRange, pVariant);
+}
 
-	std::vector<char> vertShaderBytes = CloakUtils::readFile("../data/shaders/vert.spv");
-	std::vector<char> fragShaderBytes = CloakUtils::readFile("../data/shaders/frag.spv");
+void GraphicsContext::createGraphicsPipeline(const std::string &vertShaderFilename, const std::string &fragShaderFilename,
+	const VkVertexInputBindingDescription &bindingDescription, const VkVertexInputAttributeDescription *pAttributeDescriptions, U32 attributeCount,
+	const std::vector<VkDescriptorSetLayout> &setLayouts, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut,
+	const VkPushConstantRange *pPushConstantRange, const ShaderVariant *pVariant)
+{
+	VkResult result = VK_SUCCESS;
 
-	VkShaderModule vertShaderModule;
-	VkShaderModule fragShaderModule;
+	const Shader *vertShader = mShaderLibrary.load(kShaderTypeVertex, vertShaderFilename);
+	const Shader *fragShader = mShaderLibrary.load(kShaderTypePixel, fragShaderFilename);
+	assert(vertShader && fragShader);
 
-	createShaderModule(vertShaderBytes, &vertShaderModule);
-	createShaderModule(fragShaderBytes, &fragShaderModule);
+	//both stages get every constant, each only picks up the ones it declares
+	std::array<VkSpecializationMapEntry, kShaderConstantCount> specializationEntries;
+	VkSpecializationInfo specializationInfo = {};
+	if (pVariant)
+	{
+		pVariant->getSpecializationInfo(specializationEntries, &specializationInfo);
+	}
 
 	VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
 	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module = vertShaderModule;
+	vertShaderStageInfo.module = vertShader->getModule();
 	vertShaderStageInfo.pName = "main";
+	vertShaderStageInfo.pSpecializationInfo = pVariant ? &specializationInfo : nullptr;
 
 	VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
 	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module = fragShaderModule;
+	fragShaderStageInfo.module = fragShader->getModule();
 	fragShaderStageInfo.pName = "main";
+	fragShaderStageInfo.pSpecializationInfo = pVariant ? &specializationInfo : nullptr;
 
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
-	VkVertexInputBindingDescription bindingDescription = AnimatedMeshVertex::getBindingDescription();
-	auto attributeDescriptions = AnimatedMeshVertex::getAttributeDescriptions();
-
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	vertexInputInfo.vertexBindingDescriptionCount = 1;
 	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-	vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+	vertexInputInfo.vertexAttributeDescriptionCount = attributeCount;
+	vertexInputInfo.pVertexAttributeDescriptions = pAttributeDescriptions;
 
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {};
 	inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
 	inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
 
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)mSwapchainExtent.width;
-	viewport.height = (float)mSwapchainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissor = {};
-	scissor.offset = { 0, 0 };
-	scissor.extent = mSwapchainExtent;
-
+	//set by the command buffers, so pipelines outlive swapchain resizes
 	VkPipelineViewportStateCreateInfo viewportState = {};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
+	viewportState.pViewports = nullptr;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	viewportState.pScissors = nullptr;
+
+	const VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
 
 	VkPipelineRasterizationStateCreateInfo rasterizer = {};
 	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -494,15 +830,14 @@ void GraphicsContext::createGraphicsPipeline()
 	colorBlending.blendConstants[2] = 0.0f; // Optional
 	colorBlending.blendConstants[3] = 0.0f; // Optional
 
-	VkDescriptorSetLayout setLayouts[] = { mDescriptorSetLayout };
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;
-	pipelineLayoutInfo.pSetLayouts = setLayouts;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = nullptr;
+	pipelineLayoutInfo.setLayoutCount = (U32)setLayouts.size();
+	pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = pPushConstantRange ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = pPushConstantRange;
 
-	result = vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mPipelineLayout);
+	result = vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, pPipelineLayoutOut);
 	assert(checkResult(result));
 
 	VkGraphicsPipelineCreateInfo pipelineInfo = {};
@@ -516,56 +851,229 @@ void GraphicsContext::createGraphicsPipeline()
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = &depthStencil;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr;
-	pipelineInfo.layout = mPipelineLayout;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = *pPipelineLayoutOut;
 	pipelineInfo.renderPass = mRenderPass;
 	pipelineInfo.subpass = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 	pipelineInfo.basePipelineIndex = -1;
 
-	result = vkCreateGraphicsPipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mPipeline);
+	result = vkCreateGraphicsPipelines(mDevice, mPipelineManager.getCache(), 1, &pipelineInfo, nullptr, pPipelineOut);
+	assert(checkResult(result));
+}
+
+void GraphicsContext::createComputePipeline(const std::string &compShaderFilename, VkDescriptorSetLayout descriptorSetLayout, U32 pushConstantSize,
+	VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut)
+{
+	VkResult result = VK_SUCCESS;
+
+	const Shader *compShader = mShaderLibrary.load(kShaderTypeCompute, compShaderFilename);
+	assert(compShader);
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = pushConstantSize;
+
+	VkDescriptorSetLayout setLayouts[] = { descriptorSetLayout };
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = setLayouts;
+	pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = pushConstantSize > 0 ? &pushConstantRange : nullptr;
+
+	result = vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, pPipelineLayoutOut);
 	assert(checkResult(result));
 
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = compShader->getModule();
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = *pPipelineLayoutOut;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	result = vkCreateComputePipelines(mDevice, mPipelineManager.getCache(), 1, &pipelineInfo, nullptr, pPipelineOut);
+	assert(checkResult(result));
 }
 
-void GraphicsContext::createDepthResources()
+void GraphicsContext::selectDepthFormat()
 {
+	//the depth buffer itself is a transient of the frame graph
 	const std::vector<VkFormat> candidates = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT };
 	m_depthFormat = findSupportedFormat(candidates, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
-
-	createImage(mSwapchainExtent.width, mSwapchainExtent.height, m_depthFormat,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		&m_depthImage);
-	createImageView(m_depthImage.image, m_depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, &m_depthImageView);
-
-	VkCommandBuffer commandBuffer = beginSingleUseCommandBuffer();
-	setImageLayout(commandBuffer, m_depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-	endSingleUseCommandBuffer(commandBuffer);
 }
 
-void GraphicsContext::createFramebuffers()
+void GraphicsContext::buildFrameGraph()
 {
-	VkResult result = VK_SUCCESS;
+	//whatever was built against the old graph has to be done with it
+	vkDeviceWaitIdle(mDevice);
+	mFrameGraph.destroy();
+
+	const RenderGraphResource backbuffer = mFrameGraph.importSwapchain("backbuffer", mSwapchainImages, mImageViews, mSurfaceFormat.format,
+		mSwapchainExtent.width, mSwapchainExtent.height);
+	RenderGraphImageDesc depthDesc = {};
+	depthDesc.width = mSwapchainExtent.width;
+	depthDesc.height = mSwapchainExtent.height;
+	depthDesc.mipCount = 1;
+	depthDesc.format = m_depthFormat;
+	mDepthResource = mFrameGraph.createImage("depth", depthDesc);
+
+	if (!mHasAsyncCompute)
+	{
+		//skinning writes a vertex buffer per mesh, too many to declare, so it keeps its own barrier
+		mFrameGraph.addComputePass("skinning", [this](VkCommandBuffer commandBuffer) {
+			if (mComputeCommandBuffers.empty())
+			{
+				return;
+			}
+			vkCmdExecuteCommands(commandBuffer, mComputeCommandBuffers.size(), mComputeCommandBuffers.data());
+
+			//skinned vertices have to land before any pass reads them
+			VkMemoryBarrier skinningBarrier = {};
+			skinningBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			skinningBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			skinningBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+				1, &skinningBarrier, 0, nullptr, 0, nullptr);
+		});
+	}
 
-	mSwapchainFramebuffers.resize(mImageViews.size());
-	for (size_t i = 0; i < mSwapchainFramebuffers.size(); i++)
+	//Only writes a transient, so the graph holds it back until the overlay at the end needs it. By then depth is done
+	//with, and the two share memory.
+	RenderGraphResource frameTimeGraph = kInvalidRenderGraphResource;
+	if (mFrameTimeGraph)
 	{
-		std::array<VkImageView, 2> attachments = { mImageViews[i], m_depthImageView };
+		RenderGraphImageDesc graphDesc = {};
+		graphDesc.width = kFrameTimeGraphWidth;
+		graphDesc.height = kFrameTimeGraphHeight;
+		graphDesc.mipCount = 1;
+		graphDesc.format = mSurfaceFormat.format; //a straight copy into the backbuffer needs the same format
+		frameTimeGraph = mFrameGraph.createImage("frame time graph", graphDesc);
+		const VkClearColorValue graphBackground = { { 0.f, 0.f, 0.f, 1.f } };
+		const U32 pass = mFrameGraph.addGraphicsPass("frame time graph", VK_SUBPASS_CONTENTS_INLINE, [this](VkCommandBuffer commandBuffer) {
+			recordFrameTimeGraph(commandBuffer);
+		});
+		mFrameGraph.addColorOutput(pass, frameTimeGraph, &graphBackground);
+	}
 
-		VkFramebufferCreateInfo framebufferInfo = {};
-		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferInfo.renderPass = mRenderPass;
-		framebufferInfo.attachmentCount = attachments.size();
-		framebufferInfo.pAttachments = attachments.data();
-		framebufferInfo.width = mSwapchainExtent.width;
-		framebufferInfo.height = mSwapchainExtent.height;
-		framebufferInfo.layers = 1;
+	RenderGraphResource gpuDrawCommands = kInvalidRenderGraphResource;
+	if (mGpuDriven)
+	{
+		gpuDrawCommands = mFrameGraph.importBuffer("gpu draw commands", mGpuDrawCommandBuffer.buffer);
+		const U32 pass = mFrameGraph.addComputePass("gpu cull", [this](VkCommandBuffer commandBuffer) {
+			if (mGpuDrawRecordCount > 0)
+			{
+				recordGpuDrivenCull(commandBuffer);
+			}
+		});
+		mFrameGraph.addBufferAccess(pass, gpuDrawCommands, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	}
 
-		result = vkCreateFramebuffer(mDevice, &framebufferInfo, nullptr, &mSwapchainFramebuffers[i]);
-		assert(checkResult(result));
+	//Two-phase occlusion culling: draw what was visible last frame, build Hi-Z from that depth, then
+	//test everything against it and draw whatever was missed. Nothing pops in, since anything newly
+	//visible still gets drawn this frame by the late pass.
+	RenderGraphResource drawCommands = kInvalidRenderGraphResource;
+	RenderGraphResource visibility = kInvalidRenderGraphResource;
+	RenderGraphResource hiZ = kInvalidRenderGraphResource;
+	if (mOcclusionCulling)
+	{
+		drawCommands = mFrameGraph.importBuffer("draw commands", mDrawCommandBuffer.buffer);
+		visibility = mFrameGraph.importBuffer("visibility", mVisibilityBuffer.buffer);
+		hiZ = mFrameGraph.importImage("hi-z", mHiZImage.image, mHiZImageView, VK_FORMAT_R32_SFLOAT, mSwapchainExtent.width, mSwapchainExtent.height);
+
+		//the early phase only reads visibility
+		const U32 pass = mFrameGraph.addComputePass("early cull", [this](VkCommandBuffer commandBuffer) {
+			recordOcclusionCull(commandBuffer, mFrameCullInstanceCount, 0);
+		});
+		mFrameGraph.addBufferAccess(pass, drawCommands, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+		mFrameGraph.addBufferAccess(pass, visibility, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+
+	//everything in the passes comes from the secondary command buffers
+	const VkClearColorValue clearColor = { { 0.f, 0.f, 0.f, 1.f } };
+	const VkClearDepthStencilValue clearDepth = { 1.f, 0 };
+	U32 pass = mFrameGraph.addGraphicsPass("main", VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS, [this](VkCommandBuffer commandBuffer) {
+		if (!mSecondaryCommandBuffers.empty())
+		{
+			vkCmdExecuteCommands(commandBuffer, mSecondaryCommandBuffers.size(), mSecondaryCommandBuffers.data());
+		}
+	});
+	mFrameGraph.addColorOutput(pass, backbuffer, &clearColor);
+	mFrameGraph.addDepthOutput(pass, mDepthResource, &clearDepth);
+	if (gpuDrawCommands != kInvalidRenderGraphResource)
+	{
+		mFrameGraph.addBufferAccess(pass, gpuDrawCommands, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	}
+	if (drawCommands != kInvalidRenderGraphResource)
+	{
+		mFrameGraph.addBufferAccess(pass, drawCommands, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	}
+
+	if (mOcclusionCulling)
+	{
+		pass = mFrameGraph.addComputePass("hi-z build", [this](VkCommandBuffer commandBuffer) {
+			recordHiZBuild(commandBuffer);
+		});
+		mFrameGraph.addImageAccess(pass, mDepthResource, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT);
+		mFrameGraph.addImageAccess(pass, hiZ, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+		//the late phase writes visibility back for next frame
+		pass = mFrameGraph.addComputePass("late cull", [this](VkCommandBuffer commandBuffer) {
+			recordOcclusionCull(commandBuffer, mFrameCullInstanceCount, 1);
+		});
+		mFrameGraph.addBufferAccess(pass, drawCommands, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+		mFrameGraph.addBufferAccess(pass, visibility, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		mFrameGraph.addImageAccess(pass, hiZ, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+		pass = mFrameGraph.addGraphicsPass("late", VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS, [this](VkCommandBuffer commandBuffer) {
+			if (!mLateSecondaryCommandBuffers.empty())
+			{
+				vkCmdExecuteCommands(commandBuffer, mLateSecondaryCommandBuffers.size(), mLateSecondaryCommandBuffers.data());
+			}
+		});
+		mFrameGraph.addColorOutput(pass, backbuffer);
+		mFrameGraph.addDepthOutput(pass, mDepthResource);
+		mFrameGraph.addBufferAccess(pass, drawCommands, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	}
+	if (frameTimeGraph != kInvalidRenderGraphResource)
+	{
+		//copies run outside of a render pass, like compute
+		pass = mFrameGraph.addComputePass("frame time overlay", [this, frameTimeGraph, backbuffer](VkCommandBuffer commandBuffer) {
+			if (mSwapchainExtent.width <= kFrameTimeGraphMargin || mSwapchainExtent.height <= kFrameTimeGraphMargin)
+			{
+				return;
+			}
+			VkImageCopy region = {};
+			region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.srcSubresource.layerCount = 1;
+			region.dstSubresource = region.srcSubresource;
+			region.dstOffset = { (S32)kFrameTimeGraphMargin, (S32)kFrameTimeGraphMargin, 0 };
+			region.extent.width = std::min(kFrameTimeGraphWidth, mSwapchainExtent.width - kFrameTimeGraphMargin);
+			region.extent.height = std::min(kFrameTimeGraphHeight, mSwapchainExtent.height - kFrameTimeGraphMargin);
+			region.extent.depth = 1;
+			vkCmdCopyImage(commandBuffer, mFrameGraph.getImage(frameTimeGraph), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				mFrameGraph.getImage(backbuffer), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		});
+		mFrameGraph.addImageAccess(pass, frameTimeGraph, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT);
+		mFrameGraph.addImageAccess(pass, backbuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT);
+	}
+	mFrameGraph.present(backbuffer);
+
+	mFrameGraph.compile(mDevice, mAllocator, &mResourceStates);
+	if (mOcclusionCulling)
+	{
+		//the depth buffer is new, so mip 0's source is too, and the pyramid may be after a resize
+		updateHiZDescriptorSets();
 	}
+	mFrameGraphDirty = false;
 }
 
 void GraphicsContext::createImageFromSurface(SDL_Surface *pSurface, GpuImage *pImageOut)
@@ -593,13 +1101,17 @@ void GraphicsContext::createImageFromSurface(SDL_Surface *pSurface, GpuImage *pI
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		pImageOut);
 
+	//the staging image was written by the memcpy above, which the submit makes visible
 	VkCommandBuffer commandBuffer = beginSingleUseCommandBuffer();
-	setImageLayout(commandBuffer, stagingImage.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	setImageLayout(commandBuffer, pImageOut->image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	mResourceStates.useImage(stagingImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	mResourceStates.useImage(pImageOut->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	mResourceStates.flush(commandBuffer);
 	copyImage(commandBuffer, stagingImage.image, pImageOut->image, pImageSurface->w, pImageSurface->h);
-	setImageLayout(commandBuffer, pImageOut->image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	mResourceStates.useImage(pImageOut->image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	mResourceStates.flush(commandBuffer);
 	endSingleUseCommandBuffer(commandBuffer);
 
+	mResourceStates.forgetImage(stagingImage.image);
 	vmaDestroyImage(mAllocator, stagingImage.image, stagingImage.allocation);
 
 	SDL_FreeSurface(pImageSurface);
@@ -652,48 +1164,64 @@ void GraphicsContext::createBufferFromData(void *pData, U32 bufferSize, VkBuffer
 
 void GraphicsContext::createUniformBuffer()
 {
-	//make the staging buffer the size of the largest constant buffer for now so it can be used for any buffer
-	createBuffer(sizeof(AnimationConstantBuffer), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&m_uniformStagingBuffer);
+	//each frame stages its constant buffer updates in its own buffer, kept mapped, so writing one never waits on the GPU
+	for (FrameResources &frame : mFrames)
+	{
+		createBuffer(kUploadBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&frame.uploadBuffer);
+		vmaMapMemory(mAllocator, frame.uploadBuffer.allocation, (void **)&frame.uploadData);
+	}
 	createBuffer(sizeof(SceneConstantBuffer), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		&m_uniformBuffer);
+
+	//the scene constants are updated in place, so one set 0 serves every frame
+	DescriptorResource sceneResource = makeBufferResource(m_uniformBuffer.buffer, 0, sizeof(SceneConstantBuffer));
+	mFrameDescriptorSet = mDescriptorCache.getSet(mFrameDescriptorSetLayout, &sceneResource);
 }
 
 void GraphicsContext::createDescriptorPool()
 {
-	VkResult result = VK_SUCCESS;
-
-	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	//sizes are per pool, another one gets chained on whenever these run out
+	std::vector<VkDescriptorPoolSize> poolSizes(4);
 	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = 4096;
+	poolSizes[0].descriptorCount = 2048;
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = 1024;
-
-	VkDescriptorPoolCreateInfo poolInfo = {};
-	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = poolSizes.size();
-	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = 1024;
-
-	result = vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mDescriptorPool);
-	assert(checkResult(result));
+	poolSizes[1].descriptorCount = 512;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[2].descriptorCount = 2048;
+	poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[3].descriptorCount = 32; //one per Hi-Z mip
+	mDescriptorAllocator.init(mDevice, 1024, poolSizes);
+	mDescriptorCache.init(mDevice, &mDescriptorAllocator, mHasUpdateTemplates);
 }
 
 void GraphicsContext::createCommandBuffers()
 {
 	VkResult result = VK_SUCCESS;
 
-	mCommandBuffers.resize(mSwapchainFramebuffers.size());
+	//one primary per frame in flight rather than per swapchain image, the frame's fence is what says it can be reset
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = mCommandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (U32)mCommandBuffers.size();
+	allocInfo.commandBufferCount = 1;
+	for (FrameResources &frame : mFrames)
+	{
+		result = vkAllocateCommandBuffers(mDevice, &allocInfo, &frame.commandBuffer);
+		assert(checkResult(result));
+		result = vkAllocateCommandBuffers(mDevice, &allocInfo, &frame.uploadCommandBuffer);
+		assert(checkResult(result));
+	}
 
-	result = vkAllocateCommandBuffers(mDevice, &allocInfo, mCommandBuffers.data());
-	assert(checkResult(result));
+	//the primary that runs a frame's skinning secondaries on the compute queue
+	allocInfo.commandPool = mComputeCommandPool;
+	for (FrameResources &frame : mFrames)
+	{
+		result = vkAllocateCommandBuffers(mDevice, &allocInfo, &frame.computeCommandBuffer);
+		assert(checkResult(result));
+	}
 }
 
 void GraphicsContext::createSemaphores()
@@ -703,10 +1231,38 @@ void GraphicsContext::createSemaphores()
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	result = vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &imageAcquiredSemaphore);
-	assert(checkResult(result));
-	result = vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &renderFinishedSemaphore);
-	assert(checkResult(result));
+	//signaled up front so the first wait on each frame goes straight through
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	mFrames.resize(kFramesInFlight);
+	for (FrameResources &frame : mFrames)
+	{
+		result = vkCreateFence(mDevice, &fenceInfo, nullptr, &frame.fence);
+		assert(checkResult(result));
+		//a frame's semaphores are only signaled again once its fence says the last use has retired
+		result = vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &frame.imageAcquiredSemaphore);
+		assert(checkResult(result));
+		result = vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &frame.renderFinishedSemaphore);
+		assert(checkResult(result));
+		result = vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &frame.uploadFinishedSemaphore);
+		assert(checkResult(result));
+		result = vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &frame.computeFinishedSemaphore);
+		assert(checkResult(result));
+		result = vkCreateFence(mDevice, &fenceInfo, nullptr, &frame.computeFence);
+		assert(checkResult(result));
+		frame.uploadData = nullptr;
+		frame.uploadOffset = 0;
+		frame.uploadCommandBuffer = VK_NULL_HANDLE;
+		frame.computeCommandBuffer = VK_NULL_HANDLE;
+		frame.cullInstanceData = nullptr;
+		frame.cullDescriptorSet = VK_NULL_HANDLE;
+		frame.gpuInstanceData = nullptr;
+		frame.gpuPaletteData = nullptr;
+		frame.gpuDrivenDescriptorSet = VK_NULL_HANDLE;
+		frame.gpuDrivenCommandBuffer = VK_NULL_HANDLE;
+		frame.gpuDrivenCommandsDirty = false;
+	}
 }
 
 void GraphicsContext::createCommandBuffer(AnimatedMesh *animatedMesh)
@@ -717,192 +1273,1982 @@ void GraphicsContext::createCommandBuffer(AnimatedMesh *animatedMesh)
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = mCommandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
-	allocInfo.commandBufferCount = 1;
 
-	result = vkAllocateCommandBuffers(mDevice, &allocInfo, &animatedMesh->m_commandBuffer);
-	assert(checkResult(result));
-	
-	VkCommandBufferInheritanceInfo inheritanceInfo = {};
-	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
-	inheritanceInfo.renderPass = mRenderPass;
-	inheritanceInfo.subpass = 0;
-	inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+	//compute skinned meshes draw from a different output every frame in flight, so they need a draw secondary per frame too
+	const BakedAnimation *bakedAnimation = animatedMesh->getBakedAnimation();
+	const bool computeSkinning = animatedMesh->usesComputeSkinning() && !bakedAnimation;
+	allocInfo.commandBufferCount = computeSkinning ? (U32)mFrames.size() : 1;
 
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-	beginInfo.pInheritanceInfo = &inheritanceInfo;
-	vkBeginCommandBuffer(animatedMesh->m_commandBuffer, &beginInfo);
+	animatedMesh->m_commandBuffers.resize(allocInfo.commandBufferCount);
+	result = vkAllocateCommandBuffers(mDevice, &allocInfo, animatedMesh->m_commandBuffers.data());
+	assert(checkResult(result));
+
+	if (mOcclusionCulling)
+	{
+		animatedMesh->m_lateCommandBuffers.resize(allocInfo.commandBufferCount);
+		result = vkAllocateCommandBuffers(mDevice, &allocInfo, animatedMesh->m_lateCommandBuffers.data());
+		assert(checkResult(result));
+
+		assert(mCullInstanceCount < mMaxCullInstances);
+		assert(mDrawCommandCount + animatedMesh->getSubMeshes().size() <= mMaxDrawCommands);
+		animatedMesh->m_cullIndex = mCullInstanceCount++;
+		animatedMesh->m_firstDrawCommand = mDrawCommandCount;
+		mDrawCommandCount += (U32)animatedMesh->getSubMeshes().size();
+	}
 
 	ObjectConstantBuffer objectBuffer = {};
 	objectBuffer.modelMatrix = animatedMesh->buildModelMatrix();
+	objectBuffer.animationParams = animatedMesh->getAnimationParams();
 	createBufferFromData(&objectBuffer, sizeof(objectBuffer), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &animatedMesh->m_objectConstantBuffer);
 
-	auto &boneMatrices = animatedMesh->getBoneMatrices();
-	createBufferFromData(boneMatrices.data(), sizeof(boneMatrices[0]) * boneMatrices.size(), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-		&animatedMesh->m_animationConstantBuffer);
-	
-	for (AnimatedSubMesh &subMesh : animatedMesh->getSubMeshes())
+	SharedPose *sharedPose = animatedMesh->getSharedPose();
+	if (sharedPose)
+	{
+		//the first instance to be recorded creates the palette buffer for the whole bucket
+		if (sharedPose->animationConstantBuffer.buffer == VK_NULL_HANDLE)
+		{
+			createBufferFromData(sharedPose->palette.data(), sizeof(sharedPose->palette[0]) * sharedPose->palette.size(),
+				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &sharedPose->animationConstantBuffer);
+		}
+	}
+	else if (!bakedAnimation)
+	{
+		auto &palette = animatedMesh->getPalette();
+		createBufferFromData((void *)palette.data(), sizeof(palette[0]) * palette.size(), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			&animatedMesh->m_animationConstantBuffer);
+	}
+	const PaletteFormat paletteFormat = sharedPose ? sharedPose->paletteFormat : animatedMesh->getPaletteFormat();
+	const VkDeviceSize paletteSize = SkinningPalette::getSize(paletteFormat, animatedMesh->getBoneCount());
+
+	if (computeSkinning)
+	{
+		//skin.comp only reads full matrices
+		assert(paletteFormat == kPaletteFormatMatrix4x4);
+		if (mSkinningPipeline == VK_NULL_HANDLE)
+		{
+			createSkinningPipelines();
+		}
+
+		//secondaries have to come from the same queue family as the primary that executes them
+		VkCommandBufferAllocateInfo skinningAllocInfo = allocInfo;
+		skinningAllocInfo.commandPool = mComputeCommandPool;
+		animatedMesh->m_skinningCommandBuffers.resize(mFrames.size());
+		result = vkAllocateCommandBuffers(mDevice, &skinningAllocInfo, animatedMesh->m_skinningCommandBuffers.data());
+		assert(checkResult(result));
+
+		VkCommandBufferInheritanceInfo skinningInheritanceInfo = {};
+		skinningInheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+		VkCommandBufferBeginInfo skinningBeginInfo = {};
+		skinningBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		skinningBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+		skinningBeginInfo.pInheritanceInfo = &skinningInheritanceInfo;
+		for (VkCommandBuffer skinningCommandBuffer : animatedMesh->m_skinningCommandBuffers)
+		{
+			vkBeginCommandBuffer(skinningCommandBuffer, &skinningBeginInfo);
+			vkCmdBindPipeline(skinningCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mSkinningPipeline);
+		}
+	}
+	const VkBuffer paletteBuffer = sharedPose ? sharedPose->animationConstantBuffer.buffer : animatedMesh->m_animationConstantBuffer.buffer;
+
+	//every submesh draws with the same object constants and palette, they only differ in material
+	std::array<DescriptorResource, 2> drawResources = {
+		makeBufferResource(animatedMesh->m_objectConstantBuffer.buffer, 0, sizeof(ObjectConstantBuffer)),
+		bakedAnimation ? makeBufferResource(bakedAnimation->paletteBuffer.buffer, 0, VK_WHOLE_SIZE)
+			: makeBufferResource(paletteBuffer, 0, paletteSize)
+	};
+	animatedMesh->m_drawDescriptorSet = mDescriptorCache.getSet(bakedAnimation ? mBakedDrawDescriptorSetLayout : mDrawDescriptorSetLayout,
+		drawResources.data());
+	
+	U32 subMeshIndex = 0;
+	for (AnimatedSubMesh &subMesh : animatedMesh->getSubMeshes())
+	{
+		//Create resources in GPU memory
+		acquireSubMeshGeometry(animatedMesh->getModelName() + "#" + std::to_string(subMeshIndex++), &subMesh);
+		if (computeSkinning)
+		{
+			createBufferFromData(subMesh.vertices.data(), sizeof(subMesh.vertices[0]) * subMesh.vertices.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				&subMesh.vertexBuffer);
+		}
+		
+		const Material &material = getMaterial(subMesh.textureName);
+		subMesh.textureImage = material.textureImage;
+		subMesh.textureImageView = material.textureImageView;
+		subMesh.materialDescriptorSet = material.descriptorSet;
+		subMesh.textureIndex = material.textureIndex;
+
+		if (computeSkinning)
+		{
+			for (U32 frameIndex = 0; frameIndex < animatedMesh->m_skinningCommandBuffers.size(); frameIndex++)
+			{
+				recordSkinningDispatch(animatedMesh->m_skinningCommandBuffers[frameIndex], paletteBuffer, paletteSize, frameIndex, &subMesh);
+			}
+		}
+	}
+
+	for (VkCommandBuffer skinningCommandBuffer : animatedMesh->m_skinningCommandBuffers)
+	{
+		vkEndCommandBuffer(skinningCommandBuffer);
+	}
+
+	mPooledMeshes.push_back(animatedMesh);
+	recordMeshCommands(animatedMesh);
+}
+
+bool GraphicsContext::getMeshPipeline(AnimatedMesh *animatedMesh, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut)
+{
+	if (animatedMesh->getBakedAnimation())
+	{
+		if (mBakedPipeline == VK_NULL_HANDLE)
+		{
+			mPipelineManager.getPipeline(mBakedPipelineRequest, &mBakedPipelineLayout, &mBakedPipeline);
+		}
+		*pPipelineLayoutOut = mBakedPipelineLayout;
+		*pPipelineOut = mBakedPipeline;
+	}
+	else if (animatedMesh->usesComputeSkinning())
+	{
+		*pPipelineLayoutOut = mStaticPipelineLayout;
+		*pPipelineOut = mStaticPipeline;
+	}
+	else
+	{
+		SharedPose *sharedPose = animatedMesh->getSharedPose();
+		const PaletteFormat paletteFormat = sharedPose ? sharedPose->paletteFormat : animatedMesh->getPaletteFormat();
+		if (mShaderVariants)
+		{
+			return getVariantPipeline(animatedMesh, paletteFormat, pPipelineLayoutOut, pPipelineOut);
+		}
+		getPalettePipeline(paletteFormat, pPipelineLayoutOut, pPipelineOut);
+	}
+	return *pPipelineOut != VK_NULL_HANDLE;
+}
+
+void GraphicsContext::enableShaderVariants(LightingPath lightingPath)
+{
+	mShaderVariants = true;
+	mLightingPath = lightingPath;
+}
+
+bool GraphicsContext::getVariantPipeline(AnimatedMesh *animatedMesh, PaletteFormat paletteFormat, VkPipelineLayout *pPipelineLayoutOut,
+	VkPipeline *pPipelineOut)
+{
+	ShaderVariant variant;
+	variant.set(kShaderConstantWeightsPerVertex, animatedMesh->getMaxWeightsPerVertex());
+	variant.set(kShaderConstantPaletteFormat, paletteFormat);
+	variant.set(kShaderConstantLightingPath, mLightingPath);
+
+	auto existing = mVariantPipelines.find(variant.getKey());
+	if (existing == mVariantPipelines.end())
+	{
+		//matrix palettes read the same in the generic shader, so those meshes don't have to wait for theirs
+		const bool hasFallback = paletteFormat == kPaletteFormatMatrix4x4;
+		VariantPipeline variantPipeline;
+		variantPipeline.request = (S32)mPipelineManager.requestPipeline([this, variant](VkPipelineLayout *pLayout, VkPipeline *pPipeline) {
+			createMeshPipeline("../data/shaders/skinned_vert.spv", mDrawDescriptorSetLayout, pLayout, pPipeline, &variant);
+		}, hasFallback ? mPipelineLayout : VK_NULL_HANDLE, hasFallback ? mPipeline : VK_NULL_HANDLE);
+		variantPipeline.pipelineLayout = VK_NULL_HANDLE;
+		variantPipeline.pipeline = VK_NULL_HANDLE;
+		existing = mVariantPipelines.insert(std::make_pair(variant.getKey(), variantPipeline)).first;
+	}
+
+	VariantPipeline &variantPipeline = existing->second;
+	if (variantPipeline.pipeline == VK_NULL_HANDLE)
+	{
+		if (!mPipelineManager.isReady(variantPipeline.request))
+		{
+			mPipelineManager.getPipeline(variantPipeline.request, pPipelineLayoutOut, pPipelineOut);
+			return false;
+		}
+		mPipelineManager.getPipeline(variantPipeline.request, &variantPipeline.pipelineLayout, &variantPipeline.pipeline);
+	}
+	*pPipelineLayoutOut = variantPipeline.pipelineLayout;
+	*pPipelineOut = variantPipeline.pipeline;
+	return true;
+}
+
+void GraphicsContext::recordMeshCommands(AnimatedMesh *animatedMesh)
+{
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = mRenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VkPipelineLayout pipelineLayout;
+	VkPipeline pipeline;
+	if (!getMeshPipeline(animatedMesh, &pipelineLayout, &pipeline) && std::find(mMeshesAwaitingPipelines.begin(), mMeshesAwaitingPipelines.end(), animatedMesh) ==
+		mMeshesAwaitingPipelines.end())
+	{
+		mMeshesAwaitingPipelines.push_back(animatedMesh);
+	}
+
+	for (U32 frameIndex = 0; frameIndex < animatedMesh->m_commandBuffers.size(); frameIndex++)
+	{
+		//submesh order is fine here, one mesh's draws already share everything but the material
+		RenderQueue renderQueue;
+		pushMeshDrawItems(animatedMesh, frameIndex, &renderQueue);
+
+		//the same draws get recorded twice, each reading its own half of the indirect commands
+		const VkCommandBuffer commandBuffers[] = { animatedMesh->m_commandBuffers[frameIndex],
+			mOcclusionCulling ? animatedMesh->m_lateCommandBuffers[frameIndex] : VK_NULL_HANDLE };
+		const U32 commandBufferCount = mOcclusionCulling ? 2 : 1;
+		for (U32 i = 0; i < commandBufferCount; i++)
+		{
+			vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+			recordDrawItems(commandBuffers[i], renderQueue.getItems(), 0, renderQueue.getItemCount(), i == 1);
+			vkEndCommandBuffer(commandBuffers[i]);
+		}
+	}
+
+	const bool computeSkinning = animatedMesh->usesComputeSkinning() && !animatedMesh->getBakedAnimation();
+	const std::vector<AnimatedSubMesh> &subMeshes = animatedMesh->getSubMeshes();
+	if (mOcclusionCulling)
+	{
+		std::vector<VkDrawIndexedIndirectCommand> drawCommands;
+		for (const AnimatedSubMesh &subMesh : subMeshes)
+		{
+			VkDrawIndexedIndirectCommand drawCommand = {};
+			drawCommand.indexCount = (U32)subMesh.indices.size();
+			drawCommand.instanceCount = 1;
+			drawCommand.firstIndex = subMesh.firstIndex;
+			drawCommand.vertexOffset = computeSkinning ? 0 : subMesh.vertexOffset;
+			drawCommands.push_back(drawCommand);
+		}
+
+		//the cull pass only ever touches instanceCount, everything else is filled in here
+		const VkDeviceSize commandStride = sizeof(VkDrawIndexedIndirectCommand);
+		const VkDeviceSize commandsSize = commandStride * drawCommands.size();
+		updateBuffer(mDrawCommandBuffer.buffer, commandStride * animatedMesh->m_firstDrawCommand, commandsSize, drawCommands.data());
+		updateBuffer(mDrawCommandBuffer.buffer, commandStride * (mMaxDrawCommands + animatedMesh->m_firstDrawCommand), commandsSize, drawCommands.data());
+	}
+}
+
+template<typename Handle>
+static U32 getSortId(std::unordered_map<Handle, U32> &sortIds, Handle handle)
+{
+	auto sortId = sortIds.find(handle);
+	if (sortId != sortIds.end())
+	{
+		return sortId->second;
+	}
+	const U32 newId = (U32)sortIds.size();
+	sortIds[handle] = newId;
+	return newId;
+}
+
+void GraphicsContext::pushMeshDrawItems(AnimatedMesh *animatedMesh, U32 frameIndex, RenderQueue *pRenderQueue)
+{
+	VkPipelineLayout pipelineLayout;
+	VkPipeline pipeline;
+	getMeshPipeline(animatedMesh, &pipelineLayout, &pipeline);
+	if (pipeline == VK_NULL_HANDLE)
+	{
+		//still compiling
+		return;
+	}
+	const bool computeSkinning = animatedMesh->usesComputeSkinning() && !animatedMesh->getBakedAnimation();
+
+	glm::vec3 boundsMin, boundsMax;
+	animatedMesh->getWorldBounds(boundsMin, boundsMax);
+	const float viewDepth = -(mViewMatrix * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.f)).z;
+	const U32 pipelineId = getSortId(mPipelineSortIds, pipeline);
+
+	std::vector<AnimatedSubMesh> &subMeshes = animatedMesh->getSubMeshes();
+	for (U32 i = 0; i < subMeshes.size(); i++)
+	{
+		const AnimatedSubMesh &subMesh = subMeshes[i];
+		DrawItem item;
+		item.pipeline = pipeline;
+		item.pipelineLayout = pipelineLayout;
+		item.materialSet = subMesh.materialDescriptorSet;
+		item.drawSet = animatedMesh->m_drawDescriptorSet;
+		item.textureIndex = subMesh.textureIndex;
+		//skinned output is per submesh and frame in flight, only the indices come from the pool
+		item.vertexBuffer = computeSkinning ? subMesh.skinnedVertexBuffers[frameIndex].buffer : mGeometryVertexBuffer.buffer;
+		item.indexBuffer = mGeometryIndexBuffer.buffer;
+		item.indexCount = (U32)subMesh.indices.size();
+		item.firstIndex = subMesh.firstIndex;
+		item.vertexOffset = computeSkinning ? 0 : subMesh.vertexOffset;
+		item.drawCommandIndex = mOcclusionCulling ? (S32)(animatedMesh->m_firstDrawCommand + i) : -1;
+		item.sortKey = RenderQueue::makeSortKey(kRenderQueuePassOpaque, pipelineId, viewDepth, getSortId(mMaterialSortIds, item.materialSet),
+			getSortId(mMeshSortIds, subMesh.geometryName));
+		pRenderQueue->push(item);
+	}
+}
+
+void GraphicsContext::recordDrawItems(VkCommandBuffer commandBuffer, const std::vector<DrawItem> &items, U32 first, U32 last, bool latePass)
+{
+	//only what differs from the previous draw gets bound, which after sorting is usually just set 2
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout boundPipelineLayout = VK_NULL_HANDLE;
+	VkDescriptorSet boundMaterialSet = VK_NULL_HANDLE;
+	VkDescriptorSet boundDrawSet = VK_NULL_HANDLE;
+	U32 pushedTextureIndex = ~0u;
+	VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+	VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+	setViewportAndScissor(commandBuffer);
+	for (U32 i = first; i < last; i++)
+	{
+		const DrawItem &item = items[i];
+		if (item.pipeline != boundPipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, item.pipeline);
+			boundPipeline = item.pipeline;
+		}
+		if (item.pipelineLayout != boundPipelineLayout)
+		{
+			//every mesh layout agrees on sets 0 and 1, so those survive a layout change, set 2 might not
+			if (boundPipelineLayout == VK_NULL_HANDLE)
+			{
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, item.pipelineLayout, 0, 1, &mFrameDescriptorSet, 0, nullptr);
+			}
+			boundPipelineLayout = item.pipelineLayout;
+			boundDrawSet = VK_NULL_HANDLE;
+			pushedTextureIndex = ~0u;
+		}
+		if (item.vertexBuffer != boundVertexBuffer)
+		{
+			VkDeviceSize offsets[] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &item.vertexBuffer, offsets);
+			boundVertexBuffer = item.vertexBuffer;
+		}
+		if (item.indexBuffer != boundIndexBuffer)
+		{
+			vkCmdBindIndexBuffer(commandBuffer, item.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+			boundIndexBuffer = item.indexBuffer;
+		}
+		if (item.materialSet != boundMaterialSet)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, item.pipelineLayout, 1, 1, &item.materialSet, 0, nullptr);
+			boundMaterialSet = item.materialSet;
+		}
+		if (item.drawSet != boundDrawSet)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, item.pipelineLayout, 2, 1, &item.drawSet, 0, nullptr);
+			boundDrawSet = item.drawSet;
+		}
+		if (mBindlessTextures && item.textureIndex != pushedTextureIndex)
+		{
+			vkCmdPushConstants(commandBuffer, item.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(item.textureIndex), &item.textureIndex);
+			pushedTextureIndex = item.textureIndex;
+		}
+
+		if (item.drawCommandIndex >= 0)
+		{
+			//instanceCount is 0 or 1, decided on the GPU by the cull pass
+			const S32 drawCommandIndex = item.drawCommandIndex + (latePass ? (S32)mMaxDrawCommands : 0);
+			vkCmdDrawIndexedIndirect(commandBuffer, mDrawCommandBuffer.buffer, sizeof(VkDrawIndexedIndirectCommand) * drawCommandIndex, 1,
+				sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			vkCmdDrawIndexed(commandBuffer, item.indexCount, 1, item.firstIndex, item.vertexOffset, 0);
+		}
+	}
+}
+
+void GraphicsContext::enableParallelRecording(ThreadPool *threadPool)
+{
+	VkResult result = VK_SUCCESS;
+
+	assert(mRecordingThreadPool == nullptr);
+	mRecordingThreadPool = threadPool;
+
+	//transient, the buffers never outlive the frame and the whole pool gets reset at once
+	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	commandPoolCreateInfo.queueFamilyIndex = mQueueFamilyIndex;
+
+	const U32 taskCount = threadPool->getThreadCount();
+	for (FrameResources &frame : mFrames)
+	{
+		frame.commandPools.resize(taskCount);
+		frame.commandBuffers.resize(taskCount);
+		frame.lateCommandBuffers.resize(taskCount);
+		for (U32 i = 0; i < taskCount; i++)
+		{
+			result = vkCreateCommandPool(mDevice, &commandPoolCreateInfo, nullptr, &frame.commandPools[i]);
+			assert(checkResult(result));
+
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = frame.commandPools[i];
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+			result = vkAllocateCommandBuffers(mDevice, &allocInfo, &frame.commandBuffers[i]);
+			assert(checkResult(result));
+			result = vkAllocateCommandBuffers(mDevice, &allocInfo, &frame.lateCommandBuffers[i]);
+			assert(checkResult(result));
+		}
+	}
+}
+
+void GraphicsContext::recordParallelDraws(FrameResources &frame, const std::vector<AnimatedMesh*> &meshes)
+{
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = mRenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	//one sort over every visible draw, so the slices below are each in front-to-back, state-grouped order
+	mRenderQueue.clear();
+	const U32 frameIndex = (U32)(&frame - mFrames.data());
+	for (AnimatedMesh *animatedMesh : meshes)
+	{
+		pushMeshDrawItems(animatedMesh, frameIndex, &mRenderQueue);
+	}
+	mRenderQueue.sort();
+	const std::vector<DrawItem> &items = mRenderQueue.getItems();
+
+	//task i records a contiguous slice of the sorted draws into pool i, so no two threads ever share a pool
+	const U32 taskCount = (U32)frame.commandPools.size();
+	const U32 itemsPerTask = ((U32)items.size() + taskCount - 1) / taskCount;
+	mRecordingThreadPool->parallelFor(taskCount, [&](U32 task)
+	{
+		VkResult result = vkResetCommandPool(mDevice, frame.commandPools[task], 0);
+		assert(checkResult(result));
+
+		const U32 first = std::min(task * itemsPerTask, (U32)items.size());
+		const U32 last = std::min(first + itemsPerTask, (U32)items.size());
+		if (first == last)
+		{
+			return;
+		}
+
+		vkBeginCommandBuffer(frame.commandBuffers[task], &beginInfo);
+		recordDrawItems(frame.commandBuffers[task], items, first, last, false);
+		vkEndCommandBuffer(frame.commandBuffers[task]);
+
+		if (mOcclusionCulling)
+		{
+			vkBeginCommandBuffer(frame.lateCommandBuffers[task], &beginInfo);
+			recordDrawItems(frame.lateCommandBuffers[task], items, first, last, true);
+			vkEndCommandBuffer(frame.lateCommandBuffers[task]);
+		}
+	});
+
+	for (U32 task = 0; task < taskCount && task * itemsPerTask < items.size(); task++)
+	{
+		mSecondaryCommandBuffers.push_back(frame.commandBuffers[task]);
+		if (mOcclusionCulling)
+		{
+			mLateSecondaryCommandBuffers.push_back(frame.lateCommandBuffers[task]);
+		}
+	}
+}
+
+void GraphicsContext::createGeometryPool()
+{
+	const OffsetAllocator &vertexAllocator = mGeometryPool.getVertexAllocator();
+	const OffsetAllocator &indexAllocator = mGeometryPool.getIndexAllocator();
+	//transfer source too, defragmentGeometry copies within the buffers
+	createBuffer(sizeof(AnimatedMeshVertex) * vertexAllocator.getCapacity(),
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mGeometryVertexBuffer);
+	createBuffer(sizeof(U16) * indexAllocator.getCapacity(),
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mGeometryIndexBuffer);
+}
+
+void GraphicsContext::acquireSubMeshGeometry(const std::string &geometryName, AnimatedSubMesh *pSubMesh)
+{
+	const U32 vertexCount = (U32)pSubMesh->vertices.size();
+	const U32 indexCount = (U32)pSubMesh->indices.size();
+	GeometryRange range;
+	bool created = false;
+	if (!mGeometryPool.acquire(geometryName, vertexCount, indexCount, &range, &created))
+	{
+		//there may be enough space, just not in one piece
+		defragmentGeometry();
+		bool success = mGeometryPool.acquire(geometryName, vertexCount, indexCount, &range, &created);
+		assert(success);
+	}
+
+	if (created)
+	{
+		uploadBuffer(pSubMesh->vertices.data(), sizeof(AnimatedMeshVertex) * vertexCount, mGeometryVertexBuffer.buffer,
+			sizeof(AnimatedMeshVertex) * range.firstVertex);
+		uploadBuffer(pSubMesh->indices.data(), sizeof(U16) * indexCount, mGeometryIndexBuffer.buffer, sizeof(U16) * range.firstIndex);
+	}
+
+	pSubMesh->geometryName = geometryName;
+	pSubMesh->vertexOffset = (S32)range.firstVertex;
+	pSubMesh->firstIndex = range.firstIndex;
+}
+
+void GraphicsContext::updateSubMeshGeometry(AnimatedMesh *animatedMesh)
+{
+	for (AnimatedSubMesh &subMesh : animatedMesh->getSubMeshes())
+	{
+		const GeometryRange &range = mGeometryPool.getRange(subMesh.geometryName);
+		subMesh.vertexOffset = (S32)range.firstVertex;
+		subMesh.firstIndex = range.firstIndex;
+	}
+}
+
+void GraphicsContext::releaseGeometry(AnimatedMesh *animatedMesh)
+{
+	//GPU-driven meshes keep their draw records, so they can't give their geometry back
+	assert(std::find(mGpuDrivenMeshes.begin(), mGpuDrivenMeshes.end(), animatedMesh) == mGpuDrivenMeshes.end());
+	auto pooledMesh = std::find(mPooledMeshes.begin(), mPooledMeshes.end(), animatedMesh);
+	assert(pooledMesh != mPooledMeshes.end());
+	mPooledMeshes.erase(pooledMesh);
+
+	for (AnimatedSubMesh &subMesh : animatedMesh->getSubMeshes())
+	{
+		mGeometryPool.release(subMesh.geometryName);
+		subMesh.geometryName.clear();
+	}
+}
+
+void GraphicsContext::defragmentGeometry()
+{
+	std::vector<OffsetAllocator::Move> vertexMoves;
+	std::vector<OffsetAllocator::Move> indexMoves;
+	mGeometryPool.defragment(vertexMoves, indexMoves);
+	if (vertexMoves.empty() && indexMoves.empty())
+	{
+		return;
+	}
+
+	//nothing in flight can still be reading from the old offsets
+	VkResult result = vkDeviceWaitIdle(mDevice);
+	assert(checkResult(result));
+
+	moveGeometry(mGeometryVertexBuffer.buffer, sizeof(AnimatedMeshVertex), vertexMoves);
+	moveGeometry(mGeometryIndexBuffer.buffer, sizeof(U16), indexMoves);
+
+	for (AnimatedMesh *animatedMesh : mPooledMeshes)
+	{
+		updateSubMeshGeometry(animatedMesh);
+		recordMeshCommands(animatedMesh);
+	}
+	if (!mGpuDrivenMeshes.empty())
+	{
+		for (AnimatedMesh *animatedMesh : mGpuDrivenMeshes)
+		{
+			updateSubMeshGeometry(animatedMesh);
+		}
+		uploadGpuDrivenDrawRecords(0);
+	}
+}
+
+void GraphicsContext::moveGeometry(VkBuffer buffer, VkDeviceSize elementSize, const std::vector<OffsetAllocator::Move> &moves)
+{
+	if (moves.empty())
+	{
+		return;
+	}
+
+	//a move can overlap its own source, so everything goes out to a scratch buffer and back
+	VkDeviceSize scratchSize = 0;
+	for (const OffsetAllocator::Move &move : moves)
+	{
+		scratchSize += elementSize * move.size;
+	}
+	GpuBuffer scratchBuffer;
+	createBuffer(scratchSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&scratchBuffer);
+
+	std::vector<VkBufferCopy> toScratch;
+	std::vector<VkBufferCopy> fromScratch;
+	VkDeviceSize scratchOffset = 0;
+	for (const OffsetAllocator::Move &move : moves)
+	{
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = elementSize * move.srcOffset;
+		copyRegion.dstOffset = scratchOffset;
+		copyRegion.size = elementSize * move.size;
+		toScratch.push_back(copyRegion);
+
+		copyRegion.srcOffset = scratchOffset;
+		copyRegion.dstOffset = elementSize * move.dstOffset;
+		fromScratch.push_back(copyRegion);
+		scratchOffset += copyRegion.size;
+	}
+
+	VkCommandBuffer commandBuffer = beginSingleUseCommandBuffer();
+	vkCmdCopyBuffer(commandBuffer, buffer, scratchBuffer.buffer, (U32)toScratch.size(), toScratch.data());
+
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdCopyBuffer(commandBuffer, scratchBuffer.buffer, buffer, (U32)fromScratch.size(), fromScratch.data());
+	endSingleUseCommandBuffer(commandBuffer);
+
+	vmaDestroyBuffer(mAllocator, scratchBuffer.buffer, scratchBuffer.allocation);
+}
+
+void GraphicsContext::createSkinningPipelines()
+{
+	VkResult result = VK_SUCCESS;
+
+	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	bindings[2].binding = 2;
+	bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[2].descriptorCount = 1;
+	bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = bindings.size();
+	layoutInfo.pBindings = bindings.data();
+	result = vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mSkinningDescriptorSetLayout);
+	assert(checkResult(result));
+	mDescriptorCache.registerLayout(mSkinningDescriptorSetLayout, bindings.data(), (U32)bindings.size());
+
+	createComputePipeline("../data/shaders/skin_comp.spv", mSkinningDescriptorSetLayout, sizeof(U32),
+		&mSkinningPipelineLayout, &mSkinningPipeline);
+
+	if (mStaticPipeline == VK_NULL_HANDLE)
+	{
+		createStaticPipeline();
+	}
+}
+
+void GraphicsContext::createStaticPipeline()
+{
+	VkVertexInputBindingDescription bindingDescription = MeshVertex::getBindingDescription();
+	auto attributeDescriptions = MeshVertex::getAttributeDescriptions();
+	createMeshPipeline("../data/shaders/static_vert.spv", bindingDescription, attributeDescriptions.data(), attributeDescriptions.size(),
+		mDrawDescriptorSetLayout, &mStaticPipelineLayout, &mStaticPipeline);
+}
+
+void GraphicsContext::addTextureSurface(const std::string &textureName, SDL_Surface *pSurface)
+{
+	assert(pSurface != nullptr && mMaterials.find(textureName) == mMaterials.end());
+	mTextureSurfaces[textureName] = pSurface;
+}
+
+void GraphicsContext::loadTexture(const std::string &textureName, GpuImage *pImageOut, VkImageView *pImageViewOut)
+{
+	auto surface = mTextureSurfaces.find(textureName);
+	if (surface != mTextureSurfaces.end())
+	{
+		createImageFromSurface(surface->second, pImageOut);
+	}
+	else
+	{
+		SDL_Surface *pImageSurface = IMG_Load(textureName.c_str());
+		createImageFromSurface(pImageSurface, pImageOut);
+		SDL_FreeSurface(pImageSurface);
+	}
+	createImageView(pImageOut->image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, pImageViewOut);
+}
+
+const GraphicsContext::Material& GraphicsContext::getMaterial(const std::string &textureName)
+{
+	auto existing = mMaterials.find(textureName);
+	if (existing != mMaterials.end())
+	{
+		return existing->second;
+	}
+
+	Material material;
+	loadTexture(textureName, &material.textureImage, &material.textureImageView);
+
+	if (mBindlessTextures)
+	{
+		material.descriptorSet = mBindlessDescriptorSet;
+		material.textureIndex = addBindlessTexture(material.textureImageView);
+	}
+	else
+	{
+		DescriptorResource imageResource = makeImageResource(mTextureSampler, material.textureImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		material.descriptorSet = mDescriptorCache.getSet(mMaterialDescriptorSetLayout, &imageResource);
+		material.textureIndex = 0;
+	}
+	return mMaterials[textureName] = material;
+}
+
+static const U32 kMaxBindlessTextures = 1024; //size of the texture array in bindless.frag
+
+void GraphicsContext::enableBindlessTextures()
+{
+	assert(!mBindlessTextures);
+	//every draw indexes the array with its push constant
+	assert(mEnabledFeatures.shaderSampledImageArrayDynamicIndexing);
+	assert(mHasDescriptorIndexing || mPhysicalDeviceProperties.limits.maxPerStageDescriptorSampledImages >= kMaxBindlessTextures);
+	mBindlessTextures = true;
+	createBindlessResources();
+
+	//the default pipeline was made at init for per-material sets
+	vkDestroyPipeline(mDevice, mPipeline, nullptr);
+	vkDestroyPipelineLayout(mDevice, mPipelineLayout, nullptr);
+	createGraphicsPipeline();
+}
+
+void GraphicsContext::createBindlessResources()
+{
+	VkResult result = VK_SUCCESS;
+
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[0].pImmutableSamplers = &mTextureSampler;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	bindings[1].descriptorCount = kMaxBindlessTextures;
+	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+	poolSizes[0].descriptorCount = 1;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	poolSizes[1].descriptorCount = kMaxBindlessTextures;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = bindings.size();
+	layoutInfo.pBindings = bindings.data();
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = poolSizes.size();
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = 1;
+
+#ifdef VK_EXT_descriptor_indexing
+	//slots nobody has claimed yet can stay empty, and new textures can be written while frames using the set are in flight
+	std::array<VkDescriptorBindingFlagsEXT, 2> bindingFlags = { 0, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT };
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	bindingFlagsInfo.bindingCount = bindingFlags.size();
+	bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+	if (mHasDescriptorIndexing)
+	{
+		layoutInfo.pNext = &bindingFlagsInfo;
+		layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+		poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+	}
+#endif
+
+	result = vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mBindlessDescriptorSetLayout);
+	assert(checkResult(result));
+	result = vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mBindlessDescriptorPool);
+	assert(checkResult(result));
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = mBindlessDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &mBindlessDescriptorSetLayout;
+	result = vkAllocateDescriptorSets(mDevice, &allocInfo, &mBindlessDescriptorSet);
+	assert(checkResult(result));
+}
+
+U32 GraphicsContext::addBindlessTexture(VkImageView imageView)
+{
+	assert(mBindlessTextureCount < kMaxBindlessTextures);
+	const U32 textureIndex = mBindlessTextureCount++;
+
+	//Without partially bound arrays every element has to be valid, so the first texture
+	//also goes into every slot that hasn't been claimed yet
+	const U32 writeCount = (mHasDescriptorIndexing || textureIndex > 0) ? 1 : kMaxBindlessTextures;
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.imageView = imageView;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	std::vector<VkDescriptorImageInfo> imageInfos(writeCount, imageInfo);
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = mBindlessDescriptorSet;
+	descriptorWrite.dstBinding = 1;
+	descriptorWrite.dstArrayElement = textureIndex;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	descriptorWrite.descriptorCount = writeCount;
+	descriptorWrite.pImageInfo = imageInfos.data();
+	vkUpdateDescriptorSets(mDevice, 1, &descriptorWrite, 0, nullptr);
+	return textureIndex;
+}
+
+void GraphicsContext::createStaticBatches(const StaticBatcher &batcher)
+{
+	VkResult result = VK_SUCCESS;
+
+	assert(mStaticBatchCommandBuffers.empty());
+	const std::vector<StaticBatch> &batches = batcher.getBatches();
+	if (batches.empty())
+	{
+		return;
+	}
+	if (mStaticPipeline == VK_NULL_HANDLE)
+	{
+		createStaticPipeline();
+	}
+
+	const std::vector<MeshVertex> &vertices = batcher.getVertices();
+	const std::vector<U32> &indices = batcher.getIndices();
+	createBufferFromData((void *)vertices.data(), sizeof(vertices[0]) * vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		&mStaticBatchVertexBuffer);
+	createBufferFromData((void *)indices.data(), sizeof(indices[0]) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		&mStaticBatchIndexBuffer);
+
+	//batches are already in world space
+	ObjectConstantBuffer objectBuffer = {};
+	objectBuffer.modelMatrix = glm::mat4(1.f);
+	createBufferFromData(&objectBuffer, sizeof(objectBuffer), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &mStaticObjectConstantBuffer);
+
+	//binding 1 (the palette) isn't read by static.vert, so it just gets the object constants again
+	std::array<DescriptorResource, 2> drawResources = {
+		makeBufferResource(mStaticObjectConstantBuffer.buffer, 0, sizeof(ObjectConstantBuffer)),
+		makeBufferResource(mStaticObjectConstantBuffer.buffer, 0, sizeof(ObjectConstantBuffer))
+	};
+	mStaticDrawDescriptorSet = mDescriptorCache.getSet(mDrawDescriptorSetLayout, drawResources.data());
+	for (const StaticBatch &batch : batches)
+	{
+		getMaterial(batch.material);
+	}
+
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = mCommandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	allocInfo.commandBufferCount = (U32)batches.size();
+	mStaticBatchCommandBuffers.resize(batches.size());
+	result = vkAllocateCommandBuffers(mDevice, &allocInfo, mStaticBatchCommandBuffers.data());
+	assert(checkResult(result));
+	mStaticBatches = batches;
+	recordStaticBatchCommands();
+}
+
+void GraphicsContext::recordStaticBatchCommands()
+{
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = mRenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	//each batch is one draw, so it can be culled on its own
+	for (U32 i = 0; i < mStaticBatches.size(); i++)
+	{
+		const StaticBatch &batch = mStaticBatches[i];
+		const VkCommandBuffer commandBuffer = mStaticBatchCommandBuffers[i];
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mStaticPipeline);
+		setViewportAndScissor(commandBuffer);
+		VkBuffer vertexBuffers[] = { mStaticBatchVertexBuffer.buffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, mStaticBatchIndexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+		const Material &material = getMaterial(batch.material);
+		const VkDescriptorSet descriptorSets[] = { mFrameDescriptorSet, material.descriptorSet, mStaticDrawDescriptorSet };
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mStaticPipelineLayout, 0, 3, descriptorSets, 0, nullptr);
+		if (mBindlessTextures)
+		{
+			vkCmdPushConstants(commandBuffer, mStaticPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(material.textureIndex), &material.textureIndex);
+		}
+		vkCmdDrawIndexed(commandBuffer, batch.indexCount, 1, batch.firstIndex, batch.vertexOffset, 0);
+		vkEndCommandBuffer(commandBuffer);
+	}
+}
+
+void GraphicsContext::recordSkinningDispatch(VkCommandBuffer commandBuffer, VkBuffer paletteBuffer, VkDeviceSize paletteSize, U32 frameIndex,
+	AnimatedSubMesh *pSubMesh)
+{
+	//the frame being skinned may overlap the draws of the one before it, so each frame in flight writes its own output
+	pSubMesh->skinnedVertexBuffers.resize(mFrames.size());
+	pSubMesh->skinningDescriptorSets.resize(mFrames.size());
+	GpuBuffer &skinnedVertexBuffer = pSubMesh->skinnedVertexBuffers[frameIndex];
+
+	const U32 vertexCount = (U32)pSubMesh->vertices.size();
+	createBuffer(sizeof(MeshVertex) * vertexCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &skinnedVertexBuffer);
+
+	std::array<DescriptorResource, 3> resources = {
+		makeBufferResource(paletteBuffer, 0, paletteSize),
+		makeBufferResource(pSubMesh->vertexBuffer.buffer, 0, VK_WHOLE_SIZE),
+		makeBufferResource(skinnedVertexBuffer.buffer, 0, VK_WHOLE_SIZE)
+	};
+	pSubMesh->skinningDescriptorSets[frameIndex] = mDescriptorCache.getSet(mSkinningDescriptorSetLayout, resources.data());
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mSkinningPipelineLayout, 0, 1, &pSubMesh->skinningDescriptorSets[frameIndex], 0,
+		nullptr);
+	vkCmdPushConstants(commandBuffer, mSkinningPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(vertexCount), &vertexCount);
+	vkCmdDispatch(commandBuffer, (vertexCount + 63) / 64, 1, 1);
+}
+
+//matches CullInstance in occlusion_cull.comp
+struct CullInstance
+{
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+	U32 instanceIndex;
+	U32 firstCommand;
+	U32 commandCount;
+	U32 padding;
+};
+
+struct OcclusionCullConstants
+{
+	U32 instanceCount;
+	U32 phase;
+	U32 lateCommandOffset;
+	U32 hiZMipCount;
+	glm::vec2 hiZSize;
+};
+
+struct HiZConstants
+{
+	glm::ivec2 sourceSize;
+	glm::ivec2 destinationSize;
+};
+
+void GraphicsContext::enableOcclusionCulling(U32 maxInstances, U32 maxDrawCommands)
+{
+	assert(!mOcclusionCulling);
+	mOcclusionCulling = true;
+	mMaxCullInstances = maxInstances;
+	mMaxDrawCommands = maxDrawCommands;
+	createOcclusionCullingResources();
+	mFrameGraphDirty = true;
+}
+
+void GraphicsContext::createOcclusionCullingResources()
+{
+	VkResult result = VK_SUCCESS;
+
+	createHiZImage();
+
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.anisotropyEnable = VK_FALSE;
+	samplerInfo.maxAnisotropy = 1;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE; //the mip count changes with the swapchain size
+	result = vkCreateSampler(mDevice, &samplerInfo, nullptr, &mHiZSampler);
+	assert(checkResult(result));
+
+	//Hi-Z build: reads the level below, writes one level
+	std::array<VkDescriptorSetLayoutBinding, 2> hiZBindings = {};
+	hiZBindings[0].binding = 0;
+	hiZBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	hiZBindings[0].descriptorCount = 1;
+	hiZBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	hiZBindings[1].binding = 1;
+	hiZBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	hiZBindings[1].descriptorCount = 1;
+	hiZBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = hiZBindings.size();
+	layoutInfo.pBindings = hiZBindings.data();
+	result = vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mHiZDescriptorSetLayout);
+	assert(checkResult(result));
+	mDescriptorAllocator.registerLayout(mHiZDescriptorSetLayout, hiZBindings.data(), (U32)hiZBindings.size());
+
+	createComputePipeline("../data/shaders/hiz_build_comp.spv", mHiZDescriptorSetLayout, sizeof(HiZConstants),
+		&mHiZPipelineLayout, &mHiZPipeline);
+
+	//per-instance bounds in, per-draw instance counts and per-instance visibility out. The instances are written
+	//while earlier frames may still be culling, so every frame in flight gets its own.
+	for (FrameResources &frame : mFrames)
+	{
+		createBuffer(sizeof(CullInstance) * mMaxCullInstances, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.cullInstanceBuffer);
+		vmaMapMemory(mAllocator, frame.cullInstanceBuffer.allocation, &frame.cullInstanceData);
+	}
+	createBuffer(sizeof(VkDrawIndexedIndirectCommand) * mMaxDrawCommands * 2,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mDrawCommandBuffer);
+	createBuffer(sizeof(U32) * mMaxCullInstances, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mVisibilityBuffer);
+
+	//everything counts as visible until the first late pass says otherwise
+	VkCommandBuffer commandBuffer = beginSingleUseCommandBuffer();
+	mResourceStates.useBuffer(mVisibilityBuffer.buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	mResourceStates.flush(commandBuffer);
+	vkCmdFillBuffer(commandBuffer, mVisibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 1);
+	endSingleUseCommandBuffer(commandBuffer);
+
+	std::array<VkDescriptorSetLayoutBinding, 5> cullBindings = {};
+	for (U32 i = 0; i < cullBindings.size(); i++)
+	{
+		cullBindings[i].binding = i;
+		cullBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		cullBindings[i].descriptorCount = 1;
+		cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	cullBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	cullBindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+	layoutInfo.bindingCount = cullBindings.size();
+	layoutInfo.pBindings = cullBindings.data();
+	result = vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mCullDescriptorSetLayout);
+	assert(checkResult(result));
+	mDescriptorAllocator.registerLayout(mCullDescriptorSetLayout, cullBindings.data(), (U32)cullBindings.size());
+
+	createComputePipeline("../data/shaders/occlusion_cull_comp.spv", mCullDescriptorSetLayout, sizeof(OcclusionCullConstants),
+		&mCullPipelineLayout, &mCullPipeline);
+
+	for (FrameResources &frame : mFrames)
+	{
+		mDescriptorAllocator.allocate(mCullDescriptorSetLayout, &frame.cullDescriptorSet);
+
+		std::array<VkDescriptorBufferInfo, 4> bufferInfos = {};
+		bufferInfos[0].buffer = m_uniformBuffer.buffer;
+		bufferInfos[0].range = sizeof(SceneConstantBuffer);
+		bufferInfos[1].buffer = frame.cullInstanceBuffer.buffer;
+		bufferInfos[1].range = VK_WHOLE_SIZE;
+		bufferInfos[2].buffer = mDrawCommandBuffer.buffer;
+		bufferInfos[2].range = VK_WHOLE_SIZE;
+		bufferInfos[3].buffer = mVisibilityBuffer.buffer;
+		bufferInfos[3].range = VK_WHOLE_SIZE;
+
+		//the pyramid in binding 4 is written along with the Hi-Z build's sets
+		std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
+		for (U32 i = 0; i < descriptorWrites.size(); i++)
+		{
+			descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[i].dstSet = frame.cullDescriptorSet;
+			descriptorWrites[i].dstBinding = i;
+			descriptorWrites[i].descriptorType = cullBindings[i].descriptorType;
+			descriptorWrites[i].descriptorCount = 1;
+			descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+		}
+		vkUpdateDescriptorSets(mDevice, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void GraphicsContext::createHiZImage()
+{
+	//Hi-Z pyramid, mip 0 is a copy of the depth buffer and every level above keeps the farthest depth of the four below it
+	const U32 largestDimension = std::max(mSwapchainExtent.width, mSwapchainExtent.height);
+	mHiZMipCount = 1;
+	while ((largestDimension >> mHiZMipCount) > 0)
+	{
+		mHiZMipCount++;
+	}
+	createImage(mSwapchainExtent.width, mSwapchainExtent.height, mHiZMipCount, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mHiZImage);
+	createImageView(mHiZImage.image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, mHiZMipCount, &mHiZImageView);
+	mHiZMipViews.resize(mHiZMipCount);
+	for (U32 i = 0; i < mHiZMipCount; i++)
+	{
+		createImageView(mHiZImage.image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, i, 1, &mHiZMipViews[i]);
+	}
+
+	//the pyramid lives in GENERAL, it's written and sampled by compute only
+	VkCommandBuffer commandBuffer = beginSingleUseCommandBuffer();
+	mResourceStates.useImage(mHiZImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	mResourceStates.flush(commandBuffer);
+	endSingleUseCommandBuffer(commandBuffer);
+}
+
+void GraphicsContext::destroyHiZImage()
+{
+	mResourceStates.forgetImage(mHiZImage.image);
+	for (VkImageView view : mHiZMipViews)
+	{
+		vkDestroyImageView(mDevice, view, nullptr);
+	}
+	vkDestroyImageView(mDevice, mHiZImageView, nullptr);
+	vmaDestroyImage(mAllocator, mHiZImage.image, mHiZImage.allocation);
+	mHiZImage = GpuImage();
+}
+
+void GraphicsContext::updateHiZDescriptorSets()
+{
+	//sets can't go back to the allocator one at a time, so ones left over from a bigger pyramid just wait to be reused
+	while (mHiZDescriptorSets.size() < mHiZMipCount)
+	{
+		VkDescriptorSet set;
+		mDescriptorAllocator.allocate(mHiZDescriptorSetLayout, &set);
+		mHiZDescriptorSets.push_back(set);
+	}
+
+	VkDescriptorImageInfo hiZInfo = {};
+	hiZInfo.sampler = mHiZSampler;
+	hiZInfo.imageView = mHiZImageView;
+	hiZInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	//recreateSwapchain waits for the device first, so no frame's set is in use
+	for (FrameResources &frame : mFrames)
+	{
+		VkWriteDescriptorSet cullWrite = {};
+		cullWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		cullWrite.dstSet = frame.cullDescriptorSet;
+		cullWrite.dstBinding = 4;
+		cullWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		cullWrite.descriptorCount = 1;
+		cullWrite.pImageInfo = &hiZInfo;
+		vkUpdateDescriptorSets(mDevice, 1, &cullWrite, 0, nullptr);
+	}
+
+	//each mip is built from the one before it, mip 0 from the depth buffer
+	for (U32 i = 0; i < mHiZMipCount; i++)
+	{
+		VkDescriptorImageInfo sourceInfo = {};
+		sourceInfo.sampler = mHiZSampler;
+		sourceInfo.imageView = i == 0 ? mFrameGraph.getImageView(mDepthResource) : mHiZMipViews[i - 1];
+		sourceInfo.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo destinationInfo = {};
+		destinationInfo.imageView = mHiZMipViews[i];
+		destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = mHiZDescriptorSets[i];
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].pImageInfo = &sourceInfo;
+
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = mHiZDescriptorSets[i];
+		descriptorWrites[1].dstBinding = 1;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].pImageInfo = &destinationInfo;
+		vkUpdateDescriptorSets(mDevice, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void GraphicsContext::recordOcclusionCull(VkCommandBuffer commandBuffer, U32 instanceCount, U32 phase)
+{
+	//barriers come from the accesses its frame graph pass declares
+	if (instanceCount > 0)
+	{
+		OcclusionCullConstants constants = {};
+		constants.instanceCount = instanceCount;
+		constants.phase = phase;
+		constants.lateCommandOffset = mMaxDrawCommands;
+		constants.hiZMipCount = mHiZMipCount;
+		constants.hiZSize = glm::vec2(mSwapchainExtent.width, mSwapchainExtent.height);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mCullPipeline);
+		const FrameResources &frame = mFrames[mFrameCount % mFrames.size()];
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mCullPipelineLayout, 0, 1, &frame.cullDescriptorSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, mCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatch(commandBuffer, (instanceCount + 63) / 64, 1, 1);
+	}
+}
+
+void GraphicsContext::recordHiZBuild(VkCommandBuffer commandBuffer)
+{
+	//the frame graph has depth readable and the pyramid in GENERAL by now, the barriers between levels are ours
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mHiZPipeline);
+	glm::ivec2 sourceSize(mSwapchainExtent.width, mSwapchainExtent.height);
+	for (U32 i = 0; i < mHiZMipCount; i++)
+	{
+		//each level reads the one before it
+		if (i > 0)
+		{
+			mResourceStates.useImage(mHiZImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+			mResourceStates.flush(commandBuffer);
+		}
+
+		HiZConstants constants = {};
+		constants.sourceSize = sourceSize;
+		constants.destinationSize = i == 0 ? sourceSize : glm::max(sourceSize / 2, glm::ivec2(1));
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mHiZPipelineLayout, 0, 1, &mHiZDescriptorSets[i], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, mHiZPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatch(commandBuffer, (constants.destinationSize.x + 7) / 8, (constants.destinationSize.y + 7) / 8, 1);
+		sourceSize = constants.destinationSize;
+	}
+}
+
+void GraphicsContext::recordFrameTimeGraph(VkCommandBuffer commandBuffer)
+{
+	//bars are just cleared rects, so there's no pipeline, oldest frame on the left and anything over budget in red
+	const float budgetMillis = 1000.f / (mFrameRateLimit > 0 ? mFrameRateLimit : 60);
+	std::vector<VkClearRect> onTimeBars;
+	std::vector<VkClearRect> lateBars;
+	for (U32 i = 0; i < mFrameTimeHistory.size(); i++)
+	{
+		const float frameMillis = mFrameTimeHistory[(mFrameTimeHistoryIndex + i) % mFrameTimeHistory.size()];
+		const U32 barHeight = std::min((U32)(frameMillis / kFrameTimeGraphMaxMillis * kFrameTimeGraphHeight), kFrameTimeGraphHeight);
+		if (barHeight == 0)
+		{
+			continue;
+		}
+		VkClearRect bar = {};
+		bar.rect.offset = { (S32)(i * kFrameTimeGraphBarWidth), (S32)(kFrameTimeGraphHeight - barHeight) };
+		bar.rect.extent = { kFrameTimeGraphBarWidth, barHeight };
+		bar.layerCount = 1;
+		(frameMillis > budgetMillis ? lateBars : onTimeBars).push_back(bar);
+	}
+	const U32 budgetHeight = std::min((U32)(budgetMillis / kFrameTimeGraphMaxMillis * kFrameTimeGraphHeight), kFrameTimeGraphHeight - 1);
+	VkClearRect budgetLine = {};
+	budgetLine.rect.offset = { 0, (S32)(kFrameTimeGraphHeight - 1 - budgetHeight) };
+	budgetLine.rect.extent = { kFrameTimeGraphWidth, 1 };
+	budgetLine.layerCount = 1;
+
+	VkClearAttachment attachment = {};
+	attachment.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	attachment.colorAttachment = 0;
+	if (!onTimeBars.empty())
+	{
+		attachment.clearValue.color = { { 0.1f, 0.8f, 0.1f, 1.f } };
+		vkCmdClearAttachments(commandBuffer, 1, &attachment, (U32)onTimeBars.size(), onTimeBars.data());
+	}
+	if (!lateBars.empty())
+	{
+		attachment.clearValue.color = { { 0.9f, 0.1f, 0.1f, 1.f } };
+		vkCmdClearAttachments(commandBuffer, 1, &attachment, (U32)lateBars.size(), lateBars.data());
+	}
+	attachment.clearValue.color = { { 0.5f, 0.5f, 0.5f, 1.f } };
+	vkCmdClearAttachments(commandBuffer, 1, &attachment, 1, &budgetLine);
+}
+
+//matches Instance and DrawRecord in gpu_cull.comp and gpu_driven.vert
+struct GpuDrivenInstance
+{
+	glm::mat4 modelMatrix;
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+	U32 paletteOffset;
+	U32 padding[3];
+};
+
+struct GpuDrawRecord
+{
+	U32 instanceIndex;
+	U32 indexCount;
+	U32 firstIndex;
+	S32 vertexOffset;
+	U32 textureIndex;
+	U32 padding[3];
+};
+
+static const U32 kMaxGpuDrivenTextures = 64; //size of the texture array in gpu_driven.frag
+
+void GraphicsContext::enableGpuDrivenRendering(U32 maxInstances, U32 maxDrawRecords)
+{
+	assert(!mGpuDriven);
+	//gl_InstanceIndex is how a draw finds its record
+	assert(mEnabledFeatures.drawIndirectFirstInstance && mEnabledFeatures.shaderSampledImageArrayDynamicIndexing);
+	mGpuDriven = true;
+	mMaxGpuInstances = maxInstances;
+	mMaxGpuDrawRecords = maxDrawRecords;
+	mMaxGpuPaletteMatrices = maxInstances * (sizeof(AnimationConstantBuffer) / sizeof(glm::mat4));
+	createGpuDrivenResources();
+	mFrameGraphDirty = true;
+}
+
+void GraphicsContext::createGpuDrivenResources()
+{
+	VkResult result = VK_SUCCESS;
+
+	createBuffer(sizeof(GpuDrawRecord) * mMaxGpuDrawRecords, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mGpuDrawRecordBuffer);
+	createBuffer(sizeof(VkDrawIndexedIndirectCommand) * mMaxGpuDrawRecords, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mGpuDrawCommandBuffer);
+
+	//scene, instances, draw records, palettes, draw commands, textures
+	std::array<VkDescriptorSetLayoutBinding, 6> bindings = {};
+	for (U32 i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[5].descriptorCount = kMaxGpuDrivenTextures;
+	bindings[5].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = bindings.size();
+	layoutInfo.pBindings = bindings.data();
+	result = vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mGpuDrivenDescriptorSetLayout);
+	assert(checkResult(result));
+	mDescriptorAllocator.registerLayout(mGpuDrivenDescriptorSetLayout, bindings.data(), (U32)bindings.size());
+
+	createGraphicsPipeline("../data/shaders/gpu_driven_vert.spv", "../data/shaders/gpu_driven_frag.spv", { mGpuDrivenDescriptorSetLayout },
+		&mGpuDrivenPipelineLayout, &mGpuDrivenPipeline);
+	createComputePipeline("../data/shaders/gpu_cull_comp.spv", mGpuDrivenDescriptorSetLayout, sizeof(U32),
+		&mGpuCullPipelineLayout, &mGpuCullPipeline);
+
+	//the CPU rewrites instances and palettes while earlier frames may still be reading theirs
+	for (FrameResources &frame : mFrames)
+	{
+		createBuffer(sizeof(GpuDrivenInstance) * mMaxGpuInstances, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.gpuInstanceBuffer);
+		vmaMapMemory(mAllocator, frame.gpuInstanceBuffer.allocation, &frame.gpuInstanceData);
+		createBuffer(sizeof(glm::mat4) * mMaxGpuPaletteMatrices, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.gpuPaletteBuffer);
+		vmaMapMemory(mAllocator, frame.gpuPaletteBuffer.allocation, &frame.gpuPaletteData);
+
+		mDescriptorAllocator.allocate(mGpuDrivenDescriptorSetLayout, &frame.gpuDrivenDescriptorSet);
+
+		std::array<VkDescriptorBufferInfo, 5> bufferInfos = {};
+		bufferInfos[0].buffer = m_uniformBuffer.buffer;
+		bufferInfos[0].range = sizeof(SceneConstantBuffer);
+		bufferInfos[1].buffer = frame.gpuInstanceBuffer.buffer;
+		bufferInfos[1].range = VK_WHOLE_SIZE;
+		bufferInfos[2].buffer = mGpuDrawRecordBuffer.buffer;
+		bufferInfos[2].range = VK_WHOLE_SIZE;
+		bufferInfos[3].buffer = frame.gpuPaletteBuffer.buffer;
+		bufferInfos[3].range = VK_WHOLE_SIZE;
+		bufferInfos[4].buffer = mGpuDrawCommandBuffer.buffer;
+		bufferInfos[4].range = VK_WHOLE_SIZE;
+
+		std::array<VkWriteDescriptorSet, 5> descriptorWrites = {};
+		for (U32 i = 0; i < descriptorWrites.size(); i++)
+		{
+			descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[i].dstSet = frame.gpuDrivenDescriptorSet;
+			descriptorWrites[i].dstBinding = i;
+			descriptorWrites[i].descriptorType = bindings[i].descriptorType;
+			descriptorWrites[i].descriptorCount = 1;
+			descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+		}
+		vkUpdateDescriptorSets(mDevice, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void GraphicsContext::addGpuDrivenMesh(AnimatedMesh *animatedMesh)
+{
+	assert(mGpuDriven);
+	//everything has to come out of the shared palette buffer and the one pipeline
+	assert(!animatedMesh->getBakedAnimation() && !animatedMesh->usesComputeSkinning());
+	SharedPose *sharedPose = animatedMesh->getSharedPose();
+	assert((sharedPose ? sharedPose->paletteFormat : animatedMesh->getPaletteFormat()) == kPaletteFormatMatrix4x4);
+
+	const U32 instanceIndex = (U32)mGpuDrivenMeshes.size();
+	assert(instanceIndex < mMaxGpuInstances);
+
+	//geometry comes out of the shared pool like everything else, the textures go into one array
+	const U32 textureCount = (U32)mGpuDrivenTextures.size();
+	U32 subMeshIndex = 0;
+	for (AnimatedSubMesh &subMesh : animatedMesh->getSubMeshes())
+	{
+		acquireSubMeshGeometry(animatedMesh->getModelName() + "#" + std::to_string(subMeshIndex++), &subMesh);
+		addGpuDrivenTexture(subMesh.textureName);
+	}
+	if (mGpuDrivenTextures.size() != textureCount)
+	{
+		updateGpuDrivenTextureDescriptors();
+	}
+
+	//instances sharing a pose share its palette too
+	//palettes only get written by updateGpuDrivenInstances, the shared ones every frame
+	const U32 boneCount = animatedMesh->getBoneCount();
+	U32 paletteOffset = mGpuPaletteMatrixCount;
+	auto sharedPalette = sharedPose ? mGpuSharedPaletteOffsets.find(sharedPose) : mGpuSharedPaletteOffsets.end();
+	if (sharedPalette != mGpuSharedPaletteOffsets.end())
+	{
+		paletteOffset = sharedPalette->second;
+	}
+	else
+	{
+		assert(mGpuPaletteMatrixCount + boneCount <= mMaxGpuPaletteMatrices);
+		mGpuPaletteMatrixCount += boneCount;
+		if (sharedPose)
+		{
+			mGpuSharedPaletteOffsets[sharedPose] = paletteOffset;
+		}
+	}
+
+	mGpuDrivenMeshes.push_back(animatedMesh);
+	mGpuDrivenPaletteOffsets.push_back(paletteOffset);
+	mGpuDrivenPaletteStaleFrames.push_back((U32)mFrames.size());
+	uploadGpuDrivenDrawRecords(instanceIndex);
+	invalidateGpuDrivenCommands();
+}
+
+void GraphicsContext::uploadGpuDrivenDrawRecords(U32 firstInstance)
+{
+	U32 firstRecord = 0;
+	std::vector<GpuDrawRecord> records;
+	for (U32 i = 0; i < mGpuDrivenMeshes.size(); i++)
+	{
+		for (const AnimatedSubMesh &subMesh : mGpuDrivenMeshes[i]->getSubMeshes())
+		{
+			if (i < firstInstance)
+			{
+				firstRecord++;
+				continue;
+			}
+			GpuDrawRecord record = {};
+			record.instanceIndex = i;
+			record.indexCount = (U32)subMesh.indices.size();
+			record.firstIndex = subMesh.firstIndex;
+			record.vertexOffset = subMesh.vertexOffset;
+			record.textureIndex = mGpuDrivenTextureIndices[subMesh.textureName];
+			records.push_back(record);
+		}
+	}
+	assert(firstRecord + records.size() <= mMaxGpuDrawRecords);
+	if (!records.empty())
+	{
+		uploadBuffer(records.data(), sizeof(records[0]) * records.size(), mGpuDrawRecordBuffer.buffer, sizeof(GpuDrawRecord) * firstRecord);
+	}
+	mGpuDrawRecordCount = firstRecord + (U32)records.size();
+}
+
+U32 GraphicsContext::addGpuDrivenTexture(const std::string &textureName)
+{
+	auto existing = mGpuDrivenTextureIndices.find(textureName);
+	if (existing != mGpuDrivenTextureIndices.end())
+	{
+		return existing->second;
+	}
+
+	assert(mGpuDrivenTextures.size() < kMaxGpuDrivenTextures);
+	GpuImage textureImage;
+	VkImageView textureImageView;
+	loadTexture(textureName, &textureImage, &textureImageView);
+
+	const U32 textureIndex = (U32)mGpuDrivenTextures.size();
+	mGpuDrivenTextures.push_back(textureImage);
+	mGpuDrivenTextureViews.push_back(textureImageView);
+	mGpuDrivenTextureIndices[textureName] = textureIndex;
+	return textureIndex;
+}
+
+void GraphicsContext::updateGpuDrivenTextureDescriptors()
+{
+	//every slot has to hold something valid, the unused ones just repeat the first texture
+	std::vector<VkDescriptorImageInfo> imageInfos(kMaxGpuDrivenTextures);
+	for (U32 i = 0; i < kMaxGpuDrivenTextures; i++)
+	{
+		imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[i].imageView = mGpuDrivenTextureViews[i < mGpuDrivenTextureViews.size() ? i : 0];
+		imageInfos[i].sampler = mTextureSampler;
+	}
+
+	for (FrameResources &frame : mFrames)
+	{
+		VkWriteDescriptorSet descriptorWrite = {};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = frame.gpuDrivenDescriptorSet;
+		descriptorWrite.dstBinding = 5;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrite.descriptorCount = kMaxGpuDrivenTextures;
+		descriptorWrite.pImageInfo = imageInfos.data();
+		vkUpdateDescriptorSets(mDevice, 1, &descriptorWrite, 0, nullptr);
+	}
+}
+
+void GraphicsContext::updateGpuDrivenInstances(FrameResources &frame)
+{
+	//plain data writes, nothing here records or submits anything per instance
+	GpuDrivenInstance *pInstances = (GpuDrivenInstance *)frame.gpuInstanceData;
+	glm::mat4 *pPalettes = (glm::mat4 *)frame.gpuPaletteData;
+	for (U32 i = 0; i < mGpuDrivenMeshes.size(); i++)
+	{
+		AnimatedMesh *animatedMesh = mGpuDrivenMeshes[i];
+		glm::vec3 boundsMin, boundsMax;
+		animatedMesh->getWorldBounds(boundsMin, boundsMax);
+
+		GpuDrivenInstance &instance = pInstances[i];
+		instance.modelMatrix = animatedMesh->buildModelMatrix();
+		instance.boundsMin = glm::vec4(boundsMin, 1.f);
+		instance.boundsMax = glm::vec4(boundsMax, 1.f);
+		instance.paletteOffset = mGpuDrivenPaletteOffsets[i];
+
+		//every frame has its own copy of the palette, so a change has to reach each of them in turn
+		if (animatedMesh->getSharedPose())
+		{
+			continue;
+		}
+		if (animatedMesh->hasPaletteChanged())
+		{
+			mGpuDrivenPaletteStaleFrames[i] = (U32)mFrames.size();
+		}
+		if (mGpuDrivenPaletteStaleFrames[i] > 0)
+		{
+			const std::vector<glm::vec4> &palette = animatedMesh->getPalette();
+			memcpy(pPalettes + instance.paletteOffset, palette.data(), sizeof(palette[0]) * palette.size());
+			mGpuDrivenPaletteStaleFrames[i]--;
+		}
+	}
+	for (auto &sharedPalette : mGpuSharedPaletteOffsets)
+	{
+		const std::vector<glm::vec4> &palette = sharedPalette.first->palette;
+		memcpy(pPalettes + sharedPalette.second, palette.data(), sizeof(palette[0]) * palette.size());
+	}
+}
+
+void GraphicsContext::invalidateGpuDrivenCommands()
+{
+	for (FrameResources &frame : mFrames)
 	{
-		//Create resources in GPU memory
-		createBufferFromData(subMesh.vertices.data(), sizeof(subMesh.vertices[0]) * subMesh.vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			&subMesh.vertexBuffer);
-		
-		createBufferFromData(subMesh.indices.data(), sizeof(subMesh.indices[0]) * subMesh.indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-			&subMesh.indexBuffer);
-		
-		SDL_Surface *pImageSurface = IMG_Load(subMesh.textureName.c_str());
-		createImageFromSurface(pImageSurface, &subMesh.textureImage);
-		SDL_FreeSurface(pImageSurface);
-		createImageView(subMesh.textureImage.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, &subMesh.textureImageView);
-		
-		//Create descriptor set
-		VkDescriptorSetLayout layouts[] = { mDescriptorSetLayout };
-		VkDescriptorSetAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = mDescriptorPool;
-		allocInfo.descriptorSetCount = 1;
-		allocInfo.pSetLayouts = layouts;
-
-		result = vkAllocateDescriptorSets(mDevice, &allocInfo, &subMesh.descriptorSet);
+		frame.gpuDrivenCommandsDirty = true;
+	}
+}
+
+void GraphicsContext::recordGpuDrivenCommands(FrameResources &frame)
+{
+	VkResult result = VK_SUCCESS;
+
+	//the frame's fence has already retired its last use, so this never has to wait on the GPU
+	if (frame.gpuDrivenCommandBuffer == VK_NULL_HANDLE)
+	{
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = mCommandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+		result = vkAllocateCommandBuffers(mDevice, &allocInfo, &frame.gpuDrivenCommandBuffer);
 		assert(checkResult(result));
+	}
+	const VkCommandBuffer commandBuffer = frame.gpuDrivenCommandBuffer;
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = mRenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+	result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	assert(checkResult(result));
 
-		VkDescriptorBufferInfo bufferInfo = {};
-		bufferInfo.buffer = m_uniformBuffer.buffer;
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(SceneConstantBuffer);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mGpuDrivenPipeline);
+	setViewportAndScissor(commandBuffer);
+	VkBuffer vertexBuffers[] = { mGeometryVertexBuffer.buffer };
+	VkDeviceSize offsets[] = { 0 };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, mGeometryIndexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mGpuDrivenPipelineLayout, 0, 1, &frame.gpuDrivenDescriptorSet, 0, nullptr);
+	if (mEnabledFeatures.multiDrawIndirect)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, mGpuDrawCommandBuffer.buffer, 0, mGpuDrawRecordCount, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else
+	{
+		//still recorded once, the per-draw cost is only paid when meshes are added
+		for (U32 i = 0; i < mGpuDrawRecordCount; i++)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, mGpuDrawCommandBuffer.buffer, sizeof(VkDrawIndexedIndirectCommand) * i, 1,
+				sizeof(VkDrawIndexedIndirectCommand));
+		}
+	}
 
-		VkDescriptorBufferInfo objectBufferInfo = {};
-		objectBufferInfo.buffer = animatedMesh->m_objectConstantBuffer.buffer;
-		objectBufferInfo.offset = 0;
-		objectBufferInfo.range = sizeof(ObjectConstantBuffer);
+	result = vkEndCommandBuffer(commandBuffer);
+	assert(checkResult(result));
+	frame.gpuDrivenCommandsDirty = false;
+}
 
-		VkDescriptorBufferInfo animationBufferInfo = {};
-		animationBufferInfo.buffer = animatedMesh->m_animationConstantBuffer.buffer;
-		animationBufferInfo.offset = 0;
-		animationBufferInfo.range = sizeof(AnimationConstantBuffer);
+void GraphicsContext::recordGpuDrivenCull(VkCommandBuffer commandBuffer)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mGpuCullPipeline);
+	const FrameResources &frame = mFrames[mFrameCount % mFrames.size()];
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mGpuCullPipelineLayout, 0, 1, &frame.gpuDrivenDescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, mGpuCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(mGpuDrawRecordCount), &mGpuDrawRecordCount);
+	vkCmdDispatch(commandBuffer, (mGpuDrawRecordCount + 63) / 64, 1, 1);
+}
 
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = subMesh.textureImageView;
-		imageInfo.sampler = mTextureSampler;
+void GraphicsContext::createBakedAnimation(AnimatedMesh *animatedMesh, BakedAnimation *pBakedAnimationOut)
+{
+	const Animation *animation = animatedMesh->getAnimation();
+	assert(animation);
 
-		std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = subMesh.descriptorSet;
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].pBufferInfo = &bufferInfo;
-		descriptorWrites[0].pImageInfo = nullptr;
-		descriptorWrites[0].pTexelBufferView = nullptr;
+	//only pay for the baked pipeline if something actually uses it, it builds while the palettes are baked and uploaded
+	if (mBakedPipeline == VK_NULL_HANDLE)
+	{
+		requestMeshPipeline("../data/shaders/animated_baked_vert.spv", mBakedDrawDescriptorSetLayout, &mBakedPipelineRequest,
+			&mBakedPipelineLayout, &mBakedPipeline);
+	}
 
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = subMesh.descriptorSet;
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pBufferInfo = &objectBufferInfo;
-		descriptorWrites[1].pImageInfo = nullptr;
-		descriptorWrites[1].pTexelBufferView = nullptr;
-
-		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[2].dstSet = subMesh.descriptorSet;
-		descriptorWrites[2].dstBinding = 2;
-		descriptorWrites[2].dstArrayElement = 0;
-		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[2].descriptorCount = 1;
-		descriptorWrites[2].pBufferInfo = &animationBufferInfo;
-		descriptorWrites[2].pImageInfo = nullptr;
-		descriptorWrites[2].pTexelBufferView = nullptr;
-
-		descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[3].dstSet = subMesh.descriptorSet;
-		descriptorWrites[3].dstBinding = 3;
-		descriptorWrites[3].dstArrayElement = 0;
-		descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[3].descriptorCount = 1;
-		descriptorWrites[3].pBufferInfo = nullptr;
-		descriptorWrites[3].pImageInfo = &imageInfo;
-		descriptorWrites[3].pTexelBufferView = nullptr;
+	std::vector<glm::mat4> palettes;
+	animatedMesh->bakeSkinningPalettes(palettes);
 
-		vkUpdateDescriptorSets(mDevice, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	pBakedAnimationOut->frameCount = animation->getFrameCount();
+	pBakedAnimationOut->boneCount = animation->getBoneCount();
+	pBakedAnimationOut->frameRate = animation->getFrameRate();
+	createBufferFromData(palettes.data(), sizeof(palettes[0]) * palettes.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		&pBakedAnimationOut->paletteBuffer);
+}
 
-		//Record commands
-		vkCmdBindPipeline(animatedMesh->m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipeline);
-		VkBuffer vertexBuffers[] = { subMesh.vertexBuffer.buffer };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(animatedMesh->m_commandBuffer, 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(animatedMesh->m_commandBuffer, subMesh.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
-		vkCmdBindDescriptorSets(animatedMesh->m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, 1, &subMesh.descriptorSet, 0, nullptr);
-		vkCmdDrawIndexed(animatedMesh->m_commandBuffer, subMesh.indices.size(), 1, 0, 0, 0);
+void GraphicsContext::getPalettePipeline(PaletteFormat paletteFormat, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut)
+{
+	static const char *vertShaderFilenames[kPaletteFormatCount] = {
+		"../data/shaders/vert.spv",
+		"../data/shaders/animated_affine_vert.spv",
+		"../data/shaders/animated_dq_vert.spv",
+	};
+
+	//the compact formats are only built the first time a mesh asks for them
+	if (mPalettePipelines[paletteFormat] == VK_NULL_HANDLE)
+	{
+		requestMeshPipeline(vertShaderFilenames[paletteFormat], mDrawDescriptorSetLayout, &mPalettePipelineRequests[paletteFormat],
+			&mPalettePipelineLayouts[paletteFormat], &mPalettePipelines[paletteFormat]);
+	}
+	*pPipelineLayoutOut = mPalettePipelineLayouts[paletteFormat];
+	*pPipelineOut = mPalettePipelines[paletteFormat];
+}
+
+void GraphicsContext::requestMeshPipeline(const std::string &vertShaderFilename, VkDescriptorSetLayout drawSetLayout, S32 *pRequest,
+	VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut)
+{
+	if (*pRequest < 0)
+	{
+		*pRequest = (S32)mPipelineManager.requestPipeline([this, vertShaderFilename, drawSetLayout](VkPipelineLayout *pLayout, VkPipeline *pPipeline) {
+			createMeshPipeline(vertShaderFilename, drawSetLayout, pLayout, pPipeline);
+		}, VK_NULL_HANDLE, VK_NULL_HANDLE);
+	}
+	mPipelineManager.getPipeline(*pRequest, pPipelineLayoutOut, pPipelineOut);
+}
+
+void GraphicsContext::updatePipelineRequests()
+{
+	if (mMeshesAwaitingPipelines.empty())
+	{
+		return;
 	}
 
-	vkEndCommandBuffer(animatedMesh->m_commandBuffer);
+	std::vector<AnimatedMesh*> readyMeshes;
+	for (U32 i = 0; i < mMeshesAwaitingPipelines.size();)
+	{
+		VkPipelineLayout pipelineLayout;
+		VkPipeline pipeline;
+		if (getMeshPipeline(mMeshesAwaitingPipelines[i], &pipelineLayout, &pipeline))
+		{
+			readyMeshes.push_back(mMeshesAwaitingPipelines[i]);
+			mMeshesAwaitingPipelines[i] = mMeshesAwaitingPipelines.back();
+			mMeshesAwaitingPipelines.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+	if (readyMeshes.empty() || mRecordingThreadPool)
+	{
+		//recording every frame already picks them up
+		return;
+	}
 
-	mSecondaryCommandBuffers.push_back(animatedMesh->m_commandBuffer);
+	//the empty command buffers they were given may still be in flight
+	VkResult result = vkDeviceWaitIdle(mDevice);
+	assert(checkResult(result));
+	for (AnimatedMesh *animatedMesh : readyMeshes)
+	{
+		recordMeshCommands(animatedMesh);
+	}
 }
 
 void GraphicsContext::updateConstantBuffer(const void * pData, U32 bufferSize, VkBuffer buffer)
 {
-	void *data;
-	vmaMapMemory(mAllocator, m_uniformStagingBuffer.allocation, &data);
-	memcpy(data, pData, bufferSize);
-	vmaUnmapMemory(mAllocator, m_uniformStagingBuffer.allocation);
-	copyBuffer(m_uniformStagingBuffer.buffer, buffer, bufferSize);
+	//the frame's fence has to be seen before its upload buffer can be written over
+	waitForNextFrame();
+	FrameResources &frame = mFrames[mFrameCount % mFrames.size()];
+	assert(frame.uploadOffset + bufferSize <= kUploadBufferSize);
+
+	memcpy(frame.uploadData + frame.uploadOffset, pData, bufferSize);
+	PendingUpload upload;
+	upload.buffer = buffer;
+	upload.region.srcOffset = frame.uploadOffset;
+	upload.region.dstOffset = 0;
+	upload.region.size = bufferSize;
+	frame.uploads.push_back(upload);
+	frame.uploadOffset += bufferSize;
+}
+
+void GraphicsContext::recordUploads(FrameResources &frame, VkCommandBuffer commandBuffer)
+{
+	if (frame.uploads.empty())
+	{
+		return;
+	}
+
+	//Like the skinning outputs, there are too many constant buffers to declare to the graph, so they get their own barriers.
+	//Vertex input is in there because that's where graphics waits on the previous frame's skinning, which reads the palettes.
+	const VkPipelineStageFlags readStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	vkCmdPipelineBarrier(commandBuffer, readStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+	for (const PendingUpload &upload : frame.uploads)
+	{
+		vkCmdCopyBuffer(commandBuffer, frame.uploadBuffer.buffer, upload.buffer, 1, &upload.region);
+	}
+	VkMemoryBarrier uploadBarrier = {};
+	uploadBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	uploadBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	uploadBarrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, readStages, 0, 1, &uploadBarrier, 0, nullptr, 0, nullptr);
+
+	//the staged data itself stays put until the frame's fence comes around again
+	frame.uploads.clear();
+	frame.uploadOffset = 0;
+}
+
+bool GraphicsContext::submitUploads(FrameResources &frame, VkSemaphore signalSemaphore, VkFence fence)
+{
+	VkResult result = VK_SUCCESS;
+
+	if (frame.uploads.empty())
+	{
+		return false;
+	}
+
+	//only ever reused after the frame's fence, which comes after this on the same queue
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	result = vkBeginCommandBuffer(frame.uploadCommandBuffer, &beginInfo);
+	assert(checkResult(result));
+	recordUploads(frame, frame.uploadCommandBuffer);
+	result = vkEndCommandBuffer(frame.uploadCommandBuffer);
+	assert(checkResult(result));
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &frame.uploadCommandBuffer;
+	submitInfo.signalSemaphoreCount = signalSemaphore != VK_NULL_HANDLE ? 1 : 0;
+	submitInfo.pSignalSemaphores = &signalSemaphore;
+
+	if (fence != VK_NULL_HANDLE)
+	{
+		result = vkResetFences(mDevice, 1, &fence);
+		assert(checkResult(result));
+	}
+	result = vkQueueSubmit(mQueue, 1, &submitInfo, fence);
+	assert(checkResult(result));
+	return true;
 }
 
 void GraphicsContext::updateSceneConstantBuffer(const SceneConstantBuffer &sceneConstantBuffer)
 {
+	mViewMatrix = sceneConstantBuffer.viewMatrix;
 	updateConstantBuffer(&sceneConstantBuffer, sizeof(sceneConstantBuffer), m_uniformBuffer.buffer);
 }
 
-void GraphicsContext::drawFrame()
+void GraphicsContext::waitForNextFrame()
+{
+	VkResult result = VK_SUCCESS;
+
+	if (mFrameStarted)
+	{
+		return;
+	}
+	const std::chrono::high_resolution_clock::time_point waitStart = std::chrono::high_resolution_clock::now();
+
+	//this frame's pools were last submitted kFramesInFlight frames ago
+	FrameResources &frame = mFrames[mFrameCount % mFrames.size()];
+	result = vkWaitForFences(mDevice, 1, &frame.fence, VK_TRUE, std::numeric_limits<U64>::max());
+	assert(checkResult(result));
+
+	if (mFrameRateLimit > 0)
+	{
+		//paced off the schedule rather than when the wait ended, so the average holds, unless it's fallen behind
+		const std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		if (now < mNextFrameTime)
+		{
+			std::this_thread::sleep_until(mNextFrameTime);
+		}
+		mNextFrameTime = std::max(mNextFrameTime, now) + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+			std::chrono::duration<double>(1.0 / mFrameRateLimit));
+	}
+
+	const std::chrono::high_resolution_clock::time_point frameStart = std::chrono::high_resolution_clock::now();
+	mFrameTiming.waitMillis = std::chrono::duration<float, std::milli>(frameStart - waitStart).count();
+	mFrameTiming.frameMillis = mFrameCount > 0 ? std::chrono::duration<float, std::milli>(frameStart - mFrameStartTime).count() : 0.f;
+	if (mFrameTimeGraph)
+	{
+		mFrameTimeHistory[mFrameTimeHistoryIndex] = mFrameTiming.frameMillis;
+		mFrameTimeHistoryIndex = (mFrameTimeHistoryIndex + 1) % mFrameTimeHistory.size();
+	}
+	mFrameStartTime = frameStart;
+	mFrameStarted = true;
+}
+
+void GraphicsContext::drawFrame(const std::vector<AnimatedMesh*> &visibleMeshes)
+{
+	drawFrame(visibleMeshes, std::vector<U32>());
+}
+
+void GraphicsContext::drawFrame(const std::vector<AnimatedMesh*> &visibleMeshes, const std::vector<U32> &visibleStaticBatches)
 {
 	VkResult result = VK_SUCCESS;
+
+	if (mSwapchainDirty && !recreateSwapchain())
+	{
+		//minimized, nothing to draw to, so don't spin while waiting to come back
+		//the constant buffers staged for this frame still have to land, the fence covers them instead
+		FrameResources &droppedFrame = mFrames[mFrameCount % mFrames.size()];
+		submitUploads(droppedFrame, VK_NULL_HANDLE, droppedFrame.fence);
+		mFrameStarted = false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		return;
+	}
+	if (mFrameGraphDirty)
+	{
+		buildFrameGraph();
+	}
+
+	waitForNextFrame();
+	const U32 frameIndex = mFrameCount % mFrames.size();
+	FrameResources &frame = mFrames[frameIndex];
+	updatePipelineRequests();
+
+	//only the visible set gets submitted, culled meshes cost nothing on the GPU
+	mSecondaryCommandBuffers.clear();
+	mLateSecondaryCommandBuffers.clear();
+	mComputeCommandBuffers.clear();
+	//static batches only go in the first pass, where they also help fill the depth the Hi-Z is built from
+	for (U32 batchIndex : visibleStaticBatches)
+	{
+		mSecondaryCommandBuffers.push_back(mStaticBatchCommandBuffers[batchIndex]);
+	}
+	//Secondaries execute in the order they're listed, so without the render queue sorting the draws
+	//the meshes have to go front to back themselves for early-Z to reject anything
+	mSortedMeshes.clear();
+	for (AnimatedMesh *animatedMesh : visibleMeshes)
+	{
+		float viewDepth = 0.f;
+		if (!mRecordingThreadPool)
+		{
+			glm::vec3 boundsMin, boundsMax;
+			animatedMesh->getWorldBounds(boundsMin, boundsMax);
+			viewDepth = -(mViewMatrix * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.f)).z;
+		}
+		mSortedMeshes.push_back(std::make_pair(viewDepth, animatedMesh));
+	}
+	if (!mRecordingThreadPool)
+	{
+		std::sort(mSortedMeshes.begin(), mSortedMeshes.end(), [](const std::pair<float, AnimatedMesh*> &a, const std::pair<float, AnimatedMesh*> &b)
+		{
+			return a.first < b.first;
+		});
+	}
+	CullInstance *pCullInstances = (CullInstance *)frame.cullInstanceData;
+	U32 cullInstanceCount = 0;
+	for (const std::pair<float, AnimatedMesh*> &sortedMesh : mSortedMeshes)
+	{
+		AnimatedMesh *animatedMesh = sortedMesh.second;
+		if (!mRecordingThreadPool)
+		{
+			mSecondaryCommandBuffers.push_back(animatedMesh->m_commandBuffers[frameIndex % animatedMesh->m_commandBuffers.size()]);
+		}
+		if (!animatedMesh->m_skinningCommandBuffers.empty())
+		{
+			mComputeCommandBuffers.push_back(animatedMesh->m_skinningCommandBuffers[frameIndex]);
+		}
+		if (mOcclusionCulling)
+		{
+			//the frustum was already handled on the CPU, the GPU only has to deal with occlusion
+			glm::vec3 boundsMin, boundsMax;
+			animatedMesh->getWorldBounds(boundsMin, boundsMax);
+			assert(cullInstanceCount < mMaxCullInstances);
+			CullInstance &cullInstance = pCullInstances[cullInstanceCount++];
+			cullInstance.boundsMin = glm::vec4(boundsMin, 1.f);
+			cullInstance.boundsMax = glm::vec4(boundsMax, 1.f);
+			cullInstance.instanceIndex = animatedMesh->m_cullIndex;
+			cullInstance.firstCommand = animatedMesh->m_firstDrawCommand;
+			cullInstance.commandCount = (U32)animatedMesh->getSubMeshes().size();
+			if (!mRecordingThreadPool)
+			{
+				mLateSecondaryCommandBuffers.push_back(animatedMesh->m_lateCommandBuffers[frameIndex % animatedMesh->m_lateCommandBuffers.size()]);
+			}
+		}
+	}
+	if (mRecordingThreadPool && !visibleMeshes.empty())
+	{
+		recordParallelDraws(frame, visibleMeshes);
+	}
+	mFrameCullInstanceCount = cullInstanceCount;
+	//one secondary covers the whole GPU-driven scene, culling happens in recordGpuDrivenCull
+	if (mGpuDriven && mGpuDrawRecordCount > 0)
+	{
+		if (frame.gpuDrivenCommandsDirty)
+		{
+			recordGpuDrivenCommands(frame);
+		}
+		updateGpuDrivenInstances(frame);
+		mSecondaryCommandBuffers.push_back(frame.gpuDrivenCommandBuffer);
+	}
 	
 	U32 imageIndex;
-	vkAcquireNextImageKHR(mDevice, mSwapchain, std::numeric_limits<U64>::max(), imageAcquiredSemaphore, VK_NULL_HANDLE, &imageIndex);
+	result = vkAcquireNextImageKHR(mDevice, mSwapchain, std::numeric_limits<U64>::max(), frame.imageAcquiredSemaphore, VK_NULL_HANDLE, &imageIndex);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		//nothing else was submitted, so the frame can be dropped once its constant buffer updates are flushed
+		submitUploads(frame, VK_NULL_HANDLE, frame.fence);
+		mSwapchainDirty = true;
+		mFrameStarted = false;
+		return;
+	}
+	//a suboptimal swapchain still presents, it gets replaced after this frame
+	assert(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+	if (result == VK_SUBOPTIMAL_KHR)
+	{
+		mSwapchainDirty = true;
+	}
 	
-	const VkCommandBuffer commandBuffer = mCommandBuffers[imageIndex];
+	//waitForNextFrame already saw this frame's fence, so its last submit of the primary has retired
+	const VkCommandBuffer commandBuffer = frame.commandBuffer;
 	result = vkResetCommandBuffer(commandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
 	assert(checkResult(result));
 
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
 	assert(checkResult(result));
 
-	VkRenderPassBeginInfo renderPassInfo = {};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassInfo.renderPass = mRenderPass;
-	renderPassInfo.framebuffer = mSwapchainFramebuffers[imageIndex];
-	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent = mSwapchainExtent;
-
-	std::array<VkClearValue, 2> clearColors = {};
-	clearColors[0].color = { 0.f, 0.f, 0.f, 1.f };
-	clearColors[1].depthStencil = { 1.f, 0 };
-	renderPassInfo.clearValueCount = clearColors.size();
-	renderPassInfo.pClearValues = clearColors.data();
-
-	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	//skinning runs inline in the graph without async compute
+	const bool submitCompute = mHasAsyncCompute && !mComputeCommandBuffers.empty();
+	if (submitCompute)
 	{
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipeline);
-		/*
-		VkBuffer vertexBuffers[] = { mVertexBuffer };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, mIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, 1, &mDescriptorSet, 0, nullptr);
-		vkCmdDrawIndexed(commandBuffer, gDemoIndices.size(), 1, 0, 0, 0);
-		*/
-		vkCmdExecuteCommands(commandBuffer, mSecondaryCommandBuffers.size(), mSecondaryCommandBuffers.data());
+		//the compute queue reads the palettes, so the copies go ahead of both submits
+		const bool uploadsSubmitted = submitUploads(frame, frame.uploadFinishedSemaphore, VK_NULL_HANDLE);
+		submitComputeWork(frame, uploadsSubmitted);
+	}
+	else
+	{
+		recordUploads(frame, commandBuffer);
 	}
-	vkCmdEndRenderPass(commandBuffer);
+	mFrameGraph.execute(commandBuffer, imageIndex);
 
 	result = vkEndCommandBuffer(commandBuffer);
 	assert(checkResult(result));
@@ -910,19 +3256,23 @@ void GraphicsContext::drawFrame()
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	VkSemaphore waitSemaphores[] = { imageAcquiredSemaphore };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
-	submitInfo.waitSemaphoreCount = 1;
+	//compute results only have to be ready by the time vertices are fetched
+	VkSemaphore waitSemaphores[] = { frame.imageAcquiredSemaphore, frame.computeFinishedSemaphore };
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT };
+	VkSemaphore signalSemaphores[] = { frame.renderFinishedSemaphore };
+	submitInfo.waitSemaphoreCount = submitCompute ? 2 : 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &mCommandBuffers[imageIndex];
+	submitInfo.pCommandBuffers = &commandBuffer;
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	result = vkQueueSubmit(mQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	result = vkResetFences(mDevice, 1, &frame.fence);
+	assert(checkResult(result));
+	result = vkQueueSubmit(mQueue, 1, &submitInfo, frame.fence);
 	assert(checkResult(result));
+	mFrameCount++;
 
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -933,6 +3283,52 @@ void GraphicsContext::drawFrame()
 	presentInfo.pImageIndices = &imageIndex;
 
 	result = vkQueuePresentKHR(mQueue, &presentInfo);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+	{
+		mSwapchainDirty = true;
+	}
+	else
+	{
+		assert(checkResult(result));
+	}
+	mFrameTiming.latencyMillis = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - mFrameStartTime).count();
+	mFrameStarted = false;
+}
+
+void GraphicsContext::submitComputeWork(FrameResources &frame, bool waitForUploads)
+{
+	VkResult result = VK_SUCCESS;
+
+	//The frame's graphics submit waited on this, so its fence normally already covers it.
+	//Nothing has to hold the skinning back for earlier draws either, the outputs it writes are this frame's own.
+	result = vkWaitForFences(mDevice, 1, &frame.computeFence, VK_TRUE, std::numeric_limits<U64>::max());
+	assert(checkResult(result));
+	result = vkResetFences(mDevice, 1, &frame.computeFence);
+	assert(checkResult(result));
+
+	//the visible set changes every frame, so it's re-recorded every time
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	result = vkBeginCommandBuffer(frame.computeCommandBuffer, &beginInfo);
+	assert(checkResult(result));
+	vkCmdExecuteCommands(frame.computeCommandBuffer, (U32)mComputeCommandBuffers.size(), mComputeCommandBuffers.data());
+	result = vkEndCommandBuffer(frame.computeCommandBuffer);
+	assert(checkResult(result));
+
+	//the palettes this frame skins with are copied on the graphics queue
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = waitForUploads ? 1 : 0;
+	submitInfo.pWaitSemaphores = &frame.uploadFinishedSemaphore;
+	submitInfo.pWaitDstStageMask = &waitStage;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &frame.computeCommandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &frame.computeFinishedSemaphore;
+
+	result = vkQueueSubmit(mComputeQueue, 1, &submitInfo, frame.computeFence);
 	assert(checkResult(result));
 }
 
@@ -962,20 +3358,6 @@ bool GraphicsContext::checkValidationLayerSupport(const std::vector<const char *
 	return true;
 }
 
-void GraphicsContext::createShaderModule(const std::vector<char>& code, VkShaderModule *pShaderModule)
-{
-	VkResult result = VK_SUCCESS;
-
-	VkShaderModuleCreateInfo createInfo = {};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = (U32*)code.data();
-
-	
-	result = vkCreateShaderModule(mDevice, &createInfo, nullptr, pShaderModule);
-	assert(checkResult(result));
-}
-
 void GraphicsContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, GpuBuffer *pBufferOut)
 {
 	VkResult result = VK_SUCCESS;
@@ -986,6 +3368,16 @@ void GraphicsContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
 	bufferInfo.usage = usage;
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+	//Anything the GPU reads may be touched by both the graphics and the async compute family.
+	//Concurrent sharing saves us from queue family ownership transfers on every hand-off.
+	U32 queueFamilyIndices[] = { mQueueFamilyIndex, mComputeQueueFamilyIndex };
+	if (mComputeQueueFamilyIndex != mQueueFamilyIndex && usage != VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
+
 	VmaMemoryRequirements vmaReq = {};
 	if (properties == VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
 	{
@@ -1002,6 +3394,12 @@ void GraphicsContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
 
 void GraphicsContext::createImage(U32 width, U32 height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
 	GpuImage *pImageOut)
+{
+	createImage(width, height, 1, format, tiling, usage, properties, pImageOut);
+}
+
+void GraphicsContext::createImage(U32 width, U32 height, U32 mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
+	VkMemoryPropertyFlags properties, GpuImage *pImageOut)
 {
 	VkResult result = VK_SUCCESS;
 
@@ -1011,7 +3409,7 @@ void GraphicsContext::createImage(U32 width, U32 height, VkFormat format, VkImag
 	imageInfo.extent.width = width;
 	imageInfo.extent.height = height;
 	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
+	imageInfo.mipLevels = mipLevels;
 	imageInfo.arrayLayers = 1;
 	imageInfo.format = format;
 	imageInfo.tiling = tiling;
@@ -1033,9 +3431,17 @@ void GraphicsContext::createImage(U32 width, U32 height, VkFormat format, VkImag
 
 	result = vmaCreateImage(mAllocator, &imageInfo, &vmaReq, &pImageOut->image, &pImageOut->allocation, &pImageOut->allocationInfo);
 	assert(checkResult(result));
+
+	mResourceStates.trackImage(pImageOut->image, CloakUtils::getFormatAspects(format), mipLevels, imageInfo.initialLayout);
 }
 
 void GraphicsContext::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView *pImageViewOut)
+{
+	createImageView(image, format, aspectFlags, 0, 1, pImageViewOut);
+}
+
+void GraphicsContext::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, U32 baseMipLevel, U32 mipLevelCount,
+	VkImageView *pImageViewOut)
 {
 	VkResult result = VK_SUCCESS;
 
@@ -1045,8 +3451,8 @@ void GraphicsContext::createImageView(VkImage image, VkFormat format, VkImageAsp
 	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	viewInfo.format = format;
 	viewInfo.subresourceRange.aspectMask = aspectFlags;
-	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+	viewInfo.subresourceRange.levelCount = mipLevelCount;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 	viewInfo.components = {
@@ -1061,18 +3467,48 @@ void GraphicsContext::createImageView(VkImage image, VkFormat format, VkImageAsp
 }
 
 void GraphicsContext::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+{
+	copyBuffer(srcBuffer, dstBuffer, size, 0);
+}
+
+void GraphicsContext::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize dstOffset)
 {
 	VkCommandBuffer commandBuffer = beginSingleUseCommandBuffer();
 
 	VkBufferCopy copyRegion = {};
 	copyRegion.srcOffset = 0;
-	copyRegion.dstOffset = 0;
+	copyRegion.dstOffset = dstOffset;
 	copyRegion.size = size;
 	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
 	endSingleUseCommandBuffer(commandBuffer);
 }
 
+void GraphicsContext::uploadBuffer(const void *pData, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset)
+{
+	GpuBuffer stagingBuffer;
+	createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&stagingBuffer);
+
+	void *pStagingData;
+	vmaMapMemory(mAllocator, stagingBuffer.allocation, &pStagingData);
+	memcpy(pStagingData, pData, size);
+	vmaUnmapMemory(mAllocator, stagingBuffer.allocation);
+
+	copyBuffer(stagingBuffer.buffer, dstBuffer, size, dstOffset);
+
+	vmaDestroyBuffer(mAllocator, stagingBuffer.buffer, stagingBuffer.allocation);
+}
+
+void GraphicsContext::updateBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, const void *pData)
+{
+	//small, 4 byte aligned writes only (vkCmdUpdateBuffer tops out at 64KB)
+	assert(size <= 65536 && (size & 3) == 0 && (offset & 3) == 0);
+	VkCommandBuffer commandBuffer = beginSingleUseCommandBuffer();
+	vkCmdUpdateBuffer(commandBuffer, buffer, offset, size, pData);
+	endSingleUseCommandBuffer(commandBuffer);
+}
+
 void GraphicsContext::copyImage(VkCommandBuffer commandBuffer, VkImage srcImage, VkImage dstImage, U32 width, U32 height)
 {
 	VkImageSubresourceLayers subResource = {};
@@ -1100,6 +3536,9 @@ void GraphicsContext::destroy()
 {
 	vkDeviceWaitIdle(mDevice);
 
+	mFrameGraph.destroy();
+	mPipelineManager.destroy();
+	mShaderLibrary.destroy();
 	vkDestroySwapchainKHR(mDevice, mSwapchain, nullptr);
 	vkDestroySurfaceKHR(mInstance, mSurface, nullptr);
 	vkDestroyDevice(mDevice, nullptr);
@@ -1113,68 +3552,6 @@ void GraphicsContext::destroy()
 	vkDestroyInstance(mInstance, nullptr);
 }
 
-void GraphicsContext::setImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkImageAspectFlags aspectMask, VkImageLayout oldLayout, VkImageLayout newLayout)
-{
-	VkImageMemoryBarrier imageMemoryBarrier = {};
-	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	imageMemoryBarrier.oldLayout = oldLayout;
-	imageMemoryBarrier.newLayout = newLayout;
-	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	imageMemoryBarrier.image = image;
-	imageMemoryBarrier.subresourceRange.aspectMask = aspectMask;
-	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
-	imageMemoryBarrier.subresourceRange.levelCount = 1;
-	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
-	imageMemoryBarrier.subresourceRange.layerCount = 1;
-
-	switch (oldLayout)
-	{
-	case VK_IMAGE_LAYOUT_UNDEFINED:
-		imageMemoryBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_PREINITIALIZED:
-		imageMemoryBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-		imageMemoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-		imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		break;
-	}
-
-	switch (newLayout)
-	{
-	case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		break;
-	}
-
-	VkPipelineStageFlags srcStageFlags = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-	VkPipelineStageFlags dstStageFlags = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-
-	vkCmdPipelineBarrier(commandBuffer, srcStageFlags, dstStageFlags, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-}
-
 VkCommandBuffer GraphicsContext::beginSingleUseCommandBuffer()
 {
 	VkResult result = VK_SUCCESS;
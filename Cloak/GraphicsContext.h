@@ -3,6 +3,15 @@
 #include "stdafx.h"
 
 #include "AnimatedMesh.h"
+#include "DescriptorCache.h"
+#include "GeometryPool.h"
+#include "PipelineManager.h"
+#include "RenderGraph.h"
+#include "RenderQueue.h"
+#include "ResourceStateTracker.h"
+#include "Shader.h"
+#include "StaticBatcher.h"
+#include "ThreadPool.h"
 #include "graphics_resources.h"
 
 #ifdef NDEBUG
@@ -11,6 +20,14 @@ const bool gEnableValidationLayers = false;
 const bool gEnableValidationLayers = true;
 #endif
 
+//CPU side timings of the last presented frame
+struct FrameTiming
+{
+	float frameMillis; //from the previous frame's start
+	float waitMillis; //blocked on the GPU or the frame rate limit before the frame could start
+	float latencyMillis; //from the frame's start, where input gets sampled, to its present being queued
+};
+
 class GraphicsContext
 {
 public:
@@ -19,11 +36,70 @@ public:
 
 	void init(HINSTANCE hinstance, HWND hwnd);
 
+	//MAILBOX and IMMEDIATE don't wait for vblank, FIFO_RELAXED only waits when the frame is on time. Modes the surface
+	//doesn't support fall back to FIFO. An imageCount of 0 asks for one more than the surface's minimum.
+	//Can be called before init, otherwise the swapchain is recreated with them before the next frame.
+	void setPresentMode(VkPresentModeKHR presentMode, U32 imageCount = 0);
+	//Recreates the swapchain and everything sized to it before the next frame. Presenting also triggers it once the
+	//surface reports the swapchain out of date, but not every platform does that on a resize.
+	void resize();
+	//Caps how often frames start, for present modes that don't wait for vblank. 0 turns the cap off.
+	void setFrameRateLimit(U32 framesPerSecond);
+	//Waits until the GPU is done with the oldest frame in flight and the frame rate limit allows another one.
+	//Call it right before sampling input, so the frame works from input that's as fresh as possible. drawFrame
+	//calls it if it hasn't been already.
+	void waitForNextFrame();
+	const FrameTiming& getFrameTiming() const { return mFrameTiming; }
+	//Draws the last frames' times as bars in the corner of the screen, so hitches show up as they happen.
+	//It's copied straight into the swapchain images, so it stays off for surfaces that don't allow that.
+	void enableFrameTimeGraph();
+
+	//Two-phase GPU occlusion culling against a Hi-Z pyramid built from this frame's depth.
+	//Has to be turned on before any command buffers are created.
+	void enableOcclusionCulling(U32 maxInstances, U32 maxDrawCommands);
+	//Binds every texture once through one big array in set 1 and picks one per draw with a push constant,
+	//so draws no longer split on material. Uses update-after-bind, partially bound arrays where
+	//VK_EXT_descriptor_indexing is available. Without it, the array is written in full and textures can
+	//only be added while nothing using it is in flight. Has to be turned on before any command buffers are created.
+	void enableBindlessTextures();
+	//Makes a texture that only exists in memory, like a packed atlas, loadable by name the same as a file.
+	//The surface is only read when something first uses the name, so it has to outlive the meshes using it.
+	void addTextureSurface(const std::string &textureName, SDL_Surface *pSurface);
+	//Draws skinned meshes with skinned.vert specialized for each mesh's bone count, weights per vertex and palette
+	//format instead of the generic per-format shaders, and the fragment shader with the given lighting path.
+	//Variants build in the background; meshes with matrix palettes draw with the generic pipeline until theirs is ready.
+	//Has to be turned on before any command buffers are created.
+	void enableShaderVariants(LightingPath lightingPath = kLightingPathDiffuseAmbient);
 	void createCommandBuffer(AnimatedMesh *animatedMesh);
+	//Re-records the visible meshes' draws every frame across the pool's threads instead of replaying the
+	//command buffers from createCommandBuffer, which meshes still need for their resources.
+	void enableParallelRecording(ThreadPool *threadPool);
+	//Hands the mesh's geometry back to the pool once nothing draws it anymore
+	void releaseGeometry(AnimatedMesh *animatedMesh);
+	//Packs the geometry pool and re-records everything that draws from it. Waits for the GPU to go idle,
+	//so call it at load points; it also runs on its own when an allocation doesn't fit.
+	void defragmentGeometry();
+	//GPU-driven mode: registered meshes share one set of buffers and are culled by compute into indirect draws,
+	//so submitting them costs the same however many there are. Register everything before the first drawFrame.
+	void enableGpuDrivenRendering(U32 maxInstances, U32 maxDrawRecords);
+	void addGpuDrivenMesh(AnimatedMesh *animatedMesh);
+	//Uploads the batcher's merged geometry and records one command buffer per batch. Batches are drawn
+	//by index through the drawFrame overload, so they can be culled on their bounds like anything else.
+	void createStaticBatches(const StaticBatcher &batcher);
+	void createBakedAnimation(AnimatedMesh *animatedMesh, BakedAnimation *pBakedAnimationOut);
+	//Stages the data in the current frame's upload buffer and copies it over before anything in the frame reads
+	//the buffer. Doesn't wait on the GPU, anything drawn last frame still sees the old contents.
 	void updateConstantBuffer(const void *pData, U32 bufferSize, VkBuffer buffer);
 
 	void updateSceneConstantBuffer(const SceneConstantBuffer &sceneConstantBuffer);
-	void drawFrame();
+
+	//Per-frame compute work runs on this queue and hands off to graphics with a semaphore.
+	//Without a separate queue it is the graphics queue and the work is recorded inline.
+	VkQueue getComputeQueue() const { return mComputeQueue; }
+	U32 getComputeQueueFamilyIndex() const { return mComputeQueueFamilyIndex; }
+	bool hasAsyncCompute() const { return mHasAsyncCompute; }
+	void drawFrame(const std::vector<AnimatedMesh*> &visibleMeshes);
+	void drawFrame(const std::vector<AnimatedMesh*> &visibleMeshes, const std::vector<U32> &visibleStaticBatches);
 
 	void destroy();
 
@@ -31,6 +107,7 @@ private:
 
 	VkPhysicalDeviceProperties mPhysicalDeviceProperties;
 	VkPhysicalDeviceMemoryProperties mPhysicalMemoryProperties;
+	VkPhysicalDeviceFeatures mEnabledFeatures;
 
 	VkInstance mInstance;
 	VkDebugReportCallbackEXT mDebugCallback;
@@ -38,6 +115,9 @@ private:
 	VkDevice mDevice;
 	VkQueue mQueue;
 	U32 mQueueFamilyIndex;
+	VkQueue mComputeQueue;
+	U32 mComputeQueueFamilyIndex;
+	bool mHasAsyncCompute;
 
 	VmaAllocator mAllocator;
 
@@ -46,25 +126,186 @@ private:
 
 	VkSwapchainKHR mSwapchain;
 	VkExtent2D mSwapchainExtent;
+	VkPresentModeKHR mRequestedPresentMode;
+	U32 mRequestedImageCount;
+	bool mSwapchainDirty; //recreated before the next frame
+	VkImageUsageFlags mSwapchainUsage;
+	std::vector<VkImage> mSwapchainImages;
 	std::vector<VkImageView> mImageViews;
-	std::vector<VkFramebuffer> mSwapchainFramebuffers;
-	
-	GpuImage m_depthImage;
-	VkImageView m_depthImageView;
 	VkFormat m_depthFormat;
 
-	VkRenderPass mRenderPass;
-	VkDescriptorSetLayout mDescriptorSetLayout;
+	//The frame's passes, their render passes, framebuffers and the depth buffer come from here. Rebuilt before
+	//the next frame whenever a feature that adds passes is turned on.
+	RenderGraph mFrameGraph;
+	bool mFrameGraphDirty;
+	RenderGraphResource mDepthResource;
+	VkRenderPass mRenderPass; //compatible with every graph pass, for pipelines and secondaries
+	//every pipeline goes through its cache, the ones that can wait are built in the background
+	PipelineManager mPipelineManager;
+	ResourceStateTracker mResourceStates; //every barrier outside of render passes goes through here
+	ShaderLibrary mShaderLibrary;
+	S32 mPalettePipelineRequests[kPaletteFormatCount];
+	S32 mBakedPipelineRequest;
+	std::vector<AnimatedMesh*> mMeshesAwaitingPipelines; //recorded before their pipeline was ready, with a stand-in or nothing
+	//Specialized mesh pipelines, by ShaderVariant key
+	struct VariantPipeline
+	{
+		S32 request;
+		VkPipelineLayout pipelineLayout;
+		VkPipeline pipeline;
+	};
+	bool mShaderVariants;
+	LightingPath mLightingPath;
+	std::unordered_map<U64, VariantPipeline> mVariantPipelines;
+	//Mesh pipelines share the set 0 (per frame) and set 1 (per material) layouts, so those stay bound across pipeline changes
+	VkDescriptorSetLayout mFrameDescriptorSetLayout;
+	VkDescriptorSetLayout mMaterialDescriptorSetLayout;
+	VkDescriptorSetLayout mDrawDescriptorSetLayout; //set 2, object constants and palette
+	VkDescriptorSet mFrameDescriptorSet;
 	VkPipelineLayout mPipelineLayout;
 	VkPipeline mPipeline;
-	VkDescriptorPool mDescriptorPool;
+	VkPipelineLayout mPalettePipelineLayouts[kPaletteFormatCount];
+	VkPipeline mPalettePipelines[kPaletteFormatCount]; //kPaletteFormatMatrix4x4 is mPipeline
+	VkDescriptorSetLayout mBakedDrawDescriptorSetLayout;
+	VkPipelineLayout mBakedPipelineLayout;
+	VkPipeline mBakedPipeline;
+	//compute skinning
+	VkDescriptorSetLayout mSkinningDescriptorSetLayout;
+	VkPipelineLayout mSkinningPipelineLayout;
+	VkPipeline mSkinningPipeline;
+	VkPipelineLayout mStaticPipelineLayout;
+	VkPipeline mStaticPipeline; //MeshVertex input, draws pre-skinned vertices
+	//occlusion culling
+	bool mOcclusionCulling;
+	U32 mMaxCullInstances;
+	U32 mMaxDrawCommands;
+	U32 mCullInstanceCount;
+	U32 mDrawCommandCount;
+	U32 mFrameCullInstanceCount; //submitted for culling this frame
+	GpuImage mHiZImage;
+	U32 mHiZMipCount;
+	VkImageView mHiZImageView; //every mip, read by the cull pass
+	std::vector<VkImageView> mHiZMipViews;
+	std::vector<VkDescriptorSet> mHiZDescriptorSets; //one per mip, reads the level above
+	VkSampler mHiZSampler;
+	VkDescriptorSetLayout mHiZDescriptorSetLayout;
+	VkPipelineLayout mHiZPipelineLayout;
+	VkPipeline mHiZPipeline;
+	VkDescriptorSetLayout mCullDescriptorSetLayout;
+	VkPipelineLayout mCullPipelineLayout;
+	VkPipeline mCullPipeline;
+	GpuBuffer mDrawCommandBuffer; //early commands then late commands
+	GpuBuffer mVisibilityBuffer; //last occlusion result per instance
+	//Geometry pool, every mesh's vertices and indices live in these two buffers
+	GeometryPool mGeometryPool;
+	GpuBuffer mGeometryVertexBuffer;
+	GpuBuffer mGeometryIndexBuffer;
+	std::vector<AnimatedMesh*> mPooledMeshes; //have command buffers that need re-recording when the pool is packed
+	//One per texture, shared by every submesh and static batch that uses it
+	struct Material
+	{
+		GpuImage textureImage;
+		VkImageView textureImageView;
+		VkDescriptorSet descriptorSet; //set 1, the bindless set in bindless mode
+		U32 textureIndex; //into the bindless array
+	};
+	std::unordered_map<std::string, Material> mMaterials;
+	std::unordered_map<std::string, SDL_Surface*> mTextureSurfaces; //looked up before the file system
+	//Bindless textures
+	bool mBindlessTextures;
+	VkDescriptorSetLayout mBindlessDescriptorSetLayout;
+	VkDescriptorPool mBindlessDescriptorPool; //separate, since update-after-bind sets need a pool created for them
+	VkDescriptorSet mBindlessDescriptorSet;
+	U32 mBindlessTextureCount;
+	//Static batches
+	GpuBuffer mStaticBatchVertexBuffer;
+	GpuBuffer mStaticBatchIndexBuffer; //32 bit, batches can get big
+	GpuBuffer mStaticObjectConstantBuffer; //identity model matrix shared by every batch
+	std::vector<VkCommandBuffer> mStaticBatchCommandBuffers;
+	std::vector<StaticBatch> mStaticBatches; //kept to re-record the command buffers when the swapchain changes size
+	VkDescriptorSet mStaticDrawDescriptorSet;
+	//GPU-driven rendering
+	bool mGpuDriven;
+	U32 mMaxGpuInstances;
+	U32 mMaxGpuDrawRecords;
+	U32 mMaxGpuPaletteMatrices;
+	U32 mGpuDrawRecordCount;
+	U32 mGpuPaletteMatrixCount;
+	std::unordered_map<std::string, U32> mGpuDrivenTextureIndices;
+	std::vector<GpuImage> mGpuDrivenTextures;
+	std::vector<VkImageView> mGpuDrivenTextureViews;
+	std::vector<AnimatedMesh*> mGpuDrivenMeshes;
+	std::vector<U32> mGpuDrivenPaletteOffsets; //in matrices
+	std::vector<U32> mGpuDrivenPaletteStaleFrames; //frames whose copy of an unshared palette hasn't caught up with it yet
+	std::unordered_map<const SharedPose*, U32> mGpuSharedPaletteOffsets;
+	GpuBuffer mGpuDrawRecordBuffer;
+	GpuBuffer mGpuDrawCommandBuffer;
+	VkDescriptorSetLayout mGpuDrivenDescriptorSetLayout; //shared by the cull pass and the draw
+	VkPipelineLayout mGpuDrivenPipelineLayout;
+	VkPipeline mGpuDrivenPipeline;
+	VkPipelineLayout mGpuCullPipelineLayout;
+	VkPipeline mGpuCullPipeline;
+	struct PendingUpload
+	{
+		VkBuffer buffer;
+		VkBufferCopy region; //srcOffset is into the frame's upload buffer
+	};
+	//Per frame-in-flight state, only touched again once the frame's fence says the GPU is done with it
+	struct FrameResources
+	{
+		VkFence fence;
+		VkCommandBuffer commandBuffer; //primary, from mCommandPool
+		//constant buffer updates, staged in a buffer that stays mapped and copied at the start of the frame
+		GpuBuffer uploadBuffer;
+		U8 *uploadData;
+		VkDeviceSize uploadOffset;
+		std::vector<PendingUpload> uploads;
+		VkCommandBuffer uploadCommandBuffer; //copies ahead of async compute, which reads the palettes too
+		VkSemaphore uploadFinishedSemaphore;
+		//async compute, waited on by the frame's graphics submit
+		VkCommandBuffer computeCommandBuffer; //primary, from mComputeCommandPool
+		VkFence computeFence;
+		VkSemaphore computeFinishedSemaphore;
+		std::vector<VkCommandPool> commandPools; //one per recording task, reset as a whole every frame
+		std::vector<VkCommandBuffer> commandBuffers;
+		std::vector<VkCommandBuffer> lateCommandBuffers;
+		VkSemaphore imageAcquiredSemaphore;
+		VkSemaphore renderFinishedSemaphore;
+		//occlusion culling input, rewritten from the CPU every frame and stays mapped
+		GpuBuffer cullInstanceBuffer;
+		void *cullInstanceData;
+		VkDescriptorSet cullDescriptorSet;
+		//GPU-driven instances and palettes, same deal, and the set the cull pass and the draws read them through
+		GpuBuffer gpuInstanceBuffer;
+		void *gpuInstanceData;
+		GpuBuffer gpuPaletteBuffer;
+		void *gpuPaletteData;
+		VkDescriptorSet gpuDrivenDescriptorSet;
+		VkCommandBuffer gpuDrivenCommandBuffer; //draws the whole GPU-driven scene, only re-recorded when meshes are added
+		bool gpuDrivenCommandsDirty;
+	};
+	std::vector<FrameResources> mFrames;
+	ThreadPool *mRecordingThreadPool;
+	//Per-frame draw sorting, the ids just have to be small and stable
+	RenderQueue mRenderQueue;
+	glm::mat4 mViewMatrix; //from the last scene constant buffer, for depth sorting
+	std::unordered_map<VkPipeline, U32> mPipelineSortIds;
+	std::unordered_map<VkDescriptorSet, U32> mMaterialSortIds;
+	std::unordered_map<std::string, U32> mMeshSortIds; //by geometry range, the pool itself is the same buffer for everything
+	//Long-lived sets come out of the cache, so meshes binding the same resources share a set and
+	//the pools just keep chaining as the scene grows
+	DescriptorAllocator mDescriptorAllocator;
+	DescriptorCache mDescriptorCache;
+	bool mHasUpdateTemplates;
+	bool mHasPhysicalDeviceProperties2; //instance extension, needed to ask about device extension features on 1.0
+	bool mHasDescriptorIndexing;
 	VkCommandPool mCommandPool;
-	std::vector<VkCommandBuffer> mCommandBuffers;
-	std::vector<VkCommandBuffer> mSecondaryCommandBuffers;
-	VkSemaphore imageAcquiredSemaphore;
-	VkSemaphore renderFinishedSemaphore;
+	std::vector<VkCommandBuffer> mSecondaryCommandBuffers; //this frame's visible draws
+	std::vector<std::pair<float, AnimatedMesh*>> mSortedMeshes; //visible meshes front to back, when each one brings its own secondary
+	std::vector<VkCommandBuffer> mLateSecondaryCommandBuffers;
+	VkCommandPool mComputeCommandPool;
+	std::vector<VkCommandBuffer> mComputeCommandBuffers; //this frame's per-object compute work, recorded outside of the render pass
 
-	GpuBuffer m_uniformStagingBuffer;
 	GpuBuffer m_uniformBuffer;
 
 	VkSampler mTextureSampler;
@@ -72,6 +313,15 @@ private:
 private:
 
 	U32 mFrameCount;
+	//Frame pacing
+	U32 mFrameRateLimit;
+	bool mFrameStarted; //waitForNextFrame has run for the frame drawFrame is about to record
+	std::chrono::high_resolution_clock::time_point mFrameStartTime;
+	std::chrono::high_resolution_clock::time_point mNextFrameTime; //earliest the frame rate limit lets the next one start
+	FrameTiming mFrameTiming;
+	bool mFrameTimeGraph;
+	std::vector<float> mFrameTimeHistory; //frameMillis for the last frames, oldest at mFrameTimeHistoryIndex
+	U32 mFrameTimeHistoryIndex;
 
 	//Initialization
 	void createInstance();
@@ -82,29 +332,103 @@ private:
 	void createMemoryAllocator();
 	void createSwapchain();
 	void createImageViews();
-	void createDepthResources();
+	//false while the window is minimized, there's nothing to present to
+	bool recreateSwapchain();
+	void selectDepthFormat();
 	void createRenderPass();
+	void createRenderPass(VkAttachmentLoadOp colorLoadOp, VkImageLayout initialColorLayout, VkImageLayout finalColorLayout,
+		VkAttachmentStoreOp depthStoreOp, VkRenderPass *pRenderPassOut);
 	void createDescriptorSetLayout();
+	void createDescriptorSetLayout(const VkDescriptorSetLayoutBinding *pBindings, U32 bindingCount, VkDescriptorSetLayout *pLayoutOut);
 	void createGraphicsPipeline();
-	void createFramebuffers();
+	void createGraphicsPipeline(const std::string &vertShaderFilename, const std::string &fragShaderFilename,
+		const std::vector<VkDescriptorSetLayout> &setLayouts, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut);
+	void createGraphicsPipeline(const std::string &vertShaderFilename, const std::string &fragShaderFilename,
+		const VkVertexInputBindingDescription &bindingDescription, const VkVertexInputAttributeDescription *pAttributeDescriptions, U32 attributeCount,
+		const std::vector<VkDescriptorSetLayout> &setLayouts, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut,
+		const VkPushConstantRange *pPushConstantRange = nullptr, const ShaderVariant *pVariant = nullptr);
+	//Mesh pipelines get the fragment shader, set 0/1 layouts and push constants for the current texture binding mode
+	void createMeshPipeline(const std::string &vertShaderFilename, VkDescriptorSetLayout drawSetLayout,
+		VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut, const ShaderVariant *pVariant = nullptr);
+	void createMeshPipeline(const std::string &vertShaderFilename,
+		const VkVertexInputBindingDescription &bindingDescription, const VkVertexInputAttributeDescription *pAttributeDescriptions, U32 attributeCount,
+		VkDescriptorSetLayout drawSetLayout, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut, const ShaderVariant *pVariant = nullptr);
+	void createComputePipeline(const std::string &compShaderFilename, VkDescriptorSetLayout descriptorSetLayout, U32 pushConstantSize,
+		VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut);
+	void createSkinningPipelines();
+	void createStaticPipeline();
+	void recordStaticBatchCommands();
+	//dynamic in every graphics pipeline, and secondaries don't inherit it, so each one sets it
+	void setViewportAndScissor(VkCommandBuffer commandBuffer);
+	void loadTexture(const std::string &textureName, GpuImage *pImageOut, VkImageView *pImageViewOut);
+	const Material& getMaterial(const std::string &textureName);
+	void createBindlessResources();
+	U32 addBindlessTexture(VkImageView imageView);
+	//skins into the submesh's output for frameIndex, creating it on first use
+	void recordSkinningDispatch(VkCommandBuffer commandBuffer, VkBuffer paletteBuffer, VkDeviceSize paletteSize, U32 frameIndex, AnimatedSubMesh *pSubMesh);
+	void createOcclusionCullingResources();
+	void createHiZImage();
+	void destroyHiZImage();
+	void updateHiZDescriptorSets();
+	//false while the mesh's own pipeline is still building, the outputs are then a stand-in or VK_NULL_HANDLE
+	bool getMeshPipeline(AnimatedMesh *animatedMesh, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut);
+	bool getVariantPipeline(AnimatedMesh *animatedMesh, PaletteFormat paletteFormat, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut);
+	void recordMeshCommands(AnimatedMesh *animatedMesh);
+	//frameIndex picks which of a compute skinned mesh's outputs gets drawn
+	void pushMeshDrawItems(AnimatedMesh *animatedMesh, U32 frameIndex, RenderQueue *pRenderQueue);
+	void recordDrawItems(VkCommandBuffer commandBuffer, const std::vector<DrawItem> &items, U32 first, U32 last, bool latePass);
+	void recordParallelDraws(FrameResources &frame, const std::vector<AnimatedMesh*> &meshes);
+	void recordOcclusionCull(VkCommandBuffer commandBuffer, U32 instanceCount, U32 phase);
+	void recordHiZBuild(VkCommandBuffer commandBuffer);
+	void recordFrameTimeGraph(VkCommandBuffer commandBuffer);
+	void createGeometryPool();
+	void acquireSubMeshGeometry(const std::string &geometryName, AnimatedSubMesh *pSubMesh);
+	void updateSubMeshGeometry(AnimatedMesh *animatedMesh);
+	void moveGeometry(VkBuffer buffer, VkDeviceSize elementSize, const std::vector<OffsetAllocator::Move> &moves);
+	void createGpuDrivenResources();
+	U32 addGpuDrivenTexture(const std::string &textureName);
+	void updateGpuDrivenTextureDescriptors();
+	void uploadGpuDrivenDrawRecords(U32 firstInstance);
+	void updateGpuDrivenInstances(FrameResources &frame);
+	void recordGpuDrivenCommands(FrameResources &frame);
+	void invalidateGpuDrivenCommands();
+	void recordGpuDrivenCull(VkCommandBuffer commandBuffer);
+	void getPalettePipeline(PaletteFormat paletteFormat, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut);
+	//Starts building the pipeline in the background on the first call and fills in the outputs once it's done.
+	//They stay VK_NULL_HANDLE until then, since no other pipeline reads the same draw set, so its draws are skipped.
+	void requestMeshPipeline(const std::string &vertShaderFilename, VkDescriptorSetLayout drawSetLayout, S32 *pRequest,
+		VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut);
+	void updatePipelineRequests();
+	void buildFrameGraph();
 	void createTextureSampler();
 	void createUniformBuffer();
 	void createDescriptorPool();
 	void createCommandBuffers();
 	void createSemaphores();
+	//Records the frame's staged uploads and starts the list over. Waits for earlier frames to stop reading the
+	//destinations first, and makes the copies visible to every shader stage after.
+	void recordUploads(FrameResources &frame, VkCommandBuffer commandBuffer);
+	//Uploads in their own submit, for when they have to land before async compute or the frame is dropped.
+	//Returns false without submitting anything if there was nothing staged.
+	bool submitUploads(FrameResources &frame, VkSemaphore signalSemaphore, VkFence fence);
+	void submitComputeWork(FrameResources &frame, bool waitForUploads);
 
 	void createImageFromSurface(SDL_Surface *pSurface, GpuImage *pImageOut);
 	void createBufferFromData(void *pData, U32 bufferSize, VkBufferUsageFlags usage, GpuBuffer *pBufferOut);
 
 	//Utility functions
 	bool checkValidationLayerSupport(const std::vector<const char *> &validationLayers);
-	void createShaderModule(const std::vector<char>& code, VkShaderModule *pShaderModule);
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, GpuBuffer *pBufferOut);
 	void createImage(U32 width, U32 height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, GpuImage *pImageOut);
+	void createImage(U32 width, U32 height, U32 mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
+		GpuImage *pImageOut);
 	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView * pImageViewOut);
+	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, U32 baseMipLevel, U32 mipLevelCount, VkImageView *pImageViewOut);
 	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize dstOffset);
+	void uploadBuffer(const void *pData, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset);
+	void updateBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, const void *pData);
 	void copyImage(VkCommandBuffer commandBuffer, VkImage srcImage, VkImage dstImage, U32 width, U32 height);
-	void setImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkImageAspectFlags aspectMask, VkImageLayout oldLayout, VkImageLayout newLayout);
 	VkCommandBuffer beginSingleUseCommandBuffer();
 	void endSingleUseCommandBuffer(VkCommandBuffer commandBuffer);
 	U32 findMemoryType(U32 typeFilter, VkMemoryPropertyFlags properties);
@@ -0,0 +1,322 @@
+#include "LooseOctree.h"
+
+//slab test, returns the entry distance or a negative value on a miss
+static float intersectRayBox(const glm::vec3 &origin, const glm::vec3 &invDirection, float maxDistance,
+	const glm::vec3 &min, const glm::vec3 &max)
+{
+	glm::vec3 t0 = (min - origin) * invDirection;
+	glm::vec3 t1 = (max - origin) * invDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float entry = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.f));
+	float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxDistance));
+	return entry <= exit ? entry : -1.f;
+}
+
+static bool intersectSphereBox(const glm::vec3 &center, float radius, const glm::vec3 &min, const glm::vec3 &max)
+{
+	glm::vec3 closest = glm::clamp(center, min, max);
+	glm::vec3 delta = closest - center;
+	return glm::dot(delta, delta) <= radius * radius;
+}
+
+LooseOctree::LooseOctree(const glm::vec3 &center, float halfSize, U32 maxDepth) : mMaxDepth(maxDepth)
+{
+	Node root;
+	root.center = center;
+	root.halfSize = halfSize;
+	root.depth = 0;
+	for (int &child : root.children)
+	{
+		child = -1;
+	}
+	root.subtreeObjectCount = 0;
+	root.parent = -1;
+	mNodes.push_back(root);
+}
+
+LooseOctree::~LooseOctree()
+{
+	for (Node &node : mNodes)
+	{
+		for (DrawableObject *object : node.objects)
+		{
+			object->mSpatialIndex = nullptr;
+			object->mSpatialNode = -1;
+		}
+	}
+}
+
+void LooseOctree::insert(DrawableObject *object)
+{
+	assert(object->mSpatialIndex == nullptr);
+	object->getBoundingBox(object->mSpatialMin, object->mSpatialMax);
+
+	int nodeIndex = findNode(object->mSpatialMin, object->mSpatialMax);
+	mNodes[nodeIndex].objects.push_back(object);
+	adjustSubtreeCount(nodeIndex, 1);
+
+	object->mSpatialIndex = this;
+	object->mSpatialNode = nodeIndex;
+}
+
+void LooseOctree::remove(DrawableObject *object)
+{
+	assert(object->mSpatialIndex == this);
+	std::vector<DrawableObject*> &objects = mNodes[object->mSpatialNode].objects;
+	auto it = std::find(objects.begin(), objects.end(), object);
+	assert(it != objects.end());
+	*it = objects.back();
+	objects.pop_back();
+	adjustSubtreeCount(object->mSpatialNode, -1);
+
+	object->mSpatialIndex = nullptr;
+	object->mSpatialNode = -1;
+}
+
+void LooseOctree::update(DrawableObject *object)
+{
+	assert(object->mSpatialIndex == this);
+	glm::vec3 min, max;
+	object->getBoundingBox(min, max);
+
+	int nodeIndex = findNode(min, max);
+	if (nodeIndex == object->mSpatialNode)
+	{
+		object->mSpatialMin = min;
+		object->mSpatialMax = max;
+		return;
+	}
+	remove(object);
+	insert(object);
+}
+
+int LooseOctree::findNode(const glm::vec3 &min, const glm::vec3 &max)
+{
+	const glm::vec3 center = (min + max) * 0.5f;
+	const glm::vec3 extents = (max - min) * 0.5f;
+	const float objectHalfSize = glm::max(extents.x, glm::max(extents.y, extents.z));
+
+	//anything that doesn't fit the root's loose bounds lives in the root, which is never culled
+	const Node &root = mNodes[0];
+	if (glm::any(glm::greaterThan(glm::abs(center - root.center), glm::vec3(root.halfSize))) || objectHalfSize > root.halfSize)
+	{
+		return 0;
+	}
+
+	//descend by center while the object still fits in a child's loose bounds
+	int nodeIndex = 0;
+	while (mNodes[nodeIndex].depth < mMaxDepth && objectHalfSize <= mNodes[nodeIndex].halfSize * 0.5f)
+	{
+		const Node &node = mNodes[nodeIndex];
+		U32 childIndex = (center.x >= node.center.x ? 1 : 0) | (center.y >= node.center.y ? 2 : 0) | (center.z >= node.center.z ? 4 : 0);
+		int child = node.children[childIndex];
+		if (child < 0)
+		{
+			child = createNode(nodeIndex, childIndex);
+		}
+		nodeIndex = child;
+	}
+	return nodeIndex;
+}
+
+int LooseOctree::createNode(int parent, U32 childIndex)
+{
+	Node child;
+	const float halfSize = mNodes[parent].halfSize * 0.5f;
+	child.center = mNodes[parent].center + glm::vec3(childIndex & 1 ? halfSize : -halfSize,
+		childIndex & 2 ? halfSize : -halfSize, childIndex & 4 ? halfSize : -halfSize);
+	child.halfSize = halfSize;
+	child.depth = mNodes[parent].depth + 1;
+	for (int &grandChild : child.children)
+	{
+		grandChild = -1;
+	}
+	child.subtreeObjectCount = 0;
+	child.parent = parent;
+
+	//push_back may reallocate, so don't hold on to references across it
+	int childNodeIndex = (int)mNodes.size();
+	mNodes.push_back(child);
+	mNodes[parent].children[childIndex] = childNodeIndex;
+	return childNodeIndex;
+}
+
+void LooseOctree::adjustSubtreeCount(int nodeIndex, int delta)
+{
+	for (int i = nodeIndex; i >= 0; i = mNodes[i].parent)
+	{
+		mNodes[i].subtreeObjectCount += delta;
+	}
+}
+
+U32 LooseOctree::getObjectCount() const
+{
+	return mNodes[0].subtreeObjectCount;
+}
+
+LooseOctree::Containment LooseOctree::classifyFrustum(const Frustum &frustum, const glm::vec3 &center, const glm::vec3 &extents) const
+{
+	Containment containment = kContainmentInside;
+	for (int i = 0; i < Frustum::kPlaneCount; i++)
+	{
+		const glm::vec3 normal(frustum.planes[i]);
+		float distance = glm::dot(normal, center) + frustum.planes[i].w;
+		float radius = glm::dot(glm::abs(normal), extents);
+		if (distance < -radius)
+		{
+			return kContainmentOutside;
+		}
+		if (distance < radius)
+		{
+			containment = kContainmentIntersecting;
+		}
+	}
+	return containment;
+}
+
+void LooseOctree::queryFrustum(const Frustum &frustum, std::vector<DrawableObject*> &resultsOut) const
+{
+	queryFrustum(0, frustum, false, resultsOut);
+}
+
+void LooseOctree::queryFrustum(int nodeIndex, const Frustum &frustum, bool fullyInside, std::vector<DrawableObject*> &resultsOut) const
+{
+	const Node &node = mNodes[nodeIndex];
+	if (node.subtreeObjectCount == 0)
+	{
+		return;
+	}
+	if (fullyInside)
+	{
+		gatherSubtree(nodeIndex, resultsOut);
+		return;
+	}
+
+	if (nodeIndex != 0)
+	{
+		Containment containment = classifyFrustum(frustum, node.center, glm::vec3(node.halfSize * 2.f));
+		if (containment == kContainmentOutside)
+		{
+			return;
+		}
+		if (containment == kContainmentInside)
+		{
+			gatherSubtree(nodeIndex, resultsOut);
+			return;
+		}
+	}
+
+	for (DrawableObject *object : node.objects)
+	{
+		if (frustum.intersectsBox(object->mSpatialMin, object->mSpatialMax))
+		{
+			resultsOut.push_back(object);
+		}
+	}
+	for (int child : node.children)
+	{
+		if (child >= 0)
+		{
+			queryFrustum(child, frustum, false, resultsOut);
+		}
+	}
+}
+
+void LooseOctree::gatherSubtree(int nodeIndex, std::vector<DrawableObject*> &resultsOut) const
+{
+	const Node &node = mNodes[nodeIndex];
+	if (node.subtreeObjectCount == 0)
+	{
+		return;
+	}
+	resultsOut.insert(resultsOut.end(), node.objects.begin(), node.objects.end());
+	for (int child : node.children)
+	{
+		if (child >= 0)
+		{
+			gatherSubtree(child, resultsOut);
+		}
+	}
+}
+
+void LooseOctree::querySphere(const glm::vec3 &center, float radius, std::vector<DrawableObject*> &resultsOut) const
+{
+	querySphere(0, center, radius, resultsOut);
+}
+
+void LooseOctree::querySphere(int nodeIndex, const glm::vec3 &center, float radius, std::vector<DrawableObject*> &resultsOut) const
+{
+	const Node &node = mNodes[nodeIndex];
+	if (node.subtreeObjectCount == 0)
+	{
+		return;
+	}
+	const glm::vec3 looseExtents(node.halfSize * 2.f);
+	if (nodeIndex != 0 && !intersectSphereBox(center, radius, node.center - looseExtents, node.center + looseExtents))
+	{
+		return;
+	}
+
+	for (DrawableObject *object : node.objects)
+	{
+		if (intersectSphereBox(center, radius, object->mSpatialMin, object->mSpatialMax))
+		{
+			resultsOut.push_back(object);
+		}
+	}
+	for (int child : node.children)
+	{
+		if (child >= 0)
+		{
+			querySphere(child, center, radius, resultsOut);
+		}
+	}
+}
+
+void LooseOctree::queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, std::vector<DrawableObject*> &resultsOut) const
+{
+	//IEEE division gives +-inf for axis aligned rays, which the slab test handles
+	const glm::vec3 invDirection = 1.f / direction;
+
+	std::vector<std::pair<float, DrawableObject*>> hits;
+	queryRay(0, origin, invDirection, maxDistance, hits);
+	std::sort(hits.begin(), hits.end(), [](const std::pair<float, DrawableObject*> &a, const std::pair<float, DrawableObject*> &b) {
+		return a.first < b.first;
+	});
+	for (const auto &hit : hits)
+	{
+		resultsOut.push_back(hit.second);
+	}
+}
+
+void LooseOctree::queryRay(int nodeIndex, const glm::vec3 &origin, const glm::vec3 &invDirection, float maxDistance,
+	std::vector<std::pair<float, DrawableObject*>> &hitsOut) const
+{
+	const Node &node = mNodes[nodeIndex];
+	if (node.subtreeObjectCount == 0)
+	{
+		return;
+	}
+	const glm::vec3 looseExtents(node.halfSize * 2.f);
+	if (nodeIndex != 0 && intersectRayBox(origin, invDirection, maxDistance, node.center - looseExtents, node.center + looseExtents) < 0.f)
+	{
+		return;
+	}
+
+	for (DrawableObject *object : node.objects)
+	{
+		float distance = intersectRayBox(origin, invDirection, maxDistance, object->mSpatialMin, object->mSpatialMax);
+		if (distance >= 0.f)
+		{
+			hitsOut.push_back(std::make_pair(distance, object));
+		}
+	}
+	for (int child : node.children)
+	{
+		if (child >= 0)
+		{
+			queryRay(child, origin, invDirection, maxDistance, hitsOut);
+		}
+	}
+}
\ No newline at end of file
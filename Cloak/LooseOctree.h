@@ -0,0 +1,63 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "Camera.h"
+#include "DrawableObject.h"
+
+//Loose octree over DrawableObjects. Each node's bounds are twice its cell size, so an object
+//only has to pick a depth from its size and a cell from its center, and moving it is a
+//cheap remove + insert that usually lands in the same node. Objects stay in sync through
+//DrawableObject's transform setters.
+class LooseOctree
+{
+public:
+	LooseOctree(const glm::vec3 &center, float halfSize, U32 maxDepth);
+	~LooseOctree();
+
+	void insert(DrawableObject *object);
+	void remove(DrawableObject *object);
+	//re-files the object after its bounds changed
+	void update(DrawableObject *object);
+
+	void queryFrustum(const Frustum &frustum, std::vector<DrawableObject*> &resultsOut) const;
+	void querySphere(const glm::vec3 &center, float radius, std::vector<DrawableObject*> &resultsOut) const;
+	//objects whose bounds the ray hits, nearest first
+	void queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, std::vector<DrawableObject*> &resultsOut) const;
+
+	U32 getObjectCount() const;
+	U32 getNodeCount() const { return (U32)mNodes.size(); }
+
+private:
+	struct Node
+	{
+		glm::vec3 center;
+		float halfSize; //of the cell, the loose bounds are twice this
+		U32 depth;
+		int children[8];
+		U32 subtreeObjectCount;
+		int parent;
+		std::vector<DrawableObject*> objects;
+	};
+
+	enum Containment
+	{
+		kContainmentOutside = 0,
+		kContainmentIntersecting,
+		kContainmentInside,
+	};
+
+	int findNode(const glm::vec3 &min, const glm::vec3 &max);
+	int createNode(int parent, U32 childIndex);
+	void adjustSubtreeCount(int nodeIndex, int delta);
+
+	Containment classifyFrustum(const Frustum &frustum, const glm::vec3 &center, const glm::vec3 &extents) const;
+	void queryFrustum(int nodeIndex, const Frustum &frustum, bool fullyInside, std::vector<DrawableObject*> &resultsOut) const;
+	void querySphere(int nodeIndex, const glm::vec3 &center, float radius, std::vector<DrawableObject*> &resultsOut) const;
+	void queryRay(int nodeIndex, const glm::vec3 &origin, const glm::vec3 &invDirection, float maxDistance,
+		std::vector<std::pair<float, DrawableObject*>> &hitsOut) const;
+	void gatherSubtree(int nodeIndex, std::vector<DrawableObject*> &resultsOut) const;
+
+	U32 mMaxDepth;
+	std::vector<Node> mNodes; //0 is the root, nodes are created on demand and never freed
+};
\ No newline at end of file
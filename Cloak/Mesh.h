@@ -24,6 +24,9 @@ public:
     unsigned int getIndexCount();
     unsigned int getTriangleCount();
 
+    const std::vector<MeshVertex>& getVertices() const { return mVertices; }
+    const std::vector<U32>& getIndices() const { return mIndices; }
+
     void addVertex(const MeshVertex &vertex);
     void addIndex(U32 index);
 
@@ -0,0 +1,102 @@
+#include "OffsetAllocator.h"
+
+OffsetAllocator::OffsetAllocator(U32 capacity) : mCapacity(capacity), mUsedSize(0)
+{
+	if (capacity > 0)
+	{
+		mFreeRanges[0] = capacity;
+	}
+}
+
+OffsetAllocator::~OffsetAllocator()
+{
+}
+
+U32 OffsetAllocator::allocate(U32 size)
+{
+	assert(size > 0);
+	for (auto freeRange = mFreeRanges.begin(); freeRange != mFreeRanges.end(); ++freeRange)
+	{
+		if (freeRange->second < size)
+		{
+			continue;
+		}
+
+		const U32 offset = freeRange->first;
+		const U32 remaining = freeRange->second - size;
+		mFreeRanges.erase(freeRange);
+		if (remaining > 0)
+		{
+			mFreeRanges[offset + size] = remaining;
+		}
+		mAllocations[offset] = size;
+		mUsedSize += size;
+		return offset;
+	}
+	return kInvalidOffset;
+}
+
+void OffsetAllocator::free(U32 offset)
+{
+	auto allocation = mAllocations.find(offset);
+	assert(allocation != mAllocations.end());
+	U32 rangeOffset = offset;
+	U32 rangeSize = allocation->second;
+	mUsedSize -= rangeSize;
+	mAllocations.erase(allocation);
+
+	auto next = mFreeRanges.lower_bound(rangeOffset);
+	if (next != mFreeRanges.end() && next->first == rangeOffset + rangeSize)
+	{
+		rangeSize += next->second;
+		next = mFreeRanges.erase(next);
+	}
+	if (next != mFreeRanges.begin())
+	{
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == rangeOffset)
+		{
+			rangeOffset = previous->first;
+			rangeSize += previous->second;
+			mFreeRanges.erase(previous);
+		}
+	}
+	mFreeRanges[rangeOffset] = rangeSize;
+}
+
+void OffsetAllocator::defragment(std::vector<Move> &movesOut)
+{
+	movesOut.clear();
+	std::map<U32, U32> packedAllocations;
+	U32 cursor = 0;
+	for (auto &allocation : mAllocations)
+	{
+		if (allocation.first != cursor)
+		{
+			Move move;
+			move.srcOffset = allocation.first;
+			move.dstOffset = cursor;
+			move.size = allocation.second;
+			movesOut.push_back(move);
+		}
+		packedAllocations[cursor] = allocation.second;
+		cursor += allocation.second;
+	}
+	mAllocations.swap(packedAllocations);
+
+	mFreeRanges.clear();
+	if (cursor < mCapacity)
+	{
+		mFreeRanges[cursor] = mCapacity - cursor;
+	}
+}
+
+U32 OffsetAllocator::getLargestFreeRange() const
+{
+	U32 largest = 0;
+	for (auto &freeRange : mFreeRanges)
+	{
+		largest = std::max(largest, freeRange.second);
+	}
+	return largest;
+}
\ No newline at end of file
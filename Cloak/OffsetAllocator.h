@@ -0,0 +1,41 @@
+#pragma once
+
+#include "stdafx.h"
+
+//First-fit range allocator over [0, capacity) for sub-allocating out of one big buffer. Only does the
+//bookkeeping, units are whatever the caller counts in. Freed ranges are merged with their neighbours,
+//and defragment() packs everything down so the free space ends up in one range at the end.
+class OffsetAllocator
+{
+public:
+	static const U32 kInvalidOffset = 0xffffffff;
+
+	struct Move
+	{
+		U32 srcOffset;
+		U32 dstOffset;
+		U32 size;
+	};
+
+	explicit OffsetAllocator(U32 capacity);
+	~OffsetAllocator();
+
+	//kInvalidOffset if no free range is big enough
+	U32 allocate(U32 size);
+	void free(U32 offset);
+
+	//Slides every allocation down over the gaps in front of it. Only the ones that moved end up in movesOut,
+	//lowest offset first; the caller has to move its data the same way before using the new offsets.
+	void defragment(std::vector<Move> &movesOut);
+
+	U32 getCapacity() const { return mCapacity; }
+	U32 getUsedSize() const { return mUsedSize; }
+	U32 getLargestFreeRange() const;
+	U32 getFreeRangeCount() const { return (U32)mFreeRanges.size(); }
+
+private:
+	U32 mCapacity;
+	U32 mUsedSize;
+	std::map<U32, U32> mAllocations; //offset -> size
+	std::map<U32, U32> mFreeRanges; //offset -> size, never two adjacent ones
+};
\ No newline at end of file
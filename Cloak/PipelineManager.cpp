@@ -0,0 +1,231 @@
+#include "PipelineManager.h"
+
+static const U32 kCacheFileMagic = 0x43504C43; //"CLPC"
+static const U32 kCacheFileVersion = 1;
+
+static U32 hashCacheData(const char *pData, size_t size)
+{
+	U32 hash = 2166136261u;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ (U8)pData[i]) * 16777619u;
+	}
+	return hash;
+}
+
+PipelineManager::PipelineManager() : mDevice(VK_NULL_HANDLE), mCache(VK_NULL_HANDLE), mLoadedCache(false), mShutdown(false)
+{
+}
+
+PipelineManager::~PipelineManager()
+{
+}
+
+void PipelineManager::init(VkDevice device, const VkPhysicalDeviceProperties &properties, const std::string &cacheFilename, U32 workerCount)
+{
+	mDevice = device;
+	mProperties = properties;
+	mCacheFilename = cacheFilename;
+
+	std::vector<char> cacheData;
+	mLoadedCache = readCacheFile(cacheData);
+
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = mLoadedCache ? cacheData.size() : 0;
+	cacheInfo.pInitialData = mLoadedCache ? cacheData.data() : nullptr;
+	VkResult result = vkCreatePipelineCache(mDevice, &cacheInfo, nullptr, &mCache);
+	if (result != VK_SUCCESS && mLoadedCache)
+	{
+		//the driver gets the last word on whether its data is usable
+		mLoadedCache = false;
+		cacheInfo.initialDataSize = 0;
+		cacheInfo.pInitialData = nullptr;
+		result = vkCreatePipelineCache(mDevice, &cacheInfo, nullptr, &mCache);
+	}
+	assert(result == VK_SUCCESS);
+	std::cout << (mLoadedCache ? "Loaded pipeline cache from " : "Starting an empty pipeline cache, none usable at ") << mCacheFilename << std::endl;
+
+	mShutdown = false;
+	for (U32 i = 0; i < workerCount; i++)
+	{
+		mWorkers.push_back(std::thread(&PipelineManager::workerMain, this));
+	}
+}
+
+void PipelineManager::destroy()
+{
+	//workers only leave once the queue is empty, so everything requested still gets built and cached
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mShutdown = true;
+	}
+	mWorkAvailable.notify_all();
+	for (std::thread &worker : mWorkers)
+	{
+		worker.join();
+	}
+	mWorkers.clear();
+
+	saveCache();
+	vkDestroyPipelineCache(mDevice, mCache, nullptr);
+	mCache = VK_NULL_HANDLE;
+}
+
+bool PipelineManager::readCacheFile(std::vector<char> &dataOut) const
+{
+	std::ifstream file(mCacheFilename, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	const size_t fileSize = (size_t)file.tellg();
+	if (fileSize < sizeof(CacheFileHeader))
+	{
+		return false;
+	}
+
+	CacheFileHeader header;
+	file.seekg(0);
+	file.read((char*)&header, sizeof(header));
+	//a driver update or a different GPU makes the data useless, so it's thrown away rather than handed over
+	if (header.magic != kCacheFileMagic || header.version != kCacheFileVersion ||
+		header.vendorID != mProperties.vendorID || header.deviceID != mProperties.deviceID ||
+		header.driverVersion != mProperties.driverVersion ||
+		memcmp(header.pipelineCacheUUID, mProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+		header.dataSize != fileSize - sizeof(CacheFileHeader))
+	{
+		return false;
+	}
+
+	dataOut.resize(header.dataSize);
+	file.read(dataOut.data(), header.dataSize);
+	if (!file || hashCacheData(dataOut.data(), dataOut.size()) != header.dataHash)
+	{
+		return false;
+	}
+
+	//the driver's own header: length, version, vendor, device, cache UUID
+	const size_t driverHeaderSize = 16 + VK_UUID_SIZE;
+	if (dataOut.size() < driverHeaderSize)
+	{
+		return false;
+	}
+	U32 driverHeader[4];
+	memcpy(driverHeader, dataOut.data(), sizeof(driverHeader));
+	return driverHeader[0] >= driverHeaderSize && driverHeader[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		driverHeader[2] == mProperties.vendorID && driverHeader[3] == mProperties.deviceID &&
+		memcmp(dataOut.data() + 16, mProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+bool PipelineManager::saveCache()
+{
+	size_t dataSize = 0;
+	VkResult result = vkGetPipelineCacheData(mDevice, mCache, &dataSize, nullptr);
+	assert(result == VK_SUCCESS);
+	std::vector<char> data(dataSize);
+	result = vkGetPipelineCacheData(mDevice, mCache, &dataSize, data.data());
+	assert(result == VK_SUCCESS);
+
+	CacheFileHeader header = {};
+	header.magic = kCacheFileMagic;
+	header.version = kCacheFileVersion;
+	header.vendorID = mProperties.vendorID;
+	header.deviceID = mProperties.deviceID;
+	header.driverVersion = mProperties.driverVersion;
+	memcpy(header.pipelineCacheUUID, mProperties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.dataSize = (U32)dataSize;
+	header.dataHash = hashCacheData(data.data(), dataSize);
+
+	const std::string tempFilename = mCacheFilename + ".tmp";
+	{
+		std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+		file.write((const char*)&header, sizeof(header));
+		file.write(data.data(), dataSize);
+		if (!file)
+		{
+			return false;
+		}
+	}
+	std::remove(mCacheFilename.c_str());
+	return std::rename(tempFilename.c_str(), mCacheFilename.c_str()) == 0;
+}
+
+U32 PipelineManager::requestPipeline(const std::function<void(VkPipelineLayout*, VkPipeline*)> &build, VkPipelineLayout fallbackLayout,
+	VkPipeline fallback)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	const U32 request = (U32)mRequests.size();
+	mRequests.emplace_back();
+	Request &newRequest = mRequests.back();
+	newRequest.build = build;
+	newRequest.fallbackLayout = fallbackLayout;
+	newRequest.fallback = fallback;
+	newRequest.pipelineLayout = VK_NULL_HANDLE;
+	newRequest.pipeline = VK_NULL_HANDLE;
+	newRequest.ready = false;
+
+	if (mWorkers.empty())
+	{
+		//nothing to hand it to, so it's built right here
+		lock.unlock();
+		newRequest.build(&newRequest.pipelineLayout, &newRequest.pipeline);
+		newRequest.ready = true;
+		return request;
+	}
+	mQueue.push_back(&newRequest);
+	lock.unlock();
+	mWorkAvailable.notify_one();
+	return request;
+}
+
+bool PipelineManager::isReady(U32 request) const
+{
+	return mRequests[request].ready;
+}
+
+void PipelineManager::getPipeline(U32 request, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut) const
+{
+	const Request &pipelineRequest = mRequests[request];
+	const bool ready = pipelineRequest.ready;
+	*pPipelineLayoutOut = ready ? pipelineRequest.pipelineLayout : pipelineRequest.fallbackLayout;
+	*pPipelineOut = ready ? pipelineRequest.pipeline : pipelineRequest.fallback;
+}
+
+void PipelineManager::wait(U32 request)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	Request &pipelineRequest = mRequests[request];
+	mWorkFinished.wait(lock, [&pipelineRequest] { return (bool)pipelineRequest.ready; });
+}
+
+void PipelineManager::workerMain()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true)
+	{
+		mWorkAvailable.wait(lock, [this] { return mShutdown || !mQueue.empty(); });
+		if (mQueue.empty())
+		{
+			return;
+		}
+		Request *pRequest = mQueue.front();
+		mQueue.pop_front();
+
+		lock.unlock();
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		pRequest->build(&pipelineLayout, &pipeline);
+		lock.lock();
+
+		//the handles have to be in place before anyone can see the flag
+		pRequest->pipelineLayout = pipelineLayout;
+		pRequest->pipeline = pipeline;
+		pRequest->ready = true;
+		mWorkFinished.notify_all();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "stdafx.h"
+
+//Owns the VkPipelineCache every pipeline is created through and keeps it on disk between runs, so warm starts
+//skip most of the driver's compiler. Pipelines that aren't needed right away can be built on background
+//threads instead, with a fallback handed out until they're finished.
+class PipelineManager
+{
+public:
+	PipelineManager();
+	~PipelineManager();
+
+	//Loads the cache file if it was written by the same device and driver, otherwise starts out empty
+	void init(VkDevice device, const VkPhysicalDeviceProperties &properties, const std::string &cacheFilename, U32 workerCount);
+	//Waits for outstanding builds, writes the cache back out and destroys it
+	void destroy();
+	//Written to a temporary file first, so a crash mid-write can't leave a truncated cache behind
+	bool saveCache();
+
+	VkPipelineCache getCache() const { return mCache; }
+	bool hasLoadedCache() const { return mLoadedCache; }
+
+	//Runs build on a worker thread, which creates the pipeline through getCache(). Until it's done,
+	//getPipeline hands out the fallback. build must only touch state that stays put while it runs.
+	U32 requestPipeline(const std::function<void(VkPipelineLayout*, VkPipeline*)> &build, VkPipelineLayout fallbackLayout, VkPipeline fallback);
+	bool isReady(U32 request) const;
+	//the finished pipeline, or the fallback while it's still building
+	void getPipeline(U32 request, VkPipelineLayout *pPipelineLayoutOut, VkPipeline *pPipelineOut) const;
+	//Blocks until the request is done, for when there's nothing sensible to fall back on
+	void wait(U32 request);
+
+private:
+	//written ahead of the driver's data, which it checks again on load
+	struct CacheFileHeader
+	{
+		U32 magic;
+		U32 version;
+		U32 vendorID;
+		U32 deviceID;
+		U32 driverVersion;
+		U8 pipelineCacheUUID[VK_UUID_SIZE];
+		U32 dataSize;
+		U32 dataHash;
+	};
+
+	struct Request
+	{
+		std::function<void(VkPipelineLayout*, VkPipeline*)> build;
+		VkPipelineLayout fallbackLayout;
+		VkPipeline fallback;
+		VkPipelineLayout pipelineLayout;
+		VkPipeline pipeline;
+		std::atomic<bool> ready;
+	};
+
+	bool readCacheFile(std::vector<char> &dataOut) const;
+	void workerMain();
+
+	VkDevice mDevice;
+	VkPhysicalDeviceProperties mProperties;
+	std::string mCacheFilename;
+	VkPipelineCache mCache;
+	bool mLoadedCache;
+
+	std::deque<Request> mRequests; //deque so workers can hold on to elements while more get added
+	std::deque<Request*> mQueue;
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mWorkAvailable;
+	std::condition_variable mWorkFinished;
+	bool mShutdown;
+};
\ No newline at end of file
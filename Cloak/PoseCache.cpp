@@ -0,0 +1,191 @@
+#include "PoseCache.h"
+
+PoseCache::PoseCache(U32 bucketCount) : mBucketCount(bucketCount), mLodPolicy(nullptr)
+{
+	assert(bucketCount > 0);
+}
+
+PoseCache::~PoseCache()
+{
+	for (SharedPose *pose : mPoses)
+	{
+		delete pose;
+	}
+}
+
+SharedPose* PoseCache::acquirePose(AnimatedMesh *animatedMesh, U32 startTimeMillis)
+{
+	Animation *animation = animatedMesh->getAnimation();
+	assert(animation);
+
+	const float duration = animation->getDuration();
+	const float phase = animation->wrapTime(startTimeMillis / 1000.f);
+	U32 bucket = (U32)(phase / duration * mBucketCount);
+	if (bucket >= mBucketCount)
+	{
+		bucket = mBucketCount - 1;
+	}
+
+	for (SharedPose *pose : mPoses)
+	{
+		if (pose->animation == animation && pose->bucket == bucket
+			&& pose->paletteFormat == animatedMesh->getPaletteFormat()
+			&& pose->bindMesh->getModelName() == animatedMesh->getModelName())
+		{
+			pose->instanceCount++;
+			animatedMesh->setSharedPose(pose);
+			return pose;
+		}
+	}
+
+	SharedPose *pose = new SharedPose();
+	pose->animation = animation;
+	pose->bindMesh = animatedMesh;
+	pose->bucket = bucket;
+	//every instance in the bucket plays from the start of the bucket
+	pose->animationTime = bucket * duration / mBucketCount;
+	pose->paletteFormat = animatedMesh->getPaletteFormat();
+	pose->palette.resize(SkinningPalette::getStride(pose->paletteFormat) * animation->getBoneCount());
+	pose->paletteChanged = true;
+	pose->instanceCount = 1;
+	pose->lodRequestVisible = false;
+	pose->lodRequestScreenRadius = 0.f;
+	pose->lodLevel = 0;
+	pose->lodFrozen = false;
+	pose->lodForceUpdate = true;
+	pose->lodFrameCounter = 0;
+	pose->lodPendingMillis = 0;
+	pose->lodHistoryValid = false;
+	animatedMesh->sampleSkinningKeyframes(pose->animationTime, pose->paletteFormat, pose->palette.data());
+	mPoses.push_back(pose);
+
+	animatedMesh->setSharedPose(pose);
+	return pose;
+}
+
+void PoseCache::setAnimationLodPolicy(const AnimationLodPolicy *lodPolicy)
+{
+	mLodPolicy = lodPolicy;
+	for (SharedPose *pose : mPoses)
+	{
+		pose->lodLevel = 0;
+		pose->lodForceUpdate = true;
+		pose->lodHistoryValid = false;
+	}
+}
+
+void PoseCache::requestLod(SharedPose *pose, bool isVisible, float screenRadius)
+{
+	pose->lodRequestVisible |= isVisible;
+	pose->lodRequestScreenRadius = std::max(pose->lodRequestScreenRadius, screenRadius);
+}
+
+void PoseCache::update(U32 elapsedMillis)
+{
+	mLodStats.reset();
+	for (SharedPose *pose : mPoses)
+	{
+		pose->paletteChanged = false;
+		const U32 boneCount = pose->bindMesh->getBoneCount();
+		mLodStats.instanceCount += pose->instanceCount;
+		if (!mLodPolicy)
+		{
+			evaluatePose(pose, elapsedMillis, nullptr);
+			mLodStats.evaluatedInstances += pose->instanceCount;
+			mLodStats.bonesEvaluated += boneCount;
+			continue;
+		}
+		updatePoseLod(pose, elapsedMillis);
+	}
+}
+
+void PoseCache::evaluatePose(SharedPose *pose, U32 elapsedMillis, const std::vector<U8> *boneMask)
+{
+	pose->animationTime = pose->animation->wrapTime(pose->animationTime + elapsedMillis / 1000.f);
+	pose->bindMesh->sampleSkinningKeyframes(pose->animationTime, pose->paletteFormat, pose->palette.data(), boneMask);
+	pose->paletteChanged = true;
+}
+
+void PoseCache::updatePoseLod(SharedPose *pose, U32 elapsedMillis)
+{
+	//pick the level from what the instances asked for since the last update, the same way AnimatedMesh::updateLod does for one
+	const bool frozen = !pose->lodRequestVisible && mLodPolicy->getFreezeOffscreen();
+	if (pose->lodFrozen && !frozen)
+	{
+		pose->lodForceUpdate = true;
+	}
+	pose->lodFrozen = frozen;
+	const U32 lodLevel = mLodPolicy->selectLevel(pose->lodRequestScreenRadius);
+	if (lodLevel != pose->lodLevel)
+	{
+		pose->lodLevel = lodLevel;
+		pose->lodHistoryValid = false;
+	}
+	pose->lodRequestVisible = false;
+	pose->lodRequestScreenRadius = 0.f;
+
+	const U32 boneCount = pose->bindMesh->getBoneCount();
+	pose->lodPendingMillis += elapsedMillis;
+	if (pose->lodFrozen)
+	{
+		mLodStats.frozenInstances += pose->instanceCount;
+		mLodStats.bonesSkipped += boneCount;
+		return;
+	}
+
+	//buckets are already spread across the clip, so their bucket index staggers the reduced rate updates
+	const AnimationLodLevel &level = mLodPolicy->getLevel(pose->lodLevel);
+	U32 lodFrame = (pose->lodFrameCounter++ + pose->bucket) % level.updateInterval;
+	if (lodFrame == 0 || pose->lodForceUpdate)
+	{
+		const std::vector<U8> *boneMask = level.skipLeafBones ? &pose->bindMesh->getLodBoneMask() : nullptr;
+		evaluatePose(pose, pose->lodPendingMillis, boneMask);
+		pose->lodPendingMillis = 0;
+		pose->lodForceUpdate = false;
+
+		if (level.extrapolate)
+		{
+			pose->lodPrevPalette.swap(pose->lodLastPalette);
+			pose->lodLastPalette = pose->palette;
+			pose->lodHistoryValid = pose->lodPrevPalette.size() == pose->palette.size();
+		}
+
+		U32 bonesEvaluated = boneCount;
+		if (boneMask)
+		{
+			bonesEvaluated = (U32)std::count(boneMask->begin(), boneMask->end(), 1);
+		}
+		mLodStats.evaluatedInstances += pose->instanceCount;
+		mLodStats.bonesEvaluated += bonesEvaluated;
+		mLodStats.bonesSkipped += boneCount - bonesEvaluated;
+	}
+	else if (level.extrapolate && pose->lodHistoryValid)
+	{
+		float t = lodFrame / (float)level.updateInterval;
+		SkinningPalette::extrapolate(pose->paletteFormat, pose->lodLastPalette.data(), pose->lodPrevPalette.data(), t, boneCount,
+			pose->palette.data());
+		pose->paletteChanged = true;
+		mLodStats.extrapolatedInstances += pose->instanceCount;
+		mLodStats.bonesSkipped += boneCount;
+	}
+	else
+	{
+		mLodStats.heldInstances += pose->instanceCount;
+		mLodStats.bonesSkipped += boneCount;
+	}
+}
+
+std::vector<SharedPose*>& PoseCache::getPoses()
+{
+	return mPoses;
+}
+
+U32 PoseCache::getInstanceCount() const
+{
+	U32 instanceCount = 0;
+	for (const SharedPose *pose : mPoses)
+	{
+		instanceCount += pose->instanceCount;
+	}
+	return instanceCount;
+}
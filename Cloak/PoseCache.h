@@ -0,0 +1,68 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "AnimatedMesh.h"
+#include "Animation.h"
+#include "AnimationLod.h"
+#include "graphics_resources.h"
+
+//A pose evaluated once per frame and shared by every instance playing the same clip
+//on the same model within the same phase bucket.
+struct SharedPose
+{
+	Animation *animation;
+	const AnimatedMesh *bindMesh; //supplies the inverse bind matrices for the palette
+	U32 bucket;
+	float animationTime;
+
+	PaletteFormat paletteFormat;
+	std::vector<glm::vec4> palette;
+	GpuBuffer animationConstantBuffer;
+	bool paletteChanged;
+
+	U32 instanceCount;
+
+	//Animation LOD, at the level the bucket's most demanding instance asked for
+	bool lodRequestVisible; //requests since the last update
+	float lodRequestScreenRadius;
+	U32 lodLevel;
+	bool lodFrozen;
+	bool lodForceUpdate;
+	U32 lodFrameCounter;
+	U32 lodPendingMillis;
+	bool lodHistoryValid;
+	std::vector<glm::vec4> lodLastPalette;
+	std::vector<glm::vec4> lodPrevPalette;
+};
+
+//Quantizes each instance's playback phase into one of a fixed number of buckets so that crowd
+//animation cost scales with the number of distinct poses instead of the number of instances.
+class PoseCache
+{
+public:
+	PoseCache(U32 bucketCount);
+	~PoseCache();
+
+	//Assigns the mesh to the pose for its clip and phase, creating the pose if needed
+	SharedPose* acquirePose(AnimatedMesh *animatedMesh, U32 startTimeMillis);
+	//Instances with a shared pose don't run their own animation LOD, the whole bucket does it here instead
+	void setAnimationLodPolicy(const AnimationLodPolicy *lodPolicy);
+	//Call for every instance between updates. A bucket is only as reduced as its most demanding instance allows.
+	void requestLod(SharedPose *pose, bool isVisible, float screenRadius);
+	void update(U32 elapsedMillis);
+
+	std::vector<SharedPose*>& getPoses();
+	U32 getInstanceCount() const;
+	//instance counts cover every instance in a bucket, bone counts the work actually done per bucket
+	const AnimationLodStats& getLodStats() const { return mLodStats; }
+
+private:
+	void evaluatePose(SharedPose *pose, U32 elapsedMillis, const std::vector<U8> *boneMask);
+	void updatePoseLod(SharedPose *pose, U32 elapsedMillis);
+
+	U32 mBucketCount;
+	std::vector<SharedPose*> mPoses;
+	const AnimationLodPolicy *mLodPolicy;
+	AnimationLodStats mLodStats;
+};
@@ -0,0 +1,753 @@
+#include "RenderGraph.h"
+
+#include "CloakUtils.h"
+
+static const U32 kInvalidPass = 0xFFFFFFFF;
+
+static const VkAccessFlags kWriteAccess = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+RenderGraph::RenderGraph() : mDevice(VK_NULL_HANDLE), mAllocator(VK_NULL_HANDLE), mResourceStates(nullptr), mSwapchainImageCount(1),
+	mSwapchainIndex(0), mTransientMemory(VK_NULL_HANDLE), mTransientMemorySize(0), mUnaliasedTransientMemorySize(0)
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+}
+
+RenderGraphResource RenderGraph::addResource(const std::string &name, ResourceType type)
+{
+	Resource resource = {};
+	resource.name = name;
+	resource.type = type;
+	resource.buffer = VK_NULL_HANDLE;
+	resource.allocation = VK_NULL_HANDLE;
+	resource.firstPass = kInvalidPass;
+	resource.lastPass = kInvalidPass;
+	mResources.push_back(resource);
+	return (RenderGraphResource)(mResources.size() - 1);
+}
+
+RenderGraphResource RenderGraph::createImage(const std::string &name, const RenderGraphImageDesc &desc)
+{
+	const RenderGraphResource image = addResource(name, kResourceTypeTransientImage);
+	mResources[image].desc = desc;
+	return image;
+}
+
+RenderGraphResource RenderGraph::importImage(const std::string &name, VkImage image, VkImageView view, VkFormat format, U32 width, U32 height)
+{
+	return importSwapchain(name, std::vector<VkImage>(1, image), std::vector<VkImageView>(1, view), format, width, height);
+}
+
+RenderGraphResource RenderGraph::importSwapchain(const std::string &name, const std::vector<VkImage> &images, const std::vector<VkImageView> &views,
+	VkFormat format, U32 width, U32 height)
+{
+	assert(images.size() == views.size() && !images.empty());
+	const RenderGraphResource image = addResource(name, kResourceTypeImportedImage);
+	Resource &resource = mResources[image];
+	resource.images = images;
+	resource.views = views;
+	resource.desc.width = width;
+	resource.desc.height = height;
+	resource.desc.mipCount = 1;
+	resource.desc.format = format;
+	if (images.size() > 1)
+	{
+		mSwapchainImageCount = (U32)images.size();
+	}
+	return image;
+}
+
+RenderGraphResource RenderGraph::importBuffer(const std::string &name, VkBuffer buffer)
+{
+	const RenderGraphResource resource = addResource(name, kResourceTypeBuffer);
+	mResources[resource].buffer = buffer;
+	return resource;
+}
+
+U32 RenderGraph::addGraphicsPass(const std::string &name, VkSubpassContents contents, const ExecuteFunction &execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.graphics = true;
+	pass.contents = contents;
+	pass.execute = execute;
+	pass.culled = false;
+	pass.order = kInvalidPass;
+	pass.renderPass = VK_NULL_HANDLE;
+	pass.extent = { 0, 0 };
+	mPasses.push_back(pass);
+	return (U32)(mPasses.size() - 1);
+}
+
+U32 RenderGraph::addComputePass(const std::string &name, const ExecuteFunction &execute)
+{
+	const U32 pass = addGraphicsPass(name, VK_SUBPASS_CONTENTS_INLINE, execute);
+	mPasses[pass].graphics = false;
+	return pass;
+}
+
+void RenderGraph::addAccess(U32 pass, const Access &access)
+{
+	//one barrier per resource per pass, so a pass that reads and writes something declares both in one access
+	for (const Access &existing : mPasses[pass].accesses)
+	{
+		assert(existing.resource != access.resource);
+	}
+	mPasses[pass].accesses.push_back(access);
+}
+
+void RenderGraph::addColorOutput(U32 pass, RenderGraphResource image, const VkClearColorValue *pClearValue)
+{
+	assert(mPasses[pass].graphics && mResources[image].type != kResourceTypeBuffer);
+	//depth goes last
+	for (const Access &existing : mPasses[pass].accesses)
+	{
+		assert(!existing.attachment || existing.layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	}
+
+	Access access = {};
+	access.resource = image;
+	access.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	access.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	access.access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	access.attachment = true;
+	access.clear = pClearValue != nullptr;
+	if (pClearValue)
+	{
+		access.clearValue.color = *pClearValue;
+	}
+	addAccess(pass, access);
+	mResources[image].usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+}
+
+void RenderGraph::addDepthOutput(U32 pass, RenderGraphResource image, const VkClearDepthStencilValue *pClearValue)
+{
+	assert(mPasses[pass].graphics && mResources[image].type != kResourceTypeBuffer);
+	Access access = {};
+	access.resource = image;
+	access.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	access.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	access.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	access.attachment = true;
+	access.clear = pClearValue != nullptr;
+	if (pClearValue)
+	{
+		access.clearValue.depthStencil = *pClearValue;
+	}
+	addAccess(pass, access);
+	mResources[image].usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+}
+
+void RenderGraph::addImageAccess(U32 pass, RenderGraphResource image, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	assert(mResources[image].type != kResourceTypeBuffer);
+	Access imageAccess = {};
+	imageAccess.resource = image;
+	imageAccess.layout = layout;
+	imageAccess.stages = stages;
+	imageAccess.access = access;
+	addAccess(pass, imageAccess);
+
+	Resource &resource = mResources[image];
+	switch (layout)
+	{
+	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+		resource.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_GENERAL:
+		resource.usage |= VK_IMAGE_USAGE_STORAGE_BIT | ((access & VK_ACCESS_SHADER_READ_BIT) ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+		resource.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+		resource.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		break;
+	default:
+		break;
+	}
+}
+
+void RenderGraph::addBufferAccess(U32 pass, RenderGraphResource buffer, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	assert(mResources[buffer].type == kResourceTypeBuffer);
+	Access bufferAccess = {};
+	bufferAccess.resource = buffer;
+	bufferAccess.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	bufferAccess.stages = stages;
+	bufferAccess.access = access;
+	addAccess(pass, bufferAccess);
+}
+
+void RenderGraph::present(RenderGraphResource image)
+{
+	assert(mResources[image].type == kResourceTypeImportedImage);
+	mResources[image].presented = true;
+}
+
+bool RenderGraph::isWrite(const Access &access) const
+{
+	return access.attachment || (access.access & kWriteAccess) != 0;
+}
+
+void RenderGraph::compile(VkDevice device, VmaAllocator allocator, ResourceStateTracker *pResourceStates)
+{
+	mDevice = device;
+	mAllocator = allocator;
+	mResourceStates = pResourceStates;
+
+	cullPasses();
+	sortPasses();
+
+	for (U32 order = 0; order < mExecutionOrder.size(); order++)
+	{
+		for (const Access &access : mPasses[mExecutionOrder[order]].accesses)
+		{
+			Resource &resource = mResources[access.resource];
+			if (resource.firstPass == kInvalidPass)
+			{
+				resource.firstPass = order;
+			}
+			resource.lastPass = order;
+		}
+	}
+
+	createTransientImages();
+
+	U32 culledCount = 0;
+	for (Pass &pass : mPasses)
+	{
+		if (pass.culled)
+		{
+			culledCount++;
+		}
+		else if (pass.graphics)
+		{
+			createRenderPass(pass);
+		}
+	}
+	std::cout << "Render graph: " << mPasses.size() - culledCount << " passes, " << culledCount << " culled, " <<
+		mTransientMemorySize / 1024 << "KB of transients (" << mUnaliasedTransientMemorySize / 1024 << "KB without aliasing)" << std::endl;
+}
+
+void RenderGraph::cullPasses()
+{
+	//Walk back from the end, keeping whatever produces something a later kept pass reads. Imported resources
+	//outlive the frame, so writing them always counts, and passes that declare no writes have effects we can't see.
+	std::vector<bool> live(mResources.size(), false);
+	for (U32 passIndex = (U32)mPasses.size(); passIndex-- > 0;)
+	{
+		Pass &pass = mPasses[passIndex];
+		bool hasWrites = false;
+		bool needed = false;
+		for (const Access &access : pass.accesses)
+		{
+			if (isWrite(access))
+			{
+				hasWrites = true;
+				needed |= mResources[access.resource].type != kResourceTypeTransientImage || live[access.resource];
+			}
+		}
+		pass.culled = hasWrites && !needed;
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		for (const Access &access : pass.accesses)
+		{
+			if (isWrite(access))
+			{
+				live[access.resource] = false;
+			}
+		}
+		for (const Access &access : pass.accesses)
+		{
+			//attachments without a clear load what came before
+			const bool reads = access.attachment ? !access.clear : (access.access & ~kWriteAccess) != 0;
+			if (reads)
+			{
+				live[access.resource] = true;
+			}
+		}
+	}
+}
+
+void RenderGraph::sortPasses()
+{
+	//Edges keep what the declared order means: a pass comes after the last earlier write to anything it touches,
+	//and a write also comes after every read since the write before it
+	const U32 passCount = (U32)mPasses.size();
+	std::vector<std::vector<U32>> dependents(passCount);
+	std::vector<U32> dependencyCounts(passCount, 0);
+	auto addDependency = [&dependents, &dependencyCounts](U32 before, U32 after) {
+		dependents[before].push_back(after);
+		dependencyCounts[after]++;
+	};
+	std::vector<U32> lastWrites(mResources.size(), kInvalidPass);
+	std::vector<std::vector<U32>> readsSinceWrite(mResources.size());
+	//a pass that declares nothing could be touching anything, so it stays between what came before and after it
+	U32 lastFence = kInvalidPass;
+	std::vector<U32> passesSinceFence;
+	//a pass whose writes all land in transients is held back until something needs them, keeping their lifetimes short
+	std::vector<bool> deferrable(passCount, false);
+	for (U32 passIndex = 0; passIndex < passCount; passIndex++)
+	{
+		const Pass &pass = mPasses[passIndex];
+		if (pass.culled)
+		{
+			continue;
+		}
+		if (pass.accesses.empty())
+		{
+			for (U32 earlier : passesSinceFence)
+			{
+				addDependency(earlier, passIndex);
+			}
+			if (passesSinceFence.empty() && lastFence != kInvalidPass)
+			{
+				addDependency(lastFence, passIndex);
+			}
+			lastFence = passIndex;
+			passesSinceFence.clear();
+			continue;
+		}
+		if (lastFence != kInvalidPass)
+		{
+			addDependency(lastFence, passIndex);
+		}
+		passesSinceFence.push_back(passIndex);
+
+		bool transientWritesOnly = true;
+		for (const Access &access : pass.accesses)
+		{
+			if (lastWrites[access.resource] != kInvalidPass)
+			{
+				addDependency(lastWrites[access.resource], passIndex);
+			}
+			if (!isWrite(access))
+			{
+				readsSinceWrite[access.resource].push_back(passIndex);
+				continue;
+			}
+			for (U32 reader : readsSinceWrite[access.resource])
+			{
+				addDependency(reader, passIndex);
+			}
+			readsSinceWrite[access.resource].clear();
+			lastWrites[access.resource] = passIndex;
+			transientWritesOnly &= mResources[access.resource].type == kResourceTypeTransientImage;
+		}
+		deferrable[passIndex] = transientWritesOnly;
+	}
+
+	//ready is kept in declaration order, which is what breaks ties
+	std::vector<U32> ready;
+	for (U32 passIndex = 0; passIndex < passCount; passIndex++)
+	{
+		if (!mPasses[passIndex].culled && dependencyCounts[passIndex] == 0)
+		{
+			ready.push_back(passIndex);
+		}
+	}
+	mExecutionOrder.clear();
+	while (!ready.empty())
+	{
+		auto next = std::find_if(ready.begin(), ready.end(), [&deferrable](U32 passIndex) { return !deferrable[passIndex]; });
+		if (next == ready.end())
+		{
+			next = ready.begin();
+		}
+		const U32 passIndex = *next;
+		ready.erase(next);
+		mPasses[passIndex].order = (U32)mExecutionOrder.size();
+		mExecutionOrder.push_back(passIndex);
+
+		for (U32 dependent : dependents[passIndex])
+		{
+			if (--dependencyCounts[dependent] == 0)
+			{
+				ready.insert(std::upper_bound(ready.begin(), ready.end(), dependent), dependent);
+			}
+		}
+	}
+}
+
+void RenderGraph::createTransientImages()
+{
+	struct Placement
+	{
+		RenderGraphResource resource;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+	std::vector<Placement> placements;
+	VkDeviceSize alignment = 1;
+	U32 memoryTypeBits = 0xFFFFFFFF;
+	VkDeviceSize sharedSize = 0;
+	mTransientMemorySize = 0;
+	mUnaliasedTransientMemorySize = 0;
+
+	//placed in the order they come alive, each at the lowest offset clear of everything alive at the same time
+	std::vector<RenderGraphResource> transients;
+	for (RenderGraphResource i = 0; i < mResources.size(); i++)
+	{
+		//nothing left after culling uses it
+		if (mResources[i].type == kResourceTypeTransientImage && mResources[i].firstPass != kInvalidPass)
+		{
+			transients.push_back(i);
+		}
+	}
+	std::stable_sort(transients.begin(), transients.end(), [this](RenderGraphResource a, RenderGraphResource b) {
+		return mResources[a].firstPass < mResources[b].firstPass;
+	});
+
+	std::vector<RenderGraphResource> sharedTransients;
+	for (RenderGraphResource transient : transients)
+	{
+		Resource &resource = mResources[transient];
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent.width = resource.desc.width;
+		imageInfo.extent.height = resource.desc.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = resource.desc.mipCount;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = resource.desc.format;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = resource.usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		VkImage image;
+		VkResult result = vkCreateImage(mDevice, &imageInfo, nullptr, &image);
+		assert(result == VK_SUCCESS);
+		resource.images.assign(1, image);
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(mDevice, image, &requirements);
+		mUnaliasedTransientMemorySize += requirements.size;
+		resource.memorySize = requirements.size;
+
+		//some drivers keep depth and color in different memory types, whatever can't share gets memory of its own
+		if ((memoryTypeBits & requirements.memoryTypeBits) == 0)
+		{
+			VmaMemoryRequirements vmaReq = {};
+			vmaReq.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+			VmaAllocationInfo allocationInfo;
+			result = vmaAllocateMemory(mAllocator, &requirements, &vmaReq, &resource.allocation, &allocationInfo);
+			assert(result == VK_SUCCESS);
+			result = vkBindImageMemory(mDevice, image, allocationInfo.deviceMemory, allocationInfo.offset);
+			assert(result == VK_SUCCESS);
+			mTransientMemorySize += requirements.size;
+			continue;
+		}
+		alignment = std::max(alignment, requirements.alignment);
+		memoryTypeBits &= requirements.memoryTypeBits;
+
+		VkDeviceSize offset = 0;
+		bool placed = false;
+		while (!placed)
+		{
+			placed = true;
+			for (const Placement &other : placements)
+			{
+				const Resource &otherResource = mResources[other.resource];
+				const bool aliveTogether = otherResource.firstPass <= resource.lastPass && resource.firstPass <= otherResource.lastPass;
+				if (aliveTogether && offset < other.offset + other.size && other.offset < offset + requirements.size)
+				{
+					offset = (other.offset + other.size + requirements.alignment - 1) / requirements.alignment * requirements.alignment;
+					placed = false;
+				}
+			}
+		}
+		resource.memoryOffset = offset;
+
+		for (const Placement &other : placements)
+		{
+			if (offset < other.offset + other.size && other.offset < offset + requirements.size)
+			{
+				resource.aliases.push_back(other.resource);
+				mResources[other.resource].aliases.push_back(transient);
+			}
+		}
+		Placement placement = { transient, offset, requirements.size };
+		placements.push_back(placement);
+		sharedTransients.push_back(transient);
+		sharedSize = std::max(sharedSize, offset + requirements.size);
+	}
+
+	if (!sharedTransients.empty())
+	{
+		//one allocation for every transient that can share, they're bound at their offsets into it
+		VkMemoryRequirements memoryRequirements = {};
+		memoryRequirements.size = sharedSize;
+		memoryRequirements.alignment = alignment;
+		memoryRequirements.memoryTypeBits = memoryTypeBits;
+		VmaMemoryRequirements vmaReq = {};
+		vmaReq.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		VmaAllocationInfo allocationInfo;
+		VkResult result = vmaAllocateMemory(mAllocator, &memoryRequirements, &vmaReq, &mTransientMemory, &allocationInfo);
+		assert(result == VK_SUCCESS);
+		mTransientMemorySize += sharedSize;
+
+		for (RenderGraphResource transient : sharedTransients)
+		{
+			Resource &resource = mResources[transient];
+			result = vkBindImageMemory(mDevice, resource.images[0], allocationInfo.deviceMemory, allocationInfo.offset + resource.memoryOffset);
+			assert(result == VK_SUCCESS);
+		}
+	}
+
+	for (RenderGraphResource transient : transients)
+	{
+		Resource &resource = mResources[transient];
+		const VkImage image = resource.images[0];
+		const VkImageAspectFlags aspects = CloakUtils::getFormatAspects(resource.desc.format);
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = resource.desc.format;
+		//views that get sampled can only have one aspect, the depth is the useful one
+		viewInfo.subresourceRange.aspectMask = (aspects & VK_IMAGE_ASPECT_DEPTH_BIT) ? VK_IMAGE_ASPECT_DEPTH_BIT : aspects;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = resource.desc.mipCount;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		VkImageView view;
+		VkResult result = vkCreateImageView(mDevice, &viewInfo, nullptr, &view);
+		assert(result == VK_SUCCESS);
+		resource.views.assign(1, view);
+
+		mResourceStates->trackImage(image, aspects, resource.desc.mipCount, VK_IMAGE_LAYOUT_UNDEFINED);
+	}
+}
+
+void RenderGraph::createRenderPass(Pass &pass)
+{
+	std::vector<VkAttachmentDescription> attachments;
+	std::vector<VkAttachmentReference> colorRefs;
+	VkAttachmentReference depthRef = {};
+	bool hasDepth = false;
+	bool usesSwapchain = false;
+	std::vector<const Access*> attachmentAccesses;
+
+	pass.clearValues.clear();
+	for (const Access &access : pass.accesses)
+	{
+		if (!access.attachment)
+		{
+			continue;
+		}
+		const Resource &resource = mResources[access.resource];
+		usesSwapchain |= resource.images.size() > 1;
+
+		//Contents only have to be loaded if something wrote them earlier, or they came from outside the frame.
+		//They only have to be stored if a later pass uses them or they leave the frame.
+		const bool imported = resource.type == kResourceTypeImportedImage;
+		VkAttachmentDescription attachment = {};
+		attachment.format = resource.desc.format;
+		attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		attachment.loadOp = access.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR :
+			(imported || resource.firstPass < pass.order) ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.storeOp = (imported || resource.lastPass > pass.order) ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		//the tracker's barriers do the transitions, the pass leaves layouts alone
+		attachment.initialLayout = access.layout;
+		attachment.finalLayout = access.layout;
+
+		VkAttachmentReference ref = {};
+		ref.attachment = (U32)attachments.size();
+		ref.layout = access.layout;
+		if (access.layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+		{
+			assert(!hasDepth);
+			depthRef = ref;
+			hasDepth = true;
+		}
+		else
+		{
+			colorRefs.push_back(ref);
+		}
+		attachments.push_back(attachment);
+		attachmentAccesses.push_back(&access);
+		pass.clearValues.push_back(access.clearValue);
+		pass.extent.width = resource.desc.width;
+		pass.extent.height = resource.desc.height;
+	}
+
+	VkSubpassDescription subPass = {};
+	subPass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subPass.colorAttachmentCount = (U32)colorRefs.size();
+	subPass.pColorAttachments = colorRefs.data();
+	subPass.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = (U32)attachments.size();
+	renderPassInfo.pAttachments = attachments.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subPass;
+	VkResult result = vkCreateRenderPass(mDevice, &renderPassInfo, nullptr, &pass.renderPass);
+	assert(result == VK_SUCCESS);
+
+	pass.framebuffers.resize(usesSwapchain ? mSwapchainImageCount : 1);
+	for (U32 i = 0; i < pass.framebuffers.size(); i++)
+	{
+		std::vector<VkImageView> views;
+		for (const Access *pAccess : attachmentAccesses)
+		{
+			const Resource &resource = mResources[pAccess->resource];
+			views.push_back(resource.views[resource.views.size() > 1 ? i : 0]);
+		}
+
+		VkFramebufferCreateInfo framebufferInfo = {};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = pass.renderPass;
+		framebufferInfo.attachmentCount = (U32)views.size();
+		framebufferInfo.pAttachments = views.data();
+		framebufferInfo.width = pass.extent.width;
+		framebufferInfo.height = pass.extent.height;
+		framebufferInfo.layers = 1;
+		result = vkCreateFramebuffer(mDevice, &framebufferInfo, nullptr, &pass.framebuffers[i]);
+		assert(result == VK_SUCCESS);
+	}
+}
+
+VkImage RenderGraph::getImage(RenderGraphResource image, U32 swapchainIndex) const
+{
+	const Resource &resource = mResources[image];
+	return resource.images[resource.images.size() > 1 ? swapchainIndex : 0];
+}
+
+VkImage RenderGraph::getImage(RenderGraphResource image) const
+{
+	return getImage(image, mSwapchainIndex);
+}
+
+VkImageView RenderGraph::getImageView(RenderGraphResource image) const
+{
+	const Resource &resource = mResources[image];
+	return resource.views[resource.views.size() > 1 ? mSwapchainIndex : 0];
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, U32 swapchainIndex)
+{
+	mSwapchainIndex = swapchainIndex;
+	for (U32 passIndex : mExecutionOrder)
+	{
+		const Pass &pass = mPasses[passIndex];
+
+		//every resource the pass touches gets its barrier in one batch
+		for (const Access &access : pass.accesses)
+		{
+			const Resource &resource = mResources[access.resource];
+			if (resource.type == kResourceTypeBuffer)
+			{
+				mResourceStates->useBuffer(resource.buffer, access.stages, access.access);
+				continue;
+			}
+
+			const VkImage image = getImage(access.resource, swapchainIndex);
+			if (resource.type == kResourceTypeTransientImage && resource.firstPass == pass.order)
+			{
+				//a transient starts out undefined, on top of whatever last used its memory
+				for (RenderGraphResource alias : resource.aliases)
+				{
+					mResourceStates->aliasImage(image, getImage(alias));
+				}
+				mResourceStates->discardImage(image);
+			}
+			else if (access.clear)
+			{
+				//nothing about to be cleared gets read
+				mResourceStates->discardImage(image);
+			}
+			mResourceStates->useImage(image, access.layout, access.stages, access.access);
+		}
+		mResourceStates->flush(commandBuffer);
+
+		if (!pass.graphics)
+		{
+			pass.execute(commandBuffer);
+			continue;
+		}
+
+		VkRenderPassBeginInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = pass.renderPass;
+		renderPassInfo.framebuffer = pass.framebuffers[pass.framebuffers.size() > 1 ? swapchainIndex : 0];
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = pass.extent;
+		renderPassInfo.clearValueCount = (U32)pass.clearValues.size();
+		renderPassInfo.pClearValues = pass.clearValues.data();
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, pass.contents);
+		pass.execute(commandBuffer);
+		vkCmdEndRenderPass(commandBuffer);
+	}
+
+	for (RenderGraphResource i = 0; i < mResources.size(); i++)
+	{
+		if (mResources[i].presented)
+		{
+			mResourceStates->useImage(getImage(i, swapchainIndex), VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+		}
+	}
+	mResourceStates->flush(commandBuffer);
+	for (RenderGraphResource i = 0; i < mResources.size(); i++)
+	{
+		if (mResources[i].presented)
+		{
+			//next time it's acquired, the semaphore wait at color output is what the next barrier has to chain onto
+			mResourceStates->setImageState(getImage(i, swapchainIndex), VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+				VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0);
+		}
+	}
+}
+
+void RenderGraph::destroy()
+{
+	for (Pass &pass : mPasses)
+	{
+		for (VkFramebuffer framebuffer : pass.framebuffers)
+		{
+			vkDestroyFramebuffer(mDevice, framebuffer, nullptr);
+		}
+		if (pass.renderPass != VK_NULL_HANDLE)
+		{
+			vkDestroyRenderPass(mDevice, pass.renderPass, nullptr);
+		}
+	}
+	for (Resource &resource : mResources)
+	{
+		if (resource.type == kResourceTypeTransientImage && !resource.images.empty())
+		{
+			mResourceStates->forgetImage(resource.images[0]);
+			vkDestroyImageView(mDevice, resource.views[0], nullptr);
+			vkDestroyImage(mDevice, resource.images[0], nullptr);
+			if (resource.allocation != VK_NULL_HANDLE)
+			{
+				vmaFreeMemory(mAllocator, resource.allocation);
+			}
+		}
+	}
+	if (mTransientMemory != VK_NULL_HANDLE)
+	{
+		vmaFreeMemory(mAllocator, mTransientMemory);
+		mTransientMemory = VK_NULL_HANDLE;
+	}
+
+	mPasses.clear();
+	mResources.clear();
+	mExecutionOrder.clear();
+	mSwapchainImageCount = 1;
+	mSwapchainIndex = 0;
+	mTransientMemorySize = 0;
+	mUnaliasedTransientMemorySize = 0;
+}
\ No newline at end of file
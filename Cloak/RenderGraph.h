@@ -0,0 +1,144 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "ResourceStateTracker.h"
+
+typedef U32 RenderGraphResource;
+const RenderGraphResource kInvalidRenderGraphResource = 0xFFFFFFFF;
+
+//Images the graph creates and owns for the length of the frame. Usage is worked out from how passes use them.
+struct RenderGraphImageDesc
+{
+	U32 width;
+	U32 height;
+	U32 mipCount;
+	VkFormat format;
+};
+
+//A frame described as passes that declare what they read and write. compile() works out which passes actually
+//contribute to the frame, the order they run in, the render passes and framebuffers for the graphics ones (load and
+//store ops included), and places transient images whose lifetimes don't overlap on the same memory. execute() records
+//the passes with the barriers in between coming from the ResourceStateTracker.
+//A read sees the last write to the resource added before it. Passes only get reordered where that doesn't change,
+//and passes that declare nothing stay put relative to everything else.
+class RenderGraph
+{
+public:
+	typedef std::function<void(VkCommandBuffer)> ExecuteFunction;
+
+	RenderGraph();
+	~RenderGraph();
+
+	RenderGraphResource createImage(const std::string &name, const RenderGraphImageDesc &desc);
+	RenderGraphResource importImage(const std::string &name, VkImage image, VkImageView view, VkFormat format, U32 width, U32 height);
+	//One image per swapchain image, execute() picks which
+	RenderGraphResource importSwapchain(const std::string &name, const std::vector<VkImage> &images, const std::vector<VkImageView> &views,
+		VkFormat format, U32 width, U32 height);
+	RenderGraphResource importBuffer(const std::string &name, VkBuffer buffer);
+
+	//Graphics passes get a render pass over their attachments, their own commands can be inline or secondaries
+	U32 addGraphicsPass(const std::string &name, VkSubpassContents contents, const ExecuteFunction &execute);
+	U32 addComputePass(const std::string &name, const ExecuteFunction &execute);
+
+	//Attachments go color first then depth, in the order they're added, which has to match the render pass
+	//pipelines and secondaries are built against. Without a clear value the previous contents are loaded.
+	void addColorOutput(U32 pass, RenderGraphResource image, const VkClearColorValue *pClearValue = nullptr);
+	void addDepthOutput(U32 pass, RenderGraphResource image, const VkClearDepthStencilValue *pClearValue = nullptr);
+	//Reads and writes outside of attachments. Anything in access that writes makes it a write.
+	void addImageAccess(U32 pass, RenderGraphResource image, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access);
+	void addBufferAccess(U32 pass, RenderGraphResource buffer, VkPipelineStageFlags stages, VkAccessFlags access);
+	//Hands the image to the presentation engine at the end of the frame
+	void present(RenderGraphResource image);
+
+	void compile(VkDevice device, VmaAllocator allocator, ResourceStateTracker *pResourceStates);
+	void execute(VkCommandBuffer commandBuffer, U32 swapchainIndex);
+	//Destroys everything compile() made, imported resources are left alone
+	void destroy();
+
+	//During execute() the swapchain gives the image being recorded for
+	VkImage getImage(RenderGraphResource image) const;
+	VkImageView getImageView(RenderGraphResource image) const;
+	bool isPassCulled(U32 pass) const { return mPasses[pass].culled; }
+	//what the transients take up, and what they would without sharing memory
+	VkDeviceSize getTransientMemorySize() const { return mTransientMemorySize; }
+	VkDeviceSize getUnaliasedTransientMemorySize() const { return mUnaliasedTransientMemorySize; }
+
+private:
+	enum ResourceType
+	{
+		kResourceTypeTransientImage,
+		kResourceTypeImportedImage,
+		kResourceTypeBuffer,
+	};
+
+	struct Resource
+	{
+		std::string name;
+		ResourceType type;
+		RenderGraphImageDesc desc;
+		VkImageUsageFlags usage;
+		std::vector<VkImage> images; //one per swapchain image for the swapchain, otherwise just the one
+		std::vector<VkImageView> views;
+		VkBuffer buffer;
+		VmaAllocation allocation; //transients that couldn't share the graph's memory
+		bool presented;
+
+		//filled in by compile(), as positions in mExecutionOrder
+		U32 firstPass;
+		U32 lastPass;
+		VkDeviceSize memoryOffset;
+		VkDeviceSize memorySize;
+		std::vector<RenderGraphResource> aliases; //transients sharing some of its memory
+	};
+
+	struct Access
+	{
+		RenderGraphResource resource;
+		VkImageLayout layout;
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		bool attachment;
+		bool clear;
+		VkClearValue clearValue;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		bool graphics;
+		VkSubpassContents contents;
+		ExecuteFunction execute;
+		std::vector<Access> accesses;
+		bool culled;
+		U32 order; //position in mExecutionOrder
+
+		//graphics passes only
+		VkRenderPass renderPass;
+		std::vector<VkFramebuffer> framebuffers; //per swapchain image if it draws to the swapchain
+		std::vector<VkClearValue> clearValues;
+		VkExtent2D extent;
+	};
+
+	RenderGraphResource addResource(const std::string &name, ResourceType type);
+	void addAccess(U32 pass, const Access &access);
+	bool isWrite(const Access &access) const;
+	void cullPasses();
+	void sortPasses();
+	void createTransientImages();
+	void createRenderPass(Pass &pass);
+	VkImage getImage(RenderGraphResource image, U32 swapchainIndex) const;
+
+	VkDevice mDevice;
+	VmaAllocator mAllocator;
+	ResourceStateTracker *mResourceStates;
+	std::vector<Resource> mResources;
+	std::vector<Pass> mPasses;
+	std::vector<U32> mExecutionOrder; //pass indices, culled passes left out
+	U32 mSwapchainImageCount;
+	U32 mSwapchainIndex; //the one execute() is recording for
+
+	VmaAllocation mTransientMemory;
+	VkDeviceSize mTransientMemorySize;
+	VkDeviceSize mUnaliasedTransientMemorySize;
+};
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "RenderQueue.h"
+
+RenderQueue::RenderQueue()
+{
+}
+
+RenderQueue::~RenderQueue()
+{
+}
+
+U64 RenderQueue::makeSortKey(RenderQueuePass pass, U32 pipelineId, float viewDepth, U32 materialId, U32 meshId)
+{
+	//positive floats sort the same as their bit patterns, the top 24 bits keep sign, exponent and 15 bits of mantissa
+	const float depth = std::max(viewDepth, 0.f);
+	U32 depthBits;
+	memcpy(&depthBits, &depth, sizeof(depthBits));
+	U64 depthKey = depthBits >> 8;
+	if (pass == kRenderQueuePassTransparent)
+	{
+		depthKey = 0xffffff - depthKey;
+	}
+
+	return ((U64)pass << 62) |
+		((U64)(pipelineId & 0xff) << 54) |
+		((U64)(materialId & 0xffff) << 38) |
+		(depthKey << 14) |
+		(U64)(meshId & 0x3fff);
+}
+
+void RenderQueue::clear()
+{
+	mItems.clear();
+}
+
+void RenderQueue::push(const DrawItem &item)
+{
+	mItems.push_back(item);
+}
+
+void RenderQueue::sort()
+{
+	const U32 count = (U32)mItems.size();
+	mEntries.resize(count);
+	mScratchEntries.resize(count);
+	for (U32 i = 0; i < count; i++)
+	{
+		mEntries[i].key = mItems[i].sortKey;
+		mEntries[i].index = i;
+	}
+
+	//8 passes of 8 bits, skipping any byte every key agrees on
+	for (U32 shift = 0; shift < 64; shift += 8)
+	{
+		U32 histogram[256] = {};
+		for (const SortEntry &entry : mEntries)
+		{
+			histogram[(entry.key >> shift) & 0xff]++;
+		}
+		if (histogram[(mEntries.empty() ? 0 : mEntries[0].key >> shift) & 0xff] == count)
+		{
+			continue;
+		}
+
+		U32 offset = 0;
+		for (U32 &bucket : histogram)
+		{
+			const U32 bucketCount = bucket;
+			bucket = offset;
+			offset += bucketCount;
+		}
+		for (const SortEntry &entry : mEntries)
+		{
+			mScratchEntries[histogram[(entry.key >> shift) & 0xff]++] = entry;
+		}
+		mEntries.swap(mScratchEntries);
+	}
+
+	mSortedItems.resize(count);
+	for (U32 i = 0; i < count; i++)
+	{
+		mSortedItems[i] = mItems[mEntries[i].index];
+	}
+	mItems.swap(mSortedItems);
+}
\ No newline at end of file
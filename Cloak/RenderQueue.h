@@ -0,0 +1,61 @@
+#pragma once
+
+#include "stdafx.h"
+
+enum RenderQueuePass
+{
+	kRenderQueuePassOpaque = 0,	//front to back, so early-Z throws away as much as possible
+	kRenderQueuePassTransparent,	//back to front
+	kRenderQueuePassCount
+};
+
+//Everything needed to record one indexed draw. Draws come out of the queue in key order and the
+//recorder only binds whatever differs from the previous draw.
+struct DrawItem
+{
+	U64 sortKey;
+	VkPipeline pipeline;
+	VkPipelineLayout pipelineLayout;
+	VkDescriptorSet materialSet; //set 1
+	VkDescriptorSet drawSet; //set 2
+	U32 textureIndex; //pushed per draw with bindless textures
+	VkBuffer vertexBuffer;
+	VkBuffer indexBuffer;
+	U32 indexCount;
+	U32 firstIndex;
+	S32 vertexOffset;
+	S32 drawCommandIndex; //reads its instance count from the indirect command buffer when >= 0
+};
+
+//Per-frame list of draws sorted on 64 bit keys with an LSD radix sort. Key layout, high to low:
+//pass (2) | pipeline (8) | material (16) | depth (24) | mesh (14).
+//Material sits above depth since materials are shared and each change costs a descriptor set bind,
+//within a material draws still go front to back.
+class RenderQueue
+{
+public:
+	RenderQueue();
+	~RenderQueue();
+
+	//viewDepth is the distance along the view direction, anything negative is clamped to 0
+	static U64 makeSortKey(RenderQueuePass pass, U32 pipelineId, float viewDepth, U32 materialId, U32 meshId);
+
+	void clear();
+	void push(const DrawItem &item);
+	void sort();
+
+	const std::vector<DrawItem>& getItems() const { return mItems; }
+	U32 getItemCount() const { return (U32)mItems.size(); }
+
+private:
+	struct SortEntry
+	{
+		U64 key;
+		U32 index;
+	};
+
+	std::vector<DrawItem> mItems;
+	std::vector<DrawItem> mSortedItems;
+	std::vector<SortEntry> mEntries;
+	std::vector<SortEntry> mScratchEntries;
+};
\ No newline at end of file
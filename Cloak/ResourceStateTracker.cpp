@@ -0,0 +1,200 @@
+#include "ResourceStateTracker.h"
+
+static const VkAccessFlags kWriteAccess = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+ResourceStateTracker::ResourceStateTracker() : mSrcStages(0), mDstStages(0), mAliasedWriteAccess(0), mBatch(1), mBarrierCount(0)
+{
+}
+
+ResourceStateTracker::~ResourceStateTracker()
+{
+}
+
+void ResourceStateTracker::trackImage(VkImage image, VkImageAspectFlags aspectMask, U32 mipCount, VkImageLayout layout)
+{
+	ImageState &imageState = mImages[image];
+	imageState.state = {};
+	imageState.state.layout = layout;
+	imageState.range.aspectMask = aspectMask;
+	imageState.range.baseMipLevel = 0;
+	imageState.range.levelCount = mipCount;
+	imageState.range.baseArrayLayer = 0;
+	imageState.range.layerCount = 1;
+}
+
+void ResourceStateTracker::forgetImage(VkImage image)
+{
+	mImages.erase(image);
+}
+
+void ResourceStateTracker::forgetBuffer(VkBuffer buffer)
+{
+	mBuffers.erase(buffer);
+}
+
+bool ResourceStateTracker::transition(ResourceState &state, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access,
+	VkPipelineStageFlags *pSrcStagesOut, VkAccessFlags *pSrcAccessOut)
+{
+	//one use per batch, a second would run alongside the first without anything ordering them
+	assert(state.lastBatch != mBatch);
+	state.lastBatch = mBatch;
+
+	const bool layoutChange = layout != state.layout;
+	if (layoutChange || (access & kWriteAccess))
+	{
+		//writes wait on every earlier access, but only earlier writes have anything to flush
+		*pSrcStagesOut = state.writeStages | state.readStages;
+		*pSrcAccessOut = state.writeAccess;
+		const bool needed = layoutChange || *pSrcStagesOut != 0;
+
+		state.layout = layout;
+		state.writeStages = stages;
+		state.writeAccess = access & kWriteAccess;
+		state.readStages = 0;
+		//a layout change is visible to the stages it was done for, a write isn't even visible to itself
+		state.visibleStages = state.writeAccess ? 0 : stages;
+		state.visibleAccess = state.writeAccess ? 0 : access;
+		return needed;
+	}
+
+	state.readStages |= stages;
+	if (state.writeStages == 0 || ((stages & ~state.visibleStages) == 0 && (access & ~state.visibleAccess) == 0))
+	{
+		//nothing written yet, or already made visible to these reads
+		return false;
+	}
+	*pSrcStagesOut = state.writeStages;
+	*pSrcAccessOut = state.writeAccess;
+	state.visibleStages |= stages;
+	state.visibleAccess |= access;
+	return true;
+}
+
+void ResourceStateTracker::useImage(VkImage image, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	auto found = mImages.find(image);
+	assert(found != mImages.end());
+	ImageState &imageState = found->second;
+
+	const VkImageLayout oldLayout = imageState.state.layout;
+	VkPipelineStageFlags srcStages = 0;
+	VkAccessFlags srcAccess = 0;
+	if (!transition(imageState.state, layout, stages, access, &srcStages, &srcAccess))
+	{
+		return;
+	}
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = access;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = imageState.range;
+	mImageBarriers.push_back(barrier);
+	mSrcStages |= srcStages;
+	mDstStages |= stages;
+}
+
+void ResourceStateTracker::useBuffer(VkBuffer buffer, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	auto found = mBuffers.find(buffer);
+	if (found == mBuffers.end())
+	{
+		ResourceState state = {};
+		state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		found = mBuffers.insert(std::make_pair(buffer, state)).first;
+	}
+
+	VkPipelineStageFlags srcStages = 0;
+	VkAccessFlags srcAccess = 0;
+	if (!transition(found->second, VK_IMAGE_LAYOUT_UNDEFINED, stages, access, &srcStages, &srcAccess))
+	{
+		return;
+	}
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	mBufferBarriers.push_back(barrier);
+	mSrcStages |= srcStages;
+	mDstStages |= stages;
+}
+
+void ResourceStateTracker::discardImage(VkImage image)
+{
+	auto found = mImages.find(image);
+	assert(found != mImages.end());
+	found->second.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
+void ResourceStateTracker::aliasImage(VkImage image, VkImage previous)
+{
+	auto found = mImages.find(image);
+	auto foundPrevious = mImages.find(previous);
+	assert(found != mImages.end() && foundPrevious != mImages.end());
+	ResourceState &state = found->second.state;
+	const ResourceState &previousState = foundPrevious->second.state;
+
+	//image barriers only cover their own image, so previous's writes get flushed by a memory barrier instead
+	state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	state.writeStages |= previousState.writeStages | previousState.readStages;
+	mAliasedWriteAccess |= previousState.writeAccess;
+}
+
+void ResourceStateTracker::setImageState(VkImage image, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	auto found = mImages.find(image);
+	assert(found != mImages.end());
+	ResourceState &state = found->second.state;
+	state.layout = layout;
+	state.writeStages = stages;
+	state.writeAccess = access & kWriteAccess;
+	state.readStages = 0;
+	state.visibleStages = 0;
+	state.visibleAccess = 0;
+}
+
+void ResourceStateTracker::flush(VkCommandBuffer commandBuffer)
+{
+	mBatch++;
+	if (mImageBarriers.empty() && mBufferBarriers.empty())
+	{
+		return;
+	}
+
+	VkMemoryBarrier aliasBarrier = {};
+	aliasBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	aliasBarrier.srcAccessMask = mAliasedWriteAccess;
+	aliasBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+	const U32 memoryBarrierCount = mAliasedWriteAccess ? 1 : 0;
+
+	//a layout change on something nothing has touched yet has nothing to wait for
+	const VkPipelineStageFlags srcStages = mSrcStages ? mSrcStages : (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, srcStages, mDstStages, 0, memoryBarrierCount, &aliasBarrier,
+		(U32)mBufferBarriers.size(), mBufferBarriers.data(), (U32)mImageBarriers.size(), mImageBarriers.data());
+	mBarrierCount++;
+
+	mImageBarriers.clear();
+	mBufferBarriers.clear();
+	mSrcStages = 0;
+	mDstStages = 0;
+	mAliasedWriteAccess = 0;
+}
+
+VkImageLayout ResourceStateTracker::getImageLayout(VkImage image) const
+{
+	auto found = mImages.find(image);
+	assert(found != mImages.end());
+	return found->second.state.layout;
+}
\ No newline at end of file
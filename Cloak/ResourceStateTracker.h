@@ -0,0 +1,68 @@
+#pragma once
+
+#include "stdafx.h"
+
+//Remembers how each image and buffer was last used (layout, stages, access) so callers only say how they're about
+//to use it. Works out the smallest barrier that makes that use safe, or none at all for reads of data that's
+//already visible, and queues it. flush records everything queued as one vkCmdPipelineBarrier.
+//Assumes commands execute in the order they're recorded in. Not thread safe.
+class ResourceStateTracker
+{
+public:
+	ResourceStateTracker();
+	~ResourceStateTracker();
+
+	void trackImage(VkImage image, VkImageAspectFlags aspectMask, U32 mipCount, VkImageLayout layout);
+	void forgetImage(VkImage image);
+	//buffers don't have to be tracked up front, the first use starts them off
+	void forgetBuffer(VkBuffer buffer);
+
+	//Each resource can only be used once between flushes, combine the stages and access of uses that happen together
+	void useImage(VkImage image, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access);
+	void useBuffer(VkBuffer buffer, VkPipelineStageFlags stages, VkAccessFlags access);
+	//The image's contents aren't needed any more, its next barrier transitions from UNDEFINED
+	void discardImage(VkImage image);
+	//image shares memory with previous and is about to overwrite it, so its next use also waits on
+	//previous's last use. Discards image, and has to be followed by that use before the next flush.
+	void aliasImage(VkImage image, VkImage previous);
+	//For changes made outside of barriers, like a render pass's final layout. No barrier is queued.
+	void setImageState(VkImage image, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access);
+	//Records the queued barriers, does nothing if there aren't any
+	void flush(VkCommandBuffer commandBuffer);
+
+	VkImageLayout getImageLayout(VkImage image) const;
+	U32 getBarrierCount() const { return mBarrierCount; }
+
+private:
+	struct ResourceState
+	{
+		VkImageLayout layout;
+		VkPipelineStageFlags writeStages; //stages of the last write or layout change, later uses wait on these
+		VkAccessFlags writeAccess;
+		VkPipelineStageFlags readStages; //stages that read since then, writes have to wait for them too
+		VkPipelineStageFlags visibleStages; //stages the last write has already been made visible to
+		VkAccessFlags visibleAccess;
+		U32 lastBatch;
+	};
+
+	struct ImageState
+	{
+		ResourceState state;
+		VkImageSubresourceRange range;
+	};
+
+	//Updates state for the new use, returns whether it needs a barrier and what that has to wait on
+	bool transition(ResourceState &state, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access,
+		VkPipelineStageFlags *pSrcStagesOut, VkAccessFlags *pSrcAccessOut);
+
+	std::unordered_map<VkImage, ImageState> mImages;
+	std::unordered_map<VkBuffer, ResourceState> mBuffers;
+
+	VkPipelineStageFlags mSrcStages;
+	VkPipelineStageFlags mDstStages;
+	std::vector<VkImageMemoryBarrier> mImageBarriers;
+	std::vector<VkBufferMemoryBarrier> mBufferBarriers;
+	VkAccessFlags mAliasedWriteAccess; //writes through images that have since been aliased, flushed by a memory barrier
+	U32 mBatch;
+	U32 mBarrierCount; //vkCmdPipelineBarrier calls recorded so far
+};
\ No newline at end of file
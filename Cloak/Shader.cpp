@@ -2,22 +2,167 @@
 
 #include "CloakUtils.h"
 
-Shader::Shader()
+static const U32 kUnsetConstantKey = 0xFFFF;
+
+static U64 hashShaderCode(const std::vector<char> &code)
 {
+	U64 hash = 14695981039346656037ull;
+	for (char byte : code)
+	{
+		hash = (hash ^ (U8)byte) * 1099511628211ull;
+	}
+	return hash;
 }
 
+ShaderVariant::ShaderVariant() : setMask(0)
+{
+	memset(values, 0, sizeof(values));
+}
 
-Shader::~Shader()
+void ShaderVariant::set(ShaderConstant constant, U32 value)
+{
+	assert(value < kUnsetConstantKey);
+	values[constant] = value;
+	setMask |= 1 << constant;
+}
+
+U64 ShaderVariant::getKey() const
+{
+	U64 key = 0;
+	for (U32 i = 0; i < kShaderConstantCount; i++)
+	{
+		const U64 value = (setMask & (1 << i)) ? values[i] : kUnsetConstantKey;
+		key |= value << (16 * i);
+	}
+	return key;
+}
+
+void ShaderVariant::getSpecializationInfo(std::array<VkSpecializationMapEntry, kShaderConstantCount> &entriesOut,
+	VkSpecializationInfo *pInfoOut) const
+{
+	U32 entryCount = 0;
+	for (U32 i = 0; i < kShaderConstantCount; i++)
+	{
+		if (setMask & (1 << i))
+		{
+			entriesOut[entryCount].constantID = i;
+			entriesOut[entryCount].offset = i * sizeof(U32);
+			entriesOut[entryCount].size = sizeof(U32);
+			entryCount++;
+		}
+	}
+	pInfoOut->mapEntryCount = entryCount;
+	pInfoOut->pMapEntries = entriesOut.data();
+	pInfoOut->dataSize = sizeof(values);
+	pInfoOut->pData = values;
+}
+
+Shader::Shader() : mType(kShaderTypeVertex), mShaderModule(VK_NULL_HANDLE), mHash(0)
 {
 }
 
-bool Shader::load(ShaderType shaderType, const std::string & filename)
+
+Shader::~Shader()
 {
-	std::vector<char> shaderBytes = CloakUtils::readFile(filename);
+}
 
-	if (shaderBytes.size() == 0)
+bool Shader::load(VkDevice device, ShaderType shaderType, const std::vector<char> &code)
+{
+	if (code.size() == 0)
 	{
 		return false;
 	}
+
+	VkShaderModuleCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size();
+	createInfo.pCode = (U32*)code.data();
+	VkResult result = vkCreateShaderModule(device, &createInfo, nullptr, &mShaderModule);
+	assert(result == VK_SUCCESS);
+
+	mType = shaderType;
+	mHash = hashShaderCode(code);
 	return true;
 }
+
+void Shader::destroy(VkDevice device)
+{
+	vkDestroyShaderModule(device, mShaderModule, nullptr);
+	mShaderModule = VK_NULL_HANDLE;
+}
+
+VkShaderStageFlagBits Shader::getStage() const
+{
+	switch (mType)
+	{
+	case kShaderTypePixel:
+		return VK_SHADER_STAGE_FRAGMENT_BIT;
+	case kShaderTypeCompute:
+		return VK_SHADER_STAGE_COMPUTE_BIT;
+	default:
+		return VK_SHADER_STAGE_VERTEX_BIT;
+	}
+}
+
+ShaderLibrary::ShaderLibrary() : mDevice(VK_NULL_HANDLE)
+{
+}
+
+ShaderLibrary::~ShaderLibrary()
+{
+}
+
+void ShaderLibrary::init(VkDevice device)
+{
+	mDevice = device;
+}
+
+void ShaderLibrary::destroy()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (auto &shader : mShadersByHash)
+	{
+		shader.second.destroy(mDevice);
+	}
+	mShadersByHash.clear();
+	mShadersByFilename.clear();
+}
+
+const Shader* ShaderLibrary::load(ShaderType shaderType, const std::string &filename)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto loaded = mShadersByFilename.find(filename);
+	if (loaded != mShadersByFilename.end())
+	{
+		return loaded->second;
+	}
+
+	std::vector<char> code = CloakUtils::readFile(filename);
+	if (code.size() == 0)
+	{
+		return nullptr;
+	}
+
+	//copies of the same SPIR-V under different names share a module
+	const U64 hash = hashShaderCode(code);
+	auto existing = mShadersByHash.find(hash);
+	if (existing == mShadersByHash.end())
+	{
+		Shader shader;
+		if (!shader.load(mDevice, shaderType, code))
+		{
+			return nullptr;
+		}
+		existing = mShadersByHash.insert(std::make_pair(hash, shader)).first;
+	}
+	//the stage is part of the SPIR-V, so the same contents can't turn up as another stage
+	assert(existing->second.getType() == shaderType);
+	mShadersByFilename[filename] = &existing->second;
+	return &existing->second;
+}
+
+U32 ShaderLibrary::getModuleCount() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return (U32)mShadersByHash.size();
+}
\ No newline at end of file
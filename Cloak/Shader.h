@@ -6,19 +6,80 @@ enum ShaderType
 {
 	kShaderTypeVertex,
 	kShaderTypePixel,
+	kShaderTypeCompute,
 };
 
+//constant_id of every specialization constant the mesh shaders declare
+enum ShaderConstant
+{
+	kShaderConstantWeightsPerVertex = 0,	//influences blended per vertex, 1-4
+	kShaderConstantPaletteFormat,		//PaletteFormat the palette is packed in
+	kShaderConstantLightingPath,		//LightingPath of the fragment shader
+
+	kShaderConstantCount
+};
+
+enum LightingPath
+{
+	kLightingPathDiffuseAmbient = 0,
+	kLightingPathUnlit,
+};
+
+//Specialization constant values for one pipeline variant. Constants that aren't set keep the shader's default,
+//and constants a shader doesn't declare are ignored, so one variant can cover every stage.
+struct ShaderVariant
+{
+	ShaderVariant();
+
+	void set(ShaderConstant constant, U32 value);
+	//unique per combination of values, for keying pipeline caches
+	U64 getKey() const;
+	//Points pInfoOut at the set constants. The variant and entries have to outlive it.
+	void getSpecializationInfo(std::array<VkSpecializationMapEntry, kShaderConstantCount> &entriesOut, VkSpecializationInfo *pInfoOut) const;
+
+	U32 values[kShaderConstantCount];
+	U32 setMask;
+};
+
+//One SPIR-V module, shared by every file with the same contents
 class Shader
 {
 public:
 	Shader();
 	~Shader();
 
-	bool load(ShaderType shaderType, const std::string &filename);
+	bool load(VkDevice device, ShaderType shaderType, const std::vector<char> &code);
+	void destroy(VkDevice device);
+
+	ShaderType getType() const { return mType; }
+	VkShaderStageFlagBits getStage() const;
+	VkShaderModule getModule() const { return mShaderModule; }
+	U64 getHash() const { return mHash; }
 
 private:
 	ShaderType mType;
-
 	VkShaderModule mShaderModule;
+	U64 mHash;
 };
 
+//Loads each shader file once and keeps its module around for every pipeline built from it.
+//Safe to use from the background pipeline builds.
+class ShaderLibrary
+{
+public:
+	ShaderLibrary();
+	~ShaderLibrary();
+
+	void init(VkDevice device);
+	void destroy();
+
+	//null if the file is missing or empty
+	const Shader* load(ShaderType shaderType, const std::string &filename);
+	U32 getModuleCount() const;
+
+private:
+	VkDevice mDevice;
+	mutable std::mutex mMutex;
+	std::unordered_map<U64, Shader> mShadersByHash;
+	std::unordered_map<std::string, const Shader*> mShadersByFilename;
+};
\ No newline at end of file
@@ -0,0 +1,45 @@
+#include "SkinningKeyframeCache.h"
+
+SkinningKeyframeCache::SkinningKeyframeCache()
+{
+}
+
+SkinningKeyframeCache::~SkinningKeyframeCache()
+{
+	clear();
+}
+
+const SkinningKeyframes* SkinningKeyframeCache::acquireKeyframes(const AnimatedMesh *animatedMesh)
+{
+	const Animation *animation = animatedMesh->getAnimation();
+	assert(animation);
+	for (const SkinningKeyframes *keyframes : mKeyframes)
+	{
+		if (keyframes->animation == animation && keyframes->modelName == animatedMesh->getModelName())
+		{
+			return keyframes;
+		}
+	}
+
+	//first time this clip is bound to this model, bake its skinning transforms
+	std::vector<glm::mat4> palettes;
+	animatedMesh->bakeSkinningPalettes(palettes);
+
+	SkinningKeyframes *keyframes = new SkinningKeyframes();
+	keyframes->animation = animation;
+	keyframes->modelName = animatedMesh->getModelName();
+	keyframes->boneCount = animatedMesh->getBoneCount();
+	keyframes->dualQuaternions.resize(palettes.size() * SkinningPalette::getStride(kPaletteFormatDualQuaternion));
+	SkinningPalette::pack(kPaletteFormatDualQuaternion, palettes.data(), (U32)palettes.size(), keyframes->dualQuaternions.data());
+	mKeyframes.push_back(keyframes);
+	return keyframes;
+}
+
+void SkinningKeyframeCache::clear()
+{
+	for (SkinningKeyframes *keyframes : mKeyframes)
+	{
+		delete keyframes;
+	}
+	mKeyframes.clear();
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "AnimatedMesh.h"
+#include "Animation.h"
+
+//Owns the keyframes baked for every clip and model pair, so meshes binding the same clip to the same model
+//share one copy. Has to outlive every mesh it hands keyframes to.
+class SkinningKeyframeCache
+{
+public:
+	SkinningKeyframeCache();
+	~SkinningKeyframeCache();
+
+	//Keyframes for the mesh's bound clip, baked from its bind pose the first time the pair is seen
+	const SkinningKeyframes* acquireKeyframes(const AnimatedMesh *animatedMesh);
+	//frees every entry, only once no mesh is left using them
+	void clear();
+
+	U32 getEntryCount() const { return (U32)mKeyframes.size(); }
+
+private:
+	std::vector<SkinningKeyframes*> mKeyframes;
+};
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include "SkinningPalette.h"
+
+U32 SkinningPalette::getStride(PaletteFormat format)
+{
+	switch (format)
+	{
+	case kPaletteFormatMatrix4x4:
+		return 4;
+	case kPaletteFormatAffine3x4:
+		return 3;
+	case kPaletteFormatDualQuaternion:
+		return 2;
+	}
+	assert(false);
+	return 4;
+}
+
+U32 SkinningPalette::getSize(PaletteFormat format, U32 boneCount)
+{
+	return getStride(format) * boneCount * sizeof(glm::vec4);
+}
+
+void SkinningPalette::pack(PaletteFormat format, const glm::mat4 *pMatrices, U32 boneCount, glm::vec4 *pPaletteOut)
+{
+	switch (format)
+	{
+	case kPaletteFormatMatrix4x4:
+		memcpy(pPaletteOut, pMatrices, boneCount * sizeof(glm::mat4));
+		break;
+	case kPaletteFormatAffine3x4:
+		//the bottom row is always (0, 0, 0, 1), so only store the other three
+		for (U32 i = 0; i < boneCount; i++)
+		{
+			const glm::mat4 &matrix = pMatrices[i];
+			for (U32 row = 0; row < 3; row++)
+			{
+				pPaletteOut[i * 3 + row] = glm::vec4(matrix[0][row], matrix[1][row], matrix[2][row], matrix[3][row]);
+			}
+		}
+		break;
+	case kPaletteFormatDualQuaternion:
+		for (U32 i = 0; i < boneCount; i++)
+		{
+			const glm::mat4 &matrix = pMatrices[i];
+			glm::quat real = glm::normalize(glm::quat_cast(glm::mat3(matrix)));
+			glm::vec3 translation(matrix[3]);
+			glm::quat dual = (glm::quat(0.f, translation.x, translation.y, translation.z) * real) * 0.5f;
+			pPaletteOut[i * 2 + 0] = glm::vec4(real.x, real.y, real.z, real.w);
+			pPaletteOut[i * 2 + 1] = glm::vec4(dual.x, dual.y, dual.z, dual.w);
+		}
+		break;
+	default:
+		assert(false);
+		break;
+	}
+}
+
+void SkinningPalette::packDualQuaternion(PaletteFormat format, const glm::vec4 &real, const glm::vec4 &dual, glm::vec4 *pBoneOut)
+{
+	if (format == kPaletteFormatDualQuaternion)
+	{
+		pBoneOut[0] = real;
+		pBoneOut[1] = dual;
+		return;
+	}
+
+	glm::mat3 rotation = glm::mat3_cast(glm::quat(real.w, real.x, real.y, real.z));
+	glm::vec3 realVector(real);
+	glm::vec3 dualVector(dual);
+	glm::vec3 translation = 2.f * (real.w * dualVector - dual.w * realVector + glm::cross(realVector, dualVector));
+	switch (format)
+	{
+	case kPaletteFormatMatrix4x4:
+		pBoneOut[0] = glm::vec4(rotation[0], 0.f);
+		pBoneOut[1] = glm::vec4(rotation[1], 0.f);
+		pBoneOut[2] = glm::vec4(rotation[2], 0.f);
+		pBoneOut[3] = glm::vec4(translation, 1.f);
+		break;
+	case kPaletteFormatAffine3x4:
+		for (U32 row = 0; row < 3; row++)
+		{
+			pBoneOut[row] = glm::vec4(rotation[0][row], rotation[1][row], rotation[2][row], translation[row]);
+		}
+		break;
+	default:
+		assert(false);
+		break;
+	}
+}
+
+void SkinningPalette::extrapolate(PaletteFormat format, const glm::vec4 *pLast, const glm::vec4 *pPrev, float t, U32 boneCount, glm::vec4 *pPaletteOut)
+{
+	//linear in every format, the shaders renormalize dual quaternions after blending anyway
+	const U32 stride = getStride(format);
+	for (U32 i = 0; i < boneCount; i++)
+	{
+		const U32 base = i * stride;
+		//q and -q are the same rotation, extrapolate from the one in the last pose's hemisphere
+		float prevSign = 1.f;
+		if (format == kPaletteFormatDualQuaternion && glm::dot(pLast[base], pPrev[base]) < 0.f)
+		{
+			prevSign = -1.f;
+		}
+		for (U32 j = base; j < base + stride; j++)
+		{
+			pPaletteOut[j] = pLast[j] + (pLast[j] - pPrev[j] * prevSign) * t;
+		}
+	}
+}
+
+glm::vec3 SkinningPalette::skinPosition(PaletteFormat format, const glm::vec4 *pPalette, const glm::vec3 &position, const glm::vec4 &weights,
+	const glm::uvec4 &indices)
+{
+	const U32 stride = getStride(format);
+	switch (format)
+	{
+	case kPaletteFormatMatrix4x4:
+	{
+		glm::vec4 skinnedPosition(0.f);
+		for (U32 i = 0; i < 4; i++)
+		{
+			const glm::vec4 *pBone = &pPalette[indices[i] * stride];
+			glm::mat4 matrix(pBone[0], pBone[1], pBone[2], pBone[3]);
+			skinnedPosition += (matrix * glm::vec4(position, 1.f)) * weights[i];
+		}
+		return glm::vec3(skinnedPosition);
+	}
+	case kPaletteFormatAffine3x4:
+	{
+		glm::vec4 rows[3] = { glm::vec4(0.f), glm::vec4(0.f), glm::vec4(0.f) };
+		for (U32 i = 0; i < 4; i++)
+		{
+			for (U32 row = 0; row < 3; row++)
+			{
+				rows[row] += pPalette[indices[i] * stride + row] * weights[i];
+			}
+		}
+		const glm::vec4 point(position, 1.f);
+		return glm::vec3(glm::dot(rows[0], point), glm::dot(rows[1], point), glm::dot(rows[2], point));
+	}
+	case kPaletteFormatDualQuaternion:
+	{
+		const glm::vec4 &pivot = pPalette[indices[0] * stride];
+		glm::vec4 real(0.f);
+		glm::vec4 dual(0.f);
+		for (U32 i = 0; i < 4; i++)
+		{
+			const glm::vec4 &boneReal = pPalette[indices[i] * stride];
+			float weight = glm::dot(pivot, boneReal) < 0.f ? -weights[i] : weights[i];
+			real += boneReal * weight;
+			dual += pPalette[indices[i] * stride + 1] * weight;
+		}
+		float invLength = 1.f / glm::length(real);
+		real *= invLength;
+		dual *= invLength;
+
+		glm::vec3 realVector(real);
+		glm::vec3 dualVector(dual);
+		glm::vec3 rotatedPosition = position + 2.f * glm::cross(realVector, glm::cross(realVector, position) + real.w * position);
+		glm::vec3 translation = 2.f * (real.w * dualVector - dual.w * realVector + glm::cross(realVector, dualVector));
+		return rotatedPosition + translation;
+	}
+	default:
+		assert(false);
+		return position;
+	}
+}
\ No newline at end of file
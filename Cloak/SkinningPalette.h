@@ -0,0 +1,28 @@
+#pragma once
+
+#include "stdafx.h"
+
+//How bone skinning transforms are laid out in the animation constant buffer
+enum PaletteFormat
+{
+	kPaletteFormatMatrix4x4 = 0,	//full column-major mat4, 64 bytes per bone
+	kPaletteFormatAffine3x4,		//top three rows of the matrix, 48 bytes per bone
+	kPaletteFormatDualQuaternion,	//rotation quaternion + dual part, 32 bytes per bone. Rigid transforms only.
+
+	kPaletteFormatCount
+};
+
+namespace SkinningPalette
+{
+	//number of vec4s each bone takes up in the given format
+	U32 getStride(PaletteFormat format);
+	U32 getSize(PaletteFormat format, U32 boneCount);
+	void pack(PaletteFormat format, const glm::mat4 *pMatrices, U32 boneCount, glm::vec4 *pPaletteOut);
+	//writes one bone from a unit dual quaternion straight into the given format, getStride(format) vec4s
+	void packDualQuaternion(PaletteFormat format, const glm::vec4 &real, const glm::vec4 &dual, glm::vec4 *pBoneOut);
+	//the same blend the skinning shaders do, for the odd position the CPU needs in the skinned pose
+	glm::vec3 skinPosition(PaletteFormat format, const glm::vec4 *pPalette, const glm::vec3 &position, const glm::vec4 &weights,
+		const glm::uvec4 &indices);
+	//continues the motion from pPrev to pLast by t update intervals, for animation LOD frames that skip evaluation
+	void extrapolate(PaletteFormat format, const glm::vec4 *pLast, const glm::vec4 *pPrev, float t, U32 boneCount, glm::vec4 *pPaletteOut);
+}
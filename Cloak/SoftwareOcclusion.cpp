@@ -0,0 +1,299 @@
+#include "SoftwareOcclusion.h"
+
+#include <xmmintrin.h>
+
+void SoftwareOcclusionStats::reset()
+{
+	occluderTriangles = 0;
+	rasterizedTriangles = 0;
+	testedInstances = 0;
+	occludedInstances = 0;
+	rasterizeMillis = 0.f;
+	testMillis = 0.f;
+}
+
+void SoftwareOcclusionStats::print(std::ostream &out) const
+{
+	out << "Software occlusion: " << rasterizedTriangles << "/" << occluderTriangles << " occluder triangles rasterized in "
+		<< rasterizeMillis << "ms, " << occludedInstances << "/" << testedInstances << " instances occluded in "
+		<< testMillis << "ms" << std::endl;
+}
+
+SoftwareOcclusionCuller::SoftwareOcclusionCuller(U32 width, U32 height, ThreadPool *threadPool)
+	: mWidth((width + 3) & ~3), mHeight(height), mThreadPool(threadPool)
+{
+	//a couple of bands per thread evens out occluders that only cover part of the screen
+	U32 bandTarget = mThreadPool ? mThreadPool->getThreadCount() * 2 : 1;
+	mBandHeight = std::max((mHeight + bandTarget - 1) / bandTarget, 4u);
+	mBandCount = (mHeight + mBandHeight - 1) / mBandHeight;
+	mDepth.assign(mWidth * mHeight, 1.f);
+}
+
+SoftwareOcclusionCuller::~SoftwareOcclusionCuller()
+{
+}
+
+void SoftwareOcclusionCuller::beginFrame(const glm::mat4 &viewProjection)
+{
+	mViewProjection = viewProjection;
+	mTriangles.clear();
+	mStats.reset();
+	std::fill(mDepth.begin(), mDepth.end(), 1.f);
+}
+
+void SoftwareOcclusionCuller::addOccluder(const void *pPositions, U32 positionStride, const U16 *pIndices, U32 indexCount, const glm::mat4 &modelMatrix)
+{
+	const glm::mat4 modelViewProjection = mViewProjection * modelMatrix;
+	const U8 *pBytes = (const U8 *)pPositions;
+	for (U32 i = 0; i + 2 < indexCount; i += 3)
+	{
+		glm::vec4 clip[3];
+		for (U32 j = 0; j < 3; j++)
+		{
+			const glm::vec3 &position = *(const glm::vec3 *)(pBytes + positionStride * pIndices[i + j]);
+			clip[j] = modelViewProjection * glm::vec4(position, 1.f);
+		}
+		setupTriangle(clip[0], clip[1], clip[2]);
+	}
+	mStats.occluderTriangles += indexCount / 3;
+}
+
+glm::vec3 SoftwareOcclusionCuller::toScreen(const glm::vec4 &clip) const
+{
+	glm::vec3 ndc = glm::vec3(clip) / clip.w;
+	return glm::vec3((ndc.x * 0.5f + 0.5f) * mWidth, (ndc.y * 0.5f + 0.5f) * mHeight, ndc.z);
+}
+
+void SoftwareOcclusionCuller::setupTriangle(const glm::vec4 &v0, const glm::vec4 &v1, const glm::vec4 &v2)
+{
+	//no clipping, dropping an occluder triangle only ever costs us some culling
+	const float kMinW = 1e-5f;
+	if (v0.w <= kMinW || v1.w <= kMinW || v2.w <= kMinW)
+	{
+		return;
+	}
+
+	glm::vec3 s[3] = { toScreen(v0), toScreen(v1), toScreen(v2) };
+	float area = (s[1].x - s[0].x) * (s[2].y - s[0].y) - (s[1].y - s[0].y) * (s[2].x - s[0].x);
+	if (fabsf(area) < 1e-8f)
+	{
+		return;
+	}
+	//both windings get drawn, flip so the inside is always positive
+	if (area < 0.f)
+	{
+		std::swap(s[1], s[2]);
+		area = -area;
+	}
+
+	TriangleSetup triangle;
+	triangle.minX = std::max((S32)floorf(std::min(std::min(s[0].x, s[1].x), s[2].x)), 0);
+	triangle.maxX = std::min((S32)ceilf(std::max(std::max(s[0].x, s[1].x), s[2].x)), (S32)mWidth - 1);
+	triangle.minY = std::max((S32)floorf(std::min(std::min(s[0].y, s[1].y), s[2].y)), 0);
+	triangle.maxY = std::min((S32)ceilf(std::max(std::max(s[0].y, s[1].y), s[2].y)), (S32)mHeight - 1);
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+	{
+		return;
+	}
+
+	for (U32 i = 0; i < 3; i++)
+	{
+		const glm::vec3 &a = s[i];
+		const glm::vec3 &b = s[(i + 1) % 3];
+		triangle.edgeA[i] = a.y - b.y;
+		triangle.edgeB[i] = b.x - a.x;
+		triangle.edgeC[i] = -(triangle.edgeA[i] * a.x + triangle.edgeB[i] * a.y);
+	}
+
+	triangle.depthA = ((s[1].z - s[0].z) * (s[2].y - s[0].y) - (s[2].z - s[0].z) * (s[1].y - s[0].y)) / area;
+	triangle.depthB = ((s[2].z - s[0].z) * (s[1].x - s[0].x) - (s[1].z - s[0].z) * (s[2].x - s[0].x)) / area;
+	triangle.depthC = s[0].z - triangle.depthA * s[0].x - triangle.depthB * s[0].y;
+	mTriangles.push_back(triangle);
+}
+
+void SoftwareOcclusionCuller::rasterizeOccluders()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	mStats.rasterizedTriangles = (U32)mTriangles.size();
+	if (!mTriangles.empty())
+	{
+		if (mThreadPool)
+		{
+			mThreadPool->parallelFor(mBandCount, [this](U32 band) { rasterizeBand(band); });
+		}
+		else
+		{
+			for (U32 band = 0; band < mBandCount; band++)
+			{
+				rasterizeBand(band);
+			}
+		}
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	mStats.rasterizeMillis = std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+void SoftwareOcclusionCuller::rasterizeBand(U32 band)
+{
+	const S32 bandMinY = (S32)(band * mBandHeight);
+	const S32 bandMaxY = (S32)std::min((band + 1) * mBandHeight, mHeight) - 1;
+	const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (const TriangleSetup &triangle : mTriangles)
+	{
+		const S32 minY = std::max(triangle.minY, bandMinY);
+		const S32 maxY = std::min(triangle.maxY, bandMaxY);
+		if (minY > maxY)
+		{
+			continue;
+		}
+
+		//start on a 4 pixel boundary, the buffer width is padded so the last group never runs off the row
+		const S32 startX = triangle.minX & ~3;
+		const __m128 startColumns = _mm_add_ps(_mm_set1_ps((float)startX), laneOffsets);
+
+		__m128 edgeA[3];
+		__m128 edgeStep[3];
+		for (U32 i = 0; i < 3; i++)
+		{
+			edgeA[i] = _mm_set1_ps(triangle.edgeA[i]);
+			edgeStep[i] = _mm_set1_ps(triangle.edgeA[i] * 4.f);
+		}
+		const __m128 depthStep = _mm_set1_ps(triangle.depthA * 4.f);
+		const __m128 depthRowStart = _mm_mul_ps(_mm_set1_ps(triangle.depthA), startColumns);
+
+		for (S32 y = minY; y <= maxY; y++)
+		{
+			const float centerY = y + 0.5f;
+			__m128 edge[3];
+			for (U32 i = 0; i < 3; i++)
+			{
+				edge[i] = _mm_add_ps(_mm_mul_ps(edgeA[i], startColumns), _mm_set1_ps(triangle.edgeB[i] * centerY + triangle.edgeC[i]));
+			}
+			__m128 depth = _mm_add_ps(depthRowStart, _mm_set1_ps(triangle.depthB * centerY + triangle.depthC));
+
+			float *pRow = &mDepth[y * mWidth];
+			for (S32 x = startX; x <= triangle.maxX; x += 4)
+			{
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge[0], zero), _mm_cmpge_ps(edge[1], zero)), _mm_cmpge_ps(edge[2], zero));
+				if (_mm_movemask_ps(inside))
+				{
+					__m128 current = _mm_loadu_ps(pRow + x);
+					__m128 nearest = _mm_min_ps(current, depth);
+					_mm_storeu_ps(pRow + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+				}
+
+				edge[0] = _mm_add_ps(edge[0], edgeStep[0]);
+				edge[1] = _mm_add_ps(edge[1], edgeStep[1]);
+				edge[2] = _mm_add_ps(edge[2], edgeStep[2]);
+				depth = _mm_add_ps(depth, depthStep);
+			}
+		}
+	}
+}
+
+bool SoftwareOcclusionCuller::isBoxVisible(const glm::vec3 &min, const glm::vec3 &max) const
+{
+	glm::vec2 screenMin(std::numeric_limits<float>::max());
+	glm::vec2 screenMax(-std::numeric_limits<float>::max());
+	float nearestDepth = std::numeric_limits<float>::max();
+	for (U32 i = 0; i < 8; i++)
+	{
+		glm::vec4 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z, 1.f);
+		glm::vec4 clip = mViewProjection * corner;
+		//straddles the camera, can't say anything about it
+		if (clip.w <= 1e-5f)
+		{
+			return true;
+		}
+		glm::vec3 screen = toScreen(clip);
+		screenMin = glm::min(screenMin, glm::vec2(screen));
+		screenMax = glm::max(screenMax, glm::vec2(screen));
+		nearestDepth = std::min(nearestDepth, screen.z);
+	}
+
+	const S32 minX = std::max((S32)floorf(screenMin.x), 0);
+	const S32 maxX = std::min((S32)floorf(screenMax.x), (S32)mWidth - 1);
+	const S32 minY = std::max((S32)floorf(screenMin.y), 0);
+	const S32 maxY = std::min((S32)floorf(screenMax.y), (S32)mHeight - 1);
+	if (minX > maxX || minY > maxY)
+	{
+		return true;
+	}
+
+	//visible as soon as one covered pixel has nothing in front of the box's nearest point
+	const __m128 boxDepth = _mm_set1_ps(nearestDepth);
+	const __m128 firstColumn = _mm_set1_ps((float)minX);
+	const __m128 lastColumn = _mm_set1_ps((float)maxX);
+	const S32 startX = minX & ~3;
+	for (S32 y = minY; y <= maxY; y++)
+	{
+		const float *pRow = &mDepth[y * mWidth];
+		__m128 columns = _mm_setr_ps((float)startX, (float)startX + 1.f, (float)startX + 2.f, (float)startX + 3.f);
+		for (S32 x = startX; x <= maxX; x += 4)
+		{
+			__m128 inRect = _mm_and_ps(_mm_cmpge_ps(columns, firstColumn), _mm_cmple_ps(columns, lastColumn));
+			__m128 uncovered = _mm_cmpgt_ps(_mm_loadu_ps(pRow + x), boxDepth);
+			if (_mm_movemask_ps(_mm_and_ps(inRect, uncovered)))
+			{
+				return true;
+			}
+			columns = _mm_add_ps(columns, _mm_set1_ps(4.f));
+		}
+	}
+	return false;
+}
+
+U32 SoftwareOcclusionCuller::cullBoxes(const std::vector<glm::vec3> &mins, const std::vector<glm::vec3> &maxs, std::vector<U8> &visibleInOut)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const U32 boxCount = (U32)mins.size();
+	const U32 kBoxesPerTask = 64;
+	const U32 taskCount = (boxCount + kBoxesPerTask - 1) / kBoxesPerTask;
+	std::vector<U32> testedCounts(taskCount, 0);
+	std::vector<U32> occludedCounts(taskCount, 0);
+	auto testBoxes = [&](U32 task)
+	{
+		const U32 end = std::min((task + 1) * kBoxesPerTask, boxCount);
+		for (U32 i = task * kBoxesPerTask; i < end; i++)
+		{
+			if (!visibleInOut[i])
+			{
+				continue;
+			}
+			testedCounts[task]++;
+			if (!isBoxVisible(mins[i], maxs[i]))
+			{
+				visibleInOut[i] = 0;
+				occludedCounts[task]++;
+			}
+		}
+	};
+	if (mThreadPool)
+	{
+		mThreadPool->parallelFor(taskCount, testBoxes);
+	}
+	else
+	{
+		for (U32 task = 0; task < taskCount; task++)
+		{
+			testBoxes(task);
+		}
+	}
+
+	U32 occludedCount = 0;
+	for (U32 task = 0; task < taskCount; task++)
+	{
+		mStats.testedInstances += testedCounts[task];
+		occludedCount += occludedCounts[task];
+	}
+	mStats.occludedInstances += occludedCount;
+
+	auto end = std::chrono::high_resolution_clock::now();
+	mStats.testMillis += std::chrono::duration<float, std::milli>(end - start).count();
+	return occludedCount;
+}
\ No newline at end of file
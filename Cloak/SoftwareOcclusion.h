@@ -0,0 +1,77 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "ThreadPool.h"
+
+struct SoftwareOcclusionStats
+{
+	SoftwareOcclusionStats() { reset(); }
+
+	void reset();
+	void print(std::ostream &out) const;
+
+	U32 occluderTriangles;
+	U32 rasterizedTriangles; //survived near plane and degenerate rejection
+	U32 testedInstances;
+	U32 occludedInstances;
+	float rasterizeMillis;
+	float testMillis;
+};
+
+//Rasterizes a handful of big occluders into a small depth buffer on the CPU and tests
+//bounding boxes against it, for when the GPU can't do the occlusion culling itself.
+//Rows are split into bands so every worker writes its own part of the buffer.
+class SoftwareOcclusionCuller
+{
+public:
+	//width gets rounded up to a multiple of 4, the rasterizer works on 4 pixels at a time
+	SoftwareOcclusionCuller(U32 width, U32 height, ThreadPool *threadPool);
+	~SoftwareOcclusionCuller();
+
+	//clears the depth buffer and the occluder list
+	void beginFrame(const glm::mat4 &viewProjection);
+
+	//positions are read with the given stride, so vertex arrays can be passed straight in
+	void addOccluder(const void *pPositions, U32 positionStride, const U16 *pIndices, U32 indexCount, const glm::mat4 &modelMatrix);
+	void rasterizeOccluders();
+
+	//false if every pixel the box covers already has something nearer in it
+	bool isBoxVisible(const glm::vec3 &min, const glm::vec3 &max) const;
+	//clears visibleInOut[i] for every box that's occluded. Returns the occluded count.
+	U32 cullBoxes(const std::vector<glm::vec3> &mins, const std::vector<glm::vec3> &maxs, std::vector<U8> &visibleInOut);
+
+	const SoftwareOcclusionStats& getStats() const { return mStats; }
+	U32 getWidth() const { return mWidth; }
+	U32 getHeight() const { return mHeight; }
+
+private:
+	//edge functions and depth plane, evaluated at pixel centers
+	struct TriangleSetup
+	{
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		float depthA;
+		float depthB;
+		float depthC;
+		S32 minX;
+		S32 maxX;
+		S32 minY;
+		S32 maxY;
+	};
+
+	void setupTriangle(const glm::vec4 &v0, const glm::vec4 &v1, const glm::vec4 &v2);
+	void rasterizeBand(U32 band);
+	glm::vec3 toScreen(const glm::vec4 &clip) const;
+
+	U32 mWidth;
+	U32 mHeight;
+	U32 mBandHeight;
+	U32 mBandCount;
+	ThreadPool *mThreadPool;
+	glm::mat4 mViewProjection;
+	std::vector<float> mDepth; //row-major, 1 is the far plane
+	std::vector<TriangleSetup> mTriangles;
+	SoftwareOcclusionStats mStats;
+};
\ No newline at end of file
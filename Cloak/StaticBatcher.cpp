@@ -0,0 +1,90 @@
+#include "StaticBatcher.h"
+
+bool StaticBatcher::BatchKey::operator<(const BatchKey &other) const
+{
+	if (material != other.material)
+	{
+		return material < other.material;
+	}
+	return std::lexicographical_compare(cell, cell + 3, other.cell, other.cell + 3);
+}
+
+StaticBatcher::StaticBatcher(float cellSize) : mCellSize(cellSize)
+{
+	assert(cellSize > 0.f);
+}
+
+StaticBatcher::~StaticBatcher()
+{
+}
+
+void StaticBatcher::addMesh(const Mesh *mesh, const glm::mat4 &modelMatrix, const std::string &material)
+{
+	Instance instance;
+	instance.mesh = mesh;
+	instance.modelMatrix = modelMatrix;
+	instance.material = material;
+	instance.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	instance.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (const MeshVertex &vertex : mesh->getVertices())
+	{
+		const glm::vec3 position = glm::vec3(modelMatrix * glm::vec4(vertex.position, 1.f));
+		instance.boundsMin = glm::min(instance.boundsMin, position);
+		instance.boundsMax = glm::max(instance.boundsMax, position);
+	}
+	mInstances.push_back(instance);
+}
+
+void StaticBatcher::build()
+{
+	mBatches.clear();
+	mVertices.clear();
+	mIndices.clear();
+
+	std::map<BatchKey, std::vector<U32>> bins;
+	for (U32 i = 0; i < mInstances.size(); i++)
+	{
+		const Instance &instance = mInstances[i];
+		const glm::vec3 cell = glm::floor((instance.boundsMin + instance.boundsMax) * 0.5f / mCellSize);
+		BatchKey key;
+		key.material = instance.material;
+		key.cell[0] = (S32)cell.x;
+		key.cell[1] = (S32)cell.y;
+		key.cell[2] = (S32)cell.z;
+		bins[key].push_back(i);
+	}
+
+	for (auto &bin : bins)
+	{
+		StaticBatch batch;
+		batch.material = bin.first.material;
+		batch.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+		batch.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+		batch.firstIndex = (U32)mIndices.size();
+		batch.vertexOffset = (S32)mVertices.size();
+		batch.sourceMeshCount = (U32)bin.second.size();
+
+		for (U32 instanceIndex : bin.second)
+		{
+			const Instance &instance = mInstances[instanceIndex];
+			const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(instance.modelMatrix)));
+			//indices are relative to the batch, vertexOffset does the rest
+			const U32 baseVertex = (U32)mVertices.size() - (U32)batch.vertexOffset;
+			for (MeshVertex vertex : instance.mesh->getVertices())
+			{
+				vertex.position = glm::vec3(instance.modelMatrix * glm::vec4(vertex.position, 1.f));
+				vertex.normal = glm::normalize(normalMatrix * vertex.normal);
+				mVertices.push_back(vertex);
+			}
+			for (U32 index : instance.mesh->getIndices())
+			{
+				mIndices.push_back(baseVertex + index);
+			}
+			batch.boundsMin = glm::min(batch.boundsMin, instance.boundsMin);
+			batch.boundsMax = glm::max(batch.boundsMax, instance.boundsMax);
+		}
+
+		batch.indexCount = (U32)mIndices.size() - batch.firstIndex;
+		mBatches.push_back(batch);
+	}
+}
\ No newline at end of file
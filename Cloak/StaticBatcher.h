@@ -0,0 +1,62 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "Mesh.h"
+
+//One draw's worth of merged static geometry: everything with the same material in one grid cell.
+//Ranges index into StaticBatcher's combined vertex and index arrays.
+struct StaticBatch
+{
+	std::string material;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	U32 firstIndex;
+	U32 indexCount;
+	S32 vertexOffset;
+	U32 sourceMeshCount;
+};
+
+//Merges static mesh instances into a few big batches at load time. Vertices are pre-transformed
+//into world space, so a batch draws with an identity model matrix. Instances are binned by the
+//grid cell their bounds center falls in, which keeps the batches small enough to still be culled.
+class StaticBatcher
+{
+public:
+	explicit StaticBatcher(float cellSize);
+	~StaticBatcher();
+
+	void addMesh(const Mesh *mesh, const glm::mat4 &modelMatrix, const std::string &material);
+	//Replaces any previous output with batches for every mesh added so far
+	void build();
+
+	const std::vector<StaticBatch>& getBatches() const { return mBatches; }
+	const std::vector<MeshVertex>& getVertices() const { return mVertices; }
+	const std::vector<U32>& getIndices() const { return mIndices; }
+	U32 getMeshCount() const { return (U32)mInstances.size(); }
+
+private:
+	struct Instance
+	{
+		const Mesh *mesh;
+		glm::mat4 modelMatrix;
+		std::string material;
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+	};
+
+	struct BatchKey
+	{
+		std::string material;
+		S32 cell[3];
+
+		bool operator<(const BatchKey &other) const;
+	};
+
+	float mCellSize;
+	std::vector<Instance> mInstances;
+
+	std::vector<StaticBatch> mBatches;
+	std::vector<MeshVertex> mVertices;
+	std::vector<U32> mIndices;
+};
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "TextureAtlas.h"
+
+//texels of gutter beyond the registered texcoord range, for the filter footprint at the edges
+static const S32 kFilterMargin = 4;
+
+static S32 wrapTexel(S32 texel, S32 size)
+{
+	texel %= size;
+	return texel < 0 ? texel + size : texel;
+}
+
+TextureAtlas::TextureAtlas(const std::string &name) : mName(name), mSurface(nullptr)
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+	if (mSurface)
+	{
+		SDL_FreeSurface(mSurface);
+	}
+}
+
+void TextureAtlas::addTexture(const std::string &textureName, const glm::vec2 &texcoordMin, const glm::vec2 &texcoordMax)
+{
+	auto existing = mEntryIndices.find(textureName);
+	if (existing != mEntryIndices.end())
+	{
+		Entry &entry = mEntries[existing->second];
+		entry.texcoordMin = glm::min(entry.texcoordMin, texcoordMin);
+		entry.texcoordMax = glm::max(entry.texcoordMax, texcoordMax);
+		return;
+	}
+
+	Entry entry = {};
+	entry.textureName = textureName;
+	entry.texcoordMin = texcoordMin;
+	entry.texcoordMax = texcoordMax;
+	mEntryIndices[textureName] = (U32)mEntries.size();
+	mEntries.push_back(entry);
+}
+
+bool TextureAtlas::build(U32 maxSize)
+{
+	if (mSurface)
+	{
+		SDL_FreeSurface(mSurface);
+		mSurface = nullptr;
+	}
+
+	std::vector<SDL_Surface*> surfaces(mEntries.size());
+	std::vector<U32> order(mEntries.size());
+	U64 paddedArea = 0;
+	S32 widest = 1;
+	for (U32 i = 0; i < mEntries.size(); i++)
+	{
+		Entry &entry = mEntries[i];
+		SDL_Surface *pImageSurface = IMG_Load(entry.textureName.c_str());
+		assert(pImageSurface != nullptr);
+		surfaces[i] = SDL_ConvertSurfaceFormat(pImageSurface, SDL_PIXELFORMAT_ABGR8888, 0);
+		SDL_FreeSurface(pImageSurface);
+
+		entry.width = surfaces[i]->w;
+		entry.height = surfaces[i]->h;
+		const glm::vec2 size((float)entry.width, (float)entry.height);
+		const glm::vec2 below = glm::ceil(glm::max(-entry.texcoordMin, 0.f) * size);
+		const glm::vec2 above = glm::ceil(glm::max(entry.texcoordMax - 1.f, 0.f) * size);
+		entry.gutterMin[0] = (S32)below.x + kFilterMargin;
+		entry.gutterMin[1] = (S32)below.y + kFilterMargin;
+		entry.gutterMax[0] = (S32)above.x + kFilterMargin;
+		entry.gutterMax[1] = (S32)above.y + kFilterMargin;
+
+		const S32 paddedWidth = entry.gutterMin[0] + entry.width + entry.gutterMax[0];
+		const S32 paddedHeight = entry.gutterMin[1] + entry.height + entry.gutterMax[1];
+		paddedArea += (U64)paddedWidth * paddedHeight;
+		widest = std::max(widest, paddedWidth);
+		order[i] = i;
+	}
+
+	//shelf packing, tallest first, widening the atlas until the shelves fit under maxSize
+	std::sort(order.begin(), order.end(), [this](U32 a, U32 b) {
+		return mEntries[a].gutterMin[1] + mEntries[a].height + mEntries[a].gutterMax[1] >
+			mEntries[b].gutterMin[1] + mEntries[b].height + mEntries[b].gutterMax[1];
+	});
+	S32 atlasWidth = 1;
+	while (atlasWidth < widest || (U64)atlasWidth * atlasWidth < paddedArea)
+	{
+		atlasWidth *= 2;
+	}
+	S32 atlasHeight = 0;
+	for (; atlasWidth <= (S32)maxSize; atlasWidth *= 2)
+	{
+		S32 shelfX = 0;
+		S32 shelfY = 0;
+		S32 shelfHeight = 0;
+		for (U32 index : order)
+		{
+			Entry &entry = mEntries[index];
+			const S32 paddedWidth = entry.gutterMin[0] + entry.width + entry.gutterMax[0];
+			const S32 paddedHeight = entry.gutterMin[1] + entry.height + entry.gutterMax[1];
+			if (shelfX + paddedWidth > atlasWidth)
+			{
+				shelfY += shelfHeight;
+				shelfX = 0;
+				shelfHeight = 0;
+			}
+			entry.x = shelfX + entry.gutterMin[0];
+			entry.y = shelfY + entry.gutterMin[1];
+			shelfX += paddedWidth;
+			shelfHeight = std::max(shelfHeight, paddedHeight);
+		}
+		atlasHeight = shelfY + shelfHeight;
+		if (atlasHeight <= (S32)maxSize)
+		{
+			break;
+		}
+	}
+
+	if (atlasWidth <= (S32)maxSize)
+	{
+		mSurface = SDL_CreateRGBSurfaceWithFormat(0, atlasWidth, atlasHeight, 32, SDL_PIXELFORMAT_ABGR8888);
+		SDL_FillRect(mSurface, nullptr, 0);
+		for (U32 i = 0; i < mEntries.size(); i++)
+		{
+			//the gutters repeat the texture, the same as REPEAT addressing would
+			const Entry &entry = mEntries[i];
+			const SDL_Surface *pSource = surfaces[i];
+			for (S32 y = -entry.gutterMin[1]; y < entry.height + entry.gutterMax[1]; y++)
+			{
+				const U32 *pSourceRow = (const U32*)((const U8*)pSource->pixels + wrapTexel(y, entry.height) * pSource->pitch);
+				U32 *pAtlasRow = (U32*)((U8*)mSurface->pixels + (entry.y + y) * mSurface->pitch);
+				for (S32 x = -entry.gutterMin[0]; x < entry.width + entry.gutterMax[0]; x++)
+				{
+					pAtlasRow[entry.x + x] = pSourceRow[wrapTexel(x, entry.width)];
+				}
+			}
+		}
+	}
+
+	for (SDL_Surface *pSurface : surfaces)
+	{
+		SDL_FreeSurface(pSurface);
+	}
+	return mSurface != nullptr;
+}
+
+bool TextureAtlas::contains(const std::string &textureName) const
+{
+	return mEntryIndices.find(textureName) != mEntryIndices.end();
+}
+
+glm::vec4 TextureAtlas::getTexcoordTransform(const std::string &textureName) const
+{
+	assert(mSurface != nullptr);
+	const Entry &entry = mEntries[mEntryIndices.at(textureName)];
+	const float atlasWidth = (float)mSurface->w;
+	const float atlasHeight = (float)mSurface->h;
+	return glm::vec4(entry.width / atlasWidth, entry.height / atlasHeight, entry.x / atlasWidth, entry.y / atlasHeight);
+}
\ No newline at end of file
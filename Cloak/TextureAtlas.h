@@ -0,0 +1,48 @@
+#pragma once
+
+#include "stdafx.h"
+
+//Packs several textures into one RGBA image at load time, so a mesh with several materials can be drawn
+//with one. Textures keep whatever size they have; each is surrounded by a gutter of its own wrapped texels
+//wide enough to cover the texcoord range registered for it, so texcoords that stray outside [0, 1] and
+//bilinear filtering at the edges still read what they would have from the original texture.
+class TextureAtlas
+{
+public:
+	//The name is what the packed texture is registered and looked up under
+	explicit TextureAtlas(const std::string &name);
+	~TextureAtlas();
+
+	//Grows the texcoord range the atlas has to reproduce for textureName
+	void addTexture(const std::string &textureName, const glm::vec2 &texcoordMin, const glm::vec2 &texcoordMax);
+	//Loads and packs every texture added so far. False if they don't fit in maxSize x maxSize.
+	bool build(U32 maxSize);
+
+	bool contains(const std::string &textureName) const;
+	//texcoord * xy + zw maps a texcoord of textureName into the atlas
+	glm::vec4 getTexcoordTransform(const std::string &textureName) const;
+
+	const std::string& getName() const { return mName; }
+	//ABGR8888, null until built
+	SDL_Surface* getSurface() const { return mSurface; }
+	U32 getTextureCount() const { return (U32)mEntries.size(); }
+
+private:
+	struct Entry
+	{
+		std::string textureName;
+		glm::vec2 texcoordMin;
+		glm::vec2 texcoordMax;
+		S32 width;
+		S32 height;
+		S32 gutterMin[2]; //left, top
+		S32 gutterMax[2]; //right, bottom
+		S32 x; //where texcoord (0, 0) lands in the atlas
+		S32 y;
+	};
+
+	std::string mName;
+	std::vector<Entry> mEntries;
+	std::unordered_map<std::string, U32> mEntryIndices;
+	SDL_Surface *mSurface;
+};
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(U32 workerCount) : mTask(nullptr), mTaskCount(0), mNextTask(0), mActiveWorkers(0), mGeneration(0), mShutdown(false)
+{
+	if (workerCount == 0)
+	{
+		U32 hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+	for (U32 i = 0; i < workerCount; i++)
+	{
+		mWorkers.push_back(std::thread(&ThreadPool::workerMain, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mShutdown = true;
+	}
+	mWorkAvailable.notify_all();
+	for (std::thread &worker : mWorkers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::parallelFor(U32 taskCount, const std::function<void(U32)> &task)
+{
+	if (taskCount == 0)
+	{
+		return;
+	}
+	if (mWorkers.empty() || taskCount == 1)
+	{
+		for (U32 i = 0; i < taskCount; i++)
+		{
+			task(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTask = &task;
+		mTaskCount = taskCount;
+		mNextTask = 0;
+		mActiveWorkers = (U32)mWorkers.size();
+		mGeneration++;
+	}
+	mWorkAvailable.notify_all();
+
+	runTasks();
+
+	//task lives on our stack, so every worker has to be done with it before we return
+	std::unique_lock<std::mutex> lock(mMutex);
+	mWorkFinished.wait(lock, [this] { return mActiveWorkers == 0; });
+	mTask = nullptr;
+}
+
+void ThreadPool::workerMain()
+{
+	U64 lastGeneration = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWorkAvailable.wait(lock, [this, lastGeneration] { return mShutdown || mGeneration != lastGeneration; });
+			if (mShutdown)
+			{
+				return;
+			}
+			lastGeneration = mGeneration;
+		}
+
+		runTasks();
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mActiveWorkers--;
+		}
+		mWorkFinished.notify_one();
+	}
+}
+
+void ThreadPool::runTasks()
+{
+	for (U32 i = mNextTask++; i < mTaskCount; i = mNextTask++)
+	{
+		(*mTask)(i);
+	}
+}
\ No newline at end of file
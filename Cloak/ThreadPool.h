@@ -0,0 +1,36 @@
+#pragma once
+
+#include "stdafx.h"
+
+//Fixed set of worker threads for fanning a loop out across cores. The calling thread
+//helps out, so a pool with no workers just runs everything inline.
+class ThreadPool
+{
+public:
+	//0 picks one worker per hardware thread, minus the caller's
+	explicit ThreadPool(U32 workerCount = 0);
+	~ThreadPool();
+
+	//Runs task(i) for every i in [0, taskCount) and returns once they've all finished.
+	//Tasks are handed out one at a time, so keep them coarse.
+	void parallelFor(U32 taskCount, const std::function<void(U32)> &task);
+
+	//workers plus the calling thread
+	U32 getThreadCount() const { return (U32)mWorkers.size() + 1; }
+
+private:
+	void workerMain();
+	void runTasks();
+
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mWorkAvailable;
+	std::condition_variable mWorkFinished;
+
+	const std::function<void(U32)> *mTask;
+	U32 mTaskCount;
+	std::atomic<U32> mNextTask;
+	U32 mActiveWorkers;
+	U64 mGeneration; //bumped for every parallelFor so sleeping workers know there's a new batch
+	bool mShutdown;
+};
\ No newline at end of file
@@ -153,11 +153,13 @@ struct SceneConstantBuffer
 	glm::mat4 projectionMatrix;
 	glm::vec4 lightDirection;
 	glm::vec4 lightColor;
+	glm::vec4 time; //x = seconds since startup
 };
 
 struct ObjectConstantBuffer
 {
 	glm::mat4 modelMatrix;
+	glm::vec4 animationParams; //baked animations only: x = time offset, y = frame rate, z = frame count, w = bone count
 };
 
 struct AnimationConstantBuffer
@@ -1,7 +1,7 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 0) uniform SceneConstantBuffer
+layout(set = 0, binding = 0) uniform SceneConstantBuffer
 {
 	mat4 viewMatrix;
 	mat4 projectionMatrix;
@@ -9,12 +9,12 @@ layout(binding = 0) uniform SceneConstantBuffer
 	vec4 lightColor;
 } sceneConstantBuffer;
 
-layout(binding = 1) uniform PerObjectConstantBuffer
+layout(set = 2, binding = 0) uniform PerObjectConstantBuffer
 {
 	mat4 modelMatrix;
 } perObjectCB;
 
-layout(binding = 2) uniform AnimationConstantBuffer
+layout(set = 2, binding = 1) uniform AnimationConstantBuffer
 {
 	mat4 boneMatrices[256];
 } animationCB;
@@ -0,0 +1,70 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 0, binding = 0) uniform SceneConstantBuffer
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	vec4 lightDirection;
+	vec4 lightColor;
+	vec4 time;
+} sceneConstantBuffer;
+
+layout(set = 2, binding = 0) uniform PerObjectConstantBuffer
+{
+	mat4 modelMatrix;
+	vec4 animationParams;
+} perObjectCB;
+
+//Top three rows of each bone matrix, the bottom row is always (0, 0, 0, 1)
+layout(set = 2, binding = 1) uniform AnimationConstantBuffer
+{
+	vec4 boneRows[768];
+} animationCB;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexcoord;
+layout(location = 3) in vec4 inBoneWeights;
+layout(location = 4) in uvec4 inBoneIndices;
+
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec2 fragTexcoord;
+
+//This is a hack so I don't have to make another constant buffer in the pixel shader right now. Remove ASAP.
+layout(location = 2) out vec4 fragLightDirection;
+layout(location = 3) out vec4 fragLightColor;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+void main()
+{
+	//blend the rows first so each vertex only does one 3x4 transform
+	uvec4 base = inBoneIndices * 3;
+	vec4 row0 = animationCB.boneRows[base.x] * inBoneWeights.x;
+	vec4 row1 = animationCB.boneRows[base.x + 1] * inBoneWeights.x;
+	vec4 row2 = animationCB.boneRows[base.x + 2] * inBoneWeights.x;
+	row0 += animationCB.boneRows[base.y] * inBoneWeights.y;
+	row1 += animationCB.boneRows[base.y + 1] * inBoneWeights.y;
+	row2 += animationCB.boneRows[base.y + 2] * inBoneWeights.y;
+	row0 += animationCB.boneRows[base.z] * inBoneWeights.z;
+	row1 += animationCB.boneRows[base.z + 1] * inBoneWeights.z;
+	row2 += animationCB.boneRows[base.z + 2] * inBoneWeights.z;
+	row0 += animationCB.boneRows[base.w] * inBoneWeights.w;
+	row1 += animationCB.boneRows[base.w + 1] * inBoneWeights.w;
+	row2 += animationCB.boneRows[base.w + 2] * inBoneWeights.w;
+
+	vec4 position = vec4(inPosition, 1.0);
+	vec4 skinnedPosition = vec4(dot(row0, position), dot(row1, position), dot(row2, position), 1.0);
+	vec4 skinnedNormal = vec4(dot(row0.xyz, inNormal), dot(row1.xyz, inNormal), dot(row2.xyz, inNormal), 0);
+
+	gl_Position = sceneConstantBuffer.projectionMatrix * sceneConstantBuffer.viewMatrix * perObjectCB.modelMatrix * skinnedPosition;
+	fragNormal = normalize(skinnedNormal).xyz;
+	fragTexcoord = inTexcoord;
+
+	fragLightDirection = sceneConstantBuffer.lightDirection;
+	fragLightColor = sceneConstantBuffer.lightColor;
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 0, binding = 0) uniform SceneConstantBuffer
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	vec4 lightDirection;
+	vec4 lightColor;
+	vec4 time;
+} sceneConstantBuffer;
+
+layout(set = 2, binding = 0) uniform PerObjectConstantBuffer
+{
+	mat4 modelMatrix;
+	vec4 animationParams; //x = time offset, y = frame rate, z = frame count, w = bone count
+} perObjectCB;
+
+//Skinning palettes for every frame of the clip, frame-major
+layout(std430, set = 2, binding = 1) readonly buffer BakedAnimationBuffer
+{
+	mat4 palettes[];
+} bakedAnimation;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexcoord;
+layout(location = 3) in vec4 inBoneWeights;
+layout(location = 4) in uvec4 inBoneIndices;
+
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec2 fragTexcoord;
+
+//This is a hack so I don't have to make another constant buffer in the pixel shader right now. Remove ASAP.
+layout(location = 2) out vec4 fragLightDirection;
+layout(location = 3) out vec4 fragLightColor;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+mat4 blendPalettes(uint base0, uint base1, uint bone, float blend)
+{
+	return bakedAnimation.palettes[base0 + bone] * (1.0 - blend) + bakedAnimation.palettes[base1 + bone] * blend;
+}
+
+void main()
+{
+	uint frameCount = uint(perObjectCB.animationParams.z);
+	uint boneCount = uint(perObjectCB.animationParams.w);
+
+	float frameNum = (sceneConstantBuffer.time.x + perObjectCB.animationParams.x) * perObjectCB.animationParams.y;
+	uint frame0 = uint(floor(frameNum)) % frameCount;
+	uint frame1 = (frame0 + 1) % frameCount;
+	float blend = fract(frameNum);
+
+	uint base0 = frame0 * boneCount;
+	uint base1 = frame1 * boneCount;
+	mat4 skinMatrix = blendPalettes(base0, base1, inBoneIndices.x, blend) * inBoneWeights.x;
+	skinMatrix += blendPalettes(base0, base1, inBoneIndices.y, blend) * inBoneWeights.y;
+	skinMatrix += blendPalettes(base0, base1, inBoneIndices.z, blend) * inBoneWeights.z;
+	skinMatrix += blendPalettes(base0, base1, inBoneIndices.w, blend) * inBoneWeights.w;
+
+	vec4 skinnedPosition = skinMatrix * vec4(inPosition, 1.0);
+	vec4 skinnedNormal = skinMatrix * vec4(inNormal, 0);
+
+	gl_Position = sceneConstantBuffer.projectionMatrix * sceneConstantBuffer.viewMatrix * perObjectCB.modelMatrix * skinnedPosition;
+	fragNormal = normalize(skinnedNormal).xyz;
+	fragTexcoord = inTexcoord;
+
+	fragLightDirection = sceneConstantBuffer.lightDirection;
+	fragLightColor = sceneConstantBuffer.lightColor;
+}
\ No newline at end of file
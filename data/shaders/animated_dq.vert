@@ -0,0 +1,78 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 0, binding = 0) uniform SceneConstantBuffer
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	vec4 lightDirection;
+	vec4 lightColor;
+	vec4 time;
+} sceneConstantBuffer;
+
+layout(set = 2, binding = 0) uniform PerObjectConstantBuffer
+{
+	mat4 modelMatrix;
+	vec4 animationParams;
+} perObjectCB;
+
+//Unit dual quaternion per bone, real part then dual part, both stored as (x, y, z, w)
+layout(set = 2, binding = 1) uniform AnimationConstantBuffer
+{
+	vec4 dualQuaternions[512];
+} animationCB;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexcoord;
+layout(location = 3) in vec4 inBoneWeights;
+layout(location = 4) in uvec4 inBoneIndices;
+
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec2 fragTexcoord;
+
+//This is a hack so I don't have to make another constant buffer in the pixel shader right now. Remove ASAP.
+layout(location = 2) out vec4 fragLightDirection;
+layout(location = 3) out vec4 fragLightColor;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+void blendDualQuaternion(uint bone, float weight, vec4 pivot, inout vec4 real, inout vec4 dual)
+{
+	vec4 boneReal = animationCB.dualQuaternions[bone * 2];
+	vec4 boneDual = animationCB.dualQuaternions[bone * 2 + 1];
+	//q and -q are the same rotation, keep every bone in the pivot's hemisphere
+	weight *= dot(pivot, boneReal) < 0.0 ? -1.0 : 1.0;
+	real += boneReal * weight;
+	dual += boneDual * weight;
+}
+
+void main()
+{
+	vec4 pivot = animationCB.dualQuaternions[inBoneIndices.x * 2];
+	vec4 real = vec4(0);
+	vec4 dual = vec4(0);
+	blendDualQuaternion(inBoneIndices.x, inBoneWeights.x, pivot, real, dual);
+	blendDualQuaternion(inBoneIndices.y, inBoneWeights.y, pivot, real, dual);
+	blendDualQuaternion(inBoneIndices.z, inBoneWeights.z, pivot, real, dual);
+	blendDualQuaternion(inBoneIndices.w, inBoneWeights.w, pivot, real, dual);
+
+	float invLength = 1.0 / length(real);
+	real *= invLength;
+	dual *= invLength;
+
+	vec3 rotatedPosition = inPosition + 2.0 * cross(real.xyz, cross(real.xyz, inPosition) + real.w * inPosition);
+	vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+	vec4 skinnedPosition = vec4(rotatedPosition + translation, 1.0);
+	vec4 skinnedNormal = vec4(inNormal + 2.0 * cross(real.xyz, cross(real.xyz, inNormal) + real.w * inNormal), 0);
+
+	gl_Position = sceneConstantBuffer.projectionMatrix * sceneConstantBuffer.viewMatrix * perObjectCB.modelMatrix * skinnedPosition;
+	fragNormal = normalize(skinnedNormal).xyz;
+	fragTexcoord = inTexcoord;
+
+	fragLightDirection = sceneConstantBuffer.lightDirection;
+	fragLightColor = sceneConstantBuffer.lightColor;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#define MAX_BINDLESS_TEXTURES 1024 //kMaxBindlessTextures in GraphicsContext.cpp
+//glslangValidator's default limits only allow 80 combined image units, compile with:
+//glslangValidator -V bindless.frag bindless.conf -o bindless_frag.spv
+
+layout(set = 1, binding = 0) uniform sampler texSampler;
+layout(set = 1, binding = 1) uniform texture2D textures[MAX_BINDLESS_TEXTURES];
+
+//same for the whole draw, so plain dynamic indexing is enough
+layout(push_constant) uniform DrawConstants
+{
+	uint textureIndex;
+} drawConstants;
+
+//LightingPath in Shader.h
+layout(constant_id = 2) const uint kLightingPath = 0;
+const uint kLightingPathUnlit = 1;
+
+layout(location = 0) in vec3 fragNormal;
+layout(location = 1) in vec2 fragTexcoord;
+layout(location = 2) in vec4 fragLightDirection;
+layout(location = 3) in vec4 fragLightColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+	vec3 unlitColor = texture(sampler2D(textures[drawConstants.textureIndex], texSampler), fragTexcoord).xyz;
+	if (kLightingPath == kLightingPathUnlit)
+	{
+		outColor = vec4(unlitColor, 1.f);
+		return;
+	}
+	float diffuseIntensity = dot(normalize(fragNormal).xyz, -normalize(fragLightDirection).xyz);
+	vec3 diffuseLighting = unlitColor * fragLightColor.xyz * diffuseIntensity;
+	vec3 ambientLighting = unlitColor * fragLightColor.w;
+	outColor = vec4(diffuseLighting + ambientLighting, 1.f);
+}
\ No newline at end of file
@@ -0,0 +1,97 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform SceneConstantBuffer
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	vec4 lightDirection;
+	vec4 lightColor;
+	vec4 time;
+} sceneConstantBuffer;
+
+struct Instance
+{
+	mat4 modelMatrix;
+	vec4 boundsMin;
+	vec4 boundsMax;
+	uint paletteOffset;
+	uint padding0;
+	uint padding1;
+	uint padding2;
+};
+
+layout(std430, binding = 1) readonly buffer InstanceBuffer
+{
+	Instance instances[];
+};
+
+struct DrawRecord
+{
+	uint instanceIndex;
+	uint indexCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint textureIndex;
+	uint padding0;
+	uint padding1;
+	uint padding2;
+};
+
+layout(std430, binding = 2) readonly buffer DrawRecordBuffer
+{
+	DrawRecord records[];
+};
+
+//every instance's palette back to back, paletteOffset is in matrices
+layout(std430, binding = 3) readonly buffer PaletteBuffer
+{
+	mat4 boneMatrices[];
+};
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexcoord;
+layout(location = 3) in vec4 inBoneWeights;
+layout(location = 4) in uvec4 inBoneIndices;
+
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec2 fragTexcoord;
+
+//This is a hack so I don't have to make another constant buffer in the pixel shader right now. Remove ASAP.
+layout(location = 2) out vec4 fragLightDirection;
+layout(location = 3) out vec4 fragLightColor;
+layout(location = 4) flat out uint fragTextureIndex;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+void main()
+{
+	//firstInstance is the draw record index, see gpu_cull.comp
+	DrawRecord record = records[gl_InstanceIndex];
+	Instance instance = instances[record.instanceIndex];
+	uvec4 bones = inBoneIndices + uvec4(instance.paletteOffset);
+
+	vec4 position = vec4(inPosition, 1.0);
+	vec4 skinnedPosition = (boneMatrices[bones.x] * position) * inBoneWeights.x;
+	skinnedPosition += (boneMatrices[bones.y] * position) * inBoneWeights.y;
+	skinnedPosition += (boneMatrices[bones.z] * position) * inBoneWeights.z;
+	skinnedPosition += (boneMatrices[bones.w] * position) * inBoneWeights.w;
+
+	vec4 normal = vec4(inNormal, 0);
+	vec4 skinnedNormal = (boneMatrices[bones.x] * normal) * inBoneWeights.x;
+	skinnedNormal += (boneMatrices[bones.y] * normal) * inBoneWeights.y;
+	skinnedNormal += (boneMatrices[bones.z] * normal) * inBoneWeights.z;
+	skinnedNormal += (boneMatrices[bones.w] * normal) * inBoneWeights.w;
+
+	gl_Position = sceneConstantBuffer.projectionMatrix * sceneConstantBuffer.viewMatrix * instance.modelMatrix * skinnedPosition;
+	fragNormal = normalize(skinnedNormal).xyz;
+	fragTexcoord = inTexcoord;
+	fragTextureIndex = record.textureIndex;
+
+	fragLightDirection = sceneConstantBuffer.lightDirection;
+	fragLightColor = sceneConstantBuffer.lightColor;
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+//Specialized per mesh instead of hand-writing a copy for every combination, see ShaderConstant in Shader.h
+layout(constant_id = 0) const uint kWeightsPerVertex = 4; //has to cover every influence the mesh's vertices actually use
+layout(constant_id = 1) const uint kPaletteFormat = 0; //PaletteFormat
+
+//AnimationConstantBuffer in geometry.h, a spec constant can't resize a uniform block so this stays fixed
+const uint kMaxBones = 256;
+
+const uint kPaletteFormatMatrix4x4 = 0;
+const uint kPaletteFormatAffine3x4 = 1;
+const uint kPaletteFormatDualQuaternion = 2;
+
+layout(set = 0, binding = 0) uniform SceneConstantBuffer
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	vec4 lightDirection;
+	vec4 lightColor;
+	vec4 time;
+} sceneConstantBuffer;
+
+layout(set = 2, binding = 0) uniform PerObjectConstantBuffer
+{
+	mat4 modelMatrix;
+	vec4 animationParams;
+} perObjectCB;
+
+//Packed by SkinningPalette::pack, 4, 3 or 2 vec4s per bone depending on the format.
+//Sized for the largest stride and read as one flat run of vec4s.
+layout(set = 2, binding = 1) uniform AnimationConstantBuffer
+{
+	vec4 palette[kMaxBones][4];
+} animationCB;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexcoord;
+layout(location = 3) in vec4 inBoneWeights;
+layout(location = 4) in uvec4 inBoneIndices;
+
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec2 fragTexcoord;
+
+//This is a hack so I don't have to make another constant buffer in the pixel shader right now. Remove ASAP.
+layout(location = 2) out vec4 fragLightDirection;
+layout(location = 3) out vec4 fragLightColor;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+vec4 paletteVector(uint index)
+{
+	return animationCB.palette[index >> 2][index & 3u];
+}
+
+void skinMatrix(out vec4 skinnedPosition, out vec4 skinnedNormal)
+{
+	mat4 skin = mat4(0.0);
+	for (uint i = 0; i < kWeightsPerVertex; i++)
+	{
+		uint base = inBoneIndices[i] * 4;
+		skin += mat4(paletteVector(base), paletteVector(base + 1), paletteVector(base + 2), paletteVector(base + 3)) * inBoneWeights[i];
+	}
+	skinnedPosition = skin * vec4(inPosition, 1.0);
+	skinnedNormal = skin * vec4(inNormal, 0.0);
+}
+
+void skinAffine(out vec4 skinnedPosition, out vec4 skinnedNormal)
+{
+	//blend the rows first so each vertex only does one 3x4 transform
+	vec4 row0 = vec4(0.0);
+	vec4 row1 = vec4(0.0);
+	vec4 row2 = vec4(0.0);
+	for (uint i = 0; i < kWeightsPerVertex; i++)
+	{
+		uint base = inBoneIndices[i] * 3;
+		row0 += paletteVector(base) * inBoneWeights[i];
+		row1 += paletteVector(base + 1) * inBoneWeights[i];
+		row2 += paletteVector(base + 2) * inBoneWeights[i];
+	}
+	vec4 position = vec4(inPosition, 1.0);
+	skinnedPosition = vec4(dot(row0, position), dot(row1, position), dot(row2, position), 1.0);
+	skinnedNormal = vec4(dot(row0.xyz, inNormal), dot(row1.xyz, inNormal), dot(row2.xyz, inNormal), 0.0);
+}
+
+void skinDualQuaternion(out vec4 skinnedPosition, out vec4 skinnedNormal)
+{
+	vec4 pivot = paletteVector(inBoneIndices.x * 2);
+	vec4 real = vec4(0.0);
+	vec4 dual = vec4(0.0);
+	for (uint i = 0; i < kWeightsPerVertex; i++)
+	{
+		vec4 boneReal = paletteVector(inBoneIndices[i] * 2);
+		vec4 boneDual = paletteVector(inBoneIndices[i] * 2 + 1);
+		//q and -q are the same rotation, keep every bone in the pivot's hemisphere
+		float weight = dot(pivot, boneReal) < 0.0 ? -inBoneWeights[i] : inBoneWeights[i];
+		real += boneReal * weight;
+		dual += boneDual * weight;
+	}
+
+	float invLength = 1.0 / length(real);
+	real *= invLength;
+	dual *= invLength;
+
+	vec3 rotatedPosition = inPosition + 2.0 * cross(real.xyz, cross(real.xyz, inPosition) + real.w * inPosition);
+	vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+	skinnedPosition = vec4(rotatedPosition + translation, 1.0);
+	skinnedNormal = vec4(inNormal + 2.0 * cross(real.xyz, cross(real.xyz, inNormal) + real.w * inNormal), 0.0);
+}
+
+void main()
+{
+	//the format is fixed when the pipeline is built, so only one of these survives
+	vec4 skinnedPosition;
+	vec4 skinnedNormal;
+	if (kPaletteFormat == kPaletteFormatDualQuaternion)
+	{
+		skinDualQuaternion(skinnedPosition, skinnedNormal);
+	}
+	else if (kPaletteFormat == kPaletteFormatAffine3x4)
+	{
+		skinAffine(skinnedPosition, skinnedNormal);
+	}
+	else
+	{
+		skinMatrix(skinnedPosition, skinnedNormal);
+	}
+
+	gl_Position = sceneConstantBuffer.projectionMatrix * sceneConstantBuffer.viewMatrix * perObjectCB.modelMatrix * skinnedPosition;
+	fragNormal = normalize(skinnedNormal).xyz;
+	fragTexcoord = inTexcoord;
+
+	fragLightDirection = sceneConstantBuffer.lightDirection;
+	fragLightColor = sceneConstantBuffer.lightColor;
+}
\ No newline at end of file
@@ -1,7 +1,11 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 3) uniform sampler2D texSampler;
+layout(set = 1, binding = 0) uniform sampler2D texSampler;
+
+//LightingPath in Shader.h
+layout(constant_id = 2) const uint kLightingPath = 0;
+const uint kLightingPathUnlit = 1;
 
 layout(location = 0) in vec3 fragNormal;
 layout(location = 1) in vec2 fragTexcoord;
@@ -13,6 +17,11 @@ layout(location = 0) out vec4 outColor;
 void main()
 {
 	vec3 unlitColor = texture(texSampler, fragTexcoord).xyz;
+	if (kLightingPath == kLightingPathUnlit)
+	{
+		outColor = vec4(unlitColor, 1.f);
+		return;
+	}
 	float diffuseIntensity = dot(normalize(fragNormal).xyz, -normalize(fragLightDirection).xyz);
 	vec3 diffuseLighting = unlitColor * fragLightColor.xyz * diffuseIntensity;
 	vec3 ambientLighting = unlitColor * fragLightColor.w;